@@ -0,0 +1,53 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLAKE3_OUT_LEN      32
+#define BLAKE3_BLOCK_LEN    64
+#define BLAKE3_CHUNK_LEN    1024
+/* Enough chaining values for 2^54 chunks, the maximum input size */
+#define BLAKE3_MAX_DEPTH    54
+
+typedef struct {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t  block[BLAKE3_BLOCK_LEN];
+    uint8_t  block_len;
+    uint8_t  blocks_compressed;
+} blake3_chunk_state_t;
+
+
+/**
+ * @brief State of a BLAKE3 hash being computed, in the default (unkeyed) hashing mode.
+ */
+typedef struct {
+    blake3_chunk_state_t chunk;
+    uint32_t cv_stack[BLAKE3_MAX_DEPTH][8];
+    uint8_t  cv_stack_len;
+} blake3_hasher_t;
+
+
+void blake3_hasher_init(blake3_hasher_t* hasher);
+
+
+/**
+ * @brief Add data to the hash, can be called any number of times.
+ */
+void blake3_hasher_update(blake3_hasher_t* hasher, const void* data, size_t len);
+
+
+/**
+ * @brief Get the hash of all the data added so far. The hasher is not modified, more data can still be added.
+ *
+ * @param out Filled with the BLAKE3_OUT_LEN bytes of the hash.
+ */
+void blake3_hasher_finalize(const blake3_hasher_t* hasher, uint8_t out[BLAKE3_OUT_LEN]);
+
+#endif // BLAKE3_H
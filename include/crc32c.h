@@ -0,0 +1,24 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Update a CRC32C (Castagnoli) checksum with the given data. The CPU instructions are used
+ *        when the host supports them (SSE4.2 on x86, CRC extension on ARMv8), a table is used otherwise.
+ *
+ * @param crc Checksum of the data that precedes, 0 for the first block.
+ * @param data Data to add to the checksum.
+ * @param len Size of the data in bytes.
+ *
+ * @return The new checksum, so that crc32c(crc32c(0, a), b) is the checksum of a followed by b.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif // CRC32C_H
@@ -24,6 +24,8 @@
 #define DISK_LABEL_LEN      512
 #define MAX_PART_COUNT      4
 #define DISK_SECTOR_SIZE    512UL
+/* Allocation unit (erase block) assumed for the media that don't report theirs, common for SD cards */
+#define DISK_DEFAULT_AU_SIZE    (4*MB)
 
 #define MBR_PART_ENTRY_SIZE     16
 #define MBR_PART_ENTRY_BEGIN    0x1BE
@@ -45,15 +47,41 @@ typedef struct {
     uint8_t* data;
     /* We will write at most 64KB*3, 32-bit is more than enough*/
     uint32_t data_len;
+    /* Number of zeros to write right after the data, to clear the rest of the file system metadata */
+    uint32_t zeros_len;
+    /* Also clear the rest of the partition, by discarding it or by writing zeros */
+    bool     erase;
 } partition_t;
 
 
+/* Maximum number of buffers a single system call of `disk_readv` or `disk_writev` gets */
+#define DISK_WRITEV_MAX     64
+
+/**
+ * @brief Buffer to write, see `disk_writev`.
+ */
+typedef struct {
+    const void* base;
+    size_t      len;
+} disk_iovec_t;
+
+/**
+ * @brief Buffer to fill, see `disk_readv`.
+ */
+typedef struct {
+    void*  base;
+    size_t len;
+} disk_read_iovec_t;
+
+
 typedef struct {
     char        name[256];
     char        path[256];
     char        label[DISK_LABEL_LEN];
 
     uint64_t    size_bytes;
+    /* Allocation unit (erase block) reported by the media, 0 if unknown */
+    uint32_t    au_size;
     bool        valid;
     bool        is_image;
     /* Original MBR */
@@ -122,6 +150,14 @@ disk_list_state_t* disk_get_state(void);
 
 disk_err_t disks_refresh(void);
 
+/**
+ * @brief Apply the pending hotplug events to the disks list.
+ *
+ * Unlike `disks_refresh`, only the disks that were plugged, unplugged or changed are
+ * updated, loaded images and staged changes on other disks are kept untouched.
+ */
+void disks_hotplug_update(void);
+
 void disk_apply_changes(disk_info_t* disk);
 
 void disk_revert_changes(disk_info_t* disk);
@@ -140,6 +176,13 @@ void disk_allocate_partition(disk_info_t *disk, uint32_t lba, uint32_t sectors_c
 
 const char* disk_format_partition(disk_info_t* disk, int partition);
 
+/**
+ * @brief Format a partition with the given page size instead of the one picked from its size.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_format_partition_page_size(disk_info_t* disk, int partition, int page_size);
+
 void disk_delete_partition(disk_info_t* disk, int partition);
 
 uint64_t disk_max_partition_size(disk_info_t *disk, uint32_t align, uint64_t *largest_free_addr);
@@ -148,8 +191,37 @@ const char* disk_get_fs_type(uint8_t fs_byte);
 
 void disk_get_size_str(uint64_t size, char* buffer, int buffer_size);
 
+/**
+ * @brief Write the staged MBR and partitions to the disk in a single ordered pass: contiguous ranges,
+ *        such as a header followed by the zeros of the FAT, are written with a single vectored write.
+ *
+ * @return NULL on success, error message on failure.
+ */
 const char* disk_write_changes(disk_info_t* disk);
 
+/**
+ * @brief Clear the rest of the partitions formatted from now on, in addition to their metadata.
+ */
+void disk_format_set_erase(bool erase);
+
+bool disk_format_erase(void);
+
+/**
+ * @brief Discard the unused ranges of block devices: the pages freed in ZealFS partitions and the
+ *        rest of the partitions being formatted. Image files always get their unused ranges released.
+ */
+void disk_trim_set_enabled(bool enabled);
+
+bool disk_trim_enabled(void);
+
+/**
+ * @brief Get the allocation unit (erase block) of a disk: writes are aligned on it, coalesced and
+ *        never cross it, new partitions start on it by default.
+ *
+ * @return The size reported by the media, DISK_DEFAULT_AU_SIZE if it is unknown.
+ */
+uint32_t disk_au_size(const disk_info_t* disk);
+
 /**
  * @brief Prompts the user to choose a disk image file to add to the disk list.
  *
@@ -162,13 +234,15 @@ const char* disk_write_changes(disk_info_t* disk);
  */
 int disk_open_image_file(disk_list_state_t* state);
 
-int disk_create_image(disk_list_state_t* state, const char* path, uint64_t size, bool init_mbr);
+int disk_create_image(disk_list_state_t* state, const char* path, uint64_t size, bool init_mbr, bool sparse);
 
 
 /**
  * ============================================================================
- *                              OS SPECIFIC CODE
+ *                              MEDIA ACCESS
  * ============================================================================
+ * These functions go through the simulated media when one is configured, see `disk_sim.h`,
+ * else they call their OS specific implementation directly.
  */
 /**
  * Opens a disk partition for reading and writing files to ZealFS partitions.
@@ -194,6 +268,19 @@ int disk_open(disk_info_t* disk, void** ret_fd);
  */
 ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len);
 
+/**
+ * Reads contiguous bytes of the disk into several buffers, in order, with as few system calls as possible.
+ *
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ * @param iov The buffers to fill, one after the other.
+ * @param count The number of buffers.
+ * @param disk_offset The offset on the disk of the first byte to read.
+ *        Guaranteed to be aligned on DISK_SECTOR_SIZE.
+ * @return The total number of bytes read on success, or a negative value indicating an error.
+ *         Logs errors if any occur.
+ */
+ssize_t disk_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset);
+
 /**
  * Writes data to a disk partition at a specified offset.
  *
@@ -207,6 +294,19 @@ ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len);
  */
 ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len);
 
+/**
+ * Writes several buffers to contiguous bytes of the disk, in order, with as few system calls as possible.
+ *
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ * @param iov The buffers to write, one after the other.
+ * @param count The number of buffers.
+ * @param disk_offset The offset on the disk where the first buffer is written.
+ *        Guaranteed to be aligned on DISK_SECTOR_SIZE.
+ * @return The total number of bytes written on success, or a negative value indicating an error.
+ *         Logs errors if any occur.
+ */
+ssize_t disk_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset);
+
 /**
  * Closes the disk partition and releases any associated resources.
  *
@@ -216,6 +316,63 @@ ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_
  */
 void disk_close(void* disk_fd);
 
+/**
+ * Tells the OS that a range of the disk does not hold any data anymore so that the blocks behind
+ * it can be released: holes are punched in image files, the range is discarded (TRIM) on block
+ * devices. The range of an image file reads back as zeros afterwards, the content of a discarded
+ * range of a device is undefined.
+ *
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ * @param disk_offset The offset of the range on the disk.
+ * @param len The number of bytes to discard.
+ * @return 0 on success, or a negative value if the range could not be discarded, which is not
+ *         an error since the data is not needed anymore.
+ */
+int disk_discard(void* disk_fd, off_t disk_offset, uint64_t len);
+
+/**
+ * Makes sure the data written to a range reached the media and drops the range from the OS cache,
+ * so that the next reads of the range come from the media itself.
+ *
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ * @param disk_offset The offset of the range on the disk.
+ * @param len The number of bytes of the range.
+ * @return 0 on success, or a negative value if the data could not be flushed.
+ *         Logs errors if any occur.
+ */
+int disk_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len);
+
+
+/**
+ * ============================================================================
+ *                              OS SPECIFIC CODE
+ * ============================================================================
+ */
+/**
+ * Implementations of the media access functions, they don't know about the simulated media.
+ */
+int disk_os_open(disk_info_t* disk, void** ret_fd);
+ssize_t disk_os_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len);
+ssize_t disk_os_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset);
+ssize_t disk_os_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len);
+ssize_t disk_os_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset);
+void disk_os_close(void* disk_fd);
+int disk_os_discard(void* disk_fd, off_t disk_offset, uint64_t len);
+int disk_os_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len);
+
+/**
+ * Sets the size of a newly created image file.
+ *
+ * @param file The image file, opened for writing.
+ * @param size The size of the image in bytes.
+ * @param sparse When true, the blocks are only allocated by the OS once they are written to,
+ *               else, they are all reserved now so that the image is not fragmented later.
+ * @return 0 on success, or a negative value indicating an error.
+ *         Logs errors if any occur.
+ */
+int disk_set_image_size(FILE* file, uint64_t size, bool sparse);
+
+
 
 /**
  * OPTIONAL OS FEATURES
@@ -245,4 +402,46 @@ void disk_update_progress_bar(int percent);
  */
 void disk_destroy_progress_bar(void);
 
+
+typedef enum {
+    DISK_HOTPLUG_ADD,
+    DISK_HOTPLUG_CHANGE,
+    DISK_HOTPLUG_REMOVE,
+} disk_hotplug_action_t;
+
+
+typedef struct {
+    disk_hotplug_action_t action;
+    /* Probed disk for ADD and CHANGE events, only the `path` is valid for REMOVE events */
+    disk_info_t           disk;
+} disk_hotplug_event_t;
+
+
+/**
+ * @brief Start listening for disks being plugged or unplugged.
+ *
+ * @return 0 on success, non-zero if the OS does not support hotplug detection. In that case,
+ *         the disks list can still be refreshed manually.
+ */
+int disk_hotplug_init(void);
+
+/**
+ * @brief Get the next pending hotplug event, if any. This function must not block.
+ *
+ * @param event Event to fill with the action and the probed disk.
+ *
+ * @return 1 if `event` was filled, 0 if there is no pending event.
+ */
+int disk_hotplug_poll(disk_hotplug_event_t* event);
+
+/**
+ * @brief Block until a hotplug event is pending, without consuming it.
+ *        Meant to be called from a thread other than the one calling `disk_hotplug_poll`.
+ *
+ * @param timeout_ms Maximum time to wait, in milliseconds, -1 to wait forever.
+ *
+ * @return 1 if an event is pending, 0 on timeout, negative value if hotplug is not supported.
+ */
+int disk_hotplug_wait(int timeout_ms);
+
 #endif // DISK_H
@@ -0,0 +1,143 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_ANALYZER_H
+#define DISK_ANALYZER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "disk.h"
+#include "zealfs_v2.h"
+
+#define ANALYZER_PATH_LEN       512
+/* Free runs are counted by power of two: bucket `i` holds the runs of 2^i to 2^(i+1)-1 pages */
+#define ANALYZER_RUN_BUCKETS    17
+
+
+typedef struct {
+    char     name[NAME_MAX_LEN + 1];
+    /* Index of the directory containing the file */
+    int      dir;
+    uint32_t size;
+    uint32_t pages;
+    uint32_t extents;
+} disk_analyzer_file_t;
+
+
+typedef struct {
+    char     path[ANALYZER_PATH_LEN];
+    /* Index of the parent directory, -1 for the root */
+    int      parent;
+    /* Directories that were removed stay in the array until the next full scan */
+    bool     valid;
+    /* Size of the files directly in this directory */
+    uint64_t bytes;
+    /* Size of the files in this directory and all its sub-directories */
+    uint64_t total_bytes;
+    uint32_t files;
+} disk_analyzer_dir_t;
+
+
+typedef struct {
+    disk_analyzer_dir_t*  dirs;
+    int                   dirs_count;
+    int                   dirs_capacity;
+    disk_analyzer_file_t* files;
+    int                   files_count;
+    int                   files_capacity;
+    uint32_t page_size;
+    uint32_t free_pages;
+    uint32_t free_runs[ANALYZER_RUN_BUCKETS];
+    uint32_t largest_free_run;
+    /* Summary of the fragmentation of all the files */
+    uint32_t fragmented_files;
+    uint32_t extents;
+    uint32_t pages;
+    /* Percentage of the pages that don't follow the previous page of their file */
+    uint32_t score;
+} disk_analyzer_result_t;
+
+
+/**
+ * @brief Analyzer of a ZealFS partition. The first scan runs in the background, through its own
+ * descriptor, the changes made afterwards are applied incrementally from the caller's context.
+ * All the functions must be called from the same thread.
+ */
+typedef struct {
+    disk_info_t     disk;
+    partition_t     partition;
+    bool            started;
+    /* Set when the file system changed while the scan was running, the scan must be done again */
+    bool            dirty;
+    bool            valid;
+    pthread_t       thread;
+    atomic_bool     running;
+    /* Set to make the background scan give up, its partial result is discarded */
+    atomic_bool     cancel;
+    int             scan_error;
+    /* Only accessed by the background thread while it is running */
+    disk_analyzer_result_t scan;
+    /* Latest result, only accessed by the caller */
+    disk_analyzer_result_t result;
+} disk_analyzer_t;
+
+
+/**
+ * @brief Start scanning a ZealFS partition in the background, any former scan is stopped first.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_analyzer_start(disk_analyzer_t* analyzer, disk_info_t* disk, partition_t* partition);
+
+
+/**
+ * @brief Check whether the background scan is over and collect its result. Must be called
+ *        regularly, for example once per frame.
+ *
+ * @return true if a result is available in `analyzer->result`.
+ */
+bool disk_analyzer_poll(disk_analyzer_t* analyzer);
+
+
+/**
+ * @brief Update the result after the content of a directory changed: only that directory is
+ *        read again, the free space is computed from the cached bitmap of the context.
+ *
+ * @param ctx The context the change was made with, its header and FAT must be up to date.
+ * @param path Path of the directory that changed.
+ */
+void disk_analyzer_update_dir(disk_analyzer_t* analyzer, zealfs_context_t* ctx, const char* path);
+
+
+/**
+ * @brief Scan the whole partition again, after a change that can affect any file.
+ */
+void disk_analyzer_invalidate(disk_analyzer_t* analyzer);
+
+
+/**
+ * @brief Find the analysis of a directory.
+ *
+ * @return The directory, NULL if it is unknown.
+ */
+const disk_analyzer_dir_t* disk_analyzer_find_dir(disk_analyzer_t* analyzer, const char* path);
+
+
+/**
+ * @brief Find the analysis of a file, given the path of its directory and its name.
+ *
+ * @return The file, NULL if it is unknown.
+ */
+const disk_analyzer_file_t* disk_analyzer_find_file(disk_analyzer_t* analyzer, const char* dir_path, const char* name);
+
+
+/**
+ * @brief Cancel the background scan, wait for it to give up and release all the results.
+ */
+void disk_analyzer_stop(disk_analyzer_t* analyzer);
+
+#endif // DISK_ANALYZER_H
@@ -0,0 +1,119 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_CLONE_H
+#define DISK_CLONE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "disk.h"
+#include "disk_image.h"
+#include "disk_verify.h"
+
+/* Size of the chunks read from the source and shared by all the writers */
+#define CLONE_CHUNK_SIZE    (1*MB)
+/* Number of chunks that can be in flight, the slowest target can lag behind by this many chunks */
+#define CLONE_SLOTS_COUNT   16
+
+typedef enum {
+    CLONE_TARGET_WRITING,
+    CLONE_TARGET_VERIFYING,
+    CLONE_TARGET_DONE,
+    CLONE_TARGET_FAILED,
+} disk_clone_state_t;
+
+
+typedef struct {
+    /* Copy of the target disk, the disks list may change while cloning */
+    disk_info_t disk;
+    void*       fd;
+    pthread_t   thread;
+    struct disk_clone_t* clone;
+    /* Checksums of the chunks written, read back once all of them are written */
+    disk_verify_t verify;
+    /* Progress, can be read from any thread */
+    atomic_uint_fast64_t written_bytes;
+    atomic_int  state;
+    /* Only valid once the state is CLONE_TARGET_FAILED */
+    char        error[128];
+} disk_clone_target_t;
+
+
+typedef struct {
+    uint8_t* data;
+    uint64_t offset;
+    uint32_t len;
+    /* Number of targets that still have to write this chunk */
+    int      pending_writers;
+} disk_clone_slot_t;
+
+
+/**
+ * @brief Duplicate the used regions of a source disk to several targets at once. A single reader
+ * thread reads the source once, each target has its own writer thread, so all the targets are written
+ * concurrently.
+ */
+typedef struct disk_clone_t {
+    disk_info_t     source;
+    void*           source_fd;
+    bool            verify;
+    disk_region_t*  regions;
+    int             regions_count;
+    uint64_t        total_bytes;
+    int             targets_count;
+    disk_clone_target_t targets[MAX_DISKS];
+
+    /* Chunks shared between the reader and the writers, protected by the mutex */
+    disk_clone_slot_t slots[CLONE_SLOTS_COUNT];
+    uint64_t        chunks_read;
+    bool            read_done;
+    bool            read_failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t  chunk_ready;
+    pthread_cond_t  slot_free;
+    pthread_t       reader;
+    /* Number of threads still running */
+    atomic_int      running;
+    atomic_bool     cancel;
+} disk_clone_t;
+
+
+/**
+ * @brief Start duplicating a disk to the given targets, in the background.
+ *
+ * @param clone Clone job to initialize, must stay valid until `disk_clone_finish` is called.
+ * @param source Disk to duplicate, must not have any staged changes.
+ * @param targets Disks to write, they must be at least as big as the source.
+ * @param count Number of targets.
+ * @param verify Once a target is written, read it back from the media and compare its checksums.
+ *
+ * @return NULL on success, error message on failure, in which case no thread was started.
+ */
+const char* disk_clone_start(disk_clone_t* clone, disk_info_t* source, disk_info_t** targets, int count, bool verify);
+
+
+/**
+ * @brief Check whether the clone job still has threads running.
+ */
+bool disk_clone_running(disk_clone_t* clone);
+
+
+/**
+ * @brief Stop reading the source, the targets that were not done are marked as failed.
+ */
+void disk_clone_cancel(disk_clone_t* clone);
+
+
+/**
+ * @brief Wait for the clone job to finish, release its resources and parse the partitions of the
+ * targets again, in the disks list. The state of each target stays available afterwards.
+ *
+ * @return Number of targets that failed.
+ */
+int disk_clone_finish(disk_clone_t* clone);
+
+#endif // DISK_CLONE_H
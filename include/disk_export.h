@@ -0,0 +1,46 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_EXPORT_H
+#define DISK_EXPORT_H
+
+#include <stdint.h>
+#include "disk.h"
+
+/* Maximum number of threads extracting the files */
+#define EXPORT_MAX_THREADS      8
+/* Size of the reads done by each thread, contiguous pages of a file are read at once */
+#define EXPORT_READ_SIZE        (1*MB)
+
+typedef struct {
+    int      files;
+    int      directories;
+    /* Number of threads that extracted the files */
+    int      threads;
+    uint64_t bytes_written;
+    /* Entries not extracted because their name can't be used on the host, or their path is too long */
+    int      skipped;
+} disk_export_stats_t;
+
+
+/**
+ * @brief Extract a ZealFS directory, recursively, to a directory of the host. The files are extracted
+ *        in parallel, the biggest ones first, each thread reads the disk through its own descriptor,
+ *        so the reads of a thread overlap with the writes to the host of the others.
+ *
+ * @param disk The disk containing the partition, the data still buffered for it must have been written.
+ * @param part The ZealFS partition to read.
+ * @param fs_dir Absolute path of the ZealFS directory to extract, without any trailing `/`, except for the root.
+ * @param host_dir Path of the host directory receiving the content of `fs_dir`, created if it doesn't exist.
+ *                 Existing files are replaced, entries named `.`, `..` or containing a path separator
+ *                 are skipped so that nothing is written outside of it.
+ * @param stats Filled with the number of entries and bytes extracted.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_export_dir(disk_info_t* disk, partition_t* part, const char* fs_dir,
+                            const char* host_dir, disk_export_stats_t* stats);
+
+#endif // DISK_EXPORT_H
@@ -0,0 +1,59 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_IMAGE_H
+#define DISK_IMAGE_H
+
+#include <stdint.h>
+#include "disk.h"
+
+/**
+ * @brief Range of a disk that holds data, in bytes, always aligned on DISK_SECTOR_SIZE.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} disk_region_t;
+
+
+/**
+ * @brief List the regions of a disk that hold data: the MBR, the metadata and the allocated pages
+ * of each ZealFS partition, and the whole content of any other partition since its file system
+ * is unknown. Adjacent regions are merged.
+ *
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ * @param disk The disk to browse, its partitions must have been parsed.
+ * @param regions Filled with an allocated array of regions sorted by offset, must be freed by the caller.
+ * @param used_bytes When not NULL, filled with the total size of the regions.
+ *
+ * @return Number of regions on success, negative value on error.
+ */
+int disk_image_used_regions(void* disk_fd, disk_info_t* disk, disk_region_t** regions, uint64_t* used_bytes);
+
+
+/**
+ * @brief Dump the used regions of a disk into a sparse image file of the same size.
+ *        The rest of the image reads as zeros.
+ *
+ * @param disk The disk to dump, must not have any staged changes.
+ * @param path Path of the image file to create.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_image_dump(disk_info_t* disk, const char* path);
+
+
+/**
+ * @brief Write the used regions of an image file back to a disk. The regions that are not used
+ *        in the image are left untouched on the disk.
+ *
+ * @param disk The disk to restore, must not have any staged changes and must be at least as big as the image.
+ * @param path Path of the image file to restore.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_image_restore(disk_info_t* disk, const char* path);
+
+#endif // DISK_IMAGE_H
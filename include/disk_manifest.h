@@ -0,0 +1,29 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_MANIFEST_H
+#define DISK_MANIFEST_H
+
+#include "disk.h"
+
+/* Maximum number of threads hashing the files */
+#define MANIFEST_MAX_THREADS    8
+/* Size of the reads done by each thread, contiguous pages of a file are read at once */
+#define MANIFEST_READ_SIZE      (1*MB)
+
+/**
+ * @brief Hash every file of a ZealFS partition with BLAKE3 and write a manifest listing the path,
+ *        size, date and hash of each of them. The files are hashed in parallel, each thread reads
+ *        the disk through its own descriptor.
+ *
+ * @param disk The disk containing the partition, must not have any staged changes.
+ * @param partition Index of the ZealFS partition to browse.
+ * @param path Path of the manifest file to create.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_manifest_export(disk_info_t* disk, int partition, const char* path);
+
+#endif // DISK_MANIFEST_H
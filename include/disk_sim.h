@@ -0,0 +1,93 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_SIM_H
+#define DISK_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of allocation units a simulated controller can keep open */
+#define DISK_SIM_MAX_OPEN_AUS   8
+
+
+/**
+ * @brief Behavior of a simulated media. Image files and loop devices opened while a profile is
+ * configured are slowed down as if they were on such media, to measure the I/O features without
+ * real cards.
+ */
+typedef struct {
+    const char* name;
+    /* Fixed cost of each operation, in microseconds */
+    uint32_t latency_us;
+    /* Transfer speeds, in KB/s */
+    uint32_t read_kbps;
+    uint32_t write_kbps;
+    /* Writing to an allocation unit that is not open costs a penalty, the controller keeps
+     * `open_aus` units open and closes the least recently opened one */
+    uint32_t au_size;
+    uint32_t au_penalty_us;
+    int      open_aus;
+    /* One operation out of `fail_rate` fails, 0 to never fail */
+    uint32_t fail_rate;
+} disk_sim_profile_t;
+
+
+/**
+ * @brief Operations done on a simulated media, printed when it is closed.
+ */
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t written_bytes;
+    uint64_t au_penalties;
+    uint64_t failures;
+    /* Total time spent waiting for the simulated media */
+    uint64_t delay_us;
+} disk_sim_stats_t;
+
+
+/**
+ * @brief Configure the simulated media from a specification: a profile name, optionally followed
+ *        by comma-separated overrides, for example `usb-reader,fail=1000,au=8192`. The overrides are
+ *        `latency` (us), `read` and `write` (KB/s), `au` (KB), `penalty` (us), `open` and `fail`.
+ *        Must be called before any disk is opened.
+ *
+ * @param spec The specification, NULL to disable the simulation.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_sim_configure(const char* spec);
+
+
+/**
+ * @brief Get the profile of the simulated media.
+ *
+ * @return The profile, NULL if the media are not simulated.
+ */
+const disk_sim_profile_t* disk_sim_profile(void);
+
+
+/**
+ * @brief Get the names of the predefined profiles.
+ */
+const char* const* disk_sim_profile_names(int* count);
+
+
+/**
+ * @brief Get the statistics of a disk opened with `disk_open`.
+ *
+ * @return true if the disk is simulated and `stats` was filled.
+ */
+bool disk_sim_stats(void* disk_fd, disk_sim_stats_t* stats);
+
+
+/**
+ * @brief Get the sum of the statistics of all the simulated disks closed so far, from any thread.
+ */
+void disk_sim_total_stats(disk_sim_stats_t* stats);
+
+#endif // DISK_SIM_H
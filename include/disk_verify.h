@@ -0,0 +1,94 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_VERIFY_H
+#define DISK_VERIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+
+/* Size of the chunks read back from the disk during verification */
+#define VERIFY_CHUNK_SIZE   (1*MB)
+
+/**
+ * @brief Range written to a disk, along with the checksum of the data written.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc;
+} disk_verify_range_t;
+
+
+/**
+ * @brief Ranges to read back from a disk once they have all been written.
+ */
+typedef struct {
+    disk_verify_range_t* ranges;
+    int      count;
+    int      capacity;
+    uint64_t total_bytes;
+} disk_verify_t;
+
+
+/**
+ * @brief Enable or disable the verification of the changes written to the disks.
+ */
+void disk_verify_set_enabled(bool enabled);
+
+
+/**
+ * @brief Check whether the changes written to the disks have to be verified.
+ */
+bool disk_verify_enabled(void);
+
+
+void disk_verify_init(disk_verify_t* verify);
+
+
+/**
+ * @brief Record data written to a disk. The checksum is computed right away, so the data
+ *        doesn't need to be kept. The ranges recorded must not overlap.
+ *
+ * @param verify The list of ranges to add the data to.
+ * @param offset The offset of the data on the disk.
+ * @param data The data written.
+ * @param len The size of the data in bytes.
+ *
+ * @return 0 on success, negative value if the range could not be recorded.
+ */
+int disk_verify_add(disk_verify_t* verify, uint64_t offset, const void* data, uint64_t len);
+
+
+/**
+ * @brief Record the staged MBR and partitions of a disk, must be called before writing them.
+ *
+ * @return 0 on success, negative value on error.
+ */
+int disk_verify_add_changes(disk_verify_t* verify, disk_info_t* disk);
+
+
+/**
+ * @brief Read back all the recorded ranges from the media, bypassing the OS cache, and compare their
+ *        checksums. The reads are done in the background while the previous chunk is being checked.
+ *
+ * @param verify The list of ranges to verify.
+ * @param disk_fd The abstract file descriptor of the disk, obtained from disk_open.
+ *
+ * @return NULL on success, error message on failure.
+ */
+const char* disk_verify_run(disk_verify_t* verify, void* disk_fd);
+
+
+/**
+ * @brief Open the disk and verify the recorded ranges, see `disk_verify_run`.
+ */
+const char* disk_verify_run_disk(disk_verify_t* verify, disk_info_t* disk);
+
+
+void disk_verify_free(disk_verify_t* verify);
+
+#endif // DISK_VERIFY_H
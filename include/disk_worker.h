@@ -0,0 +1,76 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_WORKER_H
+#define DISK_WORKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "disk.h"
+#include "zealfs_v2.h"
+
+
+/**
+ * @brief Reads a ZealFS partition through its own disk descriptor and its own ZealFS context, so that
+ * several workers, or a worker and the partition viewer, can read the same disk at the same time.
+ */
+typedef struct disk_worker_t {
+    void*             disk_fd;
+    uint64_t          partition_offset;
+    zealfs_context_t* zealfs;
+    /* Buffer of the size given when initializing the worker, NULL if none was requested */
+    uint8_t*          buffer;
+    /* Work shared by all the workers of a pool */
+    void*             job;
+    /* Set for the worker run by the thread that started the pool, the only one allowed to update the UI */
+    bool              main_thread;
+    pthread_t         thread;
+    void            (*routine)(struct disk_worker_t* worker);
+} disk_worker_t;
+
+
+/**
+ * @brief Open the disk and create the ZealFS context of a worker. The worker can be deinitialized
+ *        even if this function fails.
+ *
+ * @param buffer_size Size of the buffer to allocate for the worker, 0 for none.
+ * @param job Work shared by the workers, see `disk_worker_t`.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int disk_worker_init(disk_worker_t* worker, disk_info_t* disk, const partition_t* part, size_t buffer_size, void* job);
+
+
+/**
+ * @brief Close the disk descriptor of a worker and release its context and its buffer.
+ */
+void disk_worker_deinit(disk_worker_t* worker);
+
+
+/**
+ * @brief Get the number of workers to run for the given number of jobs, one per core by default.
+ *
+ * @param jobs Number of jobs to share, no more workers than jobs are run.
+ * @param min_workers Minimum number of workers, even on hosts with fewer cores.
+ * @param max_workers Maximum number of workers.
+ */
+int disk_workers_count(int jobs, int min_workers, int max_workers);
+
+
+/**
+ * @brief Run a routine in several workers at once. The first worker must already be initialized, it
+ *        runs in the calling thread, the others are initialized like it and get their own thread.
+ *        The routine is responsible for sharing the work between the workers, through their job.
+ *
+ * @param count Number of workers to run, `workers` must have as many entries. Fewer workers run
+ *              if some of them can't be initialized or started.
+ *
+ * @return Number of workers initialized, including the first one, they must all be deinitialized.
+ */
+int disk_workers_run(disk_worker_t* workers, int count, disk_info_t* disk, const partition_t* part,
+                     size_t buffer_size, void (*routine)(disk_worker_t* worker));
+
+#endif // DISK_WORKER_H
@@ -0,0 +1,73 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "disk.h"
+
+/* Maximum size of the data gathered before being written, even if the allocation unit is bigger */
+#define DISK_WRITER_MAX_SIZE    (4*MB)
+
+
+/**
+ * @brief Gathers consecutive writes to a disk so that they reach it as a single write, which never
+ * crosses an allocation unit (erase block) of the media. Flash media program a whole allocation
+ * unit at once, so writing each of them once, in order, is much faster than many small writes.
+ */
+typedef struct {
+    void*    disk_fd;
+    uint32_t au_size;
+    uint8_t* buffer;
+    uint32_t capacity;
+    /* Offset on the disk of the first byte of the buffer and number of bytes gathered */
+    uint64_t offset;
+    uint32_t len;
+    /* Statistics */
+    uint32_t writes;
+    uint64_t bytes;
+} disk_writer_t;
+
+
+/**
+ * @brief Prepare a writer for an opened disk.
+ *
+ * @param au_size Size of the allocation unit of the media, power of two, see `disk_au_size`.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int disk_writer_init(disk_writer_t* writer, void* disk_fd, uint32_t au_size);
+
+
+/**
+ * @brief Write data to the disk, it may only be gathered in the writer for now. The data must
+ *        be flushed before reading the same range, or before the disk is accessed through
+ *        another descriptor.
+ *
+ * @return The number of bytes written or gathered, negative value on error, which may come
+ *         from a former write.
+ */
+ssize_t disk_writer_write(disk_writer_t* writer, const void* data, uint64_t offset, uint32_t len);
+
+
+/**
+ * @brief Write the gathered data to the disk.
+ *
+ * @return 0 on success, negative value on error.
+ */
+int disk_writer_flush(disk_writer_t* writer);
+
+
+/**
+ * @brief Flush the writer and release its buffer.
+ *
+ * @return 0 on success, negative value if the last data could not be written.
+ */
+int disk_writer_free(disk_writer_t* writer);
+
+#endif // DISK_WRITER_H
@@ -0,0 +1,19 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "disk.h"
+#include "raylib-nuklear.h"
+
+/**
+ * @brief Open the popup to duplicate the given disk to other disks
+ */
+void ui_clone_open(disk_info_t* disk);
+
+/**
+ * @brief Render the duplication popup, if opened, and monitor the background job
+ */
+void ui_clone_show(struct nk_context *ctx, disk_list_state_t* state);
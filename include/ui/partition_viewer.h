@@ -12,8 +12,22 @@
 
 int ui_partition_viewer(struct nk_context *ctx, disk_info_t* disk, int partition_idx, struct nk_rect bounds);
 
+/**
+ * @brief Close the opened partition and all the partitions kept opened in the background, their
+ *        pending writes are flushed. Must be called before the partitions of a disk are rewritten.
+ */
 void ui_partition_viewer_clear(struct nk_context *ctx);
 
 int ui_partition_viewer_get_partition_usage_percentage(uint64_t* free_bytes, uint64_t* total_bytes);
 
+/**
+ * @brief Check the file system of the opened partition and offer to repair it when errors are found.
+ */
+void ui_partition_viewer_check(struct nk_context *ctx);
+
+/**
+ * @brief Defragment the file system of the opened partition and report the fragmentation before and after.
+ */
+void ui_partition_viewer_defrag(struct nk_context *ctx);
+
 #endif // PART_VIEW_H
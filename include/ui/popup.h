@@ -9,7 +9,7 @@
 #include <stdint.h>
 #include "raylib-nuklear.h"
 
-#define POPUP_COUNT    5
+#define POPUP_COUNT    7
 
 typedef enum {
     POPUP_MBR     = 0,
@@ -17,6 +17,8 @@ typedef enum {
     POPUP_APPLY   = 2,
     POPUP_CANCEL  = 3,
     POPUP_NEWIMG  = 4,
+    POPUP_CLONE   = 5,
+    POPUP_COPY    = 6,
 } popup_t;
 
 
@@ -0,0 +1,40 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @brief Initialize the render loop policy. The UI is only rendered when an input event occurs,
+ * when a redraw is requested or while some background work is in progress.
+ *
+ * @param hotplug True if the disks hotplug detection is active, events will then wake up the loop.
+ */
+void ui_redraw_init(bool hotplug);
+
+/**
+ * @brief Must be called at the beginning of each frame, before `UpdateNuklear`.
+ */
+void ui_redraw_begin_frame(void);
+
+/**
+ * @brief Must be called at the end of each frame, before `EndDrawing`, which is where raylib
+ * waits for the next event when the UI is idle.
+ */
+void ui_redraw_end_frame(void);
+
+/**
+ * @brief Wake up the render loop to render at least one more frame. Can be called from any thread.
+ */
+void ui_redraw_request(void);
+
+/**
+ * @brief Keep rendering continuously until the matching `ui_redraw_busy_end`, for example while
+ * a progress bar is shown. Calls can be nested and made from any thread.
+ */
+void ui_redraw_busy_begin(void);
+
+void ui_redraw_busy_end(void);
@@ -0,0 +1,63 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_ADVISOR_H
+#define ZEALFS_ADVISOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zealfs_v2.h"
+
+/* Number of page sizes ZealFS supports, from 256 bytes to 64KB */
+#define ZEALFS_ADVISOR_SIZES    9
+
+typedef struct {
+    int      page_size;
+    /* The partition can be formatted with this page size */
+    bool     valid;
+    /* All the sample files fit in the partition */
+    bool     fits;
+    uint32_t pages_count;
+    uint32_t data_pages;
+    /* Header, FAT and directories pages */
+    uint32_t metadata_pages;
+    /* Bytes allocated to the files but not used, at the end of their last page */
+    uint64_t slack_bytes;
+    uint64_t metadata_bytes;
+    /* Page reads needed to open and read every file once */
+    uint64_t read_ops;
+} zealfs_page_advice_t;
+
+
+typedef struct {
+    uint32_t files;
+    uint32_t dirs;
+    uint64_t bytes;
+    /* Host entries that cannot be stored in ZealFS, for example because their name is too long,
+     * and symbolic links */
+    uint32_t skipped;
+    zealfs_page_advice_t sizes[ZEALFS_ADVISOR_SIZES];
+    /* Index of the recommended page size in `sizes`, -1 if the sample doesn't fit with any of them */
+    int      best;
+} zealfs_advice_t;
+
+
+/**
+ * @brief Simulate the allocation of a sample of host files with each page size, on a freshly
+ *        formatted partition, and recommend the page size to use.
+ *
+ * The recommended page size is the one with the lowest cost, where the cost is the percentage of
+ * the partition wasted (slack and metadata) plus a tenth of the percentage of read operations
+ * added compared to the page size that needs the fewest.
+ *
+ * @param host_dir Directory of the host containing the sample files, browsed recursively.
+ * @param partition_size Size of the partition to format, in bytes.
+ * @param advice Filled with the result of the simulation for each page size.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int zealfs_advise_page_size(const char* host_dir, uint64_t partition_size, zealfs_advice_t* advice);
+
+#endif // ZEALFS_ADVISOR_H
@@ -0,0 +1,94 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_CACHE_H
+#define ZEALFS_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zealfs_v2.h"
+
+#define ZEALFS_CACHE_PATH_LEN   512
+/* Maximum size of the directories kept in a cache */
+#define ZEALFS_CACHE_MAX_SIZE   (4*MB)
+
+
+typedef struct {
+    uint32_t addr;
+    uint32_t len;
+    uint8_t* data;
+} zealfs_cache_range_t;
+
+
+/**
+ * @brief Metadata of a ZealFS partition of an image file, saved on the host next to the image so
+ * that reopening the partition doesn't need to read the FAT and the directories again.
+ * The cache is only used if the image has the same size and modification time as when the cache
+ * was saved, and if its ZealFS header has the same checksum.
+ */
+typedef struct {
+    char     image_path[ZEALFS_CACHE_PATH_LEN];
+    char     path[ZEALFS_CACHE_PATH_LEN];
+    uint32_t start_lba;
+    /* Snapshots of the directory entries read or written */
+    zealfs_cache_range_t* ranges;
+    int      count;
+    int      capacity;
+    uint32_t bytes;
+    bool     active;
+    bool     hit;
+} zealfs_cache_t;
+
+
+/**
+ * @brief Enable or disable the metadata cache of the images.
+ */
+void zealfs_cache_set_enabled(bool enabled);
+
+bool zealfs_cache_enabled(void);
+
+
+/**
+ * @brief Start caching the metadata of a partition of an image. If a valid cache exists on the
+ *        host, the header and the FAT of the context are filled from it, and its directories
+ *        will be served by `zealfs_cache_read`.
+ *
+ * @param ctx The context of the partition, its header must not be loaded yet.
+ * @param image_path Path of the image file on the host.
+ * @param start_lba First sector of the partition in the image.
+ *
+ * @return true if the cache was valid and loaded.
+ */
+bool zealfs_cache_open(zealfs_cache_t* cache, zealfs_context_t* ctx, const char* image_path, uint32_t start_lba);
+
+
+/**
+ * @brief Get directory entries from the cache.
+ *
+ * @return true if the whole range was in the cache and copied to `buffer`.
+ */
+bool zealfs_cache_read(zealfs_cache_t* cache, void* buffer, uint32_t addr, size_t len);
+
+
+/**
+ * @brief Keep directory entries that were read from the disk.
+ */
+void zealfs_cache_add(zealfs_cache_t* cache, const void* buffer, uint32_t addr, size_t len);
+
+
+/**
+ * @brief Update the cached directories with data written to the partition.
+ */
+void zealfs_cache_update(zealfs_cache_t* cache, const void* buffer, uint32_t addr, size_t len);
+
+
+/**
+ * @brief Save the cache on the host and release it. All the writes to the image must be done.
+ *
+ * @param ctx The context of the partition, nothing is saved if its header is not loaded.
+ */
+void zealfs_cache_close(zealfs_cache_t* cache, zealfs_context_t* ctx);
+
+#endif // ZEALFS_CACHE_H
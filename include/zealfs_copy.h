@@ -0,0 +1,38 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_COPY_H
+#define ZEALFS_COPY_H
+
+#include <stdint.h>
+#include "zealfs_v2.h"
+
+typedef struct {
+    int      files;
+    int      directories;
+    uint64_t bytes_copied;
+} zealfs_copy_stats_t;
+
+
+/**
+ * @brief Copy a file or a directory, recursively, from a ZealFS partition to another one, or to
+ *        another directory of the same partition. The data don't go through the host: the source
+ *        is read in big chunks, each made of whole extents, by a thread while the former chunk is
+ *        written to the destination. The copies keep the date of their source.
+ *        Directories that already exist in the destination are merged, files are not replaced.
+ *
+ * @param src Context of the source partition, only used by this function until it returns.
+ * @param src_dir Absolute path of the directory containing the entry to copy.
+ * @param entry Entry to copy, as returned when listing `src_dir`.
+ * @param dst Context of the destination partition, can be the same as `src`.
+ * @param dst_dir Absolute path of the destination directory, it must exist.
+ * @param stats Filled with the number of entries and bytes copied.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int zealfs_copy(zealfs_context_t* src, const char* src_dir, const zealfs_entry_t* entry,
+                zealfs_context_t* dst, const char* dst_dir, zealfs_copy_stats_t* stats);
+
+#endif // ZEALFS_COPY_H
@@ -0,0 +1,98 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_SESSION_H
+#define ZEALFS_SESSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "disk.h"
+#include "disk_writer.h"
+#include "zealfs_v2.h"
+#include "zealfs_cache.h"
+
+/* Maximum number of partitions kept opened at once, the least recently used one that isn't
+ * pinned is closed when another partition needs to be opened */
+#define ZEALFS_SESSIONS_MAX     4
+
+
+/**
+ * @brief An opened ZealFS partition: its own disk descriptor, write buffer, metadata cache and
+ * context. Sessions stay opened after the viewer switches to another partition, so that switching
+ * back, or copying between partitions, doesn't need to open the disk and read the metadata again.
+ */
+typedef struct {
+    bool     open;
+    /* Identity of the partition */
+    char     disk_path[256];
+    uint32_t start_lba;
+    uint32_t size_sectors;
+    bool     is_image;
+    /* Opened disk descriptor */
+    void*    disk_fd;
+    /* Gathers the consecutive writes, flushed before any read */
+    disk_writer_t writer;
+    /* Metadata of the partition saved on the host, only for images */
+    zealfs_cache_t cache;
+    zealfs_context_t* ctx;
+    /* Serializes the accesses to the disk descriptor, the writer and the cache, made by the context
+     * callbacks, so that the context can be used by several threads */
+    pthread_mutex_t lock;
+    /* Value of the use counter when the session was last returned by `zealfs_session_get` */
+    uint64_t last_use;
+    /* Number of users still holding the session, it is never closed to make room while pinned */
+    int      pins;
+} zealfs_session_t;
+
+
+/**
+ * @brief Get the session of a partition, open it if it isn't yet. When all the sessions are
+ *        used, the least recently used one that isn't pinned is closed. Any session returned
+ *        earlier and not pinned may be closed by this call, pin the sessions that must stay valid.
+ *
+ * @param error Filled with the reason of the failure, can be NULL.
+ *
+ * @return The session, NULL on failure or if all the sessions are pinned.
+ */
+zealfs_session_t* zealfs_session_get(disk_info_t* disk, const partition_t* part, const char** error);
+
+
+/**
+ * @brief Prevent `zealfs_session_get` from closing the session to open another partition.
+ *        Removing its disk still closes it, users must check `open` after such events.
+ */
+void zealfs_session_pin(zealfs_session_t* session);
+
+
+/**
+ * @brief Release a pin taken with `zealfs_session_pin`. Does nothing if the session was closed
+ *        in the meantime.
+ */
+void zealfs_session_unpin(zealfs_session_t* session);
+
+
+/**
+ * @brief Write everything the session still holds to the disk: the pages freed that weren't
+ *        discarded yet and the gathered writes. The session remains opened.
+ *
+ * @return 0 on success, negative value on error.
+ */
+int zealfs_session_flush(zealfs_session_t* session);
+
+
+/**
+ * @brief Close all the sessions opened on a disk, for example when it is removed or when its
+ *        partitions are about to be rewritten. The metadata cache of images is saved.
+ */
+void zealfs_session_close_disk(const char* disk_path);
+
+
+/**
+ * @brief Close all the opened sessions.
+ */
+void zealfs_session_close_all(void);
+
+#endif // ZEALFS_SESSION_H
@@ -0,0 +1,49 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_SYNC_H
+#define ZEALFS_SYNC_H
+
+#include <stdint.h>
+#include "zealfs_v2.h"
+
+/* Also compare the content of the files that have the same size and date */
+#define ZEALFS_SYNC_CONTENT     (1 << 0)
+/* Remove the files and directories that are not present in the host directory */
+#define ZEALFS_SYNC_DELETE      (1 << 1)
+
+typedef struct {
+    int      created;
+    int      updated;
+    int      deleted;
+    int      unchanged;
+    /* Host entries that were skipped, for example because their name is too long, or because
+     * they are symbolic links */
+    int      skipped;
+    /* Host entries that could not be written for lack of space */
+    int      failed;
+    uint64_t bytes_written;
+} zealfs_sync_stats_t;
+
+
+/**
+ * @brief Make a ZealFS directory match a directory of the host, recursively. Files that have the same
+ *        size and date on both sides are considered identical and are not written again. The files
+ *        written get the modification date of the host file. Symbolic links are skipped.
+ *        The entries that don't fit in the remaining space are counted as failed, the
+ *        synchronization continues with the next ones.
+ *
+ * @param ctx The context containing disk read/write functions.
+ * @param host_dir Path of the directory to copy, on the host.
+ * @param fs_dir Absolute path of the ZealFS directory to update, it must exist.
+ * @param flags Combination of ZEALFS_SYNC_CONTENT and ZEALFS_SYNC_DELETE.
+ * @param stats Filled with the number of entries processed.
+ *
+ * @return 0 on success, -ENOSPC if some entries didn't fit, or another negative error code if
+ *         the synchronization was interrupted. The statistics are filled in every case.
+ */
+int zealfs_sync(zealfs_context_t* ctx, const char* host_dir, const char* fs_dir, int flags, zealfs_sync_stats_t* stats);
+
+#endif // ZEALFS_SYNC_H
@@ -7,8 +7,11 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 
 #ifndef BIT
 #define BIT(X)  (1ULL << (X))
@@ -41,6 +44,16 @@
  */
 #define ZFS_HEADER_MAX_SIZE (8192 + sizeof(zealfs_entry_t))
 
+/**
+ * @brief The FAT has at most 65536 entries of 16 bits.
+ */
+#define ZFS_FAT_MAX_SIZE    (2 * 64*KB)
+
+/**
+ * @brief Maximum number of buffers given at once to the `readv` callback of a context.
+ */
+#define ZFS_READV_MAX   4
+
 /**
  * Helper that converts an 8-bit BCD value into a binary value.
  */
@@ -96,19 +109,94 @@ typedef struct {
 } __attribute__((packed)) zealfs_header_t;
 
 
+/**
+ * @brief Buffer to fill, see the `readv` callback of the context.
+ */
+typedef struct {
+    void*  base;
+    size_t len;
+} zealfs_iovec_t;
+
+
 typedef struct zealfs_context_t {
     ssize_t (*read) (void* arg, void* buffer, uint32_t addr, size_t len);
     ssize_t (*write)(void* arg, const void* buffer, uint32_t addr, size_t len);
+    /* Optional, used instead of `read` to read directory entries, so that they can be cached */
+    ssize_t (*read_dir)(void* arg, void* buffer, uint32_t addr, size_t len);
+    /* Optional, reads contiguous bytes into at most ZFS_READV_MAX buffers with a single operation,
+     * used to load the bitmap and the FAT together */
+    ssize_t (*readv)(void* arg, const zealfs_iovec_t* iov, int count, uint32_t addr);
+    /* Optional, called by `zealfs_discard_flush` with the ranges of the pages that were freed,
+     * their content can be dropped */
+    int     (*discard)(void* arg, uint32_t addr, size_t len);
     void* arg;
-    /* Cache for the header, filled on `opendir` on the root, MUST be populated */
-    uint8_t header[ZFS_HEADER_MAX_SIZE];
+    /* Metadata loaded from the partition on first use, sized to it and carved out of a single
+     * allocation starting at `header`, NULL when not loaded. Released by `zealfs_destroy` */
+    uint8_t* header;
     size_t header_size;
-    /* Cache for the FAT table, at most 64K entries */
-    uint16_t fat[64*KB];
+    /* FAT, `fat_size` bytes, one byte per page for 256-byte pages, else two */
+    uint16_t* fat;
     size_t fat_size;
+    /* Pages freed since the last `zealfs_discard_flush`, only allocated when `discard` is set */
+    uint8_t* discard_pending;
+    uint32_t discard_count;
+    /* Held by all the functions below taking a context: shared by the ones that only read the metadata,
+     * such as `zealfs_open`, `zealfs_read` or `zealfs_readdir`, exclusive for the ones modifying them.
+     * The callbacks are called with it held, so they must be thread-safe themselves to let several
+     * readers run at once */
+    pthread_rwlock_t lock;
 } zealfs_context_t;
 
 
+/**
+ * @brief Result of a file system check, each field counts a kind of inconsistency.
+ */
+typedef struct {
+    uint32_t files;
+    uint32_t directories;
+    /* Entries whose first page is invalid or already owned by another entry */
+    uint32_t bad_entries;
+    /* FAT entries pointing to the metadata or outside of the partition */
+    uint32_t bad_pointers;
+    /* Chains going back to one of their own pages */
+    uint32_t cycles;
+    /* Chains going through a page that belongs to another chain */
+    uint32_t cross_links;
+    /* Files whose chain is shorter or longer than their size */
+    uint32_t size_errors;
+    /* Pages marked as used in the bitmap but owned by no entry */
+    uint32_t lost_pages;
+    /* Pages owned by an entry but marked as free in the bitmap */
+    uint32_t unmarked_pages;
+    uint32_t expected_free_pages;
+    bool     free_pages_error;
+    /* Total number of problems found */
+    uint32_t errors;
+} zealfs_fsck_report_t;
+
+
+/**
+ * @brief Maximum size of the data moved at once when defragmenting.
+ */
+#define ZEALFS_DEFRAG_BATCH_SIZE    (256*KB)
+
+/**
+ * @brief Result of a defragmentation. The scores are in percent: the ratio of pages that don't
+ * follow the previous page of their file, 0 when all the files are contiguous.
+ */
+typedef struct {
+    uint32_t files;
+    uint32_t moved_files;
+    uint32_t moved_pages;
+    uint32_t fragmented_before;
+    uint32_t fragmented_after;
+    uint32_t extents_before;
+    uint32_t extents_after;
+    uint32_t score_before;
+    uint32_t score_after;
+} zealfs_defrag_report_t;
+
+
 /**
  * @brief Helper to get the recommended page size from a disk size.
  *
@@ -138,20 +226,48 @@ static inline int zealfsv2_page_size(long long part_size)
 
 
 /**
- * @brief Format the partition.
+ * @brief Check whether a page size can be used to format a partition: the pages must be addressable
+ *        by the FAT and the header, with its bitmap, must fit in the first page.
  *
- * @param partition Pointer to the partition data.
+ * @param part_size Size of the whole partition.
+ * @param page_size_bytes Size of the pages, power of two between 256 and 64KB.
+ *
+ * @return true if the partition can be formatted with this page size.
+ */
+static inline bool zealfsv2_page_size_valid(uint64_t part_size, int page_size_bytes)
+{
+    if (page_size_bytes < 256 || page_size_bytes > 64*KB || (page_size_bytes & (page_size_bytes - 1)) != 0) {
+        return false;
+    }
+    const uint64_t pages_count = part_size / page_size_bytes;
+    /* 256-byte pages have an 8-bit FAT, the others a 16-bit FAT */
+    const uint64_t max_pages = (page_size_bytes == 256) ? 256 : 65536;
+    /* The header, its bitmap and at least one root entry must fit in the first page */
+    const uint64_t header_size = (sizeof(zealfs_header_t) + (pages_count + 7) / 8 + sizeof(zealfs_entry_t) - 1) &
+                                 ~(sizeof(zealfs_entry_t) - 1);
+    /* Header page, FAT pages and at least one page for the data */
+    return pages_count >= 4 && pages_count <= max_pages &&
+           header_size + sizeof(zealfs_entry_t) <= (uint64_t) page_size_bytes;
+}
+
+
+/**
+ * @brief Format the partition with the given page size.
+ *
+ * @param partition Pointer to the partition data, it must be able to hold three pages.
  * @param size Size of the whole partition.
+ * @param page_size_bytes Size of the pages, it must be valid for the partition, see `zealfsv2_page_size_valid`.
  *
  * @return 0 on success, error else
  */
-static inline int zealfsv2_format(uint8_t* partition, uint64_t size) {
+static inline int zealfsv2_format_page_size(uint8_t* partition, uint64_t size, int page_size_bytes) {
+    if (!zealfsv2_page_size_valid(size, page_size_bytes)) {
+        return -1;
+    }
     /* Initialize image header */
     zealfs_header_t* header = (zealfs_header_t*) partition;
     header->magic = 'Z';
     header->version = 2;
-    /* According to the size of the disk, we have to calculate the size of the pages */
-    const int page_size_bytes = zealfsv2_page_size(size);
     /* The page size in the header is the log2(page_bytes/256) - 1 */
     header->page_size = ((sizeof(int) * 8) - (__builtin_clz(page_size_bytes >> 8))) - 1;
     /* Calculate the total number of pages in the partition, it mus tbe rounded down */
@@ -185,12 +301,39 @@ static inline int zealfsv2_format(uint8_t* partition, uint64_t size) {
     return 0;
 }
 
+
+/**
+ * @brief Format the partition, the page size is picked according to its size.
+ *
+ * @param partition Pointer to the partition data.
+ * @param size Size of the whole partition.
+ *
+ * @return 0 on success, error else
+ */
+static inline int zealfsv2_format(uint8_t* partition, uint64_t size) {
+    return zealfsv2_format_page_size(partition, size, zealfsv2_page_size(size));
+}
+
 typedef struct {
     zealfs_entry_t entry;
     uint32_t       entry_addr;
 } zealfs_fd_t;
 
 
+/**
+ * @brief Cursor over the entries of an opened directory. It keeps track of the page and the slot
+ * to read next, so the entries can be retrieved batch by batch without reading the former pages again.
+ */
+typedef struct {
+    uint32_t dir_addr;  /* Address of the first page of the directory */
+    uint32_t page_addr; /* Address of the current page */
+    uint16_t page;      /* Current page of the directory */
+    int      slot;      /* Next entry to read in the current page */
+    int      slots;     /* Number of entries in the current page */
+    int      done;      /* Set when the last page of the directory has been browsed */
+} zealfs_dir_iter_t;
+
+
 /**
  * @brief Opens a directory in the Zealfs filesystem.
  *
@@ -213,13 +356,95 @@ int zealfs_readdir(zealfs_context_t* ctx, zealfs_fd_t* fd, zealfs_entry_t* ret_e
 
 
 /**
- * @brief Cleans up and releases resources associated with the zealfs context.
+ * @brief Initialize an iterator over the entries of a directory opened with `zealfs_opendir`.
+ *
+ * @param ctx The context containing disk read/write functions.
+ * @param fd The opened directory.
+ * @param iter Iterator to initialize, positioned on the first entry.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int zealfs_dir_iter_init(zealfs_context_t* ctx, const zealfs_fd_t* fd, zealfs_dir_iter_t* iter);
+
+
+/**
+ * @brief Get the next batch of entries from a directory, resuming where the previous call stopped.
  *
- * @param ctx The context containing disk read/write functions to be destroyed.
+ * @param ctx The context containing disk read/write functions.
+ * @param iter The directory iterator.
+ * @param ret_entries Pointer to an array where the directory entries will be stored.
+ * @param count The maximum number of entries to read.
+ * @return The number of entries read, 0 when the whole directory has been browsed,
+ *         or a negative error code on failure.
+ */
+int zealfs_dir_iter_next(zealfs_context_t* ctx, zealfs_dir_iter_t* iter, zealfs_entry_t* ret_entries, int count);
+
+
+/**
+ * @brief Move the iterator back to the first entry of the directory.
+ *
+ * @param ctx The context containing disk read/write functions.
+ * @param iter The directory iterator.
+ */
+void zealfs_dir_iter_rewind(zealfs_context_t* ctx, zealfs_dir_iter_t* iter);
+
+
+/**
+ * @brief Allocate a context for a partition. Its metadata are only loaded on first use.
+ *        The optional callbacks can be set in the returned context before using it.
+ *        The context can then be used by several threads at once, but not a file descriptor
+ *        or a directory iterator.
+ *
+ * @param read Callback to read from the partition.
+ * @param write Callback to write to the partition.
+ * @param arg Argument given to the callbacks.
+ *
+ * @return The new context, NULL if there is not enough memory.
+ */
+zealfs_context_t* zealfs_context_create(ssize_t (*read) (void* arg, void* buffer, uint32_t addr, size_t len),
+                                        ssize_t (*write)(void* arg, const void* buffer, uint32_t addr, size_t len),
+                                        void* arg);
+
+
+/**
+ * @brief Release a context allocated with `zealfs_context_create` and its metadata.
+ */
+void zealfs_context_destroy(zealfs_context_t* ctx);
+
+
+/**
+ * @brief Release the metadata loaded in the context, they will be loaded from the partition again
+ *        on next use. The context itself remains valid.
+ *
+ * @param ctx The context containing disk read/write functions.
  */
 void zealfs_destroy(zealfs_context_t* ctx);
 
 
+/**
+ * @brief Load the metadata of the context from a copy instead of the partition, for example from
+ *        a cache. Any metadata already loaded are released.
+ *
+ * @param header The header and its bitmap, `header_size` bytes.
+ * @param fat The FAT, `fat_size` bytes.
+ *
+ * @return 0 on success, negative errno value on failure.
+ */
+int zealfs_set_metadata(zealfs_context_t* ctx, const void* header, size_t header_size,
+                        const void* fat, size_t fat_size);
+
+
+/**
+ * @brief Discard the pages freed since the last call, merged into ranges of contiguous pages.
+ *        Pages that were allocated again in the meantime are kept. Freeing pages only marks
+ *        them, so that the discards of several operations are issued together.
+ *
+ * @param ctx The context of the file system, nothing is done if its header is not loaded.
+ *
+ * @return Number of ranges discarded.
+ */
+int zealfs_discard_flush(zealfs_context_t* ctx);
+
+
 /**
  * @brief Opens a file in the zealfs filesystem.
  *
@@ -254,6 +479,15 @@ int zealfs_read(zealfs_context_t* ctx, zealfs_fd_t* fd, void *buf, size_t size,
  */
 int zealfs_mkdir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd);
 
+/**
+ * @brief Set the date of an entry, in the BCD format of Zeal 8-bit OS. The entry must be
+ *        written back to the disk afterwards, with `zealfs_flush` for a file.
+ *
+ * @param entry The entry to update.
+ * @param date The date to set, in local time.
+ */
+void zealfs_entry_set_date(zealfs_entry_t* entry, time_t date);
+
 /**
  * @brief Creates a new file in the ZealFS file system.
  *
@@ -355,3 +589,45 @@ int zealfs_write(zealfs_context_t* ctx, zealfs_fd_t* fd,
  *           changes need to be applied to the disk.
  */
 int zealfs_flush(zealfs_context_t* ctx, zealfs_fd_t* fd);
+
+
+/**
+ * @brief Check the consistency of the file system: every chain of the FAT is followed from the
+ *        directories, the pages they own are compared to the bitmap and to the free pages count.
+ *        Cross-linked chains, cycles, orphan pages and wrong sizes are detected.
+ *
+ * @param ctx The context of the file system to check, its cached header and FAT are reloaded.
+ * @param partition_size Size of the partition in bytes, pages past it must not be used.
+ * @param repair When true, cut the invalid chains, fix the sizes of the truncated files and rewrite
+ *               the bitmap and the FAT from the pages that are reachable.
+ * @param report Filled with the problems found, even when repairing.
+ *
+ * @return 0 on success, negative error code if the check could not be completed.
+ */
+int zealfs_fsck(zealfs_context_t* ctx, uint64_t partition_size, bool repair, zealfs_fsck_report_t* report);
+
+
+/**
+ * @brief Count the contiguous extents of a chain, 1 when all its pages follow each other.
+ *
+ * @param ctx The context of the file system, its header must be loaded.
+ * @param start_page First page of the chain.
+ * @param pages When not NULL, filled with the number of pages in the chain.
+ *
+ * @return Number of extents in the chain.
+ */
+uint32_t zealfs_chain_extents(zealfs_context_t* ctx, uint16_t start_page, uint32_t* pages);
+
+
+/**
+ * @brief Defragment the file system: the files made of several extents are moved, by batches of
+ *        pages, to a run of free pages big enough to hold them. The new chain is written before the
+ *        entry is updated, the old pages are freed afterwards, so a file is never left half-moved.
+ *        Directories are not moved.
+ *
+ * @param ctx The context of the file system to defragment.
+ * @param report Filled with the fragmentation before and after.
+ *
+ * @return 0 on success, negative error code on failure. The files moved before the error stay valid.
+ */
+int zealfs_defrag(zealfs_context_t* ctx, zealfs_defrag_report_t* report);
@@ -0,0 +1,259 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdint.h>
+#include <string.h>
+#include "blake3.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+#define CHUNK_START     (1 << 0)
+#define CHUNK_END       (1 << 1)
+#define PARENT          (1 << 2)
+#define ROOT            (1 << 3)
+
+/**
+ * @brief Input of a compression whose result is not known to be a chaining value or the root yet.
+ */
+typedef struct {
+    uint32_t input_cv[8];
+    uint32_t block_words[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+} blake3_output_t;
+
+
+static const uint32_t s_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/* Order of the message words for each round */
+static const uint8_t s_schedule[7][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+
+static inline uint32_t rotr32(uint32_t w, int c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+
+static inline uint32_t load32(const uint8_t* src)
+{
+    return ((uint32_t) src[0]) | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+
+static inline void store32(uint8_t* dst, uint32_t w)
+{
+    dst[0] = (uint8_t) w;
+    dst[1] = (uint8_t) (w >> 8);
+    dst[2] = (uint8_t) (w >> 16);
+    dst[3] = (uint8_t) (w >> 24);
+}
+
+
+static inline void blake3_g(uint32_t* state, int a, int b, int c, int d, uint32_t x, uint32_t y)
+{
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+
+static void blake3_compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter,
+                            uint32_t block_len, uint32_t flags, uint32_t out[16])
+{
+    uint32_t state[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        s_iv[0], s_iv[1], s_iv[2], s_iv[3],
+        (uint32_t) counter, (uint32_t) (counter >> 32), block_len, flags,
+    };
+
+    for (int r = 0; r < 7; r++) {
+        const uint8_t* s = s_schedule[r];
+        /* Columns */
+        blake3_g(state, 0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        blake3_g(state, 1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        blake3_g(state, 2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        blake3_g(state, 3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        /* Diagonals */
+        blake3_g(state, 0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        blake3_g(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        blake3_g(state, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+        blake3_g(state, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        out[i] = state[i] ^ state[i + 8];
+        out[i + 8] = state[i + 8] ^ cv[i];
+    }
+}
+
+
+static void blake3_words_from_block(const uint8_t block[BLAKE3_BLOCK_LEN], uint32_t words[16])
+{
+    for (int i = 0; i < 16; i++) {
+        words[i] = load32(block + 4 * i);
+    }
+}
+
+
+static void blake3_output_cv(const blake3_output_t* output, uint32_t cv[8])
+{
+    uint32_t out[16];
+    blake3_compress(output->input_cv, output->block_words, output->counter, output->block_len, output->flags, out);
+    memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+
+static void blake3_chunk_init(blake3_chunk_state_t* chunk, const uint32_t key[8], uint64_t counter)
+{
+    memset(chunk, 0, sizeof(*chunk));
+    memcpy(chunk->cv, key, sizeof(chunk->cv));
+    chunk->chunk_counter = counter;
+}
+
+
+static inline size_t blake3_chunk_len(const blake3_chunk_state_t* chunk)
+{
+    return BLAKE3_BLOCK_LEN * (size_t) chunk->blocks_compressed + chunk->block_len;
+}
+
+
+static inline uint32_t blake3_chunk_start_flag(const blake3_chunk_state_t* chunk)
+{
+    return chunk->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+
+static void blake3_chunk_update(blake3_chunk_state_t* chunk, const uint8_t* data, size_t len)
+{
+    uint32_t words[16];
+    uint32_t out[16];
+
+    while (len > 0) {
+        /* The last block of a chunk is only compressed once we know whether it is the root or not */
+        if (chunk->block_len == BLAKE3_BLOCK_LEN) {
+            blake3_words_from_block(chunk->block, words);
+            blake3_compress(chunk->cv, words, chunk->chunk_counter, BLAKE3_BLOCK_LEN,
+                            blake3_chunk_start_flag(chunk), out);
+            memcpy(chunk->cv, out, sizeof(chunk->cv));
+            chunk->blocks_compressed++;
+            chunk->block_len = 0;
+        }
+        const size_t take = MIN(BLAKE3_BLOCK_LEN - (size_t) chunk->block_len, len);
+        memcpy(chunk->block + chunk->block_len, data, take);
+        chunk->block_len += take;
+        data += take;
+        len -= take;
+    }
+}
+
+
+static void blake3_chunk_output(const blake3_chunk_state_t* chunk, blake3_output_t* output)
+{
+    uint8_t block[BLAKE3_BLOCK_LEN] = { 0 };
+    memcpy(block, chunk->block, chunk->block_len);
+
+    memcpy(output->input_cv, chunk->cv, sizeof(output->input_cv));
+    blake3_words_from_block(block, output->block_words);
+    output->counter = chunk->chunk_counter;
+    output->block_len = chunk->block_len;
+    output->flags = blake3_chunk_start_flag(chunk) | CHUNK_END;
+}
+
+
+static void blake3_parent_output(const uint32_t left_cv[8], const uint32_t right_cv[8], blake3_output_t* output)
+{
+    memcpy(output->input_cv, s_iv, sizeof(output->input_cv));
+    memcpy(output->block_words, left_cv, 8 * sizeof(uint32_t));
+    memcpy(output->block_words + 8, right_cv, 8 * sizeof(uint32_t));
+    output->counter = 0;
+    output->block_len = BLAKE3_BLOCK_LEN;
+    output->flags = PARENT;
+}
+
+
+/**
+ * @brief Push the chaining value of a complete chunk, merging the complete subtrees on the way.
+ * The number of subtrees to merge is the number of trailing zeros in the total number of chunks.
+ */
+static void blake3_push_chunk_cv(blake3_hasher_t* hasher, uint32_t cv[8], uint64_t total_chunks)
+{
+    blake3_output_t parent;
+
+    while ((total_chunks & 1) == 0) {
+        hasher->cv_stack_len--;
+        blake3_parent_output(hasher->cv_stack[hasher->cv_stack_len], cv, &parent);
+        blake3_output_cv(&parent, cv);
+        total_chunks >>= 1;
+    }
+    memcpy(hasher->cv_stack[hasher->cv_stack_len++], cv, 8 * sizeof(uint32_t));
+}
+
+
+void blake3_hasher_init(blake3_hasher_t* hasher)
+{
+    blake3_chunk_init(&hasher->chunk, s_iv, 0);
+    hasher->cv_stack_len = 0;
+}
+
+
+void blake3_hasher_update(blake3_hasher_t* hasher, const void* data, size_t len)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    blake3_output_t output;
+    uint32_t cv[8];
+
+    while (len > 0) {
+        /* The current chunk is only finished once more data comes, it may be the root otherwise */
+        if (blake3_chunk_len(&hasher->chunk) == BLAKE3_CHUNK_LEN) {
+            const uint64_t total_chunks = hasher->chunk.chunk_counter + 1;
+            blake3_chunk_output(&hasher->chunk, &output);
+            blake3_output_cv(&output, cv);
+            blake3_push_chunk_cv(hasher, cv, total_chunks);
+            blake3_chunk_init(&hasher->chunk, s_iv, total_chunks);
+        }
+        const size_t take = MIN(BLAKE3_CHUNK_LEN - blake3_chunk_len(&hasher->chunk), len);
+        blake3_chunk_update(&hasher->chunk, bytes, take);
+        bytes += take;
+        len -= take;
+    }
+}
+
+
+void blake3_hasher_finalize(const blake3_hasher_t* hasher, uint8_t out[BLAKE3_OUT_LEN])
+{
+    blake3_output_t output;
+    uint32_t cv[8];
+    uint32_t words[16];
+
+    /* Merge the pending subtrees from the right, the last merge is the root */
+    blake3_chunk_output(&hasher->chunk, &output);
+    for (int i = hasher->cv_stack_len - 1; i >= 0; i--) {
+        blake3_output_cv(&output, cv);
+        blake3_parent_output(hasher->cv_stack[i], cv, &output);
+    }
+
+    blake3_compress(output.input_cv, output.block_words, 0, output.block_len, output.flags | ROOT, words);
+    for (int i = 0; i < BLAKE3_OUT_LEN / 4; i++) {
+        store32(out + 4 * i, words[i]);
+    }
+}
@@ -0,0 +1,165 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #include <nmmintrin.h>
+    #define CRC32C_HW_X86   1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define CRC32C_HW_ARM   1
+#endif
+
+/* Reversed Castagnoli polynomial */
+#define CRC32C_POLY     0x82F63B78U
+
+/* Tables for the software implementation, processing 8 bytes per iteration */
+static uint32_t s_table[8][256];
+/* Whether the CPU instructions can be used, set once, before the first checksum */
+static bool s_hw_supported;
+static pthread_once_t s_init_once = PTHREAD_ONCE_INIT;
+
+
+static bool crc32c_hw_supported(void);
+
+
+static void crc32c_init(void)
+{
+    s_hw_supported = crc32c_hw_supported();
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        s_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            s_table[t][i] = (s_table[t - 1][i] >> 8) ^ s_table[0][s_table[t - 1][i] & 0xff];
+        }
+    }
+}
+
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* data, size_t len)
+{
+    while (len > 0 && ((uintptr_t) data & 7) != 0) {
+        crc = (crc >> 8) ^ s_table[0][(crc ^ *data++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        /* The bytes are processed in the little-endian order */
+        lo ^= crc;
+        crc = s_table[7][lo & 0xff] ^ s_table[6][(lo >> 8) & 0xff] ^
+              s_table[5][(lo >> 16) & 0xff] ^ s_table[4][lo >> 24] ^
+              s_table[3][hi & 0xff] ^ s_table[2][(hi >> 8) & 0xff] ^
+              s_table[1][(hi >> 16) & 0xff] ^ s_table[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ s_table[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+
+#if CRC32C_HW_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* data, size_t len)
+{
+    while (len > 0 && ((uintptr_t) data & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        len--;
+    }
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#endif
+    for (; len >= 4; len -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+
+static bool crc32c_hw_supported(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif CRC32C_HW_ARM
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* data, size_t len)
+{
+    while (len > 0 && ((uintptr_t) data & 7) != 0) {
+        crc = __crc32cb(crc, *data++);
+        len--;
+    }
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    while (len-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+
+
+static bool crc32c_hw_supported(void)
+{
+    /* The compiler only defines `__ARM_FEATURE_CRC32` when the target CPU always has it */
+    return true;
+}
+
+#else
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* data, size_t len)
+{
+    return crc32c_sw(crc, data, len);
+}
+
+
+static bool crc32c_hw_supported(void)
+{
+    return false;
+}
+
+#endif
+
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len)
+{
+    pthread_once(&s_init_once, crc32c_init);
+
+    crc = ~crc;
+    if (s_hw_supported) {
+        return ~crc32c_hw(crc, data, len);
+    }
+    return ~crc32c_sw(crc, data, len);
+}
@@ -6,15 +6,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <assert.h>
 #include "disk.h"
 #include "ui/statusbar.h"
 #include "ui/tinyfiledialogs.h"
 #include "zealfs_v2.h"
+#include "zealfs_session.h"
 
 #define ALIGN_UP(size,bound) (((size) + (bound) - 1) & ~((bound) - 1))
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Size of the buffer of zeros used to clear ranges of a disk, it can be referenced several times in a single write */
+#define DISK_ZEROS_SIZE     (64*KB)
 
 static disk_list_state_t s_state;
+static bool s_erase_on_format;
+static bool s_trim_enabled;
+static uint8_t s_zeros[DISK_ZEROS_SIZE];
 
 static const uint64_t s_valid_sizes[] = {
     32*KB, 64*KB, 128*KB, 256*KB, 512*KB,
@@ -193,6 +202,37 @@ int disk_create_mbr(disk_info_t *disk)
 }
 
 
+/**
+ * @brief Stage a new ZealFS in the partition. Only the header and its bitmap are kept in memory, the
+ * rest of the three first pages (root directory and FAT) is written as zeros when the changes are applied.
+ */
+static int disk_stage_format(partition_t* part, uint64_t part_size_bytes, int page_size)
+{
+    /* The header is staged by whole sectors, the end of its last sector must be zeros too */
+    uint8_t header[ALIGN_UP(ZFS_HEADER_MAX_SIZE, DISK_SECTOR_SIZE)] = { 0 };
+
+    if (zealfsv2_format_page_size(header, part_size_bytes, page_size) != 0) {
+        return -1;
+    }
+    const uint32_t header_len = sizeof(zealfs_header_t) + ((zealfs_header_t*) header)->bitmap_size;
+    const uint32_t layout_len = page_size * 3;
+
+    free(part->data);
+    part->data_len = MIN(ALIGN_UP(header_len, DISK_SECTOR_SIZE), layout_len);
+    part->data = malloc(part->data_len);
+    if (part->data == NULL) {
+        printf("[DISK] Could not allocate memory!\n");
+        exit(1);
+    }
+    memcpy(part->data, header, part->data_len);
+    part->zeros_len = layout_len - part->data_len;
+    part->erase = s_erase_on_format;
+    printf("[DISK] Staged %d bytes of header, %d bytes of zeros%s\n", part->data_len, part->zeros_len,
+           part->erase ? ", rest of the partition erased" : "");
+    return 0;
+}
+
+
 void disk_allocate_partition(disk_info_t *disk, uint32_t lba, uint32_t sectors_count)
 {
     const uint64_t part_size_bytes = sectors_count * DISK_SECTOR_SIZE;
@@ -223,22 +263,14 @@ void disk_allocate_partition(disk_info_t *disk, uint32_t lba, uint32_t sectors_c
     uint8_t *entry = &disk->staged_mbr[MBR_PART_ENTRY_BEGIN + disk->free_part_idx * MBR_PART_ENTRY_SIZE];
     disk_write_mbr_entry(entry, part);
 
-    /* Format the partition with data. We need to allocate 3 pages at all time:
-     * - One for the header
-     * - Two for the FAT
-     */
+    /* Format the partition: the header, the root directory and the FAT occupy the three first pages */
     assert(part->data == NULL && part->data_len == 0);
-    const int page_size = zealfsv2_page_size(part_size_bytes);
-    part->data_len = page_size * 3;
-    part->data = calloc(3, page_size);
-    if (part->data == NULL) {
-        printf("[DISK] Could not allocate memory!\n");
-        exit(1);
-    } else {
-        printf("[DISK] Allocated %d bytes (3 pages)\n", 3*page_size);
+    if (disk_stage_format(part, part_size_bytes, zealfsv2_page_size(part_size_bytes)) != 0) {
+        ui_statusbar_print("Error: Could not format the new partition!");
+        part->active = false;
+        memset(entry, 0, MBR_PART_ENTRY_SIZE);
+        return;
     }
-    zealfsv2_format(part->data, part_size_bytes);
-    printf("[DISK] Partition %d data: %p, length: %d\n", disk->free_part_idx, part->data, part->data_len);
 
     /* Inform the user about the operation */
     ui_statusbar_printf("Partition %d allocated", disk->free_part_idx);
@@ -248,7 +280,7 @@ void disk_allocate_partition(disk_info_t *disk, uint32_t lba, uint32_t sectors_c
 }
 
 
-const char* disk_format_partition(disk_info_t* disk, int partition)
+const char* disk_format_partition_page_size(disk_info_t* disk, int partition, int page_size)
 {
     if (disk_is_invalid(disk)) {
         return "Please select a valid disk!";
@@ -259,24 +291,15 @@ const char* disk_format_partition(disk_info_t* disk, int partition)
 
     partition_t* part = &disk->staged_partitions[partition];
     const uint64_t part_size_bytes = part->size_sectors * DISK_SECTOR_SIZE;
-    const int page_size = zealfsv2_page_size(part_size_bytes);
-    /* Format the partition with data. We need to allocate 3 pages at all time:
-     * - One for the header
-     * - Two for the FAT
-     */
-    free(part->data);
+    if (!zealfsv2_page_size_valid(part_size_bytes, page_size)) {
+        return "The page size cannot be used for this partition!";
+    }
+    /* Format the partition: the header, the root directory and the FAT occupy the three first pages */
+    if (disk_stage_format(part, part_size_bytes, page_size) != 0) {
+        return "Could not format the partition!";
+    }
     disk->has_staged_changes = true;
     part->type = 0x5a;
-    part->data_len = page_size * 3;
-    part->data = calloc(3, page_size);
-    if (part->data == NULL) {
-        printf("[DISK][FORMAT] Could not allocate memory!\n");
-        exit(1);
-    } else {
-        printf("[DISK][FORMAT] Allocated %d bytes (3 pages)\n", 3*page_size);
-    }
-    zealfsv2_format(part->data, part_size_bytes);
-    printf("[DISK][FORMAT] Partition %d data: %p, length: %d\n", disk->free_part_idx, part->data, part->data_len);
 
     ui_statusbar_printf("Partition %d formatted successfully", partition);
 
@@ -284,6 +307,20 @@ const char* disk_format_partition(disk_info_t* disk, int partition)
 }
 
 
+const char* disk_format_partition(disk_info_t* disk, int partition)
+{
+    if (disk_is_invalid(disk)) {
+        return "Please select a valid disk!";
+    }
+    if (partition < 0 || partition >= MAX_PART_COUNT || !disk->staged_partitions[partition].active) {
+        return "Please select a valid partition!";
+    }
+
+    const uint64_t part_size_bytes = disk->staged_partitions[partition].size_sectors * DISK_SECTOR_SIZE;
+    return disk_format_partition_page_size(disk, partition, zealfsv2_page_size(part_size_bytes));
+}
+
+
 void disk_delete_partition(disk_info_t* disk, int partition)
 {
     if (disk_is_invalid(disk) || partition < 0 || partition >= MAX_PART_COUNT) {
@@ -317,6 +354,8 @@ static void disk_free_staged_partitions_data(disk_info_t* disk)
         free(disk->staged_partitions[i].data);
         disk->staged_partitions[i].data = NULL;
         disk->staged_partitions[i].data_len = 0;
+        disk->staged_partitions[i].zeros_len = 0;
+        disk->staged_partitions[i].erase = false;
     }
 }
 
@@ -342,6 +381,190 @@ void disk_revert_changes(disk_info_t* disk)
 }
 
 
+void disk_format_set_erase(bool erase)
+{
+    s_erase_on_format = erase;
+}
+
+
+bool disk_format_erase(void)
+{
+    return s_erase_on_format;
+}
+
+
+void disk_trim_set_enabled(bool enabled)
+{
+    s_trim_enabled = enabled;
+}
+
+
+bool disk_trim_enabled(void)
+{
+    return s_trim_enabled;
+}
+
+
+uint32_t disk_au_size(const disk_info_t* disk)
+{
+    return disk->au_size != 0 ? disk->au_size : DISK_DEFAULT_AU_SIZE;
+}
+
+
+/**
+ * @brief Contiguous bytes to write to a disk, gathered from several buffers and written at once.
+ */
+typedef struct {
+    void*        fd;
+    /* Allocation unit of the media, a single write never crosses one */
+    uint32_t     au_size;
+    uint64_t     offset;
+    uint64_t     pending;
+    disk_iovec_t iov[DISK_WRITEV_MAX];
+    int          count;
+} disk_stream_t;
+
+
+static int disk_stream_flush(disk_stream_t* stream)
+{
+    if (stream->count == 0) {
+        return 0;
+    }
+    const ssize_t wr = disk_writev(stream->fd, stream->iov, stream->count, stream->offset);
+    if (wr < 0 || (uint64_t) wr != stream->pending) {
+        return -1;
+    }
+    stream->offset += stream->pending;
+    stream->pending = 0;
+    stream->count = 0;
+    return 0;
+}
+
+
+/**
+ * @brief Append bytes to write at the given offset, the former bytes are written first if they are not contiguous.
+ */
+static int disk_stream_add(disk_stream_t* stream, uint64_t offset, const void* data, size_t len)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+
+    if (stream->offset + stream->pending != offset) {
+        if (disk_stream_flush(stream) != 0) {
+            return -1;
+        }
+        stream->offset = offset;
+    }
+    while (len > 0) {
+        if (stream->count == DISK_WRITEV_MAX && disk_stream_flush(stream) != 0) {
+            return -1;
+        }
+        /* Split the buffer at the end of the allocation unit, the unit is written right away */
+        const uint64_t end = stream->offset + stream->pending;
+        const size_t count = MIN(len, stream->au_size - end % stream->au_size);
+        stream->iov[stream->count++] = (disk_iovec_t) { .base = bytes, .len = count };
+        stream->pending += count;
+        if ((end + count) % stream->au_size == 0 && disk_stream_flush(stream) != 0) {
+            return -1;
+        }
+        bytes += count;
+        len -= count;
+    }
+    return 0;
+}
+
+
+static int disk_stream_add_zeros(disk_stream_t* stream, uint64_t offset, uint64_t len)
+{
+    while (len > 0) {
+        const size_t count = MIN(len, DISK_ZEROS_SIZE);
+        if (disk_stream_add(stream, offset, s_zeros, count) != 0) {
+            return -1;
+        }
+        offset += count;
+        len -= count;
+    }
+    return 0;
+}
+
+
+static int disk_compare_partitions(const void* a, const void* b)
+{
+    const partition_t* pa = *(const partition_t**) a;
+    const partition_t* pb = *(const partition_t**) b;
+    return (pa->start_lba > pb->start_lba) - (pa->start_lba < pb->start_lba);
+}
+
+
+const char* disk_write_changes(disk_info_t* disk)
+{
+    static char error_msg[1024];
+    partition_t* parts[MAX_PART_COUNT];
+    int parts_count = 0;
+    disk_stream_t stream = { .au_size = disk_au_size(disk) };
+
+    assert(disk);
+    assert(disk->valid);
+    assert(disk->has_staged_changes);
+
+    if (disk_open(disk, &stream.fd)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open disk %s\n", disk->name);
+        return error_msg;
+    }
+
+    /* The whole layout is written in the order of the disk: MBR first, then the partitions */
+    if (disk->has_mbr && disk_stream_add(&stream, 0, disk->staged_mbr, sizeof(disk->staged_mbr)) != 0) {
+        goto error;
+    }
+
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        partition_t* part = &disk->staged_partitions[i];
+        if (part->data != NULL && part->data_len != 0) {
+            parts[parts_count++] = part;
+        } else {
+            printf("[DISK] Partition %d has no changes\n", i);
+        }
+    }
+    qsort(parts, parts_count, sizeof(partition_t*), disk_compare_partitions);
+
+    for (int i = 0; i < parts_count; i++) {
+        const partition_t* part = parts[i];
+        const uint64_t part_offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+        const uint64_t layout_len = part->data_len + part->zeros_len;
+        printf("[DISK] Writing partition @ %08" PRIx64 ", %" PRIu64 " bytes\n", part_offset, layout_len);
+
+        if (disk_stream_add(&stream, part_offset, part->data, part->data_len) != 0 ||
+            disk_stream_add_zeros(&stream, part_offset + part->data_len, part->zeros_len) != 0)
+        {
+            goto error;
+        }
+
+        /* The rest of the partition is discarded when possible. When erasing, zeros are written
+         * if it could not be discarded. */
+        const uint64_t part_size = (uint64_t) part->size_sectors * DISK_SECTOR_SIZE;
+        if ((part->erase || s_trim_enabled) && part_size > layout_len &&
+            disk_discard(stream.fd, part_offset + layout_len, part_size - layout_len) != 0 &&
+            part->erase &&
+            disk_stream_add_zeros(&stream, part_offset + layout_len, part_size - layout_len) != 0)
+        {
+            goto error;
+        }
+    }
+
+    if (disk_stream_flush(&stream) != 0) {
+        goto error;
+    }
+    disk_close(stream.fd);
+    /* Apply the changes in RAM too */
+    disk_apply_changes(disk);
+    return NULL;
+error:
+    snprintf(error_msg, sizeof(error_msg), "Could not write disk %s @ %08" PRIx64 "\n",
+             disk->name, stream.offset);
+    disk_close(stream.fd);
+    return error_msg;
+}
+
+
 void disk_apply_changes(disk_info_t* disk)
 {
     if (disk_is_invalid(disk)) {
@@ -357,6 +580,111 @@ void disk_apply_changes(disk_info_t* disk)
 }
 
 
+static int disk_find_device(const char* path)
+{
+    for (int i = 0; i < s_state.disk_count; i++) {
+        if (!s_state.disks[i].is_image && strcmp(s_state.disks[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static int disk_default_selection(void)
+{
+    for (int i = 0; i < s_state.disk_count; i++) {
+        if (s_state.disks[i].valid) {
+            return i;
+        }
+    }
+    /* Never leave an out-of-bounds selection if the list is not empty */
+    return s_state.disk_count > 0 ? 0 : -1;
+}
+
+
+static void disk_hotplug_remove(int index)
+{
+    disk_info_t* disk = &s_state.disks[index];
+    printf("[DISK] Disk removed: %s\n", disk->label);
+    ui_statusbar_printf("Disk %s removed", disk->name);
+    /* The device is gone, its staged changes cannot be applied anymore */
+    disk_free_staged_partitions_data(disk);
+    zealfs_session_close_disk(disk->path);
+
+    memmove(disk, disk + 1, (s_state.disk_count - index - 1) * sizeof(disk_info_t));
+    s_state.disk_count--;
+
+    if (index == s_state.selected_disk) {
+        s_state.selected_disk = disk_default_selection();
+        s_state.selected_partition = -1;
+    } else if (index < s_state.selected_disk) {
+        s_state.selected_disk--;
+    }
+}
+
+
+static void disk_hotplug_upsert(disk_info_t* probed)
+{
+    int index = disk_find_device(probed->path);
+
+    if (index >= 0) {
+        disk_info_t* disk = &s_state.disks[index];
+        /* Closing a disk opened in write mode makes udev emit a change event, ignore it
+         * if nothing actually changed */
+        if (disk->valid == probed->valid && disk->size_bytes == probed->size_bytes &&
+            memcmp(disk->mbr, probed->mbr, sizeof(disk->mbr)) == 0) {
+            return;
+        }
+        if (disk->has_staged_changes) {
+            ui_statusbar_printf("Disk %s changed, apply or cancel its staged changes and refresh", disk->name);
+            return;
+        }
+        if (index == s_state.selected_disk) {
+            s_state.selected_partition = -1;
+        }
+        /* The media may have been swapped, the partitions opened on it are outdated */
+        zealfs_session_close_disk(disk->path);
+    } else if (s_state.disk_count >= MAX_DISKS) {
+        printf("[DISK] Maximum number of disks reached, ignoring %s\n", probed->path);
+        return;
+    } else {
+        index = s_state.disk_count++;
+    }
+
+    disk_info_t* disk = &s_state.disks[index];
+    *disk = *probed;
+    disk_generate_label(disk);
+    disk_parse_mbr_partitions(disk);
+    printf("[DISK] Hotplugged disk: %s\n", disk->label);
+    ui_statusbar_printf("Disk %s detected", disk->name);
+
+    if (s_state.selected_disk == -1 ||
+        (!s_state.disks[s_state.selected_disk].valid && disk->valid)) {
+        s_state.selected_disk = index;
+        s_state.selected_partition = -1;
+    }
+}
+
+
+void disks_hotplug_update(void)
+{
+    /* The event embeds a whole disk structure, don't put it on the stack every frame */
+    static disk_hotplug_event_t event;
+
+    while (disk_hotplug_poll(&event)) {
+        if (event.action == DISK_HOTPLUG_REMOVE) {
+            const int index = disk_find_device(event.disk.path);
+            if (index >= 0) {
+                disk_hotplug_remove(index);
+            }
+        } else {
+            disk_hotplug_upsert(&event.disk);
+        }
+    }
+}
+
+
 const char* disk_get_fs_type(uint8_t fs_byte)
 {
     switch (fs_byte) {
@@ -521,9 +849,9 @@ uint64_t disk_max_partition_size(disk_info_t *disk, uint32_t align, uint64_t *la
     uint64_t free_bytes = disk_largest_free_space(disk, &free_start_addr);
 
     /* Try to align the address on the given alignment */
-    uint64_t aligned_addr = ALIGN_UP(free_start_addr, align);
+    uint64_t aligned_addr = ALIGN_UP(free_start_addr, (uint64_t) align);
     uint64_t wasted_bytes = aligned_addr - free_start_addr;
-    free_bytes -= wasted_bytes;
+    free_bytes = (wasted_bytes < free_bytes) ? free_bytes - wasted_bytes : 0;
 
     if (largest_free_addr) {
         *largest_free_addr = aligned_addr;
@@ -618,7 +946,7 @@ int disk_open_image_file(disk_list_state_t* state)
 }
 
 
-int disk_create_image(disk_list_state_t* state, const char* path, uint64_t size, bool init_mbr)
+int disk_create_image(disk_list_state_t* state, const char* path, uint64_t size, bool init_mbr, bool sparse)
 {
     int new_index = state->disk_count;
     /* Allocate a buffer for the MBR and initialize it to 0 */
@@ -654,7 +982,7 @@ int disk_create_image(disk_list_state_t* state, const char* path, uint64_t size,
     }
 
     /* Extend the file to the desired size */
-    if (fseek(file, size - 1, SEEK_SET) != 0 || fwrite("", 1, 1, file) != 1) {
+    if (disk_set_image_size(file, size, sparse) != 0) {
         ui_statusbar_printf("Failed to set file size: %s", path);
         fclose(file);
         return -1;
@@ -0,0 +1,422 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include "disk.h"
+#include "disk_analyzer.h"
+#include "disk_worker.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Number of entries retrieved from a directory at once */
+#define ANALYZER_DIR_BATCH      64
+
+
+/**
+ * @brief Copy a path without its trailing `/`, except for the root.
+ */
+static void analyzer_normalize_path(char* dst, const char* src)
+{
+    snprintf(dst, ANALYZER_PATH_LEN, "%s", src);
+    size_t len = strlen(dst);
+    while (len > 1 && dst[len - 1] == '/') {
+        dst[--len] = 0;
+    }
+}
+
+
+static void analyzer_result_free(disk_analyzer_result_t* result)
+{
+    free(result->dirs);
+    free(result->files);
+    memset(result, 0, sizeof(*result));
+}
+
+
+static int analyzer_add_dir(disk_analyzer_result_t* result, const char* path, int parent)
+{
+    if (result->dirs_count == result->dirs_capacity) {
+        const int capacity = result->dirs_capacity ? result->dirs_capacity * 2 : 64;
+        disk_analyzer_dir_t* dirs = realloc(result->dirs, capacity * sizeof(disk_analyzer_dir_t));
+        if (dirs == NULL) {
+            return -ENOMEM;
+        }
+        result->dirs = dirs;
+        result->dirs_capacity = capacity;
+    }
+    disk_analyzer_dir_t* dir = &result->dirs[result->dirs_count];
+    memset(dir, 0, sizeof(*dir));
+    snprintf(dir->path, sizeof(dir->path), "%s", path);
+    dir->parent = parent;
+    dir->valid = true;
+    return result->dirs_count++;
+}
+
+
+static int analyzer_add_file(disk_analyzer_result_t* result, zealfs_context_t* ctx, int dir, const zealfs_entry_t* entry)
+{
+    if (result->files_count == result->files_capacity) {
+        const int capacity = result->files_capacity ? result->files_capacity * 2 : 256;
+        disk_analyzer_file_t* files = realloc(result->files, capacity * sizeof(disk_analyzer_file_t));
+        if (files == NULL) {
+            return -ENOMEM;
+        }
+        result->files = files;
+        result->files_capacity = capacity;
+    }
+    disk_analyzer_file_t* file = &result->files[result->files_count++];
+    snprintf(file->name, sizeof(file->name), "%.*s", NAME_MAX_LEN, entry->name);
+    file->dir = dir;
+    file->size = entry->size;
+    file->extents = zealfs_chain_extents(ctx, entry->start_page, &file->pages);
+
+    result->dirs[dir].bytes += entry->size;
+    result->dirs[dir].files++;
+    return 0;
+}
+
+
+/**
+ * @brief Remove the files of a directory from the result.
+ */
+static void analyzer_remove_files(disk_analyzer_result_t* result, int dir)
+{
+    int kept = 0;
+    for (int i = 0; i < result->files_count; i++) {
+        if (result->files[i].dir != dir) {
+            result->files[kept++] = result->files[i];
+        }
+    }
+    result->files_count = kept;
+    result->dirs[dir].bytes = 0;
+    result->dirs[dir].files = 0;
+}
+
+
+/**
+ * @brief Remove a directory that doesn't exist anymore, with all its sub-directories.
+ */
+static void analyzer_remove_dir(disk_analyzer_result_t* result, int dir)
+{
+    analyzer_remove_files(result, dir);
+    result->dirs[dir].valid = false;
+    for (int i = dir + 1; i < result->dirs_count; i++) {
+        if (result->dirs[i].valid && result->dirs[i].parent == dir) {
+            analyzer_remove_dir(result, i);
+        }
+    }
+}
+
+
+static int analyzer_find_child(disk_analyzer_result_t* result, int parent, const char* path)
+{
+    for (int i = parent + 1; i < result->dirs_count; i++) {
+        const disk_analyzer_dir_t* dir = &result->dirs[i];
+        if (dir->valid && dir->parent == parent && strcmp(dir->path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Read the entries of a directory, its files are added to the result. The sub-directories
+ * that are not known yet are added too, they will have to be read afterwards. When `seen` is not
+ * NULL, the known sub-directories found are marked in it.
+ */
+static int analyzer_read_dir(disk_analyzer_result_t* result, zealfs_context_t* ctx, int index, bool* seen)
+{
+    zealfs_entry_t entries[ANALYZER_DIR_BATCH];
+    char path[ANALYZER_PATH_LEN];
+    zealfs_dir_iter_t iter;
+    zealfs_fd_t fd;
+    int count;
+    int err = 0;
+
+    /* The array may be reallocated, keep a copy of the path */
+    char dir_path[ANALYZER_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s", result->dirs[index].path);
+    const bool is_root = strcmp(dir_path, "/") == 0;
+
+    if (zealfs_opendir(dir_path, ctx, &fd) < 0 || zealfs_dir_iter_init(ctx, &fd, &iter) < 0) {
+        printf("[ANALYZER] Could not open directory %s\n", dir_path);
+        return -EIO;
+    }
+
+    while (err == 0 && (count = zealfs_dir_iter_next(ctx, &iter, entries, ANALYZER_DIR_BATCH)) > 0) {
+        for (int i = 0; i < count && err == 0; i++) {
+            const zealfs_entry_t* entry = &entries[i];
+            if ((entry->flags & IS_DIR) == 0) {
+                err = analyzer_add_file(result, ctx, index, entry);
+                continue;
+            }
+
+            const int name_len = strnlen(entry->name, NAME_MAX_LEN);
+            snprintf(path, sizeof(path), "%s/%.*s", is_root ? "" : dir_path, name_len, entry->name);
+            const int child = seen ? analyzer_find_child(result, index, path) : -1;
+            if (child >= 0) {
+                seen[child] = true;
+            } else {
+                err = analyzer_add_dir(result, path, index);
+                err = MIN(err, 0);
+            }
+        }
+    }
+
+    return err ? err : MIN(count, 0);
+}
+
+
+/**
+ * @brief Fill the free space and the summary of the result, from the bitmap of the context and
+ * from the files. The sizes of the directories are accumulated in their parents.
+ */
+static void analyzer_summarize(disk_analyzer_result_t* result, zealfs_context_t* ctx)
+{
+    const zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    const uint32_t bits = header->bitmap_size * 8U;
+    uint64_t links = 0;
+    uint64_t breaks = 0;
+
+    result->page_size = 256U << header->page_size;
+    result->free_pages = header->free_pages;
+    result->largest_free_run = 0;
+    memset(result->free_runs, 0, sizeof(result->free_runs));
+    for (uint32_t page = 0; page < bits; ) {
+        if (header->pages_bitmap[page / 8] & (1 << (page % 8))) {
+            page++;
+            continue;
+        }
+        const uint32_t start = page;
+        while (page < bits && (header->pages_bitmap[page / 8] & (1 << (page % 8))) == 0) {
+            page++;
+        }
+        const uint32_t len = page - start;
+        const int bucket = 31 - __builtin_clz(len);
+        result->free_runs[MIN(bucket, ANALYZER_RUN_BUCKETS - 1)]++;
+        if (len > result->largest_free_run) {
+            result->largest_free_run = len;
+        }
+    }
+
+    result->fragmented_files = 0;
+    result->extents = 0;
+    result->pages = 0;
+    for (int i = 0; i < result->files_count; i++) {
+        const disk_analyzer_file_t* file = &result->files[i];
+        result->fragmented_files += file->extents > 1;
+        result->extents += file->extents;
+        result->pages += file->pages;
+        links += file->pages - 1;
+        breaks += file->extents - 1;
+    }
+    result->score = links ? (uint32_t) (breaks * 100 / links) : 0;
+
+    /* Sub-directories are always after their parent in the array */
+    for (int i = 0; i < result->dirs_count; i++) {
+        result->dirs[i].total_bytes = result->dirs[i].valid ? result->dirs[i].bytes : 0;
+    }
+    for (int i = result->dirs_count - 1; i > 0; i--) {
+        const disk_analyzer_dir_t* dir = &result->dirs[i];
+        if (dir->valid && dir->parent >= 0) {
+            result->dirs[dir->parent].total_bytes += dir->total_bytes;
+        }
+    }
+}
+
+
+static void* analyzer_thread(void* arg)
+{
+    disk_analyzer_t* analyzer = (disk_analyzer_t*) arg;
+    disk_analyzer_result_t* result = &analyzer->scan;
+    disk_worker_t worker;
+    int err = -EIO;
+
+    /* The descriptor and the context of the viewer are not shared, the scan has its own */
+    if (disk_worker_init(&worker, &analyzer->disk, &analyzer->partition, 0, NULL)) {
+        goto end;
+    }
+    zealfs_context_t* zealfs = worker.zealfs;
+    err = analyzer_add_dir(result, "/", -1);
+    /* Browse the directories breadth first, the array itself is the queue */
+    for (int i = 0; err >= 0 && i < result->dirs_count; i++) {
+        if (atomic_load(&analyzer->cancel)) {
+            err = -ECANCELED;
+            break;
+        }
+        err = analyzer_read_dir(result, zealfs, i, NULL);
+    }
+    if (err >= 0) {
+        analyzer_summarize(result, zealfs);
+        err = 0;
+    }
+
+end:
+    disk_worker_deinit(&worker);
+    analyzer->scan_error = err;
+    atomic_store(&analyzer->running, false);
+    return NULL;
+}
+
+
+static const char* analyzer_spawn(disk_analyzer_t* analyzer)
+{
+    analyzer_result_free(&analyzer->scan);
+    analyzer->dirty = false;
+    atomic_store(&analyzer->cancel, false);
+    atomic_store(&analyzer->running, true);
+    if (pthread_create(&analyzer->thread, NULL, analyzer_thread, analyzer) != 0) {
+        atomic_store(&analyzer->running, false);
+        return "Could not start the analyzer thread";
+    }
+    analyzer->started = true;
+    return NULL;
+}
+
+
+const char* disk_analyzer_start(disk_analyzer_t* analyzer, disk_info_t* disk, partition_t* partition)
+{
+    assert(analyzer);
+    disk_analyzer_stop(analyzer);
+    analyzer->disk = *disk;
+    analyzer->partition = *partition;
+    return analyzer_spawn(analyzer);
+}
+
+
+bool disk_analyzer_poll(disk_analyzer_t* analyzer)
+{
+    if (analyzer->started && !atomic_load(&analyzer->running)) {
+        pthread_join(analyzer->thread, NULL);
+        analyzer->started = false;
+
+        if (analyzer->scan_error == 0) {
+            analyzer_result_free(&analyzer->result);
+            analyzer->result = analyzer->scan;
+            memset(&analyzer->scan, 0, sizeof(analyzer->scan));
+            analyzer->valid = true;
+        } else {
+            printf("[ANALYZER] Could not scan the partition: %s\n", strerror(-analyzer->scan_error));
+        }
+
+        /* The file system changed during the scan, its result is already outdated */
+        if (analyzer->dirty) {
+            analyzer_spawn(analyzer);
+        }
+    }
+    return analyzer->valid;
+}
+
+
+void disk_analyzer_invalidate(disk_analyzer_t* analyzer)
+{
+    if (analyzer->started) {
+        analyzer->dirty = true;
+    } else {
+        analyzer_spawn(analyzer);
+    }
+}
+
+
+void disk_analyzer_update_dir(disk_analyzer_t* analyzer, zealfs_context_t* ctx, const char* path)
+{
+    disk_analyzer_result_t* result = &analyzer->result;
+    char dir_path[ANALYZER_PATH_LEN];
+    int index = -1;
+
+    if (analyzer->started) {
+        analyzer->dirty = true;
+        return;
+    }
+
+    analyzer_normalize_path(dir_path, path);
+    for (int i = 0; i < result->dirs_count && index < 0; i++) {
+        if (result->dirs[i].valid && strcmp(result->dirs[i].path, dir_path) == 0) {
+            index = i;
+        }
+    }
+    bool* seen = calloc(result->dirs_count + 1, sizeof(bool));
+    if (!analyzer->valid || index < 0 || seen == NULL) {
+        free(seen);
+        disk_analyzer_invalidate(analyzer);
+        return;
+    }
+
+    const int former_count = result->dirs_count;
+    analyzer_remove_files(result, index);
+    int err = analyzer_read_dir(result, ctx, index, seen);
+
+    /* Sub-directories that are gone, and new ones that have to be read */
+    for (int i = index + 1; err == 0 && i < former_count; i++) {
+        if (result->dirs[i].valid && result->dirs[i].parent == index && !seen[i]) {
+            analyzer_remove_dir(result, i);
+        }
+    }
+    for (int i = former_count; err == 0 && i < result->dirs_count; i++) {
+        err = analyzer_read_dir(result, ctx, i, NULL);
+    }
+    free(seen);
+
+    if (err) {
+        disk_analyzer_invalidate(analyzer);
+        return;
+    }
+    analyzer_summarize(result, ctx);
+}
+
+
+const disk_analyzer_dir_t* disk_analyzer_find_dir(disk_analyzer_t* analyzer, const char* path)
+{
+    char dir_path[ANALYZER_PATH_LEN];
+
+    if (!analyzer->valid) {
+        return NULL;
+    }
+    analyzer_normalize_path(dir_path, path);
+    for (int i = 0; i < analyzer->result.dirs_count; i++) {
+        const disk_analyzer_dir_t* dir = &analyzer->result.dirs[i];
+        if (dir->valid && strcmp(dir->path, dir_path) == 0) {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+
+const disk_analyzer_file_t* disk_analyzer_find_file(disk_analyzer_t* analyzer, const char* dir_path, const char* name)
+{
+    const disk_analyzer_dir_t* dir = disk_analyzer_find_dir(analyzer, dir_path);
+    if (dir == NULL) {
+        return NULL;
+    }
+    const int index = dir - analyzer->result.dirs;
+    for (int i = 0; i < analyzer->result.files_count; i++) {
+        const disk_analyzer_file_t* file = &analyzer->result.files[i];
+        if (file->dir == index && strcmp(file->name, name) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+
+void disk_analyzer_stop(disk_analyzer_t* analyzer)
+{
+    if (analyzer->started) {
+        /* The scan stops before its next directory, no need to wait for the whole partition */
+        atomic_store(&analyzer->cancel, true);
+        pthread_join(analyzer->thread, NULL);
+        analyzer->started = false;
+    }
+    analyzer_result_free(&analyzer->scan);
+    analyzer_result_free(&analyzer->result);
+    analyzer->valid = false;
+    analyzer->dirty = false;
+}
@@ -0,0 +1,346 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "disk.h"
+#include "disk_clone.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+
+static void disk_clone_target_fail(disk_clone_target_t* target, const char* error)
+{
+    snprintf(target->error, sizeof(target->error), "%s", error);
+    printf("[CLONE] %s: %s\n", target->disk.name, error);
+    atomic_store(&target->state, CLONE_TARGET_FAILED);
+}
+
+
+/**
+ * @brief Make a chunk available to all the writers
+ */
+static void disk_clone_publish(disk_clone_t* clone, disk_clone_slot_t* slot)
+{
+    pthread_mutex_lock(&clone->mutex);
+    slot->pending_writers = clone->targets_count;
+    clone->chunks_read++;
+    pthread_cond_broadcast(&clone->chunk_ready);
+    pthread_mutex_unlock(&clone->mutex);
+}
+
+
+static void* disk_clone_reader(void* arg)
+{
+    disk_clone_t* clone = (disk_clone_t*) arg;
+    uint64_t chunk = 0;
+    bool failed = false;
+
+    for (int i = 0; i < clone->regions_count && !failed; i++) {
+        uint64_t offset = clone->regions[i].offset;
+        uint64_t remaining = clone->regions[i].length;
+
+        while (remaining > 0 && !failed) {
+            if (atomic_load(&clone->cancel)) {
+                failed = true;
+                break;
+            }
+            disk_clone_slot_t* slot = &clone->slots[chunk % CLONE_SLOTS_COUNT];
+
+            /* Wait for all the writers to be done with the chunk that was in this slot */
+            pthread_mutex_lock(&clone->mutex);
+            while (slot->pending_writers > 0) {
+                pthread_cond_wait(&clone->slot_free, &clone->mutex);
+            }
+            pthread_mutex_unlock(&clone->mutex);
+
+            /* No writer accesses the slot until it is published */
+            slot->offset = offset;
+            slot->len = MIN(remaining, CLONE_CHUNK_SIZE);
+            if (disk_read(clone->source_fd, slot->data, slot->offset, slot->len) != slot->len) {
+                printf("[CLONE] Could not read source %s @ %08llx\n", clone->source.name, (unsigned long long) offset);
+                failed = true;
+                break;
+            }
+            disk_clone_publish(clone, slot);
+
+            offset += slot->len;
+            remaining -= slot->len;
+            chunk++;
+        }
+    }
+
+    pthread_mutex_lock(&clone->mutex);
+    clone->read_done = true;
+    clone->read_failed = failed;
+    pthread_cond_broadcast(&clone->chunk_ready);
+    pthread_mutex_unlock(&clone->mutex);
+
+    atomic_fetch_sub(&clone->running, 1);
+    return NULL;
+}
+
+
+static void* disk_clone_writer(void* arg)
+{
+    disk_clone_target_t* target = (disk_clone_target_t*) arg;
+    disk_clone_t* clone = target->clone;
+
+    for (uint64_t chunk = 0; ; chunk++) {
+        pthread_mutex_lock(&clone->mutex);
+        while (clone->chunks_read <= chunk && !clone->read_done) {
+            pthread_cond_wait(&clone->chunk_ready, &clone->mutex);
+        }
+        const bool available = clone->chunks_read > chunk;
+        pthread_mutex_unlock(&clone->mutex);
+        if (!available) {
+            break;
+        }
+
+        disk_clone_slot_t* slot = &clone->slots[chunk % CLONE_SLOTS_COUNT];
+        /* A failed target keeps consuming the chunks so that it doesn't block the reader */
+        if (atomic_load(&target->state) != CLONE_TARGET_FAILED) {
+            if (disk_write(target->fd, slot->data, slot->offset, slot->len) != slot->len) {
+                disk_clone_target_fail(target, "Write error");
+            } else if (clone->verify && disk_verify_add(&target->verify, slot->offset, slot->data, slot->len) != 0) {
+                disk_clone_target_fail(target, "Could not allocate memory for the verification");
+            } else {
+                atomic_fetch_add(&target->written_bytes, slot->len);
+            }
+        }
+
+        pthread_mutex_lock(&clone->mutex);
+        if (--slot->pending_writers == 0) {
+            pthread_cond_signal(&clone->slot_free);
+        }
+        pthread_mutex_unlock(&clone->mutex);
+    }
+
+    if (atomic_load(&target->state) != CLONE_TARGET_FAILED) {
+        if (clone->read_failed) {
+            disk_clone_target_fail(target, atomic_load(&clone->cancel) ? "Cancelled" : "Could not read the source");
+        } else {
+            /* Reading back right after writing would only hit the OS cache, check the media once all is written */
+            const char* error = NULL;
+            if (clone->verify) {
+                atomic_store(&target->state, CLONE_TARGET_VERIFYING);
+                error = disk_verify_run(&target->verify, target->fd);
+            }
+            if (error) {
+                disk_clone_target_fail(target, error);
+            } else {
+                atomic_store(&target->state, CLONE_TARGET_DONE);
+            }
+        }
+    }
+
+    atomic_fetch_sub(&clone->running, 1);
+    return NULL;
+}
+
+
+/**
+ * @brief Release everything allocated by `disk_clone_start`, threads must not be running anymore.
+ */
+static void disk_clone_free(disk_clone_t* clone)
+{
+    for (int i = 0; i < CLONE_SLOTS_COUNT; i++) {
+        free(clone->slots[i].data);
+        clone->slots[i].data = NULL;
+    }
+    for (int i = 0; i < clone->targets_count; i++) {
+        disk_clone_target_t* target = &clone->targets[i];
+        disk_verify_free(&target->verify);
+        if (target->fd != NULL) {
+            disk_close(target->fd);
+            target->fd = NULL;
+        }
+    }
+    if (clone->source_fd != NULL) {
+        disk_close(clone->source_fd);
+        clone->source_fd = NULL;
+    }
+    free(clone->regions);
+    clone->regions = NULL;
+    pthread_mutex_destroy(&clone->mutex);
+    pthread_cond_destroy(&clone->chunk_ready);
+    pthread_cond_destroy(&clone->slot_free);
+}
+
+
+/**
+ * @brief Make the given writers stop, as if the source could not be read, and wait for them.
+ */
+static void disk_clone_abort_writers(disk_clone_t* clone, int started)
+{
+    pthread_mutex_lock(&clone->mutex);
+    clone->read_done = true;
+    clone->read_failed = true;
+    pthread_cond_broadcast(&clone->chunk_ready);
+    pthread_mutex_unlock(&clone->mutex);
+    for (int i = 0; i < started; i++) {
+        pthread_join(clone->targets[i].thread, NULL);
+    }
+}
+
+
+const char* disk_clone_start(disk_clone_t* clone, disk_info_t* source, disk_info_t** targets, int count, bool verify)
+{
+    static char error_msg[1024];
+    const char* error = NULL;
+
+    assert(clone);
+    if (source == NULL || !source->valid || count <= 0 || count > MAX_DISKS) {
+        return "Invalid source or targets";
+    } else if (source->has_staged_changes) {
+        return "Source disk has staged changes, apply or cancel them first";
+    }
+
+    memset(clone, 0, sizeof(*clone));
+    pthread_mutex_init(&clone->mutex, NULL);
+    pthread_cond_init(&clone->chunk_ready, NULL);
+    pthread_cond_init(&clone->slot_free, NULL);
+    clone->source = *source;
+    clone->verify = verify;
+
+    for (int i = 0; i < count; i++) {
+        disk_clone_target_t* target = &clone->targets[i];
+        disk_info_t* disk = targets[i];
+        if (!disk->valid || disk->has_staged_changes || disk->size_bytes < source->size_bytes ||
+            strcmp(disk->path, source->path) == 0)
+        {
+            snprintf(error_msg, sizeof(error_msg), "Disk %s cannot be a target", disk->name);
+            error = error_msg;
+            goto error;
+        }
+        target->disk = *disk;
+        target->clone = clone;
+        disk_verify_init(&target->verify);
+        clone->targets_count++;
+        if (disk_open(&target->disk, &target->fd)) {
+            target->fd = NULL;
+            snprintf(error_msg, sizeof(error_msg), "Could not open disk %s", disk->name);
+            error = error_msg;
+            goto error;
+        }
+    }
+
+    if (disk_open(&clone->source, &clone->source_fd)) {
+        clone->source_fd = NULL;
+        snprintf(error_msg, sizeof(error_msg), "Could not open disk %s", source->name);
+        error = error_msg;
+        goto error;
+    }
+
+    /* Only the regions that hold data need to be duplicated */
+    clone->regions_count = disk_image_used_regions(clone->source_fd, &clone->source, &clone->regions, &clone->total_bytes);
+    if (clone->regions_count < 0) {
+        clone->regions = NULL;
+        error = "Could not browse the partitions of the source";
+        goto error;
+    }
+
+    for (int i = 0; i < CLONE_SLOTS_COUNT; i++) {
+        clone->slots[i].data = malloc(CLONE_CHUNK_SIZE);
+        if (clone->slots[i].data == NULL) {
+            error = "Could not allocate memory for the duplication";
+            goto error;
+        }
+    }
+
+    printf("[CLONE] Duplicating %llu bytes from %s to %d disks\n",
+           (unsigned long long) clone->total_bytes, source->name, count);
+
+    /* Count all the threads before starting any, so that `running` never reaches 0 too early */
+    atomic_store(&clone->running, count + 1);
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&clone->targets[i].thread, NULL, disk_clone_writer, &clone->targets[i]) != 0) {
+            disk_clone_abort_writers(clone, i);
+            error = "Could not start the writer threads";
+            goto error;
+        }
+    }
+    if (pthread_create(&clone->reader, NULL, disk_clone_reader, clone) != 0) {
+        disk_clone_abort_writers(clone, count);
+        error = "Could not start the reader thread";
+        goto error;
+    }
+
+    return NULL;
+error:
+    disk_clone_free(clone);
+    clone->targets_count = 0;
+    atomic_store(&clone->running, 0);
+    return error;
+}
+
+
+bool disk_clone_running(disk_clone_t* clone)
+{
+    return atomic_load(&clone->running) > 0;
+}
+
+
+void disk_clone_cancel(disk_clone_t* clone)
+{
+    atomic_store(&clone->cancel, true);
+}
+
+
+/**
+ * @brief Read the MBR of a target again and update its entry in the disks list, if it is still there.
+ */
+static void disk_clone_update_target(disk_clone_target_t* target)
+{
+    disk_list_state_t* state = disk_get_state();
+
+    for (int i = 0; i < state->disk_count; i++) {
+        disk_info_t* disk = &state->disks[i];
+        if (disk->is_image != target->disk.is_image || strcmp(disk->path, target->disk.path) != 0) {
+            continue;
+        }
+
+        void* fd = NULL;
+        if (disk->has_staged_changes || disk_open(disk, &fd)) {
+            return;
+        }
+        if (disk_read(fd, disk->mbr, 0, DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE) {
+            disk->has_mbr = (disk->mbr[510] == 0x55 && disk->mbr[511] == 0xAA);
+            disk_parse_mbr_partitions(disk);
+        }
+        disk_close(fd);
+        return;
+    }
+}
+
+
+int disk_clone_finish(disk_clone_t* clone)
+{
+    int failed = 0;
+
+    if (clone->targets_count == 0) {
+        return 0;
+    }
+
+    pthread_join(clone->reader, NULL);
+    for (int i = 0; i < clone->targets_count; i++) {
+        pthread_join(clone->targets[i].thread, NULL);
+    }
+
+    /* Close the disks before parsing them again */
+    disk_clone_free(clone);
+
+    for (int i = 0; i < clone->targets_count; i++) {
+        disk_clone_target_t* target = &clone->targets[i];
+        if (atomic_load(&target->state) == CLONE_TARGET_FAILED) {
+            failed++;
+        }
+        disk_clone_update_target(target);
+    }
+
+    return failed;
+}
@@ -0,0 +1,259 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define host_mkdir(path)    _mkdir(path)
+#else
+#define host_mkdir(path)    mkdir(path, 0755)
+#endif
+#include "disk.h"
+#include "disk_export.h"
+#include "disk_worker.h"
+#include "zealfs_v2.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Number of entries retrieved from a directory at once */
+#define EXPORT_DIR_BATCH        64
+#define EXPORT_PATH_LEN         1024
+
+typedef struct {
+    char*          host_path;
+    zealfs_entry_t entry;
+    bool           failed;
+} export_file_t;
+
+
+typedef struct {
+    export_file_t*     files;
+    int                files_count;
+    int                files_capacity;
+    int                directories;
+    int                skipped;
+    uint64_t           total_bytes;
+    /* Shared between the threads */
+    atomic_int         next_file;
+    atomic_uint_fast64_t written_bytes;
+} export_job_t;
+
+
+static int export_add_file(export_job_t* job, const char* host_path, const zealfs_entry_t* entry)
+{
+    if (job->files_count == job->files_capacity) {
+        const int capacity = job->files_capacity ? job->files_capacity * 2 : 64;
+        export_file_t* files = realloc(job->files, capacity * sizeof(export_file_t));
+        if (files == NULL) {
+            return -1;
+        }
+        job->files = files;
+        job->files_capacity = capacity;
+    }
+
+    export_file_t* file = &job->files[job->files_count];
+    memset(file, 0, sizeof(*file));
+    file->host_path = strdup(host_path);
+    if (file->host_path == NULL) {
+        return -1;
+    }
+    file->entry = *entry;
+    job->files_count++;
+    job->total_bytes += entry->size;
+    return 0;
+}
+
+
+/**
+ * @brief Check that an entry name, read from a partition that may be corrupted or crafted, only
+ *        designates an entry of the host directory it is extracted to.
+ */
+static bool export_name_is_safe(const char* name, int len)
+{
+    if (len == 0 || (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.')) {
+        return false;
+    }
+    return memchr(name, '/', len) == NULL && memchr(name, '\\', len) == NULL;
+}
+
+
+/**
+ * @brief Gather all the files of a directory and of its sub-directories, the host directories
+ * are created along the way so that the threads only have to create the files.
+ *
+ * @param dir_path Absolute path of the directory, without any trailing `/`, except for the root.
+ * @param host_dir Path of the host directory receiving the content of `dir_path`.
+ */
+static int export_browse(export_job_t* job, zealfs_context_t* zealfs, const char* dir_path, const char* host_dir)
+{
+    zealfs_entry_t entries[EXPORT_DIR_BATCH];
+    char path[EXPORT_PATH_LEN];
+    char host_path[EXPORT_PATH_LEN];
+    zealfs_dir_iter_t iter;
+    zealfs_fd_t fd;
+    int count;
+    const bool is_root = strcmp(dir_path, "/") == 0;
+
+    if (host_mkdir(host_dir) != 0 && errno != EEXIST) {
+        printf("[EXPORT] Could not create directory %s: %s\n", host_dir, strerror(errno));
+        return -1;
+    }
+    job->directories++;
+
+    if (zealfs_opendir(dir_path, zealfs, &fd) < 0 || zealfs_dir_iter_init(zealfs, &fd, &iter) < 0) {
+        printf("[EXPORT] Could not open directory %s\n", dir_path);
+        return -1;
+    }
+
+    while ((count = zealfs_dir_iter_next(zealfs, &iter, entries, EXPORT_DIR_BATCH)) > 0) {
+        for (int i = 0; i < count; i++) {
+            const zealfs_entry_t* entry = &entries[i];
+            const int name_len = strnlen(entry->name, NAME_MAX_LEN);
+            const bool is_dir = entry->flags & IS_DIR;
+            if (!export_name_is_safe(entry->name, name_len)) {
+                printf("[EXPORT] Skipping invalid name %.*s in %s\n", name_len, entry->name, dir_path);
+                job->skipped++;
+                continue;
+            }
+            const int path_len = snprintf(path, sizeof(path), "%s/%.*s", is_root ? "" : dir_path, name_len, entry->name);
+            const int host_len = snprintf(host_path, sizeof(host_path), "%s/%.*s", host_dir, name_len, entry->name);
+            if (path_len >= (int) sizeof(path) || host_len >= (int) sizeof(host_path)) {
+                printf("[EXPORT] Skipping %.*s in %s, path too long\n", name_len, entry->name, dir_path);
+                job->skipped++;
+                continue;
+            }
+
+            const int ret = is_dir ? export_browse(job, zealfs, path, host_path) : export_add_file(job, host_path, entry);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+static int export_compare_size(const void* a, const void* b)
+{
+    const export_file_t* fa = (const export_file_t*) a;
+    const export_file_t* fb = (const export_file_t*) b;
+    return (fa->entry.size < fb->entry.size) - (fa->entry.size > fb->entry.size);
+}
+
+
+static void export_file(disk_worker_t* worker, export_file_t* file)
+{
+    zealfs_fd_t fd = { .entry = file->entry };
+    const uint32_t size = file->entry.size;
+
+    FILE* out = fopen(file->host_path, "wb");
+    if (out == NULL) {
+        printf("[EXPORT] Could not create file %s: %s\n", file->host_path, strerror(errno));
+        file->failed = true;
+        return;
+    }
+
+    for (uint32_t offset = 0; offset < size; ) {
+        const int bytes_read = zealfs_read(worker->zealfs, &fd, worker->buffer, MIN(size - offset, EXPORT_READ_SIZE), offset);
+        if (bytes_read <= 0 || fwrite(worker->buffer, 1, bytes_read, out) != (size_t) bytes_read) {
+            printf("[EXPORT] Could not extract file %s\n", file->host_path);
+            file->failed = true;
+            break;
+        }
+        offset += bytes_read;
+    }
+
+    if (fclose(out) != 0) {
+        file->failed = true;
+    }
+}
+
+
+static void export_worker(disk_worker_t* worker)
+{
+    export_job_t* job = (export_job_t*) worker->job;
+    int index;
+
+    /* Files are given out one by one, biggest first, so that the last ones to be given out are
+     * small and all the threads finish at about the same time */
+    while ((index = atomic_fetch_add(&job->next_file, 1)) < job->files_count) {
+        export_file_t* file = &job->files[index];
+        export_file(worker, file);
+        const uint64_t written = atomic_fetch_add(&job->written_bytes, file->entry.size) + file->entry.size;
+        /* Only the main thread is allowed to update the progress bar */
+        if (worker->main_thread && job->total_bytes > 0) {
+            disk_update_progress_bar((int) (written * 100 / job->total_bytes));
+        }
+    }
+}
+
+
+const char* disk_export_dir(disk_info_t* disk, partition_t* part, const char* fs_dir,
+                            const char* host_dir, disk_export_stats_t* stats)
+{
+    disk_worker_t workers[EXPORT_MAX_THREADS];
+    export_job_t job = { 0 };
+    const char* error = NULL;
+    /* The first worker is deinitialized even if it couldn't be initialized */
+    int started = 1;
+
+    memset(stats, 0, sizeof(*stats));
+    if (disk == NULL || part == NULL || !disk_is_valid_zealfs_partition(part)) {
+        return "Please select a ZealFS partition";
+    }
+
+    /* The main thread browses the directory first, then takes part in the extraction */
+    if (disk_worker_init(&workers[0], disk, part, EXPORT_READ_SIZE, &job)) {
+        error = "Could not open the disk";
+        goto deinit;
+    }
+    if (export_browse(&job, workers[0].zealfs, fs_dir, host_dir) < 0) {
+        error = "Could not browse the directory";
+        goto deinit;
+    }
+
+    qsort(job.files, job.files_count, sizeof(export_file_t), export_compare_size);
+    /* The threads mostly wait for the disk or the host, so even a single core gets two of them,
+     * the reads of one overlap with the writes of the other */
+    const int threads = disk_workers_count(job.files_count, 2, EXPORT_MAX_THREADS);
+    printf("[EXPORT] Extracting %d files, %llu bytes, with %d threads\n",
+           job.files_count, (unsigned long long) job.total_bytes, threads);
+
+    disk_init_progress_bar();
+    started = disk_workers_run(workers, threads, disk, part, EXPORT_READ_SIZE, export_worker);
+    disk_destroy_progress_bar();
+
+    stats->threads = started;
+    for (int i = 0; i < job.files_count; i++) {
+        if (job.files[i].failed) {
+            error = "Some files could not be extracted";
+        } else {
+            stats->files++;
+            stats->bytes_written += job.files[i].entry.size;
+        }
+    }
+    if (error == NULL && job.skipped > 0) {
+        error = "Some entries were skipped, their name can't be used on the host";
+    }
+
+deinit:
+    stats->directories = job.directories;
+    stats->skipped = job.skipped;
+    for (int i = 0; i < started; i++) {
+        disk_worker_deinit(&workers[i]);
+    }
+    for (int i = 0; i < job.files_count; i++) {
+        free(job.files[i].host_path);
+    }
+    free(job.files);
+    return error;
+}
@@ -0,0 +1,386 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "disk.h"
+#include "disk_image.h"
+#include "ui/statusbar.h"
+#include "zealfs_v2.h"
+
+#define ALIGN_UP(size,bound) (((size) + (bound) - 1) & ~((bound) - 1))
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Size of the buffer used to copy the regions from one disk to another */
+#define COPY_CHUNK_SIZE     (1*MB)
+/* Size of the ZealFS header to read, rounded up to the sector size */
+#define ZFS_HEADER_READ_SIZE    ALIGN_UP(ZFS_HEADER_MAX_SIZE, DISK_SECTOR_SIZE)
+
+
+typedef struct {
+    disk_region_t* regions;
+    int count;
+    int capacity;
+} region_list_t;
+
+
+/**
+ * @brief Add a region to the list, the bounds are extended to the sectors containing them.
+ */
+static int region_list_add(region_list_t* list, uint64_t offset, uint64_t length)
+{
+    const uint64_t start = offset & ~(DISK_SECTOR_SIZE - 1);
+    const uint64_t end = ALIGN_UP(offset + length, DISK_SECTOR_SIZE);
+
+    /* The pages of a partition are browsed in order, most of the time the region extends the last one */
+    if (list->count > 0) {
+        disk_region_t* last = &list->regions[list->count - 1];
+        if (start >= last->offset && start <= last->offset + last->length) {
+            last->length = MAX(last->offset + last->length, end) - last->offset;
+            return 0;
+        }
+    }
+
+    if (list->count == list->capacity) {
+        const int capacity = MAX(list->capacity * 2, 64);
+        disk_region_t* regions = realloc(list->regions, capacity * sizeof(disk_region_t));
+        if (regions == NULL) {
+            return -1;
+        }
+        list->regions = regions;
+        list->capacity = capacity;
+    }
+
+    list->regions[list->count++] = (disk_region_t) {
+        .offset = start,
+        .length = end - start,
+    };
+    return 0;
+}
+
+
+static int region_compare(const void* a, const void* b)
+{
+    const disk_region_t* ra = (const disk_region_t*) a;
+    const disk_region_t* rb = (const disk_region_t*) b;
+    return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+
+/**
+ * @brief Sort the regions and merge the ones that overlap or touch each other.
+ */
+static void region_list_merge(region_list_t* list)
+{
+    if (list->count == 0) {
+        return;
+    }
+
+    qsort(list->regions, list->count, sizeof(disk_region_t), region_compare);
+    int merged = 0;
+    for (int i = 1; i < list->count; i++) {
+        disk_region_t* last = &list->regions[merged];
+        const disk_region_t* current = &list->regions[i];
+        if (current->offset <= last->offset + last->length) {
+            last->length = MAX(last->offset + last->length, current->offset + current->length) - last->offset;
+        } else {
+            list->regions[++merged] = *current;
+        }
+    }
+    list->count = merged + 1;
+}
+
+
+/**
+ * @brief Add the metadata and the allocated pages of a ZealFS partition to the list.
+ */
+static int disk_image_zealfs_regions(void* disk_fd, const partition_t* part, uint64_t part_size, region_list_t* list)
+{
+    static uint8_t buffer[ZFS_HEADER_READ_SIZE];
+    const uint64_t part_offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+
+    if (part_size < ZFS_HEADER_READ_SIZE ||
+        disk_read(disk_fd, buffer, part_offset, ZFS_HEADER_READ_SIZE) != ZFS_HEADER_READ_SIZE)
+    {
+        printf("[IMAGE] Could not read ZealFS header @ %08llx\n", (unsigned long long) part_offset);
+        return -1;
+    }
+
+    const zealfs_header_t* header = (const zealfs_header_t*) buffer;
+    if (header->magic != 'Z' || header->version != 2 || header->page_size > 8) {
+        /* The partition was not formatted, its content is unknown, keep all of it */
+        return region_list_add(list, part_offset, part_size);
+    }
+
+    /* Each bit of the bitmap represents a page, the header and the FAT pages are always marked as allocated */
+    const uint64_t page_size = 256ULL << header->page_size;
+    const uint32_t pages_count = MIN((uint64_t) header->bitmap_size * 8, part_size / page_size);
+    for (uint32_t page = 0; page < pages_count; page++) {
+        if ((header->pages_bitmap[page / 8] & (1 << (page % 8))) &&
+            region_list_add(list, part_offset + page * page_size, page_size) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int disk_image_used_regions(void* disk_fd, disk_info_t* disk, disk_region_t** regions, uint64_t* used_bytes)
+{
+    region_list_t list = { 0 };
+
+    /* The MBR, or the first sector when there is none, is always kept */
+    int ret = region_list_add(&list, 0, DISK_SECTOR_SIZE);
+
+    if (!disk->has_mbr && !disk_is_valid_zealfs_partition(&disk->partitions[0])) {
+        /* No partition table and no file system we know about, keep the whole disk */
+        ret = region_list_add(&list, 0, disk->size_bytes);
+    }
+
+    for (int i = 0; ret == 0 && i < MAX_PART_COUNT; i++) {
+        partition_t* part = &disk->partitions[i];
+        const uint64_t part_offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+        if (!part->active || part->size_sectors == 0 || part_offset >= disk->size_bytes) {
+            continue;
+        }
+        /* Make sure the partition table doesn't make us read past the end of the disk */
+        const uint64_t part_size = MIN((uint64_t) part->size_sectors * DISK_SECTOR_SIZE, disk->size_bytes - part_offset);
+
+        if (disk_is_valid_zealfs_partition(part)) {
+            ret = disk_image_zealfs_regions(disk_fd, part, part_size, &list);
+        } else {
+            ret = region_list_add(&list, part_offset, part_size);
+        }
+    }
+
+    if (ret != 0) {
+        free(list.regions);
+        return -1;
+    }
+
+    region_list_merge(&list);
+
+    if (used_bytes) {
+        *used_bytes = 0;
+        for (int i = 0; i < list.count; i++) {
+            *used_bytes += list.regions[i].length;
+        }
+    }
+    *regions = list.regions;
+    return list.count;
+}
+
+
+/**
+ * @brief Copy the given regions from one opened disk to another, showing the progress.
+ */
+static const char* disk_image_copy_regions(void* src_fd, void* dst_fd, const disk_region_t* regions,
+                                           int count, uint64_t total_bytes)
+{
+    const char* error = NULL;
+    uint64_t copied = 0;
+
+    uint8_t* buffer = malloc(COPY_CHUNK_SIZE);
+    if (buffer == NULL) {
+        return "Could not allocate memory to copy the disk";
+    }
+
+    disk_init_progress_bar();
+    for (int i = 0; i < count && error == NULL; i++) {
+        uint64_t offset = regions[i].offset;
+        uint64_t remaining = regions[i].length;
+
+        while (remaining > 0) {
+            const uint32_t len = MIN(remaining, COPY_CHUNK_SIZE);
+            if (disk_read(src_fd, buffer, offset, len) != len) {
+                error = "Could not read from the source";
+                break;
+            }
+            if (disk_write(dst_fd, buffer, offset, len) != len) {
+                error = "Could not write to the destination";
+                break;
+            }
+            offset += len;
+            remaining -= len;
+            copied += len;
+            disk_update_progress_bar((int) (copied * 100 / total_bytes));
+        }
+    }
+    disk_destroy_progress_bar();
+
+    free(buffer);
+    return error;
+}
+
+
+/**
+ * @brief Fill a disk structure that can be passed to the OS functions to access an image file.
+ */
+static void disk_image_info(disk_info_t* image, const char* path, uint64_t size)
+{
+    memset(image, 0, sizeof(disk_info_t));
+    snprintf(image->path, sizeof(image->path), "%s", path);
+    snprintf(image->name, sizeof(image->name), "%s", disk_get_basename(path));
+    image->size_bytes = size;
+    image->valid = true;
+    image->is_image = true;
+}
+
+
+const char* disk_image_dump(disk_info_t* disk, const char* path)
+{
+    static char error_msg[1024];
+    disk_info_t image;
+    disk_region_t* regions = NULL;
+    uint64_t used_bytes = 0;
+    void* disk_fd = NULL;
+    void* image_fd = NULL;
+    const char* error = NULL;
+
+    if (disk == NULL || !disk->valid) {
+        return "Invalid disk";
+    } else if (disk->has_staged_changes) {
+        return "Disk has staged changes, apply or cancel them first";
+    } else if (strcmp(disk->path, path) == 0) {
+        return "Cannot dump a disk into itself";
+    }
+
+    if (disk_open(disk, &disk_fd)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open disk %s", disk->name);
+        return error_msg;
+    }
+
+    const int count = disk_image_used_regions(disk_fd, disk, &regions, &used_bytes);
+    if (count < 0) {
+        error = "Could not browse the partitions of the disk";
+        goto close_disk;
+    }
+
+    /* Create an image of the same size, only the used regions will be allocated on the host */
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not create image %s", path);
+        error = error_msg;
+        goto close_disk;
+    }
+    const int ret = disk_set_image_size(file, disk->size_bytes, true);
+    fclose(file);
+    if (ret != 0) {
+        snprintf(error_msg, sizeof(error_msg), "Could not set the size of image %s", path);
+        error = error_msg;
+        goto close_disk;
+    }
+
+    disk_image_info(&image, path, disk->size_bytes);
+    if (disk_open(&image, &image_fd)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open image %s", path);
+        error = error_msg;
+        goto close_disk;
+    }
+
+    printf("[IMAGE] Dumping %d regions, %llu/%llu bytes\n", count,
+           (unsigned long long) used_bytes, (unsigned long long) disk->size_bytes);
+    error = disk_image_copy_regions(disk_fd, image_fd, regions, count, used_bytes);
+    disk_close(image_fd);
+
+    if (error == NULL) {
+        char used_str[32];
+        disk_get_size_str(used_bytes, used_str, sizeof(used_str));
+        ui_statusbar_printf("Dumped %s of %s to %s\n", used_str, disk->name, path);
+    }
+
+close_disk:
+    free(regions);
+    disk_close(disk_fd);
+    return error;
+}
+
+
+const char* disk_image_restore(disk_info_t* disk, const char* path)
+{
+    static char error_msg[1024];
+    disk_info_t image;
+    disk_region_t* regions = NULL;
+    uint64_t used_bytes = 0;
+    void* disk_fd = NULL;
+    void* image_fd = NULL;
+    const char* error = NULL;
+
+    if (disk == NULL || !disk->valid) {
+        return "Invalid disk";
+    } else if (disk->has_staged_changes) {
+        return "Disk has staged changes, apply or cancel them first";
+    } else if (strcmp(disk->path, path) == 0) {
+        return "Cannot restore a disk from itself";
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open image %s", path);
+        return error_msg;
+    }
+
+    /* Get the size of the file by seeking to the end */
+    fseek(file, 0, SEEK_END);
+    disk_image_info(&image, path, ftell(file));
+    rewind(file);
+    const size_t rd = fread(image.mbr, 1, sizeof(image.mbr), file);
+    fclose(file);
+    if (rd != sizeof(image.mbr)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not read MBR from image %s", path);
+        return error_msg;
+    }
+
+    if (image.size_bytes > disk->size_bytes) {
+        return "The image is bigger than the disk";
+    }
+
+    /* The partitions of the image determine the regions to write */
+    image.has_mbr = (image.mbr[510] == 0x55 && image.mbr[511] == 0xAA);
+    disk_parse_mbr_partitions(&image);
+
+    if (disk_open(&image, &image_fd)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open image %s", path);
+        return error_msg;
+    }
+
+    const int count = disk_image_used_regions(image_fd, &image, &regions, &used_bytes);
+    if (count < 0) {
+        error = "Could not browse the partitions of the image";
+        goto close_image;
+    }
+
+    if (disk_open(disk, &disk_fd)) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open disk %s", disk->name);
+        error = error_msg;
+        goto close_image;
+    }
+
+    printf("[IMAGE] Restoring %d regions, %llu/%llu bytes\n", count,
+           (unsigned long long) used_bytes, (unsigned long long) image.size_bytes);
+    error = disk_image_copy_regions(image_fd, disk_fd, regions, count, used_bytes);
+
+    /* Even on error, the MBR may have been overwritten, get it back from the disk */
+    if (disk_read(disk_fd, disk->mbr, 0, DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE) {
+        disk->has_mbr = (disk->mbr[510] == 0x55 && disk->mbr[511] == 0xAA);
+        disk_parse_mbr_partitions(disk);
+    }
+    disk_close(disk_fd);
+
+    if (error == NULL) {
+        char used_str[32];
+        disk_get_size_str(used_bytes, used_str, sizeof(used_str));
+        ui_statusbar_printf("Restored %s from %s to %s\n", used_str, path, disk->name);
+    }
+
+close_image:
+    free(regions);
+    disk_close(image_fd);
+    return error;
+}
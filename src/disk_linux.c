@@ -3,6 +3,8 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+/* Required for `fallocate` */
+#define _GNU_SOURCE
 #include "disk.h"
 #include <stdio.h>
 #include <string.h>
@@ -11,9 +13,16 @@
 #include <errno.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <linux/fs.h>
+#include <linux/falloc.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <linux/netlink.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <dirent.h>
 
 static const char* s_image_files[] = {
     // "emulated_sd.img",
@@ -21,6 +30,57 @@ static const char* s_image_files[] = {
     // "test_disk.img"
 };
 
+/**
+ * @brief Read a numeric attribute of a block device from sysfs.
+ *
+ * @return The value, 0 if the attribute doesn't exist.
+ */
+static uint64_t disk_sysfs_value(const char* path, const char* attr)
+{
+    char sys_path[512];
+    unsigned long long value = 0;
+    const char* name = strrchr(path, '/');
+
+    snprintf(sys_path, sizeof(sys_path), "/sys/block/%s/%s", name ? name + 1 : path, attr);
+    FILE* file = fopen(sys_path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    if (fscanf(file, "%llu", &value) != 1) {
+        value = 0;
+    }
+    fclose(file);
+    return value;
+}
+
+
+/**
+ * @brief Get the allocation unit of a block device: SD cards behind an MMC host report their
+ * erase size, other devices may report an optimal I/O size.
+ *
+ * @return The size in bytes, 0 if the device doesn't report any.
+ */
+static uint32_t disk_detect_au_size(const char* path)
+{
+    const char* attrs[] = { "device/preferred_erase_size", "queue/optimal_io_size" };
+
+    for (size_t i = 0; i < DIM(attrs); i++) {
+        const uint64_t size = disk_sysfs_value(path, attrs[i]);
+        /* Only keep sizes that make sense as an allocation unit */
+        if (size >= 64*KB && size <= 64*MB && (size & (size - 1)) == 0) {
+            return (uint32_t) size;
+        }
+    }
+    return 0;
+}
+
+
+static int disk_is_loop(const char* devname)
+{
+    return strncmp(devname, "loop", 4) == 0 && devname[4] >= '0' && devname[4] <= '9';
+}
+
+
 static disk_err_t disk_try_open(const char* path, disk_info_t* info, int is_file)
 {
     int fd = open(path, O_RDONLY);
@@ -49,6 +109,10 @@ static disk_err_t disk_try_open(const char* path, disk_info_t* info, int is_file
         return ERR_INVALID;
     }
 
+    if (!is_file) {
+        info->au_size = disk_detect_au_size(path);
+    }
+
     info->valid = info->size_bytes <= MAX_DISK_SIZE;
     if (!info->valid) {
         fprintf(stderr, "%s exceeds max disk size of %lluGB with %lluGB bytes\n", path, MAX_DISK_SIZE/GB, info->size_bytes/GB);
@@ -68,22 +132,69 @@ static disk_err_t disk_try_open(const char* path, disk_info_t* info, int is_file
 }
 
 
+/**
+ * @brief Only keep the `/dev/sdX` disks and the loop devices, which are handy to test images as
+ * if they were real disks. Both the full scan and the hotplug events rely on it.
+ */
+static int disk_supported(const char* devname)
+{
+    if (strncmp(devname, "sd", 2) == 0) {
+        return devname[2] >= 'a' && devname[2] <= 'z' && devname[3] == 0;
+    }
+    return disk_is_loop(devname);
+}
+
+
+/**
+ * @brief Check whether a disk is a loop device that has no file attached, its size is 0.
+ */
+static int disk_is_detached_loop(const disk_info_t* info)
+{
+    return disk_is_loop(disk_get_basename(info->path)) && info->size_bytes == 0;
+}
+
+
+static int disk_scan_filter(const struct dirent* entry)
+{
+    return disk_supported(entry->d_name);
+}
+
+
 disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count)
 {
+    struct dirent** entries;
+    disk_err_t ret = ERR_SUCCESS;
+
     memset(out_disks, 0, sizeof(disk_info_t) * max_disks);
     *out_count = 0;
-    for (char c = 'a'; c <= 'z' && *out_count < max_disks; ++c) {
+
+    /* Every block device of the system is listed in sysfs, keep the same ones as the hotplug events */
+    const int count = scandir("/sys/block", &entries, disk_scan_filter, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "[LINUX] Could not list the block devices: %s\n", strerror(errno));
+        return ERR_INVALID;
+    }
+    for (int i = 0; i < count && ret == ERR_SUCCESS && *out_count < max_disks; ++i) {
         char path[256];
-        snprintf(path, sizeof(path), "/dev/sd%c", c);
-        disk_err_t err = disk_try_open(path, &out_disks[*out_count], 0);
-        if (err == ERR_SUCCESS) {
+        disk_info_t* info = &out_disks[*out_count];
+        /* The names of the supported devices are short, they can't be truncated */
+        snprintf(path, sizeof(path), "/dev/%.32s", entries[i]->d_name);
+        disk_err_t err = disk_try_open(path, info, 0);
+        if (err == ERR_SUCCESS && !disk_is_detached_loop(info)) {
             (*out_count)++;
-        } else if (err == ERR_INVALID) {
-            continue;
+        } else if (err == ERR_SUCCESS || err == ERR_INVALID) {
+            memset(info, 0, sizeof(*info));
         } else {
-            return err;
+            ret = err;
         }
     }
+    for (int i = 0; i < count; ++i) {
+        free(entries[i]);
+    }
+    free(entries);
+    if (ret != ERR_SUCCESS) {
+        return ret;
+    }
 
 
     /* Check for images */
@@ -100,63 +211,7 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count)
 }
 
 
-const char* disk_write_changes(disk_info_t* disk)
-{
-    assert(disk);
-    assert(disk->valid);
-    assert(disk->has_staged_changes);
-
-    static char error_msg[1024];
-
-    /* Reopen the disk to write it back */
-    int fd = open(disk->path, O_WRONLY);
-    if (fd < 0) {
-        sprintf(error_msg, "Could not open disk %s: %s\n", disk->name, strerror(errno));
-        return error_msg;
-    }
-
-    /* Write MBR */
-    if (disk->has_mbr) {
-        ssize_t wr = write(fd, disk->staged_mbr, sizeof(disk->staged_mbr));
-        if (wr != DISK_SECTOR_SIZE) {
-            sprintf(error_msg, "Could not write disk %s: %s\n", disk->name, strerror(errno));
-            goto error;
-        }
-    }
-
-    /* Write any new partition */
-    for (int i = 0; i < MAX_PART_COUNT; i++) {
-        const partition_t* part = &disk->staged_partitions[i];
-        if (part->data != NULL && part->data_len != 0) {
-            /* Data need to be written back to the disk */
-            off_t part_offset = part->start_lba * DISK_SECTOR_SIZE;
-            const off_t offset = lseek(fd, part_offset, SEEK_SET);
-            printf("[DISK] Writing partition %d @ %08" PRIx64 ", %d bytes\n", i, (uint64_t) offset, part->data_len);
-            if (offset != part_offset){
-                sprintf(error_msg, "Could not offset in the disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-            ssize_t wr = write(fd, part->data, part->data_len);
-            if (wr != part->data_len) {
-                sprintf(error_msg, "Could not write partition to disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-        } else {
-            printf("[DISK] Partition %d has no changes\n", i);
-        }
-    }
-
-    close(fd);
-    /* Apply the changes in RAM too */
-    disk_apply_changes(disk);
-    return NULL;
-error:
-    close(fd);
-    return error_msg;
-}
-
-
-int disk_open(disk_info_t* disk, void** ret_fd)
+int disk_os_open(disk_info_t* disk, void** ret_fd)
 {
     assert(disk);
     assert(disk->valid);
@@ -173,15 +228,11 @@ int disk_open(disk_info_t* disk, void** ret_fd)
 }
 
 
-ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 {
     int fd = (int)(intptr_t) disk_fd;
-    if (lseek(fd, disk_offset, SEEK_SET) != disk_offset) {
-        fprintf(stderr, "[LINUX] Could not seek to offset %" PRId64 ": %s\n", (uint64_t) disk_offset, strerror(errno));
-        return -1;
-    }
-
-    ssize_t bytes_read = read(fd, buffer, len);
+    /* Positional read, the offset of the descriptor is left untouched */
+    ssize_t bytes_read = pread(fd, buffer, len, disk_offset);
     if (bytes_read < 0) {
         fprintf(stderr, "[LINUX] Could not read from disk: %s\n", strerror(errno));
     }
@@ -190,7 +241,7 @@ ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 }
 
 
-ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
 {
     int fd = (int)(intptr_t) disk_fd;
     if (lseek(fd, disk_offset, SEEK_SET) != disk_offset) {
@@ -207,12 +258,159 @@ ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_
 }
 
 
-void disk_close(void* disk_fd)
+ssize_t disk_os_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct iovec vec[DISK_WRITEV_MAX];
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; ) {
+        const int n = (count - i < DISK_WRITEV_MAX) ? count - i : DISK_WRITEV_MAX;
+        size_t len = 0;
+        for (int j = 0; j < n; j++) {
+            vec[j].iov_base = iov[i + j].base;
+            vec[j].iov_len = iov[i + j].len;
+            len += iov[i + j].len;
+        }
+        const ssize_t bytes_read = preadv(fd, vec, n, disk_offset + total);
+        if (bytes_read < 0) {
+            fprintf(stderr, "[LINUX] Could not read from disk: %s\n", strerror(errno));
+            return -1;
+        }
+        total += bytes_read;
+        if ((size_t) bytes_read != len) {
+            break;
+        }
+        i += n;
+    }
+
+    return total;
+}
+
+
+ssize_t disk_os_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct iovec vec[DISK_WRITEV_MAX];
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; ) {
+        const int n = (count - i < DISK_WRITEV_MAX) ? count - i : DISK_WRITEV_MAX;
+        size_t len = 0;
+        for (int j = 0; j < n; j++) {
+            vec[j].iov_base = (void*) iov[i + j].base;
+            vec[j].iov_len = iov[i + j].len;
+            len += iov[i + j].len;
+        }
+        const ssize_t bytes_written = pwritev(fd, vec, n, disk_offset + total);
+        if (bytes_written < 0) {
+            fprintf(stderr, "[LINUX] Could not write to disk: %s\n", strerror(errno));
+            return -1;
+        }
+        total += bytes_written;
+        if ((size_t) bytes_written != len) {
+            break;
+        }
+        i += n;
+    }
+
+    return total;
+}
+
+
+void disk_os_close(void* disk_fd)
 {
     close((int)(intptr_t) disk_fd);
 }
 
 
+int disk_set_image_size(FILE* file, uint64_t size, bool sparse)
+{
+    const int fd = fileno(file);
+
+    /* Make sure the data written so far (MBR) reached the file */
+    if (fflush(file) != 0 || ftruncate(fd, size) != 0) {
+        fprintf(stderr, "[LINUX] Could not resize image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (!sparse) {
+        const int err = posix_fallocate(fd, 0, size);
+        if (err != 0) {
+            fprintf(stderr, "[LINUX] Could not preallocate image: %s\n", strerror(err));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int disk_os_discard(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    /* Punch holes in image files, let the controller of block devices know the range is unused */
+    if (S_ISREG(st.st_mode)) {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, disk_offset, len) != 0) {
+            if (errno != EOPNOTSUPP) {
+                fprintf(stderr, "[LINUX] Could not punch hole in image: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+        return 0;
+    } else if (!S_ISBLK(st.st_mode)) {
+        return -1;
+    }
+
+    /* The range must be aligned on the logical sectors, only discard the sectors fully covered */
+    int sector_size = DISK_SECTOR_SIZE;
+    if (ioctl(fd, BLKSSZGET, &sector_size) != 0 || sector_size <= 0) {
+        sector_size = DISK_SECTOR_SIZE;
+    }
+    const uint64_t start = ((uint64_t) disk_offset + sector_size - 1) / sector_size * sector_size;
+    const uint64_t end = ((uint64_t) disk_offset + len) / sector_size * sector_size;
+    if (end <= start) {
+        return -1;
+    }
+
+    uint64_t range[2] = { start, end - start };
+    if (ioctl(fd, BLKDISCARD, &range) != 0) {
+        if (errno != EOPNOTSUPP) {
+            fprintf(stderr, "[LINUX] Could not discard range of the disk: %s\n", strerror(errno));
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int disk_os_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    int fd = (int)(intptr_t) disk_fd;
+
+    if (fdatasync(fd) != 0) {
+        fprintf(stderr, "[LINUX] Could not flush disk: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Clean pages are dropped right away, for block devices too */
+    const int err = posix_fadvise(fd, disk_offset, len, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+        fprintf(stderr, "[LINUX] Could not drop the cache: %s\n", strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 void disk_init_progress_bar(void)
 {
 }
@@ -227,3 +425,114 @@ void disk_update_progress_bar(int percent)
 void disk_destroy_progress_bar(void)
 {
 }
+
+
+static int s_hotplug_fd = -1;
+
+
+int disk_hotplug_init(void)
+{
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        /* Kernel uevents multicast group */
+        .nl_groups = 1,
+    };
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        fprintf(stderr, "[LINUX] Could not create uevent socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "[LINUX] Could not listen to uevents: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    s_hotplug_fd = fd;
+    return 0;
+}
+
+
+int disk_hotplug_poll(disk_hotplug_event_t* event)
+{
+    char buffer[4096];
+
+    if (s_hotplug_fd < 0) {
+        return 0;
+    }
+
+    while (1) {
+        ssize_t len = recv(s_hotplug_fd, buffer, sizeof(buffer) - 1, 0);
+        if (len <= 0) {
+            if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "[LINUX] Could not receive uevent: %s\n", strerror(errno));
+            }
+            return 0;
+        }
+        buffer[len] = 0;
+
+        /* The message is made of `action@devpath` followed by `KEY=VALUE` strings, all NULL-terminated */
+        const char* action = NULL;
+        const char* subsystem = NULL;
+        const char* devtype = NULL;
+        const char* devname = NULL;
+        for (char* field = buffer; field < buffer + len; field += strlen(field) + 1) {
+            if (strncmp(field, "ACTION=", 7) == 0) {
+                action = field + 7;
+            } else if (strncmp(field, "SUBSYSTEM=", 10) == 0) {
+                subsystem = field + 10;
+            } else if (strncmp(field, "DEVTYPE=", 8) == 0) {
+                devtype = field + 8;
+            } else if (strncmp(field, "DEVNAME=", 8) == 0) {
+                devname = field + 8;
+            }
+        }
+
+        if (action == NULL || subsystem == NULL || devtype == NULL || devname == NULL ||
+            strcmp(subsystem, "block") != 0 || strcmp(devtype, "disk") != 0 ||
+            !disk_supported(disk_get_basename(devname)))
+        {
+            continue;
+        }
+
+        memset(&event->disk, 0, sizeof(event->disk));
+        char path[256];
+        snprintf(path, sizeof(path), "/dev/%s", disk_get_basename(devname));
+
+        if (strcmp(action, "remove") == 0) {
+            strcpy(event->disk.path, path);
+            event->action = DISK_HOTPLUG_REMOVE;
+        } else if (strcmp(action, "add") == 0 || strcmp(action, "change") == 0) {
+            event->action = (action[0] == 'a') ? DISK_HOTPLUG_ADD : DISK_HOTPLUG_CHANGE;
+            /* A detached loop device is considered removed */
+            if (disk_try_open(path, &event->disk, 0) != ERR_SUCCESS || disk_is_detached_loop(&event->disk)) {
+                strcpy(event->disk.path, path);
+                event->action = DISK_HOTPLUG_REMOVE;
+            }
+        } else {
+            continue;
+        }
+
+        return 1;
+    }
+}
+
+
+int disk_hotplug_wait(int timeout_ms)
+{
+    if (s_hotplug_fd < 0) {
+        return -1;
+    }
+
+    struct pollfd pfd = {
+        .fd = s_hotplug_fd,
+        .events = POLLIN,
+    };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    return ret > 0 && (pfd.revents & POLLIN);
+}
@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/disk.h>
 
 
@@ -89,61 +90,7 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 }
 
 
-const char* disk_write_changes(disk_info_t* disk)
-{
-    static char error_msg[1024];
-    assert(disk);
-    assert(disk->has_staged_changes);
-
-    /* Reopen the disk to write it back */
-    int fd = open(disk->path, O_WRONLY);
-    if (fd < 0) {
-        sprintf(error_msg, "Could not open disk %s: %s\n", disk->name, strerror(errno));
-        return error_msg;
-    }
-
-    /* Write MBR */
-    if (disk->has_mbr) {
-        ssize_t wr = write(fd, disk->staged_mbr, sizeof(disk->staged_mbr));
-        if (wr != DISK_SECTOR_SIZE) {
-            sprintf(error_msg, "Could not write disk %s: %s\n", disk->name, strerror(errno));
-            goto error;
-        }
-    }
-
-    /* Write any new partition */
-    for (int i = 0; i < MAX_PART_COUNT; i++) {
-        const partition_t* part = &disk->staged_partitions[i];
-        if (part->data != NULL && part->data_len != 0) {
-            /* Data need to be written back to the disk */
-            off_t part_offset = part->start_lba * DISK_SECTOR_SIZE;
-            const off_t offset = lseek(fd, part_offset, SEEK_SET);
-            printf("[DISK] Writing partition %d @ %08llx, %d bytes\n", i, offset, part->data_len);
-            if (offset != part_offset){
-                sprintf(error_msg, "Could not offset in the disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-            ssize_t wr = write(fd, part->data, part->data_len);
-            if (wr != part->data_len) {
-                sprintf(error_msg, "Could not write partition to disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-        } else {
-            printf("[DISK] Partition %d has no changes\n", i);
-        }
-    }
-
-    /* Apply the changes in RAM too */
-    disk_apply_changes(disk);
-    close(fd);
-    return NULL;
-error:
-    close(fd);
-    return error_msg;
-}
-
-
-int disk_open(disk_info_t* disk, void** ret_fd)
+int disk_os_open(disk_info_t* disk, void** ret_fd)
 {
     assert(disk);
     assert(disk->valid);
@@ -160,7 +107,7 @@ int disk_open(disk_info_t* disk, void** ret_fd)
 }
 
 
-ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 {
     uint8_t aligned_buf[DISK_SECTOR_SIZE];
     const int returned_len = len;
@@ -197,7 +144,7 @@ ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 }
 
 
-ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
 {
     uint8_t temp_buffer[512];
     ssize_t bytes_written;
@@ -248,12 +195,199 @@ ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_
 }
 
 
-void disk_close(void* disk_fd)
+ssize_t disk_os_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct iovec vec[DISK_WRITEV_MAX];
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; ) {
+        const int n = (count - i < DISK_WRITEV_MAX) ? count - i : DISK_WRITEV_MAX;
+        size_t len = 0;
+        for (int j = 0; j < n; j++) {
+            vec[j].iov_base = iov[i + j].base;
+            vec[j].iov_len = iov[i + j].len;
+            len += iov[i + j].len;
+        }
+        if (lseek(fd, disk_offset + total, SEEK_SET) != disk_offset + total) {
+            fprintf(stderr, "[MAC] Could not seek to offset %lld: %s\n", (long long) (disk_offset + total), strerror(errno));
+            return -1;
+        }
+        const ssize_t bytes_read = readv(fd, vec, n);
+        if (bytes_read < 0) {
+            fprintf(stderr, "[MAC] Could not read from disk: %s\n", strerror(errno));
+            return -1;
+        }
+        total += bytes_read;
+        if ((size_t) bytes_read != len) {
+            break;
+        }
+        i += n;
+    }
+
+    return total;
+}
+
+
+ssize_t disk_os_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct iovec vec[DISK_WRITEV_MAX];
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; ) {
+        const int n = (count - i < DISK_WRITEV_MAX) ? count - i : DISK_WRITEV_MAX;
+        size_t len = 0;
+        for (int j = 0; j < n; j++) {
+            vec[j].iov_base = (void*) iov[i + j].base;
+            vec[j].iov_len = iov[i + j].len;
+            len += iov[i + j].len;
+        }
+        if (lseek(fd, disk_offset + total, SEEK_SET) != disk_offset + total) {
+            fprintf(stderr, "[MAC] Could not seek to offset %lld: %s\n", (long long) (disk_offset + total), strerror(errno));
+            return -1;
+        }
+        const ssize_t bytes_written = writev(fd, vec, n);
+        if (bytes_written < 0) {
+            fprintf(stderr, "[MAC] Could not write to disk: %s\n", strerror(errno));
+            return -1;
+        }
+        total += bytes_written;
+        if ((size_t) bytes_written != len) {
+            break;
+        }
+        i += n;
+    }
+
+    return total;
+}
+
+
+void disk_os_close(void* disk_fd)
 {
     close((int)(intptr_t) disk_fd);
 }
 
 
+int disk_set_image_size(FILE* file, uint64_t size, bool sparse)
+{
+    const int fd = fileno(file);
+
+    /* Make sure the data written so far (MBR) reached the file */
+    if (fflush(file) != 0) {
+        fprintf(stderr, "[MAC] Could not flush image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (!sparse) {
+        /* Try to get contiguous blocks first, fallback to any blocks */
+        fstore_t store = {
+            .fst_flags   = F_ALLOCATECONTIG | F_ALLOCATEALL,
+            .fst_posmode = F_PEOFPOSMODE,
+            .fst_offset  = 0,
+            .fst_length  = size,
+        };
+        if (fcntl(fd, F_PREALLOCATE, &store) != 0) {
+            store.fst_flags = F_ALLOCATEALL;
+            if (fcntl(fd, F_PREALLOCATE, &store) != 0) {
+                fprintf(stderr, "[MAC] Could not preallocate image: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "[MAC] Could not resize image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int disk_os_discard(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+        /* Let the controller of the device know the range is unused, only the sectors fully covered */
+        uint32_t sector_size = DISK_SECTOR_SIZE;
+        if (ioctl(fd, DKIOCGETBLOCKSIZE, &sector_size) != 0 || sector_size == 0) {
+            sector_size = DISK_SECTOR_SIZE;
+        }
+        const uint64_t start = ((uint64_t) disk_offset + sector_size - 1) / sector_size * sector_size;
+        const uint64_t end = ((uint64_t) disk_offset + len) / sector_size * sector_size;
+        if (end <= start) {
+            return -1;
+        }
+        dk_extent_t extent = {
+            .offset = start,
+            .length = end - start,
+        };
+        dk_unmap_t unmap = {
+            .extents      = &extent,
+            .extentsCount = 1,
+        };
+        if (ioctl(fd, DKIOCUNMAP, &unmap) != 0) {
+            if (errno != ENOTSUP && errno != ENOTTY) {
+                fprintf(stderr, "[MAC] Could not discard range of the disk: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+        return 0;
+    } else if (!S_ISREG(st.st_mode)) {
+        return -1;
+    }
+
+    /* The range must be aligned on the file system blocks, only punch the blocks fully discarded */
+    const off_t block = st.st_blksize;
+    const off_t start = (disk_offset + block - 1) / block * block;
+    const off_t end = (disk_offset + (off_t) len) / block * block;
+    if (end <= start) {
+        return -1;
+    }
+
+    struct fpunchhole args = {
+        .fp_flags  = 0,
+        .fp_offset = start,
+        .fp_length = end - start,
+    };
+    if (fcntl(fd, F_PUNCHHOLE, &args) != 0) {
+        fprintf(stderr, "[MAC] Could not punch hole in image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int disk_os_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    int fd = (int)(intptr_t) disk_fd;
+    (void) disk_offset;
+    (void) len;
+
+    /* Unlike fsync, F_FULLFSYNC also flushes the cache of the drive itself */
+    if (fcntl(fd, F_FULLFSYNC) != 0 && fsync(fd) != 0) {
+        fprintf(stderr, "[MAC] Could not flush disk: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* There is no way to drop a range from the cache, stop caching the data read from this descriptor */
+    if (fcntl(fd, F_NOCACHE, 1) != 0) {
+        fprintf(stderr, "[MAC] Could not disable the cache: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 void disk_init_progress_bar(void)
 {
 }
@@ -267,4 +401,23 @@ void disk_update_progress_bar(int percent)
 
 void disk_destroy_progress_bar(void)
 {
-}
\ No newline at end of file
+}
+
+int disk_hotplug_init(void)
+{
+    return 1;
+}
+
+
+int disk_hotplug_poll(disk_hotplug_event_t* event)
+{
+    (void) event;
+    return 0;
+}
+
+
+int disk_hotplug_wait(int timeout_ms)
+{
+    (void) timeout_ms;
+    return -1;
+}
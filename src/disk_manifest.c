@@ -0,0 +1,228 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "disk.h"
+#include "disk_manifest.h"
+#include "disk_worker.h"
+#include "zealfs_v2.h"
+#include "blake3.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Number of entries retrieved from a directory at once */
+#define MANIFEST_DIR_BATCH      64
+#define MANIFEST_PATH_LEN       512
+
+typedef struct {
+    char*          path;
+    zealfs_entry_t entry;
+    uint8_t        hash[BLAKE3_OUT_LEN];
+    bool           failed;
+} manifest_file_t;
+
+
+typedef struct {
+    disk_info_t*     disk;
+    const partition_t* partition;
+    manifest_file_t* files;
+    int              files_count;
+    int              files_capacity;
+    uint64_t         total_bytes;
+    /* Shared between the threads */
+    atomic_int       next_file;
+    atomic_uint_fast64_t hashed_bytes;
+} manifest_job_t;
+
+
+static int manifest_add_file(manifest_job_t* job, const char* path, const zealfs_entry_t* entry)
+{
+    if (job->files_count == job->files_capacity) {
+        const int capacity = job->files_capacity ? job->files_capacity * 2 : 64;
+        manifest_file_t* files = realloc(job->files, capacity * sizeof(manifest_file_t));
+        if (files == NULL) {
+            return -1;
+        }
+        job->files = files;
+        job->files_capacity = capacity;
+    }
+
+    manifest_file_t* file = &job->files[job->files_count];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    if (file->path == NULL) {
+        return -1;
+    }
+    file->entry = *entry;
+    job->files_count++;
+    job->total_bytes += entry->size;
+    return 0;
+}
+
+
+/**
+ * @brief Gather all the files of a directory and of its sub-directories.
+ *
+ * @param dir_path Absolute path of the directory, without any trailing `/`, except for the root.
+ */
+static int manifest_browse(manifest_job_t* job, zealfs_context_t* zealfs, const char* dir_path)
+{
+    zealfs_entry_t entries[MANIFEST_DIR_BATCH];
+    char path[MANIFEST_PATH_LEN];
+    zealfs_dir_iter_t iter;
+    zealfs_fd_t fd;
+    int count;
+    const bool is_root = strcmp(dir_path, "/") == 0;
+
+    if (zealfs_opendir(dir_path, zealfs, &fd) < 0 || zealfs_dir_iter_init(zealfs, &fd, &iter) < 0) {
+        printf("[MANIFEST] Could not open directory %s\n", dir_path);
+        return -1;
+    }
+
+    while ((count = zealfs_dir_iter_next(zealfs, &iter, entries, MANIFEST_DIR_BATCH)) > 0) {
+        for (int i = 0; i < count; i++) {
+            const zealfs_entry_t* entry = &entries[i];
+            const int name_len = strnlen(entry->name, NAME_MAX_LEN);
+            const bool is_dir = entry->flags & IS_DIR;
+            snprintf(path, sizeof(path), "%s/%.*s", is_root ? "" : dir_path, name_len, entry->name);
+
+            const int ret = is_dir ? manifest_browse(job, zealfs, path) : manifest_add_file(job, path, entry);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+static void manifest_hash_file(disk_worker_t* worker, manifest_file_t* file)
+{
+    zealfs_fd_t fd = { .entry = file->entry };
+    blake3_hasher_t hasher;
+    const uint32_t size = file->entry.size;
+
+    blake3_hasher_init(&hasher);
+    for (uint32_t offset = 0; offset < size; ) {
+        const int bytes_read = zealfs_read(worker->zealfs, &fd, worker->buffer, MIN(size - offset, MANIFEST_READ_SIZE), offset);
+        if (bytes_read <= 0) {
+            printf("[MANIFEST] Could not read file %s\n", file->path);
+            file->failed = true;
+            return;
+        }
+        blake3_hasher_update(&hasher, worker->buffer, bytes_read);
+        offset += bytes_read;
+    }
+    blake3_hasher_finalize(&hasher, file->hash);
+}
+
+
+static void manifest_worker(disk_worker_t* worker)
+{
+    manifest_job_t* job = (manifest_job_t*) worker->job;
+    int index;
+
+    /* Files are given out one by one, so the threads stay busy even if the sizes differ a lot */
+    while ((index = atomic_fetch_add(&job->next_file, 1)) < job->files_count) {
+        manifest_file_t* file = &job->files[index];
+        manifest_hash_file(worker, file);
+        const uint64_t hashed = atomic_fetch_add(&job->hashed_bytes, file->entry.size) + file->entry.size;
+        /* Only the main thread is allowed to update the progress bar */
+        if (worker->main_thread && job->total_bytes > 0) {
+            disk_update_progress_bar((int) (hashed * 100 / job->total_bytes));
+        }
+    }
+}
+
+
+static const char* manifest_write(manifest_job_t* job, const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        return "Could not create the manifest file";
+    }
+
+    fprintf(out, "# %s, partition %d\n", job->disk->name, (int) (job->partition - job->disk->partitions));
+    fprintf(out, "# blake3 size date path\n");
+    for (int i = 0; i < job->files_count; i++) {
+        const manifest_file_t* file = &job->files[i];
+        const zealfs_entry_t* entry = &file->entry;
+        for (int j = 0; j < BLAKE3_OUT_LEN; j++) {
+            fprintf(out, "%02x", file->hash[j]);
+        }
+        /* The date fields are in BCD, they can be printed as hexadecimal values directly */
+        fprintf(out, " %u %02x%02x-%02x-%02x %02x:%02x:%02x %s\n", entry->size,
+                entry->year[0], entry->year[1], entry->month, entry->day,
+                entry->hours, entry->minutes, entry->seconds, file->path);
+    }
+
+    if (fclose(out) != 0) {
+        return "Could not write the manifest file";
+    }
+    return NULL;
+}
+
+
+const char* disk_manifest_export(disk_info_t* disk, int partition, const char* path)
+{
+    disk_worker_t workers[MANIFEST_MAX_THREADS];
+    manifest_job_t job = { 0 };
+    const char* error = NULL;
+    int failed = 0;
+    /* The first worker is deinitialized even if it couldn't be initialized */
+    int started = 1;
+
+    if (disk == NULL || partition < 0 || partition >= MAX_PART_COUNT ||
+        !disk_is_valid_zealfs_partition(&disk->partitions[partition]))
+    {
+        return "Please select a ZealFS partition";
+    } else if (disk->has_staged_changes) {
+        return "Disk has staged changes, apply or cancel them first";
+    }
+    job.disk = disk;
+    job.partition = &disk->partitions[partition];
+
+    /* The main thread browses the partition first, then takes part in the hashing */
+    if (disk_worker_init(&workers[0], disk, job.partition, MANIFEST_READ_SIZE, &job)) {
+        error = "Could not open the disk";
+        goto deinit;
+    }
+    if (manifest_browse(&job, workers[0].zealfs, "/") < 0) {
+        error = "Could not browse the partition";
+        goto deinit;
+    }
+
+    const int threads = disk_workers_count(job.files_count, 1, MANIFEST_MAX_THREADS);
+    printf("[MANIFEST] Hashing %d files, %llu bytes, with %d threads\n",
+           job.files_count, (unsigned long long) job.total_bytes, threads);
+
+    disk_init_progress_bar();
+    started = disk_workers_run(workers, threads, disk, job.partition, MANIFEST_READ_SIZE, manifest_worker);
+    disk_destroy_progress_bar();
+
+    for (int i = 0; i < job.files_count; i++) {
+        failed += job.files[i].failed;
+    }
+    if (failed) {
+        error = "Some files could not be read";
+    } else {
+        error = manifest_write(&job, path);
+    }
+
+deinit:
+    for (int i = 0; i < started; i++) {
+        disk_worker_deinit(&workers[i]);
+    }
+    for (int i = 0; i < job.files_count; i++) {
+        free(job.files[i].path);
+    }
+    free(job.files);
+    return error;
+}
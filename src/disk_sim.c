@@ -0,0 +1,386 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "disk.h"
+#include "disk_sim.h"
+
+/**
+ * @brief Descriptor returned by `disk_open` while the simulation is enabled. Only image files and
+ * loop devices are simulated, the other disks are accessed as usual through the same descriptor.
+ */
+typedef struct {
+    void*    os_fd;
+    bool     simulated;
+    /* Allocation units currently open in the simulated controller */
+    uint64_t open_aus[DISK_SIM_MAX_OPEN_AUS];
+    int      open_count;
+    int      next_close;
+    uint32_t random;
+    disk_sim_stats_t stats;
+} disk_sim_fd_t;
+
+
+static const disk_sim_profile_t s_profiles[] = {
+    /* Cheap USB reader with an entry-level card: slow writes, a single open allocation unit */
+    {
+        .name          = "usb-reader",
+        .latency_us    = 1500,
+        .read_kbps     = 18*1024,
+        .write_kbps    = 6*1024,
+        .au_size       = 4*MB,
+        .au_penalty_us = 40000,
+        .open_aus      = 1,
+    },
+    /* Good card behind a fast reader */
+    {
+        .name          = "good-card",
+        .latency_us    = 200,
+        .read_kbps     = 85*1024,
+        .write_kbps    = 50*1024,
+        .au_size       = 4*MB,
+        .au_penalty_us = 4000,
+        .open_aus      = 4,
+    },
+};
+
+static bool s_enabled;
+static disk_sim_profile_t s_profile;
+/* Statistics of the descriptors already closed, the clone and the manifest close theirs from their threads */
+static disk_sim_stats_t s_totals;
+static pthread_mutex_t s_totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+const char* const* disk_sim_profile_names(int* count)
+{
+    static const char* names[DIM(s_profiles)];
+    for (size_t i = 0; i < DIM(s_profiles); i++) {
+        names[i] = s_profiles[i].name;
+    }
+    *count = DIM(s_profiles);
+    return names;
+}
+
+
+const char* disk_sim_configure(const char* spec)
+{
+    static char error_msg[256];
+    char copy[256];
+
+    s_enabled = false;
+    if (spec == NULL) {
+        return NULL;
+    }
+
+    snprintf(copy, sizeof(copy), "%s", spec);
+    const char* name = strtok(copy, ",");
+    const disk_sim_profile_t* profile = NULL;
+    for (size_t i = 0; name != NULL && i < DIM(s_profiles); i++) {
+        if (strcmp(s_profiles[i].name, name) == 0) {
+            profile = &s_profiles[i];
+        }
+    }
+    if (profile == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Unknown media profile '%s'", name ? name : "");
+        return error_msg;
+    }
+    s_profile = *profile;
+
+    for (char* option = strtok(NULL, ","); option != NULL; option = strtok(NULL, ",")) {
+        char* equal = strchr(option, '=');
+        if (equal == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Invalid media option '%s'", option);
+            return error_msg;
+        }
+        *equal = 0;
+        const uint32_t value = (uint32_t) strtoul(equal + 1, NULL, 0);
+        if (strcmp(option, "latency") == 0) {
+            s_profile.latency_us = value;
+        } else if (strcmp(option, "read") == 0) {
+            s_profile.read_kbps = value;
+        } else if (strcmp(option, "write") == 0) {
+            s_profile.write_kbps = value;
+        } else if (strcmp(option, "au") == 0) {
+            s_profile.au_size = value * KB;
+        } else if (strcmp(option, "penalty") == 0) {
+            s_profile.au_penalty_us = value;
+        } else if (strcmp(option, "open") == 0 && value >= 1 && value <= DISK_SIM_MAX_OPEN_AUS) {
+            s_profile.open_aus = value;
+        } else if (strcmp(option, "fail") == 0) {
+            s_profile.fail_rate = value;
+        } else {
+            snprintf(error_msg, sizeof(error_msg), "Invalid media option '%s'", option);
+            return error_msg;
+        }
+    }
+
+    printf("[SIM] Simulating '%s' media: %u us/op, read %u KB/s, write %u KB/s, AU %u KB (%u us, %d open), "
+           "failure 1/%u\n", s_profile.name, s_profile.latency_us, s_profile.read_kbps, s_profile.write_kbps,
+           s_profile.au_size / (uint32_t) KB, s_profile.au_penalty_us, s_profile.open_aus, s_profile.fail_rate);
+    s_enabled = true;
+    return NULL;
+}
+
+
+const disk_sim_profile_t* disk_sim_profile(void)
+{
+    return s_enabled ? &s_profile : NULL;
+}
+
+
+bool disk_sim_stats(void* disk_fd, disk_sim_stats_t* stats)
+{
+    const disk_sim_fd_t* sim = (const disk_sim_fd_t*) disk_fd;
+    if (!s_enabled || !sim->simulated) {
+        return false;
+    }
+    *stats = sim->stats;
+    return true;
+}
+
+
+void disk_sim_total_stats(disk_sim_stats_t* stats)
+{
+    pthread_mutex_lock(&s_totals_lock);
+    *stats = s_totals;
+    pthread_mutex_unlock(&s_totals_lock);
+}
+
+
+static void disk_sim_sleep(uint64_t us)
+{
+#ifdef _WIN32
+    Sleep((DWORD) ((us + 999) / 1000));
+#else
+    struct timespec ts = {
+        .tv_sec  = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+#endif
+}
+
+
+static uint32_t disk_sim_random(disk_sim_fd_t* sim)
+{
+    /* xorshift32, each descriptor has its own sequence so threads don't share any state */
+    sim->random ^= sim->random << 13;
+    sim->random ^= sim->random >> 17;
+    sim->random ^= sim->random << 5;
+    return sim->random;
+}
+
+
+/**
+ * @brief Open the allocation unit in the simulated controller.
+ *
+ * @return true if the unit was not open yet and the penalty applies.
+ */
+static bool disk_sim_open_au(disk_sim_fd_t* sim, uint64_t au)
+{
+    for (int i = 0; i < sim->open_count; i++) {
+        if (sim->open_aus[i] == au) {
+            return false;
+        }
+    }
+    if (sim->open_count < s_profile.open_aus) {
+        sim->open_aus[sim->open_count++] = au;
+    } else {
+        sim->open_aus[sim->next_close] = au;
+        sim->next_close = (sim->next_close + 1) % s_profile.open_aus;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Wait as long as the simulated media would take to do the operation.
+ *
+ * @return 0 if the operation can be done, -1 if it must fail.
+ */
+static int disk_sim_access(disk_sim_fd_t* sim, bool write, uint64_t offset, uint64_t len)
+{
+    const uint32_t kbps = write ? s_profile.write_kbps : s_profile.read_kbps;
+    uint64_t delay_us = s_profile.latency_us;
+    if (kbps != 0) {
+        delay_us += len * 1000000 / (kbps * KB);
+    }
+
+    if (write && s_profile.au_size != 0 && len != 0) {
+        const uint64_t last = (offset + len - 1) / s_profile.au_size;
+        for (uint64_t au = offset / s_profile.au_size; au <= last; au++) {
+            if (disk_sim_open_au(sim, au)) {
+                sim->stats.au_penalties++;
+                delay_us += s_profile.au_penalty_us;
+            }
+        }
+    }
+
+    sim->stats.delay_us += delay_us;
+    disk_sim_sleep(delay_us);
+
+    if (s_profile.fail_rate != 0 && disk_sim_random(sim) % s_profile.fail_rate == 0) {
+        sim->stats.failures++;
+        fprintf(stderr, "[SIM] Injected %s failure @ %08llx\n", write ? "write" : "read", (unsigned long long) offset);
+        errno = EIO;
+        return -1;
+    }
+
+    if (write) {
+        sim->stats.writes++;
+        sim->stats.written_bytes += len;
+    } else {
+        sim->stats.reads++;
+        sim->stats.read_bytes += len;
+    }
+    return 0;
+}
+
+
+static inline void* disk_sim_os_fd(void* disk_fd)
+{
+    return s_enabled ? ((disk_sim_fd_t*) disk_fd)->os_fd : disk_fd;
+}
+
+
+static inline disk_sim_fd_t* disk_sim_get(void* disk_fd)
+{
+    disk_sim_fd_t* sim = (disk_sim_fd_t*) disk_fd;
+    return (s_enabled && sim->simulated) ? sim : NULL;
+}
+
+
+int disk_open(disk_info_t* disk, void** ret_fd)
+{
+    if (!s_enabled) {
+        return disk_os_open(disk, ret_fd);
+    }
+
+    disk_sim_fd_t* sim = calloc(1, sizeof(disk_sim_fd_t));
+    if (sim == NULL) {
+        return 1;
+    }
+    const int ret = disk_os_open(disk, &sim->os_fd);
+    if (ret) {
+        free(sim);
+        return ret;
+    }
+    /* A loop device is backed by a file too, it can stand for a real card */
+    sim->simulated = disk->is_image || strncmp(disk_get_basename(disk->path), "loop", 4) == 0;
+    sim->random = (uint32_t) (uintptr_t) sim | 1;
+    *ret_fd = sim;
+    return 0;
+}
+
+
+ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
+{
+    disk_sim_fd_t* sim = disk_sim_get(disk_fd);
+    if (sim != NULL && disk_sim_access(sim, false, disk_offset, len) != 0) {
+        return -1;
+    }
+    return disk_os_read(disk_sim_os_fd(disk_fd), buffer, disk_offset, len);
+}
+
+
+ssize_t disk_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset)
+{
+    disk_sim_fd_t* sim = disk_sim_get(disk_fd);
+    if (sim != NULL) {
+        uint64_t len = 0;
+        for (int i = 0; i < count; i++) {
+            len += iov[i].len;
+        }
+        if (disk_sim_access(sim, false, disk_offset, len) != 0) {
+            return -1;
+        }
+    }
+    return disk_os_readv(disk_sim_os_fd(disk_fd), iov, count, disk_offset);
+}
+
+
+ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
+{
+    disk_sim_fd_t* sim = disk_sim_get(disk_fd);
+    if (sim != NULL && disk_sim_access(sim, true, disk_offset, len) != 0) {
+        return -1;
+    }
+    return disk_os_write(disk_sim_os_fd(disk_fd), buffer, disk_offset, len);
+}
+
+
+ssize_t disk_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset)
+{
+    disk_sim_fd_t* sim = disk_sim_get(disk_fd);
+    if (sim != NULL) {
+        uint64_t len = 0;
+        for (int i = 0; i < count; i++) {
+            len += iov[i].len;
+        }
+        if (disk_sim_access(sim, true, disk_offset, len) != 0) {
+            return -1;
+        }
+    }
+    return disk_os_writev(disk_sim_os_fd(disk_fd), iov, count, disk_offset);
+}
+
+
+void disk_close(void* disk_fd)
+{
+    if (!s_enabled) {
+        disk_os_close(disk_fd);
+        return;
+    }
+
+    disk_sim_fd_t* sim = (disk_sim_fd_t*) disk_fd;
+    if (sim->simulated) {
+        const disk_sim_stats_t* stats = &sim->stats;
+        printf("[SIM] %llu reads (%llu KB), %llu writes (%llu KB), %llu AU penalties, %llu failures, %.2f s\n",
+               (unsigned long long) stats->reads, (unsigned long long) (stats->read_bytes / KB),
+               (unsigned long long) stats->writes, (unsigned long long) (stats->written_bytes / KB),
+               (unsigned long long) stats->au_penalties, (unsigned long long) stats->failures,
+               stats->delay_us / 1000000.0);
+
+        pthread_mutex_lock(&s_totals_lock);
+        s_totals.reads += stats->reads;
+        s_totals.writes += stats->writes;
+        s_totals.read_bytes += stats->read_bytes;
+        s_totals.written_bytes += stats->written_bytes;
+        s_totals.au_penalties += stats->au_penalties;
+        s_totals.failures += stats->failures;
+        s_totals.delay_us += stats->delay_us;
+        pthread_mutex_unlock(&s_totals_lock);
+    }
+    disk_os_close(sim->os_fd);
+    free(sim);
+}
+
+
+int disk_discard(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    disk_sim_fd_t* sim = disk_sim_get(disk_fd);
+    if (sim != NULL) {
+        /* Discarding only costs the latency of a command */
+        sim->stats.delay_us += s_profile.latency_us;
+        disk_sim_sleep(s_profile.latency_us);
+    }
+    return disk_os_discard(disk_sim_os_fd(disk_fd), disk_offset, len);
+}
+
+
+int disk_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    return disk_os_drop_cache(disk_sim_os_fd(disk_fd), disk_offset, len);
+}
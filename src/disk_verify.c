@@ -0,0 +1,288 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "disk.h"
+#include "disk_verify.h"
+#include "crc32c.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+/* Number of chunks being read or checked at the same time */
+#define VERIFY_BUFFERS_COUNT    2
+
+/**
+ * @brief State shared between the thread reading the disk and the one computing the checksums.
+ * Both browse the chunks in the same order, the reader fills the buffers in turn.
+ */
+typedef struct {
+    disk_verify_t*  verify;
+    void*           disk_fd;
+    uint8_t*        buffers[VERIFY_BUFFERS_COUNT];
+    bool            full[VERIFY_BUFFERS_COUNT];
+    bool            read_failed;
+    bool            stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} verify_pipeline_t;
+
+
+static bool s_verify_enabled;
+
+
+void disk_verify_set_enabled(bool enabled)
+{
+    s_verify_enabled = enabled;
+}
+
+
+bool disk_verify_enabled(void)
+{
+    return s_verify_enabled;
+}
+
+
+void disk_verify_init(disk_verify_t* verify)
+{
+    memset(verify, 0, sizeof(*verify));
+}
+
+
+int disk_verify_add(disk_verify_t* verify, uint64_t offset, const void* data, uint64_t len)
+{
+    if (len == 0) {
+        return 0;
+    }
+
+    /* Data written right after the last range extends it, the checksum can be continued */
+    if (verify->count > 0) {
+        disk_verify_range_t* last = &verify->ranges[verify->count - 1];
+        if (last->offset + last->length == offset) {
+            last->crc = crc32c(last->crc, data, len);
+            last->length += len;
+            verify->total_bytes += len;
+            return 0;
+        }
+    }
+
+    if (verify->count == verify->capacity) {
+        const int capacity = verify->capacity ? verify->capacity * 2 : 16;
+        disk_verify_range_t* ranges = realloc(verify->ranges, capacity * sizeof(disk_verify_range_t));
+        if (ranges == NULL) {
+            return -1;
+        }
+        verify->ranges = ranges;
+        verify->capacity = capacity;
+    }
+
+    verify->ranges[verify->count++] = (disk_verify_range_t) {
+        .offset = offset,
+        .length = len,
+        .crc    = crc32c(0, data, len),
+    };
+    verify->total_bytes += len;
+    return 0;
+}
+
+
+int disk_verify_add_changes(disk_verify_t* verify, disk_info_t* disk)
+{
+    static const uint8_t zeros[DISK_SECTOR_SIZE];
+
+    if (disk->has_mbr && disk_verify_add(verify, 0, disk->staged_mbr, DISK_SECTOR_SIZE) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        if (part->data == NULL || part->data_len == 0) {
+            continue;
+        }
+        const uint64_t offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+        if (disk_verify_add(verify, offset, part->data, part->data_len) != 0) {
+            return -1;
+        }
+        /* The zeros following the staged data are part of the layout, they extend the same range */
+        for (uint32_t done = 0; done < part->zeros_len; done += sizeof(zeros)) {
+            const uint32_t len = MIN(part->zeros_len - done, sizeof(zeros));
+            if (disk_verify_add(verify, offset + part->data_len + done, zeros, len) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static void* disk_verify_reader(void* arg)
+{
+    verify_pipeline_t* pipeline = (verify_pipeline_t*) arg;
+    disk_verify_t* verify = pipeline->verify;
+    int chunk = 0;
+
+    for (int i = 0; i < verify->count; i++) {
+        const disk_verify_range_t* range = &verify->ranges[i];
+
+        for (uint64_t done = 0; done < range->length; done += VERIFY_CHUNK_SIZE, chunk++) {
+            const int idx = chunk % VERIFY_BUFFERS_COUNT;
+            const uint32_t len = MIN(range->length - done, VERIFY_CHUNK_SIZE);
+
+            pthread_mutex_lock(&pipeline->mutex);
+            while (pipeline->full[idx] && !pipeline->stop) {
+                pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+            }
+            const bool stop = pipeline->stop;
+            pthread_mutex_unlock(&pipeline->mutex);
+            if (stop) {
+                return NULL;
+            }
+
+            const bool success = disk_read(pipeline->disk_fd, pipeline->buffers[idx], range->offset + done, len) == len;
+
+            pthread_mutex_lock(&pipeline->mutex);
+            pipeline->full[idx] = success;
+            pipeline->read_failed = !success;
+            pthread_cond_broadcast(&pipeline->cond);
+            pthread_mutex_unlock(&pipeline->mutex);
+            if (!success) {
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Compute the checksums of the chunks as soon as the reader filled them.
+ */
+static const char* disk_verify_check(verify_pipeline_t* pipeline)
+{
+    /* Several disks can be verified at the same time, by different threads */
+    static _Thread_local char error_msg[256];
+    disk_verify_t* verify = pipeline->verify;
+    int chunk = 0;
+
+    for (int i = 0; i < verify->count; i++) {
+        const disk_verify_range_t* range = &verify->ranges[i];
+        uint32_t crc = 0;
+
+        for (uint64_t done = 0; done < range->length; done += VERIFY_CHUNK_SIZE, chunk++) {
+            const int idx = chunk % VERIFY_BUFFERS_COUNT;
+            const uint32_t len = MIN(range->length - done, VERIFY_CHUNK_SIZE);
+
+            pthread_mutex_lock(&pipeline->mutex);
+            while (!pipeline->full[idx] && !pipeline->read_failed) {
+                pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+            }
+            const bool failed = !pipeline->full[idx];
+            pthread_mutex_unlock(&pipeline->mutex);
+            if (failed) {
+                snprintf(error_msg, sizeof(error_msg), "Could not read back the disk @ %08llx",
+                         (unsigned long long) (range->offset + done));
+                return error_msg;
+            }
+
+            crc = crc32c(crc, pipeline->buffers[idx], len);
+
+            pthread_mutex_lock(&pipeline->mutex);
+            pipeline->full[idx] = false;
+            pthread_cond_broadcast(&pipeline->cond);
+            pthread_mutex_unlock(&pipeline->mutex);
+        }
+
+        if (crc != range->crc) {
+            snprintf(error_msg, sizeof(error_msg), "Verification failed, data @ %08llx (%llu bytes) differs",
+                     (unsigned long long) range->offset, (unsigned long long) range->length);
+            return error_msg;
+        }
+    }
+
+    return NULL;
+}
+
+
+const char* disk_verify_run(disk_verify_t* verify, void* disk_fd)
+{
+    verify_pipeline_t pipeline = {
+        .verify  = verify,
+        .disk_fd = disk_fd,
+    };
+    const char* error = NULL;
+    pthread_t reader;
+
+    if (verify->count == 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < verify->count; i++) {
+        if (disk_drop_cache(disk_fd, verify->ranges[i].offset, verify->ranges[i].length) != 0) {
+            return "Could not flush the disk before verifying it";
+        }
+    }
+
+    for (int i = 0; i < VERIFY_BUFFERS_COUNT; i++) {
+        pipeline.buffers[i] = malloc(MIN(verify->total_bytes, VERIFY_CHUNK_SIZE));
+        if (pipeline.buffers[i] == NULL) {
+            error = "Could not allocate memory for the verification";
+            goto free_buffers;
+        }
+    }
+
+    pthread_mutex_init(&pipeline.mutex, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+    if (pthread_create(&reader, NULL, disk_verify_reader, &pipeline) != 0) {
+        error = "Could not start the verification thread";
+    } else {
+        error = disk_verify_check(&pipeline);
+
+        /* Make the reader stop if the check ended early */
+        pthread_mutex_lock(&pipeline.mutex);
+        pipeline.stop = true;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.mutex);
+        pthread_join(reader, NULL);
+    }
+    pthread_mutex_destroy(&pipeline.mutex);
+    pthread_cond_destroy(&pipeline.cond);
+
+    if (error == NULL) {
+        printf("[VERIFY] %llu bytes verified in %d ranges\n", (unsigned long long) verify->total_bytes, verify->count);
+    }
+free_buffers:
+    for (int i = 0; i < VERIFY_BUFFERS_COUNT; i++) {
+        free(pipeline.buffers[i]);
+    }
+    return error;
+}
+
+
+const char* disk_verify_run_disk(disk_verify_t* verify, disk_info_t* disk)
+{
+    void* disk_fd = NULL;
+
+    if (verify->count == 0) {
+        return NULL;
+    }
+    if (disk_open(disk, &disk_fd)) {
+        return "Could not open the disk to verify it";
+    }
+    const char* error = disk_verify_run(verify, disk_fd);
+    disk_close(disk_fd);
+    return error;
+}
+
+
+void disk_verify_free(disk_verify_t* verify)
+{
+    free(verify->ranges);
+    disk_verify_init(verify);
+}
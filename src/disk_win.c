@@ -4,11 +4,21 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <windows.h>
+#include <winioctl.h>
 #include <commctrl.h>  // for Progress Bar
+#include <io.h>
 #include <assert.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "disk.h"
+
+#ifndef DEVICE_DSM_FLAG_TRIM_NOT_FS_ALLOCATED
+#define DEVICE_DSM_FLAG_TRIM_NOT_FS_ALLOCATED 0x80000000
+#endif
+
 #define MIN(a,b)    (((a) < (b)) ? (a) : (b))
 
 disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
@@ -63,73 +73,6 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 }
 
 
-const char* disk_write_changes(disk_info_t* disk)
-{
-#if DEBUG_DISKS
-    return NULL;
-#endif
-    static char error_msg[1024];
-    assert(disk);
-    assert(disk->has_staged_changes);
-
-
-    HANDLE fd = CreateFileA(disk->path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-    if (fd == INVALID_HANDLE_VALUE) {
-        snprintf(error_msg, sizeof(error_msg),
-            "Could not open disk %s: %lu\n", disk->path, GetLastError());
-        return error_msg;
-    }
-
-    if (disk->has_mbr) {
-        /* Let's be safe and set the pointer */
-        SetFilePointer(fd, 0, NULL, FILE_BEGIN);
-        DWORD wr = 0;
-        BOOL success = WriteFile(fd, disk->staged_mbr, 512, &wr, NULL);
-        if (!success || wr != DISK_SECTOR_SIZE) {
-            snprintf(error_msg, sizeof(error_msg),
-                "Could not write disk %s: %lu\n", disk->name, GetLastError());
-            goto error;
-        }
-    }
-
-    /* Write any new partition */
-    for (int i = 0; i < MAX_PART_COUNT; i++) {
-        const partition_t* part = &disk->staged_partitions[i];
-        if (part->data != NULL && part->data_len != 0) {
-            /* Data need to be written back to the disk */
-            LARGE_INTEGER offset = {
-                .QuadPart = 0
-            };
-            LARGE_INTEGER part_offset = {
-                .QuadPart = part->start_lba * DISK_SECTOR_SIZE
-            };
-            BOOL success = SetFilePointerEx(fd, part_offset, &offset, FILE_BEGIN);
-            printf("[DISK] Writing partition %d @ %08llx, %d bytes\n", i, offset.QuadPart, part->data_len);
-            if (offset.QuadPart != part_offset.QuadPart){
-                sprintf(error_msg, "Could not offset in the disk %s: %lu\n", disk->name, GetLastError());
-                goto error;
-            }
-            DWORD wr = 0;
-            success = WriteFile(fd, part->data, part->data_len, &wr, NULL);
-            if (!success || wr != part->data_len) {
-                sprintf(error_msg, "Could not write partition to disk %s: %lu\n", disk->name, GetLastError());
-                goto error;
-            }
-        } else {
-            printf("[DISK] Partition %d has no changes\n", i);
-        }
-    }
-
-    /* Apply the changes in RAM too */
-    disk_apply_changes(disk);
-    CloseHandle(fd);
-    return NULL;
-error:
-    CloseHandle(fd);
-    return error_msg;
-}
-
-
 static int set_errno(void)
 {
     DWORD error_code = GetLastError();
@@ -154,7 +97,7 @@ static int set_errno(void)
 }
 
 
-int disk_open(disk_info_t* disk, void** ret_fd)
+int disk_os_open(disk_info_t* disk, void** ret_fd)
 {
     assert(disk);
     assert(ret_fd);
@@ -172,7 +115,7 @@ int disk_open(disk_info_t* disk, void** ret_fd)
 }
 
 
-ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 {
     HANDLE handle = (HANDLE) disk_fd;
     uint8_t temp_buffer[DISK_SECTOR_SIZE];
@@ -216,7 +159,7 @@ ssize_t disk_read(void* disk_fd, void* buffer, off_t disk_offset, uint32_t len)
 }
 
 
-ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
+ssize_t disk_os_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_t len)
 {
     DWORD bytes_written;
     HANDLE handle = (HANDLE) disk_fd;
@@ -240,7 +183,86 @@ ssize_t disk_write(void* disk_fd, const void* buffer, off_t disk_offset, uint32_
 }
 
 
-void disk_close(void* disk_fd)
+ssize_t disk_os_readv(void* disk_fd, const disk_read_iovec_t* iov, int count, off_t disk_offset)
+{
+    HANDLE handle = (HANDLE) disk_fd;
+    ssize_t total = 0;
+    bool aligned = true;
+    assert(handle != INVALID_HANDLE_VALUE);
+
+    for (int i = 0; i < count; i++) {
+        total += iov[i].len;
+        aligned = aligned && (iov[i].len % DISK_SECTOR_SIZE) == 0;
+    }
+
+    if (!aligned) {
+        /* Physical drives only accept whole sectors, read the range at once and split it */
+        uint8_t* buffer = malloc(total);
+        if (buffer == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        const ssize_t bytes_read = disk_os_read(disk_fd, buffer, disk_offset, (uint32_t) total);
+        for (int i = 0, done = 0; bytes_read == total && i < count; done += iov[i].len, i++) {
+            memcpy(iov[i].base, buffer + done, iov[i].len);
+        }
+        free(buffer);
+        return bytes_read;
+    }
+
+    LARGE_INTEGER li_offset = {
+        .QuadPart = disk_offset
+    };
+    if (!SetFilePointerEx(handle, li_offset, NULL, FILE_BEGIN)) {
+        return set_errno();
+    }
+
+    /* The buffers follow each other on the disk, read them without seeking again */
+    total = 0;
+    for (int i = 0; i < count; i++) {
+        DWORD bytes_read = 0;
+        BOOL success = ReadFile(handle, iov[i].base, (DWORD) iov[i].len, &bytes_read, NULL);
+        if (!success) {
+            return set_errno();
+        }
+        total += bytes_read;
+        if (bytes_read != iov[i].len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+ssize_t disk_os_writev(void* disk_fd, const disk_iovec_t* iov, int count, off_t disk_offset)
+{
+    HANDLE handle = (HANDLE) disk_fd;
+    ssize_t total = 0;
+    assert(handle != INVALID_HANDLE_VALUE);
+
+    LARGE_INTEGER li_offset = {
+        .QuadPart = disk_offset
+    };
+    if (!SetFilePointerEx(handle, li_offset, NULL, FILE_BEGIN)) {
+        return set_errno();
+    }
+
+    /* The buffers follow each other on the disk, write them without seeking again */
+    for (int i = 0; i < count; i++) {
+        DWORD bytes_written = 0;
+        BOOL success = WriteFile(handle, iov[i].base, (DWORD) iov[i].len, &bytes_written, NULL);
+        if (!success || bytes_written != iov[i].len) {
+            return set_errno();
+        }
+        total += bytes_written;
+    }
+
+    return total;
+}
+
+
+void disk_os_close(void* disk_fd)
 {
     HANDLE handle = (HANDLE) disk_fd;
     if (handle != INVALID_HANDLE_VALUE) {
@@ -249,6 +271,113 @@ void disk_close(void* disk_fd)
 }
 
 
+int disk_set_image_size(FILE* file, uint64_t size, bool sparse)
+{
+    DWORD returned;
+
+    /* Make sure the data written so far (MBR) reached the file */
+    if (fflush(file) != 0) {
+        return -1;
+    }
+
+    HANDLE handle = (HANDLE) _get_osfhandle(_fileno(file));
+    if (handle == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    /* Extending a file that is not sparse allocates all its clusters on NTFS */
+    if (sparse && !DeviceIoControl(handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL)) {
+        printf("[WIN] Could not mark the image as sparse, it will be preallocated\n");
+    }
+
+    LARGE_INTEGER li_size = {
+        .QuadPart = size
+    };
+    if (!SetFilePointerEx(handle, li_size, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {
+        return set_errno();
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Let the controller of a physical drive know that a range is unused (TRIM).
+ */
+static int disk_trim(HANDLE handle, off_t disk_offset, uint64_t len)
+{
+    DWORD returned;
+
+    /* Only the sectors fully covered are discarded */
+    const uint64_t start = ((uint64_t) disk_offset + DISK_SECTOR_SIZE - 1) / DISK_SECTOR_SIZE * DISK_SECTOR_SIZE;
+    const uint64_t end = ((uint64_t) disk_offset + len) / DISK_SECTOR_SIZE * DISK_SECTOR_SIZE;
+    if (end <= start) {
+        return -1;
+    }
+
+    typedef struct {
+        DEVICE_MANAGE_DATA_SET_ATTRIBUTES attributes;
+        DEVICE_DATA_SET_RANGE             range;
+    } disk_trim_t;
+
+    disk_trim_t trim = {
+        .attributes = {
+            .Size                = sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES),
+            .Action              = DeviceDsmAction_Trim,
+            .Flags               = DEVICE_DSM_FLAG_TRIM_NOT_FS_ALLOCATED,
+            .DataSetRangesOffset = offsetof(disk_trim_t, range),
+            .DataSetRangesLength = sizeof(DEVICE_DATA_SET_RANGE),
+        },
+        .range = {
+            .StartingOffset = start,
+            .LengthInBytes  = end - start,
+        },
+    };
+    if (!DeviceIoControl(handle, IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES, &trim, sizeof(trim),
+                         NULL, 0, &returned, NULL))
+    {
+        return set_errno();
+    }
+
+    return 0;
+}
+
+
+int disk_os_discard(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    DWORD returned;
+    HANDLE handle = (HANDLE) disk_fd;
+
+    /* On sparse files, zeroing a range releases its clusters. Physical drives don't support it,
+     * their range is trimmed instead. */
+    FILE_ZERO_DATA_INFORMATION info = {
+        .FileOffset.QuadPart      = disk_offset,
+        .BeyondFinalZero.QuadPart = disk_offset + len,
+    };
+    if (!DeviceIoControl(handle, FSCTL_SET_ZERO_DATA, &info, sizeof(info), NULL, 0, &returned, NULL)) {
+        return disk_trim(handle, disk_offset, len);
+    }
+
+    return 0;
+}
+
+
+int disk_os_drop_cache(void* disk_fd, off_t disk_offset, uint64_t len)
+{
+    HANDLE handle = (HANDLE) disk_fd;
+    (void) disk_offset;
+    (void) len;
+
+    /* Physical drives are not cached by Windows, flushing is enough for them. For image files,
+     * the cache manager may still serve the data from memory. */
+    if (!FlushFileBuffers(handle)) {
+        return set_errno();
+    }
+
+    return 0;
+}
+
+
 static HWND hwndProgress = NULL;
 static HWND hwndWindow = NULL;
 
@@ -308,4 +437,23 @@ void disk_destroy_progress_bar(void) {
         hwndWindow = NULL;
         hwndProgress = NULL;
     }
-}
\ No newline at end of file
+}
+
+int disk_hotplug_init(void)
+{
+    return 1;
+}
+
+
+int disk_hotplug_poll(disk_hotplug_event_t* event)
+{
+    (void) event;
+    return 0;
+}
+
+
+int disk_hotplug_wait(int timeout_ms)
+{
+    (void) timeout_ms;
+    return -1;
+}
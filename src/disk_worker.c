@@ -0,0 +1,170 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "disk.h"
+#include "disk_worker.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+
+static ssize_t worker_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    disk_worker_t* worker = (disk_worker_t*) arg;
+    const size_t total = len;
+    uint8_t sector[DISK_SECTOR_SIZE];
+    uint8_t* out = (uint8_t*) buffer;
+    uint64_t offset = worker->partition_offset + addr;
+
+    /* The disk is read by whole sectors, the first and last ones may only be partially needed */
+    const size_t head = offset % DISK_SECTOR_SIZE;
+    if (head != 0) {
+        const size_t count = MIN(DISK_SECTOR_SIZE - head, len);
+        if (disk_read(worker->disk_fd, sector, offset - head, DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE) {
+            return -1;
+        }
+        memcpy(out, sector + head, count);
+        out += count;
+        offset += count;
+        len -= count;
+    }
+
+    const size_t aligned = len & ~(DISK_SECTOR_SIZE - 1);
+    if (aligned > 0) {
+        if (disk_read(worker->disk_fd, out, offset, aligned) != (ssize_t) aligned) {
+            return -1;
+        }
+        out += aligned;
+        offset += aligned;
+        len -= aligned;
+    }
+
+    if (len > 0) {
+        if (disk_read(worker->disk_fd, sector, offset, DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE) {
+            return -1;
+        }
+        memcpy(out, sector, len);
+    }
+
+    return total;
+}
+
+
+static ssize_t worker_readv(void* arg, const zealfs_iovec_t* iov, int count, uint32_t addr)
+{
+    disk_worker_t* worker = (disk_worker_t*) arg;
+    const uint64_t offset = worker->partition_offset + addr;
+    disk_read_iovec_t vec[ZFS_READV_MAX];
+    ssize_t total = 0;
+
+    if (offset % DISK_SECTOR_SIZE != 0) {
+        for (int i = 0; i < count; i++) {
+            if (worker_read(arg, iov[i].base, addr + total, iov[i].len) != (ssize_t) iov[i].len) {
+                return -1;
+            }
+            total += iov[i].len;
+        }
+        return total;
+    }
+
+    for (int i = 0; i < count; i++) {
+        vec[i] = (disk_read_iovec_t) { .base = iov[i].base, .len = iov[i].len };
+    }
+    return disk_readv(worker->disk_fd, vec, count, offset);
+}
+
+
+int disk_worker_init(disk_worker_t* worker, disk_info_t* disk, const partition_t* part, size_t buffer_size, void* job)
+{
+    memset(worker, 0, sizeof(*worker));
+    worker->job = job;
+    worker->partition_offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+    worker->zealfs = zealfs_context_create(worker_read, NULL, worker);
+    if (worker->zealfs == NULL) {
+        return -1;
+    }
+    worker->zealfs->readv = worker_readv;
+    if (buffer_size > 0) {
+        worker->buffer = malloc(buffer_size);
+        if (worker->buffer == NULL) {
+            return -1;
+        }
+    }
+    if (disk_open(disk, &worker->disk_fd)) {
+        worker->disk_fd = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void disk_worker_deinit(disk_worker_t* worker)
+{
+    if (worker->disk_fd != NULL) {
+        disk_close(worker->disk_fd);
+    }
+    zealfs_context_destroy(worker->zealfs);
+    free(worker->buffer);
+    memset(worker, 0, sizeof(*worker));
+}
+
+
+int disk_workers_count(int jobs, int min_workers, int max_workers)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cpus = info.dwNumberOfProcessors;
+#else
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    cpus = MAX(cpus, min_workers);
+    cpus = MIN(cpus, max_workers);
+    cpus = MIN(cpus, jobs);
+    return cpus > 0 ? cpus : 1;
+}
+
+
+static void* worker_thread(void* arg)
+{
+    disk_worker_t* worker = (disk_worker_t*) arg;
+    worker->routine(worker);
+    return NULL;
+}
+
+
+int disk_workers_run(disk_worker_t* workers, int count, disk_info_t* disk, const partition_t* part,
+                     size_t buffer_size, void (*routine)(disk_worker_t* worker))
+{
+    int started = 1;
+
+    for (; started < count; started++) {
+        disk_worker_t* worker = &workers[started];
+        if (disk_worker_init(worker, disk, part, buffer_size, workers[0].job)) {
+            /* Fewer threads will do the work */
+            disk_worker_deinit(worker);
+            break;
+        }
+        worker->routine = routine;
+        if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+            disk_worker_deinit(worker);
+            break;
+        }
+    }
+
+    workers[0].main_thread = true;
+    routine(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    return started;
+}
@@ -0,0 +1,111 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include "disk.h"
+#include "disk_writer.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+
+int disk_writer_init(disk_writer_t* writer, void* disk_fd, uint32_t au_size)
+{
+    assert(au_size >= DISK_SECTOR_SIZE && (au_size & (au_size - 1)) == 0);
+
+    memset(writer, 0, sizeof(*writer));
+    writer->disk_fd = disk_fd;
+    writer->au_size = au_size;
+    writer->capacity = MIN(au_size, DISK_WRITER_MAX_SIZE);
+    writer->buffer = malloc(writer->capacity);
+    if (writer->buffer == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+
+static int disk_writer_write_now(disk_writer_t* writer, const void* data, uint64_t offset, uint32_t len)
+{
+    const ssize_t wr = disk_write(writer->disk_fd, data, offset, len);
+    if (wr != (ssize_t) len) {
+        printf("[WRITER] Could not write %u bytes @ %08llx\n", len, (unsigned long long) offset);
+        return -EIO;
+    }
+    writer->writes++;
+    writer->bytes += len;
+    return 0;
+}
+
+
+int disk_writer_flush(disk_writer_t* writer)
+{
+    if (writer->len == 0) {
+        return 0;
+    }
+    const uint32_t len = writer->len;
+    writer->len = 0;
+    return disk_writer_write_now(writer, writer->buffer, writer->offset, len);
+}
+
+
+ssize_t disk_writer_write(disk_writer_t* writer, const void* data, uint64_t offset, uint32_t len)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    const uint32_t total = len;
+
+    while (len) {
+        /* Only consecutive data can be gathered */
+        if (writer->len != 0 && offset != writer->offset + writer->len) {
+            int err = disk_writer_flush(writer);
+            if (err) {
+                return err;
+            }
+        }
+        if (writer->len == 0) {
+            writer->offset = offset;
+        }
+
+        /* Never go past the end of the current allocation unit */
+        const uint64_t au_end = (offset / writer->au_size + 1) * writer->au_size;
+        const uint32_t room = (uint32_t) MIN(au_end - offset, writer->capacity - writer->len);
+        const uint32_t count = MIN(len, room);
+
+        if (writer->len == 0 && count == room) {
+            /* The data fills the rest of the unit on its own, no need to copy it */
+            int err = disk_writer_write_now(writer, bytes, offset, count);
+            if (err) {
+                return err;
+            }
+        } else {
+            memcpy(writer->buffer + writer->len, bytes, count);
+            writer->len += count;
+            if (count == room) {
+                int err = disk_writer_flush(writer);
+                if (err) {
+                    return err;
+                }
+            }
+        }
+
+        bytes += count;
+        offset += count;
+        len -= count;
+    }
+
+    return total;
+}
+
+
+int disk_writer_free(disk_writer_t* writer)
+{
+    const int err = disk_writer_flush(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return err;
+}
@@ -12,12 +12,16 @@
 #include "app_icon.h"
 #include "raylib-nuklear.h"
 #include "disk.h"
+#include "disk_verify.h"
+#include "disk_sim.h"
 
 #include "ui.h"
 #include "ui/popup.h"
 #include "ui/menubar.h"
 #include "ui/statusbar.h"
 #include "ui/partition_viewer.h"
+#include "ui/clone.h"
+#include "ui/redraw.h"
 #include "ui/tinyfiledialogs.h"
 
 typedef enum {
@@ -259,6 +263,7 @@ static void ui_mbr_handle(struct nk_context *ctx, disk_info_t* disk)
                 /* Yes/No prompt */
                 nk_layout_row_dynamic(ctx, 40, 2);
                 if (nk_button_label(ctx, "Yes")) {
+                    ui_partition_viewer_clear(ctx);
                     int success = disk_create_mbr(disk);
                     if (success) {
                         ui_statusbar_printf("MBR created successfully!\n");
@@ -292,7 +297,18 @@ static void ui_apply_handle(struct nk_context *ctx, disk_info_t* disk)
                     .title = "Apply changes",
                     .msg = "Success!"
                 };
+                disk_verify_t verify;
+                disk_verify_init(&verify);
+                /* The checksums must be computed before the staged data are released */
+                const bool verify_changes = disk_verify_enabled() && disk_verify_add_changes(&verify, disk) == 0;
+                ui_partition_viewer_clear(ctx);
                 const char* error_str = disk_write_changes(disk);
+                result_info.msg = "Success!";
+                if (error_str == NULL && verify_changes) {
+                    error_str = disk_verify_run_disk(&verify, disk);
+                    result_info.msg = "Success, changes verified!";
+                }
+                disk_verify_free(&verify);
                 if (error_str) {
                     result_info.msg = error_str;
                     printf("%s\n", error_str);
@@ -350,11 +366,10 @@ static void size_to_str(uint64_t size, units_t unit, char* output, int length)
  */
 static void ui_new_partition(struct nk_context *ctx, disk_info_t* disk)
 {
-    const char* all_alignments[] = { "512 bytes", "1 MiB" };
     static char size_input[16];
-    static int selected_alignment = 1;
+    /* Start the partitions on an allocation unit of the media by default */
+    static int selected_alignment = 2;
     static uint64_t selected_size_kb;
-    const int alignment = (selected_alignment == 0) ? 512 : 1048576;
     /* Shall be set to 1 when the popup was just opened */
     static int init_state = 1;
     const char* units[] = { "KiB", "MiB" };
@@ -365,6 +380,22 @@ static void ui_new_partition(struct nk_context *ctx, disk_info_t* disk)
     if (!popup_is_opened(POPUP_NEWPART, &position, &arg)) {
         return;
     }
+
+    char au_label[32];
+    const uint32_t au_size = disk_au_size(disk);
+    if (au_size >= MB) {
+        snprintf(au_label, sizeof(au_label), "Erase block (%u MiB)", (unsigned) (au_size / MB));
+    } else {
+        snprintf(au_label, sizeof(au_label), "Erase block (%u KiB)", (unsigned) (au_size / KB));
+    }
+    const char* all_alignments[] = { "512 bytes", "1 MiB", au_label };
+    const uint32_t all_alignment_sizes[] = { 512, 1*MB, au_size };
+    /* Small disks may not have room for an aligned partition, fall back to the sector alignment */
+    if (init_state && disk_max_partition_size(disk, all_alignment_sizes[selected_alignment], NULL) < 8*KB) {
+        selected_alignment = 0;
+    }
+    const uint32_t alignment = all_alignment_sizes[selected_alignment];
+
     if(nk_begin(ctx, "Create a new partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
         /* If there are no empty partition, show an error */
         if (disk->free_part_idx == -1) {
@@ -460,7 +491,7 @@ static void ui_new_partition(struct nk_context *ctx, disk_info_t* disk)
 
         /* Combo box for the alignment */
         nk_label(ctx, "Alignment:", NK_TEXT_CENTERED);
-        selected_alignment = nk_combo(ctx, all_alignments, 2, selected_alignment, COMBO_HEIGHT, nk_vec2(width, 150));
+        selected_alignment = nk_combo(ctx, all_alignments, DIM(all_alignments), selected_alignment, COMBO_HEIGHT, nk_vec2(width, 150));
         nk_label(ctx, "", NK_TEXT_CENTERED);
 
         /* Show the address where it will be created */
@@ -548,6 +579,13 @@ static void ui_new_image(struct nk_context *ctx, disk_list_state_t* state)
         selected_partition_table = nk_combo(ctx, partition_table_options, 2, selected_partition_table, COMBO_HEIGHT, nk_vec2(width, 150));
         nk_label(ctx, "", NK_TEXT_CENTERED);
 
+        /* Combo box for the allocation of the image on the host */
+        nk_label(ctx, "Allocation:", NK_TEXT_CENTERED);
+        const char* allocation_options[] = { "Sparse", "Preallocated" };
+        static int selected_allocation = 0;
+        selected_allocation = nk_combo(ctx, allocation_options, 2, selected_allocation, COMBO_HEIGHT, nk_vec2(width, 150));
+        nk_label(ctx, "", NK_TEXT_CENTERED);
+
 
         nk_layout_row_dynamic(ctx, 30, 2);
 
@@ -559,7 +597,8 @@ static void ui_new_image(struct nk_context *ctx, disk_list_state_t* state)
             /* The user clicked on `Create`, create a new disk image */
             uint64_t selected_size = disk_get_size_of_idx(image_size_index);
             popup_close(POPUP_NEWIMG);
-            int new_index = disk_create_image(state, image_path, selected_size, selected_partition_table == 1);
+            int new_index = disk_create_image(state, image_path, selected_size, selected_partition_table == 1,
+                                              selected_allocation == 0);
             if (new_index == -1) {
                 static popup_info_t error_info = {
                     .title = "Error",
@@ -623,10 +662,26 @@ static void setup_window(int argc, char* argv[]) {
 
 
 int main(int argc, char* argv[]) {
+    /* Image files can be slowed down as if they were on a real media, to measure the I/O features */
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--media=", 8) == 0) {
+            const char* error = disk_sim_configure(argv[i] + 8);
+            if (error) {
+                int count = 0;
+                const char* const* names = disk_sim_profile_names(&count);
+                fprintf(stderr, "%s, available profiles:", error);
+                for (int j = 0; j < count; j++) {
+                    fprintf(stderr, " %s", names[j]);
+                }
+                fprintf(stderr, "\n");
+                return 1;
+            }
+        }
+    }
+
     SetTraceLogLevel(LOG_WARNING);
     setup_window(argc, argv);
 
-    SetTargetFPS(60);
     popup_init(winWidth, winHeight);
 
     disk_err_t err = disks_refresh();
@@ -639,6 +694,11 @@ int main(int argc, char* argv[]) {
         return message_box(ctx, "You must run this program as Administrator!\n");
     }
 
+    /* Not supported on all platforms, the devices can still be refreshed manually */
+    const bool hotplug = disk_hotplug_init() == 0;
+    /* Only render frames when something happens */
+    ui_redraw_init(hotplug);
+
     const int fontSize = 13;
     Font font = LoadFontFromNuklear(fontSize);
     ctx = InitNuklearEx(font, fontSize);
@@ -646,6 +706,9 @@ int main(int argc, char* argv[]) {
     ui_statusbar_print("Ready!");
 
     while (!WindowShouldClose()) {
+        ui_redraw_begin_frame();
+        /* Apply the plugged/unplugged disks before rendering anything */
+        disks_hotplug_update();
         UpdateNuklear(ctx);
 
         /* If any popup is opened, the main window must not be focusable */
@@ -739,6 +802,7 @@ int main(int argc, char* argv[]) {
         ui_cancel_handle(ctx, current_disk);
         ui_new_partition(ctx, current_disk);
         ui_new_image(ctx, state);
+        ui_clone_show(ctx, state);
         /* Only allow the partition viewer if a partition is selected and we have no staged changes */
         struct nk_rect viewer_bounds = {
             .x = disk_view_rect.w,
@@ -763,9 +827,13 @@ int main(int argc, char* argv[]) {
         BeginDrawing();
             ClearBackground(WHITE);
             DrawNuklear(ctx);
+            /* Decide whether the next frame can wait for an event, `EndDrawing` is where it waits */
+            ui_redraw_end_frame();
         EndDrawing();
     }
 
+    /* Flush the opened partitions and save their metadata cache */
+    ui_partition_viewer_clear(ctx);
     UnloadNuklear(ctx);
     CloseWindow();
     return 0;
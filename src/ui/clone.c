@@ -0,0 +1,172 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include "disk_clone.h"
+#include "zealfs_session.h"
+#include "ui.h"
+#include "ui/clone.h"
+#include "ui/popup.h"
+#include "ui/redraw.h"
+#include "ui/statusbar.h"
+
+typedef enum {
+    CLONE_UI_SELECT,
+    CLONE_UI_RUNNING,
+    CLONE_UI_DONE,
+} clone_ui_state_t;
+
+static disk_clone_t s_clone;
+static clone_ui_state_t s_ui_state;
+/* Path of the disk to duplicate, the disks list may change while the popup is opened */
+static char s_source_path[256];
+static nk_bool s_selected[MAX_DISKS];
+static nk_bool s_verify = nk_true;
+
+
+void ui_clone_open(disk_info_t* disk)
+{
+    if (disk == NULL || s_ui_state == CLONE_UI_RUNNING) {
+        return;
+    }
+
+    snprintf(s_source_path, sizeof(s_source_path), "%s", disk->path);
+    memset(s_selected, 0, sizeof(s_selected));
+    s_ui_state = CLONE_UI_SELECT;
+    popup_open(POPUP_CLONE, 420, 380, NULL);
+}
+
+
+static bool ui_clone_is_candidate(const disk_info_t* source, const disk_info_t* disk)
+{
+    return disk != source && disk->valid && !disk->has_staged_changes &&
+           disk->size_bytes >= source->size_bytes && strcmp(disk->path, source->path) != 0;
+}
+
+
+static void ui_clone_select(struct nk_context *ctx, disk_list_state_t* state)
+{
+    disk_info_t* source = NULL;
+    for (int i = 0; i < state->disk_count; i++) {
+        if (strcmp(state->disks[i].path, s_source_path) == 0) {
+            source = &state->disks[i];
+        }
+    }
+
+    nk_layout_row_dynamic(ctx, 20, 1);
+    if (source == NULL) {
+        nk_label(ctx, "The source disk is not available anymore", NK_TEXT_LEFT);
+    } else {
+        nk_labelf(ctx, NK_TEXT_LEFT, "Source:%s", source->label);
+        nk_label(ctx, "Targets:", NK_TEXT_LEFT);
+
+        int candidates = 0;
+        for (int i = 0; i < state->disk_count; i++) {
+            disk_info_t* disk = &state->disks[i];
+            if (ui_clone_is_candidate(source, disk)) {
+                nk_checkbox_label(ctx, disk->label, &s_selected[i]);
+                candidates++;
+            } else {
+                s_selected[i] = nk_false;
+            }
+        }
+        if (candidates == 0) {
+            nk_label(ctx, "No disk is big enough", NK_TEXT_LEFT);
+        }
+        nk_checkbox_label(ctx, "Verify after writing", &s_verify);
+    }
+
+    nk_layout_row_dynamic(ctx, 30, 2);
+    if (nk_button_label(ctx, "Start") && source != NULL) {
+        disk_info_t* targets[MAX_DISKS];
+        int count = 0;
+        for (int i = 0; i < state->disk_count; i++) {
+            if (s_selected[i]) {
+                targets[count++] = &state->disks[i];
+                /* The partitions opened on the targets are about to be overwritten */
+                zealfs_session_close_disk(state->disks[i].path);
+            }
+        }
+
+        const char* error = count == 0 ? "No target selected" :
+                            disk_clone_start(&s_clone, source, targets, count, s_verify);
+        if (error) {
+            ui_statusbar_print(error);
+        } else {
+            /* Keep rendering frames to show the progress */
+            ui_redraw_busy_begin();
+            s_ui_state = CLONE_UI_RUNNING;
+        }
+    }
+    if (nk_button_label(ctx, "Cancel")) {
+        popup_close(POPUP_CLONE);
+    }
+}
+
+
+static void ui_clone_progress(struct nk_context *ctx)
+{
+    const float ratio[] = { 0.35f, 0.4f, 0.25f };
+
+    if (s_ui_state == CLONE_UI_RUNNING && !disk_clone_running(&s_clone)) {
+        const int failed = disk_clone_finish(&s_clone);
+        ui_redraw_busy_end();
+        s_ui_state = CLONE_UI_DONE;
+        ui_statusbar_printf("Duplication finished, %d/%d disks written\n",
+                            s_clone.targets_count - failed, s_clone.targets_count);
+    }
+
+    nk_layout_row_dynamic(ctx, 20, 1);
+    nk_labelf(ctx, NK_TEXT_LEFT, "Source: %s", s_clone.source.name);
+
+    nk_layout_row(ctx, NK_DYNAMIC, 20, 3, ratio);
+    for (int i = 0; i < s_clone.targets_count; i++) {
+        disk_clone_target_t* target = &s_clone.targets[i];
+        const uint64_t written = atomic_load(&target->written_bytes);
+        const int state = atomic_load(&target->state);
+        nk_size percent = s_clone.total_bytes ? (nk_size) (written * 100 / s_clone.total_bytes) : 100;
+
+        nk_label(ctx, target->disk.name, NK_TEXT_LEFT);
+        nk_progress(ctx, &percent, 100, nk_false);
+        if (state == CLONE_TARGET_FAILED) {
+            nk_label_colored(ctx, target->error, NK_TEXT_RIGHT, nk_rgb(255, 80, 80));
+        } else if (state == CLONE_TARGET_DONE) {
+            nk_label(ctx, s_clone.verify ? "Verified" : "Done", NK_TEXT_RIGHT);
+        } else if (state == CLONE_TARGET_VERIFYING) {
+            nk_label(ctx, "Verifying...", NK_TEXT_RIGHT);
+        } else {
+            nk_labelf(ctx, NK_TEXT_RIGHT, "%d%%", (int) percent);
+        }
+    }
+
+    nk_layout_row_dynamic(ctx, 30, 1);
+    if (s_ui_state == CLONE_UI_RUNNING) {
+        if (nk_button_label(ctx, "Cancel")) {
+            disk_clone_cancel(&s_clone);
+        }
+    } else if (nk_button_label(ctx, "Close")) {
+        popup_close(POPUP_CLONE);
+        s_ui_state = CLONE_UI_SELECT;
+    }
+}
+
+
+void ui_clone_show(struct nk_context *ctx, disk_list_state_t* state)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_CLONE, &position, NULL)) {
+        return;
+    }
+
+    if (nk_begin(ctx, "Duplicate disk", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        if (s_ui_state == CLONE_UI_SELECT) {
+            ui_clone_select(ctx, state);
+        } else {
+            ui_clone_progress(ctx);
+        }
+    }
+    nk_end(ctx);
+}
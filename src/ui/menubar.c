@@ -5,8 +5,16 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdio.h>
+#include "disk_image.h"
+#include "disk_manifest.h"
+#include "disk_verify.h"
+#include "zealfs_advisor.h"
+#include "zealfs_cache.h"
+#include "ui/clone.h"
 #include "ui/popup.h"
 #include "ui/menubar.h"
+#include "ui/partition_viewer.h"
+#include "ui/tinyfiledialogs.h"
 
 static popup_info_t info;
 
@@ -85,6 +93,125 @@ void ui_menubar_new_image(struct nk_context *ctx, disk_list_state_t* state)
 }
 
 
+void ui_menubar_dump_image(struct nk_context *ctx, disk_info_t* disk)
+{
+    if (disk == NULL) {
+        return;
+    }
+
+    const char* filter_patterns[] = { "*.img" };
+    const char* path = tinyfd_saveFileDialog("Dump disk to image", "dump.img", 1, filter_patterns, NULL);
+    if (path == NULL) {
+        return;
+    }
+
+    const char* error = disk_image_dump(disk, path);
+    info.data = NULL;
+    info.title = "Dump image";
+    info.msg = error ? error : "Success!";
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
+void ui_menubar_export_manifest(struct nk_context *ctx, disk_info_t* disk, int partition)
+{
+    if (disk == NULL) {
+        return;
+    }
+
+    const char* filter_patterns[] = { "*.txt" };
+    const char* path = tinyfd_saveFileDialog("Export manifest", "manifest.txt", 1, filter_patterns, NULL);
+    if (path == NULL) {
+        return;
+    }
+
+    const char* error = disk_manifest_export(disk, partition, path);
+    info.data = NULL;
+    info.title = "Export manifest";
+    info.msg = error ? error : "Success!";
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
+void ui_menubar_format_advised(struct nk_context *ctx, disk_info_t* disk, int partition)
+{
+    static char report[1024];
+    char size_str[32];
+    zealfs_advice_t advice;
+
+    if (disk == NULL || partition < 0 || partition >= MAX_PART_COUNT || !disk->staged_partitions[partition].active) {
+        return;
+    }
+
+    const char* host_dir = tinyfd_selectFolderDialog("Select a directory with sample files", NULL);
+    if (host_dir == NULL) {
+        return;
+    }
+
+    const uint64_t part_size = disk->staged_partitions[partition].size_sectors * DISK_SECTOR_SIZE;
+    info.data = NULL;
+    info.title = "Format partition";
+    if (zealfs_advise_page_size(host_dir, part_size, &advice) != 0) {
+        info.msg = "Could not browse the sample directory";
+        popup_open(POPUP_MBR, 300, 140, &info);
+        return;
+    } else if (advice.best < 0) {
+        info.msg = "The sample files don't fit in the partition, whatever the page size";
+        popup_open(POPUP_MBR, 300, 140, &info);
+        return;
+    }
+
+    disk_get_size_str(advice.bytes, size_str, sizeof(size_str));
+    int len = snprintf(report, sizeof(report), "%u files, %u directories, %s\n\nPage: slack, metadata, reads\n",
+                       advice.files, advice.dirs, size_str);
+    for (int i = 0; i < ZEALFS_ADVISOR_SIZES && len < (int) sizeof(report); i++) {
+        const zealfs_page_advice_t* size = &advice.sizes[i];
+        if (size->valid && size->fits) {
+            len += snprintf(report + len, sizeof(report) - len, "%s%d: %llu KB, %llu KB, %llu\n",
+                            i == advice.best ? "> " : "  ", size->page_size,
+                            (unsigned long long) size->slack_bytes / KB, (unsigned long long) size->metadata_bytes / KB,
+                            (unsigned long long) size->read_ops);
+        }
+    }
+    if (len < (int) sizeof(report)) {
+        snprintf(report + len, sizeof(report) - len, "\nFormat with %d-byte pages?", advice.sizes[advice.best].page_size);
+    }
+    if (!tinyfd_messageBox("Format partition", report, "yesno", "question", 0)) {
+        return;
+    }
+
+    const char* error = disk_format_partition_page_size(disk, partition, advice.sizes[advice.best].page_size);
+    info.msg = error ? error : "Success!";
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
+void ui_menubar_restore_image(struct nk_context *ctx, disk_info_t* disk)
+{
+    if (disk == NULL) {
+        return;
+    }
+
+    const char* filter_patterns[] = { "*.img" };
+    const char* path = tinyfd_openFileDialog("Restore image to disk", "", 1, filter_patterns, "Disk Image Files", 0);
+    if (path == NULL ||
+        !tinyfd_messageBox("Restore image", "The content of the disk will be overwritten, are you sure?",
+                           "yesno", "warning", 0))
+    {
+        return;
+    }
+
+    /* Close the opened partitions first, their metadata must not be written or cached over the
+     * restored image. The partitions may also change, the viewer will parse them again */
+    ui_partition_viewer_clear(ctx);
+    const char* error = disk_image_restore(disk, path);
+    info.data = NULL;
+    info.title = "Restore image";
+    info.msg = error ? error : "Success!";
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
 int ui_menubar_show(struct nk_context *ctx, disk_list_state_t* state, int width)
 {
     int must_exit = 0;
@@ -97,12 +224,18 @@ int ui_menubar_show(struct nk_context *ctx, disk_list_state_t* state, int width)
         const float ratios[] = { 0.04f, 0.07f, 0.04f };
         nk_layout_row(ctx, NK_DYNAMIC, 25, 3, ratios);
 
-        if (nk_menu_begin_label(ctx, "File", NK_TEXT_LEFT, nk_vec2(130, 200))) {
+        if (nk_menu_begin_label(ctx, "File", NK_TEXT_LEFT, nk_vec2(150, 410))) {
             nk_layout_row_dynamic(ctx, 25, 1);
             if (nk_menu_item_label(ctx, "Open image...", NK_TEXT_LEFT)) {
                 ui_menubar_load_image(ctx, state);
             } else if (nk_menu_item_label(ctx, "Create image...", NK_TEXT_LEFT)) {
                 ui_menubar_new_image(ctx, state);
+            } else if (nk_menu_item_label(ctx, "Dump image...", NK_TEXT_LEFT)) {
+                ui_menubar_dump_image(ctx, disk);
+            } else if (nk_menu_item_label(ctx, "Restore image...", NK_TEXT_LEFT)) {
+                ui_menubar_restore_image(ctx, disk);
+            } else if (nk_menu_item_label(ctx, "Duplicate disk...", NK_TEXT_LEFT)) {
+                ui_clone_open(disk);
             }
             if (nk_menu_item_label(ctx, "Refresh devices", NK_TEXT_LEFT)) {
                 disks_refresh();
@@ -113,10 +246,26 @@ int ui_menubar_show(struct nk_context *ctx, disk_list_state_t* state, int width)
             } else if (nk_menu_item_label(ctx, "Quit", NK_TEXT_LEFT)) {
                 must_exit = 1;
             }
+            nk_bool verify = disk_verify_enabled();
+            if (nk_checkbox_label(ctx, "Verify writes", &verify)) {
+                disk_verify_set_enabled(verify);
+            }
+            nk_bool erase = disk_format_erase();
+            if (nk_checkbox_label(ctx, "Erase on format", &erase)) {
+                disk_format_set_erase(erase);
+            }
+            nk_bool trim = disk_trim_enabled();
+            if (nk_checkbox_label(ctx, "TRIM freed space", &trim)) {
+                disk_trim_set_enabled(trim);
+            }
+            nk_bool cache = zealfs_cache_enabled();
+            if (nk_checkbox_label(ctx, "Cache metadata", &cache)) {
+                zealfs_cache_set_enabled(cache);
+            }
             nk_menu_end(ctx);
         }
 
-        if (nk_menu_begin_label(ctx, "Partition", NK_TEXT_LEFT, nk_vec2(100, 200))) {
+        if (nk_menu_begin_label(ctx, "Partition", NK_TEXT_LEFT, nk_vec2(140, 290))) {
             nk_layout_row_dynamic(ctx, 25, 1);
             if (nk_menu_item_label(ctx, "Create MBR", NK_TEXT_LEFT)) {
                 ui_menubar_create_mbr(ctx, disk);
@@ -129,6 +278,14 @@ int ui_menubar_show(struct nk_context *ctx, disk_list_state_t* state, int width)
                 info.title = "Format partition";
                 info.msg = error ? error : "Success!";
                 popup_open(POPUP_MBR, 300, 140, &info);
+            } else if (nk_menu_item_label(ctx, "Format for files...", NK_TEXT_LEFT)) {
+                ui_menubar_format_advised(ctx, disk, state->selected_partition);
+            } else if (nk_menu_item_label(ctx, "Export manifest...", NK_TEXT_LEFT)) {
+                ui_menubar_export_manifest(ctx, disk, state->selected_partition);
+            } else if (nk_menu_item_label(ctx, "Check file system", NK_TEXT_LEFT)) {
+                ui_partition_viewer_check(ctx);
+            } else if (nk_menu_item_label(ctx, "Defragment", NK_TEXT_LEFT)) {
+                ui_partition_viewer_defrag(ctx);
             }
             nk_menu_end(ctx);
         }
@@ -2,24 +2,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "raylib.h"
 #include "ui/statusbar.h"
 #include "ui/menubar.h"
 #include "ui/partition_viewer.h"
 #include "ui/tinyfiledialogs.h"
+#include "ui/popup.h"
 #include "zealfs_v2.h"
+#include "zealfs_sync.h"
+#include "disk_verify.h"
+#include "disk_analyzer.h"
+#include "zealfs_session.h"
+#include "zealfs_copy.h"
+#include "disk_export.h"
+#include "crc32c.h"
 
 #define MAX_PATH_LENGTH 512
-#define MAX_ENTRIES     2048 // 64KB pages / 32
+/* Size of the reads done when verifying an imported file */
+#define VERIFY_READ_SIZE        (64*KB)
+/* Number of entries allocated at first, doubled whenever the arrays are full */
+#define ENTRIES_INIT_CAPACITY   256
+#define ENTRY_ROW_HEIGHT        20
 #define ENTRY_NAME_LEN  (NAME_MAX_LEN)
 #define ENTRY_SIZE_LEN  14
 #define ENTRY_TYPE_LEN  12
 #define ENTRY_DATE_LEN  16
 
-#define CHECK_RW(ret)   do { if((ret) <= 0) { return (ret); } } while(0)
-
+/* Strings shown in the view for an entry, only formatted once the entry becomes visible */
 typedef struct {
+    bool formatted;
     char name[ENTRY_NAME_LEN + 2]; // +2 in case it's a directory, to add `/` and \0
     char size[ENTRY_SIZE_LEN];
     char type[ENTRY_TYPE_LEN];
@@ -29,14 +43,16 @@ typedef struct {
 
 typedef struct {
     char address_bar[MAX_PATH_LENGTH];
+    disk_info_t* disk;
     partition_t* partition;
     int  selected_file;
-    /* Opened disk descriptor */
-    void* disk_fd;
-    /* Entries for the current view */
-    zealfs_entry_t entries_raw[MAX_ENTRIES];
-    partition_entry_t entries[MAX_ENTRIES];
+    /* Opened partition, it remains opened when switching to another one */
+    zealfs_session_t* session;
+    /* Entries for the current view, both arrays have `entries_capacity` elements */
+    zealfs_entry_t* entries_raw;
+    partition_entry_t* entries;
     int entries_count;
+    int entries_capacity;
 } partition_viewer_t;
 
 
@@ -45,119 +61,32 @@ static partition_viewer_t m_part_ctx = {
     .address_bar = { '/', 0 }
 };
 
+/* Context of the opened partition, owned by its session */
+static zealfs_context_t* zealfs_ctx;
 
-static inline int chars_width_px(int n)
-{
-    const int font_size = 8;
-    return n * font_size;
-}
-
-
-static ssize_t partition_viewer_read(void* arg, void* buffer, uint32_t addr, size_t len)
-{
-    const size_t total = len;
-    uint8_t temp_sector[DISK_SECTOR_SIZE];
-    partition_viewer_t* fs_ctx = (partition_viewer_t*) arg;
-    off_t disk_offset = (off_t) fs_ctx->partition->start_lba * DISK_SECTOR_SIZE + addr;
-    ssize_t bytes_read = 0;
-
-    /* Check if addr is aligned to DISK_SECTOR_SIZE */
-    size_t offset = addr % DISK_SECTOR_SIZE;
-    if (offset != 0) {
-        /* Read the first unaligned sector */
-        const off_t first_sector_offset = disk_offset - offset;
-        bytes_read = disk_read(fs_ctx->disk_fd, temp_sector, first_sector_offset, DISK_SECTOR_SIZE);
-        CHECK_RW(bytes_read);
-
-        /* Copy the relevant part of the sector to the buffer */
-        const size_t unaligned_len = DISK_SECTOR_SIZE - offset;
-        const size_t bytes_to_copy = NK_MIN(len, unaligned_len);
-        memcpy(buffer, temp_sector + offset, bytes_to_copy);
-
-        /* Update the buffer, addr, and len */
-        len -= bytes_to_copy;
-        buffer += bytes_to_copy;
-        disk_offset += bytes_to_copy;
-    }
-
-    if (len == 0) {
-        return total;
-    }
-
-    /* Read the sector from the disk */
-    bytes_read = disk_read(fs_ctx->disk_fd, buffer, disk_offset, len);
-    CHECK_RW(bytes_read);
-
-    return total;
-}
-
-static ssize_t read_write_sector(partition_viewer_t* fs_ctx, const void* buffer, off_t aligned_addr, off_t offset, size_t len)
-{
-    uint8_t temp_sector[DISK_SECTOR_SIZE];
-
-    /* Read the first unaligned sector and write it back */
-    // printf("read_write_sector:read: aligned_addr=0x%lx, offset=%lu, len=%u\n", aligned_addr, offset, len);
-    ssize_t bytes_read = disk_read(fs_ctx->disk_fd, temp_sector, aligned_addr, DISK_SECTOR_SIZE);
-    CHECK_RW(bytes_read);
+/* Entry to copy to another partition and its destination, picked in the copy popup */
+static struct {
+    zealfs_session_t* source;
+    /* Use counter of the source when the popup was opened, tells if its slot was reused since */
+    uint64_t source_use;
+    zealfs_entry_t entry;
+    char src_dir[MAX_PATH_LENGTH];
+    char dst_dir[MAX_PATH_LENGTH + 1];
+    int  disk;
+    int  partition;
+} m_copy;
 
-    /* Copy the relevant part of the sector to the buffer */
-    const size_t unaligned_len = DISK_SECTOR_SIZE - offset;
-    const size_t bytes_to_copy = NK_MIN(len, unaligned_len);
-    memcpy(temp_sector + offset, buffer, bytes_to_copy);
+/* Fragmentation and space usage of the opened partition, scanned in the background */
+static disk_analyzer_t m_analyzer;
 
-    /* Write it back */
-    // printf("read_write_sector:write: aligned_addr=0x%lx, offset=%u, len=%u\n", aligned_addr, offset, DISK_SECTOR_SIZE);
-    ssize_t bytes_written = disk_write(fs_ctx->disk_fd, temp_sector, aligned_addr, DISK_SECTOR_SIZE);
-    CHECK_RW(bytes_written);
-
-    return bytes_to_copy;
-}
 
-
-static ssize_t partition_viewer_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+static inline int chars_width_px(int n)
 {
-    const size_t total = len;
-    partition_viewer_t* fs_ctx = (partition_viewer_t*) arg;
-    off_t disk_offset = (off_t) fs_ctx->partition->start_lba * DISK_SECTOR_SIZE + addr;
-
-    /* Check if addr is aligned to DISK_SECTOR_SIZE */
-    size_t offset = addr % DISK_SECTOR_SIZE;
-    if (offset != 0) {
-        const off_t first_sector_addr = disk_offset - offset;
-        ssize_t written = read_write_sector(fs_ctx, buffer, first_sector_addr, offset, len);
-        CHECK_RW(written);
-
-        /* Update the buffer, addr, and len */
-        len -= written;
-        buffer += written;
-        disk_offset += written;
-    }
-
-    /* Write in chunks of DISK_SECTOR_SIZE */
-    for (int i = 0; i < len / DISK_SECTOR_SIZE; i++) {
-        ssize_t written = read_write_sector(fs_ctx, buffer, disk_offset, 0, DISK_SECTOR_SIZE);
-        CHECK_RW(written);
-        buffer += DISK_SECTOR_SIZE;
-        disk_offset += DISK_SECTOR_SIZE;
-    }
-
-    /* Handle any remaining unaligned bytes */
-    len = len % DISK_SECTOR_SIZE;
-    if (len > 0) {
-        ssize_t written = read_write_sector(fs_ctx, buffer, disk_offset, 0, len);
-        CHECK_RW(written);
-    }
-
-    return total;
+    const int font_size = 8;
+    return n * font_size;
 }
 
 
-static zealfs_context_t zealfs_ctx = {
-    .read     = partition_viewer_read,
-    .write    = partition_viewer_write,
-    .arg      = &m_part_ctx,
-};
-
 static void add_trailing_slash(char* path, size_t max_size)
 {
     size_t len = strlen(path);
@@ -184,6 +113,65 @@ static void remove_trailing_slash(char* path)
 }
 
 
+/**
+ * @brief Make sure the entries arrays can hold at least `capacity` entries.
+ *
+ * @returns 0 on success, -ENOMEM on failure, in which case the former arrays are kept.
+ */
+static int reserve_entries(int capacity)
+{
+    if (capacity <= m_part_ctx.entries_capacity) {
+        return 0;
+    }
+
+    zealfs_entry_t* entries_raw = realloc(m_part_ctx.entries_raw, capacity * sizeof(zealfs_entry_t));
+    if (entries_raw == NULL) {
+        return -ENOMEM;
+    }
+    m_part_ctx.entries_raw = entries_raw;
+
+    partition_entry_t* entries = realloc(m_part_ctx.entries, capacity * sizeof(partition_entry_t));
+    if (entries == NULL) {
+        return -ENOMEM;
+    }
+    m_part_ctx.entries = entries;
+    m_part_ctx.entries_capacity = capacity;
+    return 0;
+}
+
+
+/**
+ * @brief Get the strings to show for the given entry, format them on the first access.
+ */
+static partition_entry_t* get_entry(int index)
+{
+    partition_entry_t* entry = &m_part_ctx.entries[index];
+    if (entry->formatted) {
+        return entry;
+    }
+
+    char tmp[64];
+    const zealfs_entry_t* entry_raw = &m_part_ctx.entries_raw[index];
+    const int is_dir = entry_raw->flags & IS_DIR;
+    snprintf(entry->name, ENTRY_NAME_LEN, "%s%c", entry_raw->name, is_dir ? '/' : '\0');
+    snprintf(entry->size, ENTRY_SIZE_LEN, "%u", entry_raw->size);
+    snprintf(entry->type, ENTRY_TYPE_LEN, "%s", is_dir ? "Directory" : "File");
+    const uint8_t year_hi = from_bcd(entry_raw->year[0]);
+    const uint8_t year_lo = from_bcd(entry_raw->year[1]);
+    const uint8_t month  = from_bcd(entry_raw->month);
+    const uint8_t day    = from_bcd(entry_raw->day);
+    const uint8_t hour   = from_bcd(entry_raw->hours);
+    const uint8_t minute = from_bcd(entry_raw->minutes);
+    const uint8_t second = from_bcd(entry_raw->seconds);
+
+    snprintf(tmp, sizeof(tmp), "%02u%02u-%02u-%02u %02u:%02u:%02u",
+             year_hi, year_lo, month, day, hour, minute, second);
+    memcpy(entry->date, tmp, ENTRY_DATE_LEN);
+    entry->formatted = true;
+    return entry;
+}
+
+
 static int read_directory(const char* path_ro)
 {
     zealfs_fd_t fd;
@@ -194,38 +182,51 @@ static int read_directory(const char* path_ro)
     remove_trailing_slash(path);
 
     /* We have to create a context/arg for zealfs functions */
-    int ret = zealfs_opendir(path, &zealfs_ctx, &fd);
+    int ret = zealfs_opendir(path, zealfs_ctx, &fd);
     if (ret) {
         printf("[VIEWER] Could not open directory %s: %s\n", path, strerror(-ret));
         return ret;
     }
 
-    /* Browse the root directory */
-    const int filled_entries = zealfs_readdir(&zealfs_ctx, &fd, m_part_ctx.entries_raw, MAX_ENTRIES);
-    m_part_ctx.entries_count = filled_entries;
-
-    for (int i = 0; i < filled_entries; i++) {
-        char tmp[64];
-
-        partition_entry_t* entry = &m_part_ctx.entries[i];
-        zealfs_entry_t* entry_raw = &m_part_ctx.entries_raw[i];
+    zealfs_dir_iter_t iter;
+    ret = zealfs_dir_iter_init(zealfs_ctx, &fd, &iter);
+    if (ret) {
+        return ret;
+    }
 
-        const int is_dir = m_part_ctx.entries_raw[i].flags & 1;
-        snprintf(entry->name, ENTRY_NAME_LEN, "%s%c", entry_raw->name, is_dir ? '/' : '\0');
-        snprintf(entry->size, ENTRY_SIZE_LEN, "%u", entry_raw->size);
-        snprintf(entry->type, ENTRY_TYPE_LEN, "%s", is_dir ? "Directory" : "File");
-        const uint8_t year_hi = from_bcd(entry_raw->year[0]);
-        const uint8_t year_lo = from_bcd(entry_raw->year[1]);
-        const uint8_t month  = from_bcd(entry_raw->month);
-        const uint8_t day    = from_bcd(entry_raw->day);
-        const uint8_t hour   = from_bcd(entry_raw->hours);
-        const uint8_t minute = from_bcd(entry_raw->minutes);
-        const uint8_t second = from_bcd(entry_raw->seconds);
+    /* Stream the directory batch by batch, growing the arrays when they get full */
+    int filled_entries = 0;
+    while (1) {
+        if (filled_entries == m_part_ctx.entries_capacity) {
+            const int capacity = NK_MAX(m_part_ctx.entries_capacity * 2, ENTRIES_INIT_CAPACITY);
+            ret = reserve_entries(capacity);
+            if (ret) {
+                /* Show the entries that could be read so far */
+                printf("[VIEWER] Could not allocate %d entries\n", capacity);
+                break;
+            }
+        }
+        ret = zealfs_dir_iter_next(zealfs_ctx, &iter, m_part_ctx.entries_raw + filled_entries,
+                                   m_part_ctx.entries_capacity - filled_entries);
+        if (ret < 0) {
+            /* The entries read so far don't belong to the directory shown in the address bar */
+            printf("[VIEWER] Could not read directory %s: %s\n", path, strerror(-ret));
+            ui_statusbar_printf("Could not read directory '%s': %s\n", path, strerror(-ret));
+            m_part_ctx.entries_count = 0;
+            m_part_ctx.selected_file = 0;
+            return ret;
+        } else if (ret == 0) {
+            break;
+        }
+        filled_entries += ret;
+    }
 
-        snprintf(tmp, sizeof(tmp), "%02u%02u-%02u-%02u %02u:%02u:%02u",
-                 year_hi, year_lo, month, day, hour, minute, second);
-        memcpy(entry->date, tmp, ENTRY_DATE_LEN);
+    /* The strings are formatted when the entries are shown */
+    m_part_ctx.entries_count = filled_entries;
+    for (int i = 0; i < m_part_ctx.entries_count; i++) {
+        m_part_ctx.entries[i].formatted = false;
     }
+    m_part_ctx.selected_file = NK_MIN(m_part_ctx.selected_file, NK_MAX(m_part_ctx.entries_count - 1, 0));
 
     return 0;
 }
@@ -262,32 +263,45 @@ static void partition_viewer_clear(void)
         m_part_ctx.entries_count = 0;
         m_part_ctx.selected_file = 0;
         m_part_ctx.partition = NULL;
-        disk_close(m_part_ctx.disk_fd);
-        m_part_ctx.disk_fd = NULL;
+        m_part_ctx.disk = NULL;
+        /* The session stays opened, only make sure the disk is up to date while it is idle */
+        zealfs_session_flush(m_part_ctx.session);
+        zealfs_session_unpin(m_part_ctx.session);
+        m_part_ctx.session = NULL;
+        zealfs_ctx = NULL;
+        disk_analyzer_stop(&m_analyzer);
     }
 }
 
 
 /**
- * @brief Parse a newly opened partition
+ * @brief Parse a newly opened partition, or show again a partition that was already opened
  */
 static void partition_viewer_parse(disk_info_t* disk, partition_t* part)
 {
+    const char* error = NULL;
+
     partition_viewer_clear();
     m_part_ctx.partition = part;
+    m_part_ctx.disk = disk;
 
     if (disk == NULL || part == NULL) {
         return;
-    } else {
-        zealfs_destroy(&zealfs_ctx);
     }
 
-    int ret = disk_open(disk, &m_part_ctx.disk_fd);
-    if (ret) {
-        printf("[VIEWER] Could not open disk\n");
+    m_part_ctx.session = zealfs_session_get(disk, part, &error);
+    if (m_part_ctx.session == NULL) {
+        ui_statusbar_printf("Could not open the partition: %s\n", error);
         return;
     }
+    /* Opening other partitions must not close the one shown */
+    zealfs_session_pin(m_part_ctx.session);
+    zealfs_ctx = m_part_ctx.session->ctx;
 
+    error = disk_analyzer_start(&m_analyzer, disk, part);
+    if (error) {
+        printf("[VIEWER] %s\n", error);
+    }
     refresh_directory();
 }
 
@@ -309,9 +323,10 @@ static void create_directory(void)
     if (folder_name && strlen(folder_name) > 0 && strlen(folder_name) <= ENTRY_NAME_LEN) {
         char path[MAX_PATH_LENGTH];
         snprintf(path, MAX_PATH_LENGTH, "%s%s", m_part_ctx.address_bar, folder_name);
-        int ret = zealfs_mkdir(path, &zealfs_ctx, NULL);
+        int ret = zealfs_mkdir(path, zealfs_ctx, NULL);
         if (ret == 0) {
             ui_statusbar_printf("Folder '%s' created successfully.\n", folder_name);
+            disk_analyzer_update_dir(&m_analyzer, zealfs_ctx, m_part_ctx.address_bar);
             refresh_directory();
         } else {
             ui_statusbar_printf("Failed to create folder '%s': %s\n", folder_name, strerror(-ret));
@@ -319,6 +334,44 @@ static void create_directory(void)
     } else if (folder_name) {
         ui_statusbar_print("Invalid folder name. Must be 1-16 characters long.");
     }
+    /* The dump, the manifest or the clone read the disk through their own descriptor */
+    zealfs_session_flush(m_part_ctx.session);
+}
+
+
+static void sync_directory(void)
+{
+    char path[MAX_PATH_LENGTH];
+    zealfs_sync_stats_t stats;
+    int flags = 0;
+
+    const char* host_dir = tinyfd_selectFolderDialog("Select the directory to synchronize", NULL);
+    if (host_dir == NULL) {
+        return;
+    }
+    if (tinyfd_messageBox("Synchronize", "Delete the files that are not in the selected directory?",
+                          "yesno", "question", 0))
+    {
+        flags |= ZEALFS_SYNC_DELETE;
+    }
+    if (tinyfd_messageBox("Synchronize", "Also compare the content of the files that have the same size and date? "
+                          "This is slower since all the files are read.", "yesno", "question", 0))
+    {
+        flags |= ZEALFS_SYNC_CONTENT;
+    }
+
+    snprintf(path, MAX_PATH_LENGTH, "%s", m_part_ctx.address_bar);
+    remove_trailing_slash(path);
+    int ret = zealfs_sync(zealfs_ctx, host_dir, path, flags, &stats);
+    /* The entries processed before an error are reported too */
+    ui_statusbar_printf("%s%s: %d created, %d updated, %d deleted, %d unchanged, %d skipped, %d failed\n",
+                        ret < 0 ? "Synchronization failed, " : "Synchronized", ret < 0 ? strerror(-ret) : "",
+                        stats.created, stats.updated, stats.deleted, stats.unchanged, stats.skipped, stats.failed);
+    zealfs_discard_flush(zealfs_ctx);
+    zealfs_session_flush(m_part_ctx.session);
+    /* Sub-directories may have been synchronized too */
+    disk_analyzer_invalidate(&m_analyzer);
+    refresh_directory();
 }
 
 
@@ -330,27 +383,65 @@ static void delete_entry(void)
         return;
     }
 
-    char* name = m_part_ctx.entries[m_part_ctx.selected_file].name;
+    char* name = get_entry(m_part_ctx.selected_file)->name;
     snprintf(path, MAX_PATH_LENGTH, "%s%s", m_part_ctx.address_bar, name);
     remove_trailing_slash(path);
 
     if (m_part_ctx.entries_raw[m_part_ctx.selected_file].flags & 1) {
-        int ret = zealfs_rmdir(path, &zealfs_ctx);
+        int ret = zealfs_rmdir(path, zealfs_ctx);
         if (ret == 0) {
             ui_statusbar_printf("Directory '%s' deleted.\n", name);
+            disk_analyzer_update_dir(&m_analyzer, zealfs_ctx, m_part_ctx.address_bar);
             refresh_directory();
         } else {
             ui_statusbar_printf("Failed to delete directory '%s': %s\n", name, strerror(-ret));
         }
     } else {
-        int ret = zealfs_unlink(path, &zealfs_ctx);
+        int ret = zealfs_unlink(path, zealfs_ctx);
         if (ret == 0) {
             ui_statusbar_printf("File '%s' deleted successfully.\n", name);
+            disk_analyzer_update_dir(&m_analyzer, zealfs_ctx, m_part_ctx.address_bar);
             refresh_directory();
         } else {
             ui_statusbar_printf("Failed to delete file '%s': %s\n", name, strerror(-ret));
         }
     }
+    zealfs_discard_flush(zealfs_ctx);
+    zealfs_session_flush(m_part_ctx.session);
+}
+
+
+/**
+ * @brief Extract the selected directory and all its content to a directory of the host, named after it.
+ */
+static void extract_selected_directory(void)
+{
+    char path[MAX_PATH_LENGTH];
+    char host_path[MAX_PATH_LENGTH * 2];
+    disk_export_stats_t stats;
+
+    const char* host_dir = tinyfd_selectFolderDialog("Exporting directory, choose a destination", NULL);
+    if (host_dir == NULL) {
+        return;
+    }
+
+    /* The entry name of a directory ends with a `/` */
+    const char* name = get_entry(m_part_ctx.selected_file)->name;
+    snprintf(path, sizeof(path), "%s%s", m_part_ctx.address_bar, name);
+    remove_trailing_slash(path);
+    snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, name);
+    remove_trailing_slash(host_path);
+    ui_statusbar_printf("Extracting to %s...\n", host_path);
+
+    /* The files are read through other descriptors, the session must not hold any data */
+    zealfs_session_flush(m_part_ctx.session);
+    const char* error = disk_export_dir(m_part_ctx.disk, m_part_ctx.partition, path, host_path, &stats);
+    if (error) {
+        ui_statusbar_printf("Could not extract directory %s: %s\n", path, error);
+    } else {
+        ui_statusbar_printf("Directory extracted successfully: %d files, %d directories (%llu bytes)\n",
+                            stats.files, stats.directories, (unsigned long long) stats.bytes_written);
+    }
 }
 
 
@@ -365,13 +456,13 @@ static void extract_selected_file(void)
     if (m_part_ctx.entries_count <= 0) {
         return;
     }
-    /* At the moment, only extarct files, not directories */
-    if (m_part_ctx.entries_raw[m_part_ctx.selected_file].flags & 1) {
-        ui_statusbar_print("Only files can be extracted!");
+    /* Directories are extracted with all their content */
+    if (m_part_ctx.entries_raw[m_part_ctx.selected_file].flags & IS_DIR) {
+        extract_selected_directory();
         return;
     }
 
-    char* filename = m_part_ctx.entries[m_part_ctx.selected_file].name;
+    char* filename = get_entry(m_part_ctx.selected_file)->name;
     /* Where to save the file */
     char* destination = tinyfd_saveFileDialog("Exporting file, choose a destination",
                                               filename, 0,
@@ -384,7 +475,7 @@ static void extract_selected_file(void)
 
     /* Determine the file that is selected */
     snprintf(path, sizeof(path), "%s%s", m_part_ctx.address_bar, filename);
-    int ret = zealfs_open(path, &zealfs_ctx, &fd);
+    int ret = zealfs_open(path, zealfs_ctx, &fd);
     if (ret < 0) {
         ui_statusbar_printf("Could not extract file %s: %s\n", filename, strerror(ret));
         return;
@@ -399,7 +490,7 @@ static void extract_selected_file(void)
 
     /* Write the file chunk by chunk */
     while(1) {
-        bytes_read = zealfs_read(&zealfs_ctx, &fd, buffer, sizeof(buffer), total_bytes_written);
+        bytes_read = zealfs_read(zealfs_ctx, &fd, buffer, sizeof(buffer), total_bytes_written);
         if (bytes_read <= 0) {
             break;
         }
@@ -421,12 +512,47 @@ static void extract_selected_file(void)
     fclose(dest_file);
 }
 
+/**
+ * @brief Read back an imported file from the media and compare its checksum to the one of the source file.
+ */
+static int verify_file(const char* path, size_t size, uint32_t expected_crc)
+{
+    static uint8_t buffer[VERIFY_READ_SIZE];
+    const partition_t* part = m_part_ctx.partition;
+    uint32_t crc = 0;
+    zealfs_fd_t fd;
+
+    /* Make sure the file is read from the media and not from the OS cache */
+    if (disk_writer_flush(&m_part_ctx.session->writer) != 0 ||
+        disk_drop_cache(m_part_ctx.session->disk_fd, (off_t) part->start_lba * DISK_SECTOR_SIZE,
+                        (uint64_t) part->size_sectors * DISK_SECTOR_SIZE) != 0 ||
+        zealfs_open(path, zealfs_ctx, &fd) < 0)
+    {
+        return 0;
+    }
+
+    for (size_t offset = 0; offset < size; ) {
+        const int bytes_read = zealfs_read(zealfs_ctx, &fd, buffer, NK_MIN(sizeof(buffer), size - offset), offset);
+        if (bytes_read <= 0) {
+            return 0;
+        }
+        crc = crc32c(crc, buffer, bytes_read);
+        offset += bytes_read;
+    }
+
+    return crc == expected_crc;
+}
+
+
 static int import_file(const char* file_path)
 {
     char path[MAX_PATH_LENGTH];
     uint8_t buffer[4096];
     size_t bytes_read = 0;
     size_t total_bytes_written = 0;
+    /* Checksum of the source, computed while importing it */
+    const bool verify = disk_verify_enabled();
+    uint32_t crc = 0;
     zealfs_fd_t fd;
 
     FILE* src_file = fopen(file_path, "rb");
@@ -439,7 +565,7 @@ static int import_file(const char* file_path)
     fseek(src_file, 0, SEEK_END);
     size_t file_size = ftell(src_file);
     fseek(src_file, 0, SEEK_SET);
-    if (file_size > zealfs_free_space(&zealfs_ctx)) {
+    if (file_size > zealfs_free_space(zealfs_ctx)) {
         ui_statusbar_print("Not enough space in the partition to import the file.");
         fclose(src_file);
         return 0;
@@ -458,7 +584,7 @@ static int import_file(const char* file_path)
 
     /* Filename is correct, generate the absolute path and create it! */
     snprintf(path, MAX_PATH_LENGTH, "%s%s", m_part_ctx.address_bar, filename);
-    int ret = zealfs_create(path, &zealfs_ctx, &fd);
+    int ret = zealfs_create(path, zealfs_ctx, &fd);
     if (ret < 0) {
         ui_statusbar_printf("Failed to create file %s: %s\n", filename, strerror(-ret));
         fclose(src_file);
@@ -472,12 +598,15 @@ static int import_file(const char* file_path)
         if (bytes_read <= 0) {
             break;
         }
-        size_t bytes_written = zealfs_write(&zealfs_ctx, &fd, buffer, bytes_read, total_bytes_written);
+        size_t bytes_written = zealfs_write(zealfs_ctx, &fd, buffer, bytes_read, total_bytes_written);
         if (bytes_written != bytes_read) {
             ui_statusbar_printf("Error writing to file %s in partition\n", filename);
             fclose(src_file);
             return 0;
         }
+        if (verify) {
+            crc = crc32c(crc, buffer, bytes_written);
+        }
         remaining -= bytes_written;
         int percentage = (int)(((file_size - remaining) * 100) / file_size);
         disk_update_progress_bar(percentage);
@@ -487,13 +616,24 @@ static int import_file(const char* file_path)
 
     fclose(src_file);
 
+    /* Keep the modification date of the source, a later sync can then tell the file didn't change */
+    struct stat st;
+    if (stat(file_path, &st) == 0) {
+        zealfs_entry_set_date(&fd.entry, st.st_mtime);
+    }
+
     /* Flush the changes on the disk */
-    int err = zealfs_flush(&zealfs_ctx, &fd);
+    int err = zealfs_flush(zealfs_ctx, &fd);
     if (err) {
         ui_statusbar_printf("Error flushing file %s\n", filename);
         return 0;
     }
 
+    if (verify && !verify_file(path, total_bytes_written, crc)) {
+        ui_statusbar_printf("Verification of file %s failed\n", filename);
+        return 0;
+    }
+
     return 1;
 }
 
@@ -525,18 +665,141 @@ static void import_files(void)
     }
 
     free(files);
+    /* Files that were replaced freed their former pages */
+    zealfs_discard_flush(zealfs_ctx);
+    zealfs_session_flush(m_part_ctx.session);
+    disk_analyzer_update_dir(&m_analyzer, zealfs_ctx, m_part_ctx.address_bar);
     refresh_directory();
 }
 
 
+static void open_copy_popup(void)
+{
+    if (m_part_ctx.entries_count == 0) {
+        ui_statusbar_print("No entry to copy");
+        return;
+    }
+    m_copy.source = m_part_ctx.session;
+    m_copy.source_use = m_part_ctx.session->last_use;
+    m_copy.entry = m_part_ctx.entries_raw[m_part_ctx.selected_file];
+    snprintf(m_copy.src_dir, sizeof(m_copy.src_dir), "%s", m_part_ctx.address_bar);
+    snprintf(m_copy.dst_dir, sizeof(m_copy.dst_dir), "/");
+    m_copy.disk = -1;
+    m_copy.partition = -1;
+    popup_open(POPUP_COPY, 420, 380, NULL);
+}
+
+
+/**
+ * @brief Copy the entry picked when the popup was opened to the selected partition, the data
+ * go from one partition to the other without going through the host.
+ */
+static void copy_entry(disk_list_state_t* state)
+{
+    zealfs_copy_stats_t stats;
+    const char* error = NULL;
+
+    zealfs_session_t* source = m_part_ctx.session;
+    if (source == NULL || source != m_copy.source || !source->open || source->last_use != m_copy.source_use) {
+        ui_statusbar_print("The source partition was closed");
+        return;
+    }
+    if (m_copy.disk < 0 || m_copy.disk >= state->disk_count) {
+        ui_statusbar_print("No destination partition selected");
+        return;
+    }
+    disk_info_t* disk = &state->disks[m_copy.disk];
+    partition_t* part = &disk->partitions[m_copy.partition];
+    if (disk->has_staged_changes || !disk_is_valid_zealfs_partition(part)) {
+        ui_statusbar_print("The destination partition is not available anymore");
+        return;
+    }
+
+    /* Opening the destination may close another session to make room, never the pinned source */
+    zealfs_session_pin(source);
+    zealfs_session_t* dest = zealfs_session_get(disk, part, &error);
+    if (dest == NULL || !source->open) {
+        zealfs_session_unpin(source);
+        ui_statusbar_printf("Could not open the destination partition: %s\n",
+                            error ? error : "The source partition was closed");
+        return;
+    }
+
+    remove_trailing_slash(m_copy.dst_dir);
+    const int ret = zealfs_copy(source->ctx, m_copy.src_dir, &m_copy.entry, dest->ctx, m_copy.dst_dir, &stats);
+    zealfs_session_flush(dest);
+    zealfs_session_unpin(source);
+    if (ret < 0) {
+        ui_statusbar_printf("Copy failed after %d files: %s\n", stats.files, strerror(-ret));
+    } else {
+        ui_statusbar_printf("Copied %d files and %d directories (%llu bytes)\n",
+                            stats.files, stats.directories, (unsigned long long) stats.bytes_copied);
+    }
+
+    if (dest == source) {
+        disk_analyzer_invalidate(&m_analyzer);
+        refresh_directory();
+    }
+}
+
+
+static void ui_partition_viewer_copy_popup(struct nk_context *ctx)
+{
+    struct nk_rect position;
+    char label[DISK_LABEL_LEN + 32];
+
+    if (!popup_is_opened(POPUP_COPY, &position, NULL)) {
+        return;
+    }
+
+    if (nk_begin(ctx, "Copy to partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        disk_list_state_t* state = disk_get_state();
+
+        nk_layout_row_dynamic(ctx, 20, 1);
+        nk_labelf(ctx, NK_TEXT_LEFT, "Copy %.*s%s to:", NAME_MAX_LEN, m_copy.entry.name,
+                  (m_copy.entry.flags & IS_DIR) ? "/" : "");
+
+        /* Any ZealFS partition of any disk, including the opened one */
+        for (int i = 0; i < state->disk_count; i++) {
+            disk_info_t* disk = &state->disks[i];
+            for (int j = 0; j < MAX_PART_COUNT && !disk->has_staged_changes; j++) {
+                if (!disk_is_valid_zealfs_partition(&disk->partitions[j])) {
+                    continue;
+                }
+                snprintf(label, sizeof(label), "%s, partition %d", disk->label, j);
+                nk_bool selected = m_copy.disk == i && m_copy.partition == j;
+                if (nk_selectable_label(ctx, label, NK_TEXT_LEFT, &selected) && selected) {
+                    m_copy.disk = i;
+                    m_copy.partition = j;
+                }
+            }
+        }
+
+        nk_layout_row(ctx, NK_DYNAMIC, 30, 2, (float[]){0.25f, 0.75f});
+        nk_label(ctx, "Directory:", NK_TEXT_LEFT);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, m_copy.dst_dir, MAX_PATH_LENGTH, nk_filter_default);
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (nk_button_label(ctx, "Copy")) {
+            copy_entry(state);
+            popup_close(POPUP_COPY);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_COPY);
+        }
+    }
+    nk_end(ctx);
+}
+
+
 int ui_partition_viewer_get_partition_usage_percentage(uint64_t* free_bytes, uint64_t* total_bytes)
 {
     /* If the current selected partition is not a valid ZealFS partition, return 0% */
-    if (m_part_ctx.partition == NULL) {
+    if (m_part_ctx.session == NULL) {
         return 0;
     }
 
-    uint64_t free_space = zealfs_free_space(&zealfs_ctx);
+    uint64_t free_space = zealfs_free_space(zealfs_ctx);
     if (free_bytes) {
         *free_bytes = free_space;
     }
@@ -545,7 +808,7 @@ int ui_partition_viewer_get_partition_usage_percentage(uint64_t* free_bytes, uin
     /* If the partition starts at 0, it means that the disk has no MBR, instead of taking the
      * whole disk as the partition size, use the number of bytes in the bitmap */
     if (m_part_ctx.partition->start_lba == 0) {
-        size_bytes = zealfs_total_space(&zealfs_ctx);
+        size_bytes = zealfs_total_space(zealfs_ctx);
     }
     if (total_bytes) {
         *total_bytes = size_bytes;
@@ -554,6 +817,72 @@ int ui_partition_viewer_get_partition_usage_percentage(uint64_t* free_bytes, uin
 }
 
 
+void ui_partition_viewer_defrag(struct nk_context *ctx)
+{
+    zealfs_defrag_report_t report;
+
+    if (m_part_ctx.session == NULL) {
+        ui_statusbar_print("No ZealFS partition opened");
+        return;
+    }
+
+    int ret = zealfs_defrag(zealfs_ctx, &report);
+    if (ret < 0) {
+        ui_statusbar_printf("Defragmentation failed: %s\n", strerror(-ret));
+    } else {
+        ui_statusbar_printf("Defragmented %u files, fragmentation %u%% -> %u%% (%u -> %u fragmented files)\n",
+                            report.moved_files, report.score_before, report.score_after,
+                            report.fragmented_before, report.fragmented_after);
+    }
+    zealfs_session_flush(m_part_ctx.session);
+    disk_analyzer_invalidate(&m_analyzer);
+    refresh_directory();
+}
+
+
+void ui_partition_viewer_check(struct nk_context *ctx)
+{
+    zealfs_fsck_report_t report;
+
+    if (m_part_ctx.session == NULL) {
+        ui_statusbar_print("No ZealFS partition opened");
+        return;
+    }
+
+    uint64_t size_bytes = m_part_ctx.partition->size_sectors * DISK_SECTOR_SIZE;
+    if (m_part_ctx.partition->start_lba == 0) {
+        size_bytes = zealfs_total_space(zealfs_ctx);
+    }
+
+    int ret = zealfs_fsck(zealfs_ctx, size_bytes, false, &report);
+    if (ret == 0 && report.errors != 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "%u errors found: %u bad entries, %u bad pointers, %u cycles, %u cross-links, "
+                 "%u wrong sizes, %u lost pages, %u unmarked pages.\nRepair the file system?",
+                 report.errors, report.bad_entries, report.bad_pointers, report.cycles, report.cross_links,
+                 report.size_errors, report.lost_pages, report.unmarked_pages);
+        if (tinyfd_messageBox("Check file system", msg, "yesno", "warning", 0)) {
+            ret = zealfs_fsck(zealfs_ctx, size_bytes, true, &report);
+            if (ret == 0) {
+                ui_statusbar_printf("File system repaired, %u errors fixed\n", report.errors);
+            }
+            zealfs_session_flush(m_part_ctx.session);
+            disk_analyzer_invalidate(&m_analyzer);
+            refresh_directory();
+        } else {
+            ui_statusbar_printf("File system check: %u errors found\n", report.errors);
+        }
+    } else if (ret == 0) {
+        ui_statusbar_printf("File system check: no error in %u files and %u directories\n",
+                            report.files, report.directories);
+    }
+
+    if (ret < 0) {
+        ui_statusbar_printf("File system check failed: %s\n", strerror(-ret));
+    }
+}
+
+
 static void ui_partition_viewer_show_usage(struct nk_context *ctx)
 {
     char usage_info[128];
@@ -572,6 +901,49 @@ static void ui_partition_viewer_show_usage(struct nk_context *ctx)
 }
 
 
+/**
+ * @brief Show the result of the analyzer: fragmentation of the files, size of the current directory
+ * and distribution of the free runs of pages.
+ */
+static void ui_partition_viewer_show_analysis(struct nk_context *ctx)
+{
+    char line[256];
+    char size_str[32];
+
+    nk_layout_row_dynamic(ctx, 20, 1);
+    if (!disk_analyzer_poll(&m_analyzer)) {
+        nk_label(ctx, "Analyzing the partition...", NK_TEXT_CENTERED);
+        nk_label(ctx, "", NK_TEXT_CENTERED);
+        return;
+    }
+
+    const disk_analyzer_result_t* result = &m_analyzer.result;
+    const disk_analyzer_dir_t* dir = disk_analyzer_find_dir(&m_analyzer, m_part_ctx.address_bar);
+    disk_get_size_str(dir ? dir->total_bytes : 0, size_str, sizeof(size_str));
+    int len = snprintf(line, sizeof(line), "Directory: %s | Fragmented files: %u/%d (%u%%)",
+                       size_str, result->fragmented_files, result->files_count, result->score);
+
+    /* Fragments of the selected file */
+    if (m_part_ctx.entries_count > 0 && (m_part_ctx.entries_raw[m_part_ctx.selected_file].flags & IS_DIR) == 0) {
+        const disk_analyzer_file_t* file = disk_analyzer_find_file(&m_analyzer, m_part_ctx.address_bar,
+                                                                   get_entry(m_part_ctx.selected_file)->name);
+        if (file) {
+            snprintf(line + len, sizeof(line) - len, " | Selected: %u fragments", file->extents);
+        }
+    }
+    nk_label(ctx, line, NK_TEXT_CENTERED);
+
+    /* Free runs per power of two, only the non-empty ones */
+    len = snprintf(line, sizeof(line), "Largest free run: %u pages | Free runs:", result->largest_free_run);
+    for (int i = 0; i < ANALYZER_RUN_BUCKETS && len < (int) sizeof(line); i++) {
+        if (result->free_runs[i] != 0) {
+            len += snprintf(line + len, sizeof(line) - len, " %u+:%u", 1U << i, result->free_runs[i]);
+        }
+    }
+    nk_label(ctx, line, NK_TEXT_CENTERED);
+}
+
+
 static void collapse_slashes(char *path)
 {
     char *src = path;
@@ -658,14 +1030,15 @@ int ui_partition_viewer(struct nk_context *ctx, disk_info_t* disk, int partition
         part = &disk->partitions[partition_idx];
     }
 
-    if (part != m_part_ctx.partition) {
+    /* The session may also have been closed behind the viewer, for example if the disk was removed */
+    if (part != m_part_ctx.partition || (m_part_ctx.session != NULL && !m_part_ctx.session->open)) {
         partition_viewer_parse(disk, part);
         snprintf(user_address_bar, MAX_PATH_LENGTH, "%s", m_part_ctx.address_bar);
     }
 
     if (nk_begin(ctx, "Partition viewer", bounds, NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_BORDER | NK_WINDOW_TITLE))
     {
-        if (part == NULL) {
+        if (part == NULL || m_part_ctx.session == NULL) {
             nk_layout_row_dynamic(ctx, 30, 1);
             nk_label_wrap(ctx, "Please select a ZealFS partition to manage its content.\n"
                                "The disk must not have any pending operation.");
@@ -673,13 +1046,28 @@ int ui_partition_viewer(struct nk_context *ctx, disk_info_t* disk, int partition
         }
 
 
-        nk_layout_row_dynamic(ctx, 30, 4);
+        nk_layout_row_dynamic(ctx, 30, 6);
+        if (nk_widget_is_hovered(ctx)) {
+            nk_tooltip(ctx, "Extract the selected file, or the selected directory with all its content, to the host");
+        }
         if (nk_button_label(ctx, "Export")) {
             extract_selected_file();
         }
+        if (nk_widget_is_hovered(ctx)) {
+            nk_tooltip(ctx, "Copy the selected entry to another ZealFS partition, of any disk");
+        }
+        if (nk_button_label(ctx, "Copy to")) {
+            open_copy_popup();
+        }
         if (nk_button_label(ctx, "Import")) {
             import_files();
         }
+        if (nk_widget_is_hovered(ctx)) {
+            nk_tooltip(ctx, "Only write the files of a host directory that changed since the last sync");
+        }
+        if (nk_button_label(ctx, "Sync")) {
+            sync_directory();
+        }
         if (nk_button_label(ctx, "New dir")) {
             create_directory();
         }
@@ -703,73 +1091,81 @@ int ui_partition_viewer(struct nk_context *ctx, disk_info_t* disk, int partition
         }
 
         struct nk_rect bounds = nk_window_get_content_region(ctx);
-        float remaining_height = bounds.h - (nk_widget_bounds(ctx).y - bounds.y) - 25;
+        /* Keep room for the usage and the analysis below the list */
+        float remaining_height = bounds.h - (nk_widget_bounds(ctx).y - bounds.y) - 75;
         nk_layout_row_dynamic(ctx, remaining_height, 1);
 
-        if (nk_group_begin(ctx, "EntriesList", NK_WINDOW_BORDER)) {
+        /* Remove the small gap that exists between each element of a single row, this will help with making the
+         * selection of a whole row being of the same color. It must be done before starting the list since the
+         * spacing is part of the rows height. */
+        nk_style_push_vec2(ctx, &ctx->style.window.spacing, nk_vec2(0, 0));
 
+        /* Only the visible rows are laid out and formatted, the first row is the header */
+        struct nk_list_view view;
+        if (nk_list_view_begin(ctx, &view, "EntriesList", NK_WINDOW_BORDER, ENTRY_ROW_HEIGHT,
+                               m_part_ctx.entries_count + 1))
+        {
             /* Assign a minimum width to each of th fields below */
-            nk_layout_row_template_begin(ctx, 20);
+            nk_layout_row_template_begin(ctx, ENTRY_ROW_HEIGHT);
             nk_layout_row_template_push_variable(ctx, chars_width_px(16));
             nk_layout_row_template_push_variable(ctx, chars_width_px(ENTRY_SIZE_LEN));
             nk_layout_row_template_push_variable(ctx, chars_width_px(2));
             nk_layout_row_template_push_variable(ctx, chars_width_px(ENTRY_TYPE_LEN));
             nk_layout_row_template_push_variable(ctx, chars_width_px(ENTRY_DATE_LEN));
             nk_layout_row_template_end(ctx);
-            /* Remove the small gap that exists between each element of a single row, this will help with making the
-             * selection of a whole row being of the same color. */
-            nk_style_push_vec2(ctx, &ctx->style.window.spacing, nk_vec2(0, 0));
-            /* Make the header a bit darker */
-            nk_style_push_color(ctx, &ctx->style.window.background, nk_rgba(30, 30, 30, 255)); // Set a darker label background color
-            nk_label(ctx, "Name", NK_TEXT_LEFT);
-            nk_label(ctx, "Size (bytes)", NK_TEXT_RIGHT);
-            nk_label(ctx, " ", NK_TEXT_RIGHT); // Padding
-            nk_label(ctx, "Type", NK_TEXT_LEFT);
-            nk_label(ctx, "Date", NK_TEXT_LEFT);
-            nk_style_pop_color(ctx);
-
-            /* Tried to make all the names background in a darker color */
-            // struct nk_command_buffer* canvas = nk_window_get_canvas(ctx);
-            // struct nk_rect rect = nk_layout_widget_bounds(ctx);
-            // rect.w = chars_width_px(16);
-            // rect.h = remaining_height;
-            // nk_fill_rect(canvas, rect, 0, nk_rgba(0x28, 0x28, 0x28, 255));
+
+            if (view.begin == 0) {
+                /* Make the header a bit darker */
+                nk_style_push_color(ctx, &ctx->style.window.background, nk_rgba(30, 30, 30, 255)); // Set a darker label background color
+                nk_label(ctx, "Name", NK_TEXT_LEFT);
+                nk_label(ctx, "Size (bytes)", NK_TEXT_RIGHT);
+                nk_label(ctx, " ", NK_TEXT_RIGHT); // Padding
+                nk_label(ctx, "Type", NK_TEXT_LEFT);
+                nk_label(ctx, "Date", NK_TEXT_LEFT);
+                nk_style_pop_color(ctx);
+            }
+
             struct nk_rect group_bounds = nk_window_get_content_region(ctx);
 
-            for (int i = 0; i < m_part_ctx.entries_count; i++) {
+            for (int i = NK_MAX(view.begin, 1) - 1; i < view.end - 1; i++) {
                 /* In order to check for a double-click, we need to retrieve the bounds of the next widget,
                  * but since we want the whole line to be clickable, we need to modify the width. */
                 struct nk_rect bounds = nk_widget_bounds(ctx);
                 bounds.w = group_bounds.w;
 
+                const partition_entry_t* entry = get_entry(i);
                 nk_bool selected = m_part_ctx.selected_file == i;
-                nk_selectable_text(ctx, m_part_ctx.entries[i].name, ENTRY_NAME_LEN, NK_TEXT_LEFT, &selected);
-                nk_selectable_text(ctx, m_part_ctx.entries[i].size, ENTRY_SIZE_LEN, NK_TEXT_RIGHT, &selected);
+                nk_selectable_text(ctx, entry->name, ENTRY_NAME_LEN, NK_TEXT_LEFT, &selected);
+                nk_selectable_text(ctx, entry->size, ENTRY_SIZE_LEN, NK_TEXT_RIGHT, &selected);
                 nk_selectable_label(ctx, "   ", NK_TEXT_LEFT, &selected);
-                nk_selectable_text(ctx, m_part_ctx.entries[i].type, ENTRY_TYPE_LEN, NK_TEXT_LEFT, &selected);
-                nk_selectable_text(ctx, m_part_ctx.entries[i].date, ENTRY_DATE_LEN, NK_TEXT_LEFT, &selected);
+                nk_selectable_text(ctx, entry->type, ENTRY_TYPE_LEN, NK_TEXT_LEFT, &selected);
+                nk_selectable_text(ctx, entry->date, ENTRY_DATE_LEN, NK_TEXT_LEFT, &selected);
                 if (selected) {
                     m_part_ctx.selected_file = i;
                 }
 
                 if (nk_item_double_clicked(ctx, bounds, i)) {
-                    if (m_part_ctx.entries_raw[i].flags & 1) {
-                        change_directory(m_part_ctx.entries[i].name);
+                    if (m_part_ctx.entries_raw[i].flags & IS_DIR) {
+                        change_directory(entry->name);
                         snprintf(user_address_bar, MAX_PATH_LENGTH, "%s", m_part_ctx.address_bar);
+                        /* The entries have been replaced, stop drawing the former ones */
+                        break;
                     } else {
                         extract_selected_file();
                     }
                 }
             }
-            nk_style_pop_vec2(ctx);
-            nk_group_end(ctx);
+            nk_list_view_end(&view);
         }
+        nk_style_pop_vec2(ctx);
 
         ui_partition_viewer_show_usage(ctx);
+        ui_partition_viewer_show_analysis(ctx);
     }
 
 window_end:
     nk_end(ctx);
+    ui_partition_viewer_copy_popup(ctx);
     return 0;
 }
 
@@ -777,4 +1173,6 @@ window_end:
 void ui_partition_viewer_clear(struct nk_context *ctx)
 {
     partition_viewer_clear();
+    /* The partitions may be rewritten, none of the opened ones can be trusted anymore */
+    zealfs_session_close_all();
 }
\ No newline at end of file
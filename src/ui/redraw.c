@@ -0,0 +1,146 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "raylib.h"
+#include "disk.h"
+#include "ui/redraw.h"
+
+/* Frames to keep rendering after an event, Nuklear needs a few frames to reflect a state
+ * that was modified by an input */
+#define SETTLE_FRAMES   3
+#define ACTIVE_FPS      60
+/* When the loop cannot be woken up by background events, it must poll them at this rate */
+#define IDLE_FPS        5
+
+#ifdef __linux__
+/* raylib embeds GLFW, but depending on how it was built, its symbols may not be exported.
+ * Without it, the loop cannot be woken up from another thread. */
+extern void glfwPostEmptyEvent(void) __attribute__((weak));
+#define CAN_POST_EVENT()    (glfwPostEmptyEvent != NULL)
+#define POST_EVENT()        glfwPostEmptyEvent()
+#else
+/* There is no hotplug detection on other platforms, background work uses the busy state */
+#define CAN_POST_EVENT()    0
+#define POST_EVENT()
+#endif
+
+static atomic_int s_busy_count;
+static atomic_bool s_redraw_requested;
+static int  s_settle_frames = SETTLE_FRAMES;
+static bool s_waiting;
+static bool s_can_block = true;
+
+/* Hotplug events are consumed by the render loop, make the waker wait for that */
+static pthread_mutex_t s_hotplug_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  s_hotplug_cond = PTHREAD_COND_INITIALIZER;
+static bool s_hotplug_pending;
+
+
+static void* ui_redraw_hotplug_waker(void* arg)
+{
+    (void) arg;
+
+    while (disk_hotplug_wait(-1) > 0) {
+        pthread_mutex_lock(&s_hotplug_mutex);
+        s_hotplug_pending = true;
+        ui_redraw_request();
+        while (s_hotplug_pending) {
+            pthread_cond_wait(&s_hotplug_cond, &s_hotplug_mutex);
+        }
+        pthread_mutex_unlock(&s_hotplug_mutex);
+    }
+
+    return NULL;
+}
+
+
+void ui_redraw_init(bool hotplug)
+{
+    if (hotplug) {
+        pthread_t thread;
+        /* If the loop cannot be woken up, hotplug events must be polled, don't block */
+        s_can_block = CAN_POST_EVENT() &&
+                      pthread_create(&thread, NULL, ui_redraw_hotplug_waker, NULL) == 0;
+        if (s_can_block) {
+            pthread_detach(thread);
+        } else {
+            printf("[UI] Cannot wake up the render loop, polling hotplug events\n");
+        }
+    }
+    SetTargetFPS(ACTIVE_FPS);
+}
+
+
+static bool ui_redraw_input_pending(void)
+{
+    const Vector2 delta = GetMouseDelta();
+    return delta.x != 0 || delta.y != 0 || GetMouseWheelMove() != 0 ||
+           IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT) ||
+           IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) || GetKeyPressed() != 0 || IsWindowResized();
+}
+
+
+void ui_redraw_begin_frame(void)
+{
+    /* When the previous frame was waiting, we have been woken up by an event */
+    if (s_waiting || atomic_exchange(&s_redraw_requested, false) || ui_redraw_input_pending()) {
+        s_settle_frames = SETTLE_FRAMES;
+    }
+
+    /* The render loop is about to consume the hotplug events, let the waker check for new ones */
+    pthread_mutex_lock(&s_hotplug_mutex);
+    if (s_hotplug_pending) {
+        s_hotplug_pending = false;
+        pthread_cond_signal(&s_hotplug_cond);
+    }
+    pthread_mutex_unlock(&s_hotplug_mutex);
+}
+
+
+void ui_redraw_end_frame(void)
+{
+    if (s_settle_frames > 0) {
+        s_settle_frames--;
+    }
+
+    const bool active = s_settle_frames > 0 || atomic_load(&s_busy_count) > 0 ||
+                        atomic_load(&s_redraw_requested);
+    const bool waiting = !active && s_can_block;
+
+    if (waiting != s_waiting) {
+        if (waiting) {
+            EnableEventWaiting();
+        } else {
+            DisableEventWaiting();
+        }
+    }
+    /* Without blocking, polling at a low rate is the next best thing */
+    SetTargetFPS((active || s_can_block) ? ACTIVE_FPS : IDLE_FPS);
+    s_waiting = waiting;
+}
+
+
+void ui_redraw_request(void)
+{
+    atomic_store(&s_redraw_requested, true);
+    POST_EVENT();
+}
+
+
+void ui_redraw_busy_begin(void)
+{
+    atomic_fetch_add(&s_busy_count, 1);
+    ui_redraw_request();
+}
+
+
+void ui_redraw_busy_end(void)
+{
+    atomic_fetch_sub(&s_busy_count, 1);
+    ui_redraw_request();
+}
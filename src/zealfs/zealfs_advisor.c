@@ -0,0 +1,242 @@
+/* SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "zealfs_v2.h"
+#include "zealfs_advisor.h"
+
+#ifdef _WIN32
+#define lstat(path, st)     stat(path, st)
+#endif
+
+#define MAX(a,b)    (((a) > (b)) ? (a) : (b))
+
+#define ADVISOR_PATH_LEN    512
+
+typedef struct {
+    uint32_t size;
+    /* Index of the directory containing the file */
+    int      dir;
+} advisor_file_t;
+
+
+typedef struct {
+    /* Number of entries, files and directories, directly in the directory */
+    uint32_t entries;
+} advisor_dir_t;
+
+
+typedef struct {
+    advisor_file_t* files;
+    int             files_count;
+    int             files_capacity;
+    advisor_dir_t*  dirs;
+    int             dirs_count;
+    int             dirs_capacity;
+    uint32_t        skipped;
+} advisor_sample_t;
+
+
+static int advisor_add_dir(advisor_sample_t* sample)
+{
+    if (sample->dirs_count == sample->dirs_capacity) {
+        const int capacity = sample->dirs_capacity ? sample->dirs_capacity * 2 : 64;
+        advisor_dir_t* dirs = realloc(sample->dirs, capacity * sizeof(advisor_dir_t));
+        if (dirs == NULL) {
+            return -ENOMEM;
+        }
+        sample->dirs = dirs;
+        sample->dirs_capacity = capacity;
+    }
+    sample->dirs[sample->dirs_count].entries = 0;
+    return sample->dirs_count++;
+}
+
+
+static int advisor_add_file(advisor_sample_t* sample, int dir, uint32_t size)
+{
+    if (sample->files_count == sample->files_capacity) {
+        const int capacity = sample->files_capacity ? sample->files_capacity * 2 : 256;
+        advisor_file_t* files = realloc(sample->files, capacity * sizeof(advisor_file_t));
+        if (files == NULL) {
+            return -ENOMEM;
+        }
+        sample->files = files;
+        sample->files_capacity = capacity;
+    }
+    sample->files[sample->files_count++] = (advisor_file_t) { .size = size, .dir = dir };
+    return 0;
+}
+
+
+/**
+ * @brief Gather the sizes of the files of a host directory and the number of entries of each
+ * directory, recursively. Only what ZealFS could store is taken into account.
+ */
+static int advisor_browse(advisor_sample_t* sample, const char* host_dir, int index)
+{
+    char host_path[ADVISOR_PATH_LEN];
+    struct dirent* dirent;
+    struct stat st;
+    int ret = 0;
+
+    DIR* dir = opendir(host_dir);
+    if (dir == NULL) {
+        return -errno;
+    }
+
+    while (ret == 0 && (dirent = readdir(dir)) != NULL) {
+        const char* name = dirent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        /* Symbolic links are skipped, a link to a parent directory would never end */
+        const int len = snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, name);
+        if (len < 0 || len >= (int) sizeof(host_path) || strlen(name) > NAME_MAX_LEN ||
+            lstat(host_path, &st) != 0 || (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) ||
+            (S_ISREG(st.st_mode) && (uint64_t) st.st_size > UINT32_MAX))
+        {
+            sample->skipped++;
+            continue;
+        }
+
+        sample->dirs[index].entries++;
+        if (S_ISDIR(st.st_mode)) {
+            ret = advisor_add_dir(sample);
+            if (ret >= 0) {
+                ret = advisor_browse(sample, host_path, ret);
+            }
+        } else {
+            ret = advisor_add_file(sample, index, (uint32_t) st.st_size);
+        }
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+
+static uint32_t advisor_div_up(uint64_t value, uint32_t div)
+{
+    return (uint32_t) ((value + div - 1) / div);
+}
+
+
+/**
+ * @brief Simulate the allocation of the sample on a partition freshly formatted with the given page size.
+ */
+static void advisor_simulate(const advisor_sample_t* sample, uint64_t partition_size, zealfs_page_advice_t* advice)
+{
+    const uint32_t page_size = advice->page_size;
+
+    advice->valid = zealfsv2_page_size_valid(partition_size, page_size);
+    if (!advice->valid) {
+        return;
+    }
+
+    /* Same geometry as `zealfsv2_format_page_size` gives, without formatting anything */
+    const uint32_t pages_count = partition_size / page_size;
+    const uint32_t bitmap_size = (pages_count + 7) / 8;
+    const uint32_t header_size = (sizeof(zealfs_header_t) + bitmap_size + sizeof(zealfs_entry_t) - 1) &
+                                 ~(sizeof(zealfs_entry_t) - 1);
+    const uint32_t root_entries = (page_size - header_size) / sizeof(zealfs_entry_t);
+    const uint32_t dir_entries = page_size / sizeof(zealfs_entry_t);
+    const uint32_t fat_pages = (page_size == 256) ? 1 : 2;
+    const uint32_t free_pages = pages_count - 1 - fat_pages;
+    uint32_t* dir_pages = malloc(sample->dirs_count * sizeof(uint32_t));
+    if (dir_pages == NULL) {
+        advice->valid = false;
+        return;
+    }
+
+    /* The root directory starts in the header page, the other directories have at least one page */
+    uint32_t allocated = 0;
+    dir_pages[0] = 1 + advisor_div_up(MAX(sample->dirs[0].entries, root_entries) - root_entries, dir_entries);
+    allocated += dir_pages[0] - 1;
+    for (int i = 1; i < sample->dirs_count; i++) {
+        dir_pages[i] = MAX(1, advisor_div_up(sample->dirs[i].entries, dir_entries));
+        allocated += dir_pages[i];
+    }
+    advice->metadata_pages = 1 + fat_pages + allocated;
+
+    /* Even an empty file has a page. Opening a file browses half of its directory on average, the file is
+     * then read page by page */
+    advice->data_pages = 0;
+    advice->slack_bytes = 0;
+    advice->read_ops = 0;
+    for (int i = 0; i < sample->files_count; i++) {
+        const advisor_file_t* file = &sample->files[i];
+        const uint32_t pages = MAX(1, advisor_div_up(file->size, page_size));
+        advice->data_pages += pages;
+        advice->slack_bytes += (uint64_t) pages * page_size - file->size;
+        advice->read_ops += pages + (dir_pages[file->dir] + 1) / 2;
+    }
+    free(dir_pages);
+
+    advice->pages_count = pages_count;
+    advice->metadata_bytes = (uint64_t) advice->metadata_pages * page_size;
+    advice->fits = (uint64_t) allocated + advice->data_pages <= free_pages;
+}
+
+
+int zealfs_advise_page_size(const char* host_dir, uint64_t partition_size, zealfs_advice_t* advice)
+{
+    advisor_sample_t sample = { 0 };
+    uint64_t min_reads = UINT64_MAX;
+    double best_cost = 0;
+
+    memset(advice, 0, sizeof(*advice));
+    advice->best = -1;
+
+    int ret = advisor_add_dir(&sample);
+    if (ret >= 0) {
+        ret = advisor_browse(&sample, host_dir, ret);
+    }
+    if (ret < 0) {
+        goto end;
+    }
+
+    advice->files = sample.files_count;
+    advice->dirs = sample.dirs_count - 1;
+    advice->skipped = sample.skipped;
+    for (int i = 0; i < sample.files_count; i++) {
+        advice->bytes += sample.files[i].size;
+    }
+
+    for (int i = 0; i < ZEALFS_ADVISOR_SIZES; i++) {
+        zealfs_page_advice_t* size = &advice->sizes[i];
+        size->page_size = 256 << i;
+        advisor_simulate(&sample, partition_size, size);
+        if (size->valid && size->fits && size->read_ops < min_reads) {
+            min_reads = size->read_ops;
+        }
+    }
+
+    for (int i = 0; i < ZEALFS_ADVISOR_SIZES; i++) {
+        const zealfs_page_advice_t* size = &advice->sizes[i];
+        if (!size->valid || !size->fits) {
+            continue;
+        }
+        const double waste = (size->slack_bytes + size->metadata_bytes) * 100.0 / partition_size;
+        const double reads = min_reads ? (size->read_ops - min_reads) * 100.0 / min_reads : 0;
+        const double cost = waste + reads / 10;
+        if (advice->best < 0 || cost < best_cost) {
+            advice->best = i;
+            best_cost = cost;
+        }
+    }
+    ret = 0;
+
+end:
+    free(sample.files);
+    free(sample.dirs);
+    return ret;
+}
@@ -0,0 +1,318 @@
+/* SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "zealfs_v2.h"
+#include "zealfs_cache.h"
+#include "crc32c.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+#define MAX(a,b)    (((a) > (b)) ? (a) : (b))
+
+#define CACHE_MAGIC     "ZDTCACHE"
+#define CACHE_VERSION   1
+
+
+/**
+ * @brief Header of a cache file. It is followed by the ZealFS header, the FAT, and the ranges of
+ * directory entries, each one being its address, its length and its data.
+ */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t start_lba;
+    uint64_t image_size;
+    int64_t  image_mtime;
+    uint32_t header_crc;
+    uint32_t header_size;
+    uint32_t fat_size;
+    uint32_t ranges_count;
+    /* Checksum of everything following this header */
+    uint32_t payload_crc;
+} zealfs_cache_file_t;
+
+
+static bool s_cache_enabled;
+
+
+void zealfs_cache_set_enabled(bool enabled)
+{
+    s_cache_enabled = enabled;
+}
+
+
+bool zealfs_cache_enabled(void)
+{
+    return s_cache_enabled;
+}
+
+
+static zealfs_cache_range_t* zealfs_cache_find(zealfs_cache_t* cache, uint32_t addr, size_t len)
+{
+    for (int i = 0; i < cache->count; i++) {
+        zealfs_cache_range_t* range = &cache->ranges[i];
+        if (addr >= range->addr && addr + len <= range->addr + range->len) {
+            return range;
+        }
+    }
+    return NULL;
+}
+
+
+static int zealfs_cache_insert(zealfs_cache_t* cache, const void* data, uint32_t addr, uint32_t len)
+{
+    if (cache->bytes + len > ZEALFS_CACHE_MAX_SIZE) {
+        return -ENOSPC;
+    }
+    if (cache->count == cache->capacity) {
+        const int capacity = cache->capacity ? cache->capacity * 2 : 64;
+        zealfs_cache_range_t* ranges = realloc(cache->ranges, capacity * sizeof(zealfs_cache_range_t));
+        if (ranges == NULL) {
+            return -ENOMEM;
+        }
+        cache->ranges = ranges;
+        cache->capacity = capacity;
+    }
+    uint8_t* copy = malloc(len);
+    if (copy == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(copy, data, len);
+    cache->ranges[cache->count++] = (zealfs_cache_range_t) { .addr = addr, .len = len, .data = copy };
+    cache->bytes += len;
+    return 0;
+}
+
+
+/**
+ * @brief Load the content of a cache file, after its header.
+ */
+static int zealfs_cache_load(zealfs_cache_t* cache, zealfs_context_t* ctx, FILE* file, const zealfs_cache_file_t* info)
+{
+    /* Read the whole payload first, its checksum must be valid before anything is used */
+    const long start = ftell(file);
+    if (fseek(file, 0, SEEK_END) != 0) {
+        return -EIO;
+    }
+    const long size = ftell(file) - start;
+    if (size < (long) (info->header_size + info->fat_size) || size > (long) (ZFS_HEADER_MAX_SIZE + ZFS_FAT_MAX_SIZE + ZEALFS_CACHE_MAX_SIZE * 2) ||
+        fseek(file, start, SEEK_SET) != 0)
+    {
+        return -EINVAL;
+    }
+    uint8_t* payload = malloc(size);
+    uint8_t* header = malloc(info->header_size);
+    int err = 0;
+    if (payload == NULL || header == NULL) {
+        err = -ENOMEM;
+        goto end;
+    }
+    if (fread(payload, 1, size, file) != (size_t) size || crc32c(0, payload, size) != info->payload_crc) {
+        err = -EINVAL;
+        goto end;
+    }
+
+    /* The header is read from the image anyway, its checksum tells whether the partition changed
+     * since the cache was saved */
+    if (ctx->read(ctx->arg, header, 0, info->header_size) < 0) {
+        err = -EIO;
+        goto end;
+    }
+    if (crc32c(0, header, info->header_size) != info->header_crc) {
+        err = -ESTALE;
+        goto end;
+    }
+
+    const uint8_t* cursor = payload + info->header_size + info->fat_size;
+    const uint8_t* payload_end = payload + size;
+    for (uint32_t i = 0; i < info->ranges_count && err == 0; i++) {
+        uint32_t addr, len;
+        if (cursor + 2 * sizeof(uint32_t) > payload_end) {
+            err = -EINVAL;
+            break;
+        }
+        memcpy(&addr, cursor, sizeof(uint32_t));
+        memcpy(&len, cursor + sizeof(uint32_t), sizeof(uint32_t));
+        cursor += 2 * sizeof(uint32_t);
+        if (len > (uint32_t) (payload_end - cursor)) {
+            err = -EINVAL;
+            break;
+        }
+        err = zealfs_cache_insert(cache, cursor, addr, len);
+        cursor += len;
+    }
+
+    if (err == 0) {
+        err = zealfs_set_metadata(ctx, header, info->header_size, payload + info->header_size, info->fat_size);
+    }
+end:
+    free(header);
+    free(payload);
+    return err;
+}
+
+
+bool zealfs_cache_open(zealfs_cache_t* cache, zealfs_context_t* ctx, const char* image_path, uint32_t start_lba)
+{
+    zealfs_cache_file_t info;
+    struct stat st;
+
+    memset(cache, 0, sizeof(*cache));
+    if (!s_cache_enabled) {
+        return false;
+    }
+    snprintf(cache->image_path, sizeof(cache->image_path), "%s", image_path);
+    snprintf(cache->path, sizeof(cache->path), "%s-%u.zdtcache", image_path, start_lba);
+    cache->start_lba = start_lba;
+    cache->active = true;
+
+    FILE* file = fopen(cache->path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    int err = -EINVAL;
+    if (stat(image_path, &st) == 0 &&
+        fread(&info, sizeof(info), 1, file) == 1 &&
+        memcmp(info.magic, CACHE_MAGIC, sizeof(info.magic)) == 0 &&
+        info.version == CACHE_VERSION &&
+        info.start_lba == start_lba &&
+        info.image_size == (uint64_t) st.st_size &&
+        info.image_mtime == (int64_t) st.st_mtime &&
+        info.header_size >= sizeof(zealfs_header_t) &&
+        info.header_size <= ZFS_HEADER_MAX_SIZE &&
+        info.fat_size <= ZFS_FAT_MAX_SIZE)
+    {
+        err = zealfs_cache_load(cache, ctx, file, &info);
+    }
+    fclose(file);
+
+    if (err) {
+        printf("[CACHE] %s is outdated, the metadata will be read from the image\n", cache->path);
+        for (int i = 0; i < cache->count; i++) {
+            free(cache->ranges[i].data);
+        }
+        cache->count = 0;
+        cache->bytes = 0;
+        return false;
+    }
+
+    printf("[CACHE] Loaded the FAT and %d directory ranges (%u bytes) from %s\n",
+           cache->count, cache->bytes, cache->path);
+    cache->hit = true;
+    return true;
+}
+
+
+bool zealfs_cache_read(zealfs_cache_t* cache, void* buffer, uint32_t addr, size_t len)
+{
+    if (!cache->active) {
+        return false;
+    }
+    const zealfs_cache_range_t* range = zealfs_cache_find(cache, addr, len);
+    if (range == NULL) {
+        return false;
+    }
+    memcpy(buffer, range->data + (addr - range->addr), len);
+    return true;
+}
+
+
+void zealfs_cache_add(zealfs_cache_t* cache, const void* buffer, uint32_t addr, size_t len)
+{
+    if (cache->active && zealfs_cache_find(cache, addr, len) == NULL) {
+        /* The cache is only an optimization, the range is simply not kept if it can't be */
+        (void) zealfs_cache_insert(cache, buffer, addr, len);
+    }
+}
+
+
+void zealfs_cache_update(zealfs_cache_t* cache, const void* buffer, uint32_t addr, size_t len)
+{
+    if (!cache->active) {
+        return;
+    }
+    const uint64_t end = (uint64_t) addr + len;
+    for (int i = 0; i < cache->count; i++) {
+        zealfs_cache_range_t* range = &cache->ranges[i];
+        const uint64_t range_end = (uint64_t) range->addr + range->len;
+        if (addr < range_end && end > range->addr) {
+            const uint64_t from = MAX(addr, range->addr);
+            const uint64_t to = MIN(end, range_end);
+            memcpy(range->data + (from - range->addr), (const uint8_t*) buffer + (from - addr), to - from);
+        }
+    }
+}
+
+
+static int zealfs_cache_save(zealfs_cache_t* cache, zealfs_context_t* ctx)
+{
+    zealfs_cache_file_t info = { 0 };
+    struct stat st;
+
+    if (stat(cache->image_path, &st) != 0) {
+        return -errno;
+    }
+
+    memcpy(info.magic, CACHE_MAGIC, sizeof(info.magic));
+    info.version = CACHE_VERSION;
+    info.start_lba = cache->start_lba;
+    info.image_size = st.st_size;
+    info.image_mtime = st.st_mtime;
+    info.header_size = ctx->header_size;
+    info.header_crc = crc32c(0, ctx->header, ctx->header_size);
+    info.fat_size = ctx->fat_size;
+    info.ranges_count = cache->count;
+
+    uint32_t crc = crc32c(0, ctx->header, ctx->header_size);
+    crc = crc32c(crc, ctx->fat, ctx->fat_size);
+    for (int i = 0; i < cache->count; i++) {
+        const zealfs_cache_range_t* range = &cache->ranges[i];
+        crc = crc32c(crc, &range->addr, sizeof(uint32_t));
+        crc = crc32c(crc, &range->len, sizeof(uint32_t));
+        crc = crc32c(crc, range->data, range->len);
+    }
+    info.payload_crc = crc;
+
+    FILE* file = fopen(cache->path, "wb");
+    if (file == NULL) {
+        return -errno;
+    }
+    bool success = fwrite(&info, sizeof(info), 1, file) == 1 &&
+                   fwrite(ctx->header, 1, ctx->header_size, file) == ctx->header_size &&
+                   fwrite(ctx->fat, 1, ctx->fat_size, file) == ctx->fat_size;
+    for (int i = 0; success && i < cache->count; i++) {
+        const zealfs_cache_range_t* range = &cache->ranges[i];
+        success = fwrite(&range->addr, sizeof(uint32_t), 1, file) == 1 &&
+                  fwrite(&range->len, sizeof(uint32_t), 1, file) == 1 &&
+                  fwrite(range->data, 1, range->len, file) == range->len;
+    }
+    if (fclose(file) != 0 || !success) {
+        /* Don't leave a truncated cache behind, even though its checksum would reject it */
+        remove(cache->path);
+        return -EIO;
+    }
+    return 0;
+}
+
+
+void zealfs_cache_close(zealfs_cache_t* cache, zealfs_context_t* ctx)
+{
+    if (cache->active && ctx->header != NULL) {
+        const int err = zealfs_cache_save(cache, ctx);
+        if (err) {
+            printf("[CACHE] Could not save %s: %s\n", cache->path, strerror(-err));
+        }
+    }
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->ranges[i].data);
+    }
+    free(cache->ranges);
+    memset(cache, 0, sizeof(*cache));
+}
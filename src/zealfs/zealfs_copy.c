@@ -0,0 +1,342 @@
+/* SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "zealfs_v2.h"
+#include "zealfs_copy.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+#define COPY_PATH_LEN       512
+/* Size of the chunks read from the source, a multiple of all the page sizes so that the
+ * extents of a file are never split between two chunks */
+#define COPY_CHUNK_SIZE     (1*MB)
+/* Number of chunks that can be read ahead of the writer, twice the biggest write gathered by a
+ * session, so that the reader keeps going while the destination writes a whole allocation unit */
+#define COPY_SLOTS_COUNT    8
+/* Number of entries retrieved from a ZealFS directory at once */
+#define COPY_DIR_BATCH      64
+
+
+typedef struct {
+    uint8_t* data;
+    uint32_t len;
+} copy_slot_t;
+
+
+typedef struct {
+    zealfs_context_t*    src;
+    zealfs_context_t*    dst;
+    zealfs_copy_stats_t* stats;
+    copy_slot_t          slots[COPY_SLOTS_COUNT];
+
+    /* File being copied, only accessed by the reader thread while it runs */
+    zealfs_fd_t          src_fd;
+    uint32_t             chunks_count;
+    /* Progress of the reader and the writer, protected by the mutex */
+    uint32_t             chunks_read;
+    uint32_t             chunks_written;
+    int                  read_error;
+    bool                 write_failed;
+    pthread_mutex_t      mutex;
+    pthread_cond_t       chunk_ready;
+    pthread_cond_t       slot_free;
+} copy_job_t;
+
+
+static void copy_path(char* path, const char* dir, const char* name)
+{
+    const size_t len = strlen(dir);
+    const bool has_slash = len > 0 && dir[len - 1] == '/';
+    snprintf(path, COPY_PATH_LEN, "%s%s%.*s", dir, has_slash ? "" : "/",
+             (int) strnlen(name, NAME_MAX_LEN), name);
+}
+
+
+static int copy_read_chunk(copy_job_t* job, copy_slot_t* slot, uint32_t chunk)
+{
+    const uint32_t offset = chunk * COPY_CHUNK_SIZE;
+    slot->len = MIN(job->src_fd.entry.size - offset, COPY_CHUNK_SIZE);
+    const int ret = zealfs_read(job->src, &job->src_fd, slot->data, slot->len, offset);
+    if (ret != (int) slot->len) {
+        return ret < 0 ? ret : -EIO;
+    }
+    return 0;
+}
+
+
+static void* copy_reader(void* arg)
+{
+    copy_job_t* job = (copy_job_t*) arg;
+    int err = 0;
+
+    for (uint32_t chunk = 0; chunk < job->chunks_count && err == 0; chunk++) {
+        /* Wait for the writer to be done with the chunk that was in this slot */
+        pthread_mutex_lock(&job->mutex);
+        while (chunk - job->chunks_written >= COPY_SLOTS_COUNT && !job->write_failed) {
+            pthread_cond_wait(&job->slot_free, &job->mutex);
+        }
+        const bool stop = job->write_failed;
+        pthread_mutex_unlock(&job->mutex);
+        if (stop) {
+            break;
+        }
+
+        /* The writer doesn't access the slot until it is published */
+        err = copy_read_chunk(job, &job->slots[chunk % COPY_SLOTS_COUNT], chunk);
+
+        pthread_mutex_lock(&job->mutex);
+        if (err) {
+            job->read_error = err;
+        } else {
+            job->chunks_read++;
+        }
+        pthread_cond_signal(&job->chunk_ready);
+        pthread_mutex_unlock(&job->mutex);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Write the chunks of the current file as soon as the reader publishes them.
+ */
+static int copy_write_chunks(copy_job_t* job, zealfs_fd_t* dst_fd)
+{
+    int ret = 0;
+
+    for (uint32_t chunk = 0; chunk < job->chunks_count; chunk++) {
+        pthread_mutex_lock(&job->mutex);
+        while (job->chunks_read <= chunk && job->read_error == 0) {
+            pthread_cond_wait(&job->chunk_ready, &job->mutex);
+        }
+        ret = job->chunks_read > chunk ? 0 : job->read_error;
+        pthread_mutex_unlock(&job->mutex);
+        if (ret) {
+            break;
+        }
+
+        copy_slot_t* slot = &job->slots[chunk % COPY_SLOTS_COUNT];
+        ret = zealfs_write(job->dst, dst_fd, slot->data, slot->len, chunk * COPY_CHUNK_SIZE);
+        if (ret < 0) {
+            break;
+        }
+        ret = 0;
+
+        pthread_mutex_lock(&job->mutex);
+        job->chunks_written++;
+        pthread_cond_signal(&job->slot_free);
+        pthread_mutex_unlock(&job->mutex);
+    }
+
+    if (ret) {
+        /* Don't let the reader wait for a slot that will never be freed */
+        pthread_mutex_lock(&job->mutex);
+        job->write_failed = true;
+        pthread_cond_signal(&job->slot_free);
+        pthread_mutex_unlock(&job->mutex);
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Copy the content of the current file. Files that fit in a single chunk are copied
+ * sequentially, the others are read by a thread, even within the same partition since the context
+ * can be shared between threads.
+ */
+static int copy_data(copy_job_t* job, zealfs_fd_t* dst_fd)
+{
+    pthread_t reader;
+    int ret = 0;
+
+    job->chunks_count = (job->src_fd.entry.size + COPY_CHUNK_SIZE - 1) / COPY_CHUNK_SIZE;
+    job->chunks_read = 0;
+    job->chunks_written = 0;
+    job->read_error = 0;
+    job->write_failed = false;
+
+    if (job->chunks_count <= 1) {
+        for (uint32_t chunk = 0; chunk < job->chunks_count && ret >= 0; chunk++) {
+            copy_slot_t* slot = &job->slots[0];
+            ret = copy_read_chunk(job, slot, chunk);
+            if (ret == 0) {
+                ret = zealfs_write(job->dst, dst_fd, slot->data, slot->len, chunk * COPY_CHUNK_SIZE);
+            }
+        }
+        return ret < 0 ? ret : 0;
+    }
+
+    if (pthread_create(&reader, NULL, copy_reader, job) != 0) {
+        return -EAGAIN;
+    }
+    ret = copy_write_chunks(job, dst_fd);
+    pthread_join(reader, NULL);
+    return ret;
+}
+
+
+static int copy_file(copy_job_t* job, const char* src_path, const char* dst_path)
+{
+    zealfs_fd_t dst_fd;
+
+    int ret = zealfs_open(src_path, job->src, &job->src_fd);
+    if (ret < 0) {
+        return ret;
+    }
+    if (job->src_fd.entry.size > zealfs_free_space(job->dst)) {
+        return -ENOSPC;
+    }
+
+    ret = zealfs_create(dst_path, job->dst, &dst_fd);
+    if (ret < 0) {
+        printf("[COPY] Could not create %s: %s\n", dst_path, strerror(-ret));
+        return ret;
+    }
+    ret = copy_data(job, &dst_fd);
+    if (ret < 0) {
+        /* Don't leave a truncated copy behind, its pages are released with it */
+        zealfs_flush(job->dst, &dst_fd);
+        zealfs_unlink(dst_path, job->dst);
+    } else {
+        /* Keep the date of the source, from the year to the seconds */
+        const zealfs_entry_t* src = &job->src_fd.entry;
+        memcpy(dst_fd.entry.year, src->year, offsetof(zealfs_entry_t, reserved) - offsetof(zealfs_entry_t, year));
+        ret = zealfs_flush(job->dst, &dst_fd);
+    }
+    if (ret < 0) {
+        printf("[COPY] Could not copy %s: %s\n", src_path, strerror(-ret));
+        return ret;
+    }
+
+    job->stats->files++;
+    job->stats->bytes_copied += job->src_fd.entry.size;
+    return 0;
+}
+
+
+/**
+ * @brief Get all the entries of a source directory, the context is also needed to copy them,
+ * so the directory can't be browsed while copying.
+ *
+ * @return Number of entries on success, negative error code on failure.
+ */
+static int copy_list_dir(zealfs_context_t* ctx, const char* dir, zealfs_entry_t** ret_entries)
+{
+    zealfs_entry_t* entries = NULL;
+    int capacity = 0;
+    int total = 0;
+    zealfs_dir_iter_t iter;
+    zealfs_fd_t fd;
+    int count;
+
+    count = zealfs_opendir(dir, ctx, &fd);
+    if (count < 0 || (count = zealfs_dir_iter_init(ctx, &fd, &iter)) < 0) {
+        return count;
+    }
+
+    do {
+        if (total + COPY_DIR_BATCH > capacity) {
+            capacity = (capacity + COPY_DIR_BATCH) * 2;
+            zealfs_entry_t* bigger = realloc(entries, capacity * sizeof(zealfs_entry_t));
+            if (bigger == NULL) {
+                free(entries);
+                return -ENOMEM;
+            }
+            entries = bigger;
+        }
+        count = zealfs_dir_iter_next(ctx, &iter, entries + total, COPY_DIR_BATCH);
+        total += count > 0 ? count : 0;
+    } while (count > 0);
+
+    if (count < 0) {
+        free(entries);
+        return count;
+    }
+    *ret_entries = entries;
+    return total;
+}
+
+
+static int copy_entry(copy_job_t* job, const char* src_dir, const zealfs_entry_t* entry, const char* dst_dir)
+{
+    char src_path[COPY_PATH_LEN];
+    char dst_path[COPY_PATH_LEN];
+
+    copy_path(src_path, src_dir, entry->name);
+    copy_path(dst_path, dst_dir, entry->name);
+    if ((entry->flags & IS_DIR) == 0) {
+        return copy_file(job, src_path, dst_path);
+    }
+
+    /* Copying a directory inside itself would never end */
+    const size_t src_len = strlen(src_path);
+    if (job->src == job->dst && strncmp(dst_path, src_path, src_len) == 0 &&
+        (dst_path[src_len] == '/' || dst_path[src_len] == 0))
+    {
+        return -EINVAL;
+    }
+
+    zealfs_fd_t fd;
+    int ret = zealfs_mkdir(dst_path, job->dst, &fd);
+    if (ret == 0) {
+        job->stats->directories++;
+    } else if (ret != -EEXIST) {
+        printf("[COPY] Could not create %s: %s\n", dst_path, strerror(-ret));
+        return ret;
+    }
+
+    zealfs_entry_t* entries = NULL;
+    const int count = copy_list_dir(job->src, src_path, &entries);
+    if (count < 0) {
+        return count;
+    }
+    ret = 0;
+    for (int i = 0; i < count && ret == 0; i++) {
+        ret = copy_entry(job, src_path, &entries[i], dst_path);
+    }
+    free(entries);
+    return ret;
+}
+
+
+int zealfs_copy(zealfs_context_t* src, const char* src_dir, const zealfs_entry_t* entry,
+                zealfs_context_t* dst, const char* dst_dir, zealfs_copy_stats_t* stats)
+{
+    copy_job_t job = {
+        .src   = src,
+        .dst   = dst,
+        .stats = stats,
+    };
+    int ret = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < COPY_SLOTS_COUNT && ret == 0; i++) {
+        job.slots[i].data = malloc(COPY_CHUNK_SIZE);
+        if (job.slots[i].data == NULL) {
+            ret = -ENOMEM;
+        }
+    }
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.chunk_ready, NULL);
+    pthread_cond_init(&job.slot_free, NULL);
+
+    if (ret == 0) {
+        ret = copy_entry(&job, src_dir, entry, dst_dir);
+    }
+
+    pthread_mutex_destroy(&job.mutex);
+    pthread_cond_destroy(&job.chunk_ready);
+    pthread_cond_destroy(&job.slot_free);
+    for (int i = 0; i < COPY_SLOTS_COUNT; i++) {
+        free(job.slots[i].data);
+    }
+    return ret;
+}
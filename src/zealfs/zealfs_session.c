@@ -0,0 +1,381 @@
+/* SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "zealfs_session.h"
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+#define CHECK_RW(ret)   do { if((ret) <= 0) { return (ret); } } while(0)
+
+
+static zealfs_session_t s_sessions[ZEALFS_SESSIONS_MAX];
+static uint64_t s_use_counter;
+
+
+static ssize_t session_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    const size_t total = len;
+    uint8_t temp_sector[DISK_SECTOR_SIZE];
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    off_t disk_offset = (off_t) session->start_lba * DISK_SECTOR_SIZE + addr;
+    ssize_t bytes_read = 0;
+
+    /* The data to read may still be in the writer */
+    if (disk_writer_flush(&session->writer) != 0) {
+        return -1;
+    }
+
+    /* Check if addr is aligned to DISK_SECTOR_SIZE */
+    size_t offset = addr % DISK_SECTOR_SIZE;
+    if (offset != 0) {
+        /* Read the first unaligned sector */
+        const off_t first_sector_offset = disk_offset - offset;
+        bytes_read = disk_read(session->disk_fd, temp_sector, first_sector_offset, DISK_SECTOR_SIZE);
+        CHECK_RW(bytes_read);
+
+        /* Copy the relevant part of the sector to the buffer */
+        const size_t unaligned_len = DISK_SECTOR_SIZE - offset;
+        const size_t bytes_to_copy = MIN(len, unaligned_len);
+        memcpy(buffer, temp_sector + offset, bytes_to_copy);
+
+        /* Update the buffer, addr, and len */
+        len -= bytes_to_copy;
+        buffer += bytes_to_copy;
+        disk_offset += bytes_to_copy;
+    }
+
+    if (len == 0) {
+        return total;
+    }
+
+    /* Read the sector from the disk */
+    bytes_read = disk_read(session->disk_fd, buffer, disk_offset, len);
+    CHECK_RW(bytes_read);
+
+    return total;
+}
+
+
+static ssize_t session_readv(void* arg, const zealfs_iovec_t* iov, int count, uint32_t addr)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    const off_t disk_offset = (off_t) session->start_lba * DISK_SECTOR_SIZE + addr;
+    disk_read_iovec_t vec[ZFS_READV_MAX];
+    ssize_t total = 0;
+
+    if (addr % DISK_SECTOR_SIZE != 0) {
+        /* Unaligned reads need a temporary sector, read the buffers one by one */
+        for (int i = 0; i < count; i++) {
+            ssize_t bytes_read = session_read(arg, iov[i].base, addr + total, iov[i].len);
+            CHECK_RW(bytes_read);
+            total += bytes_read;
+        }
+        return total;
+    }
+
+    if (disk_writer_flush(&session->writer) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        vec[i] = (disk_read_iovec_t) { .base = iov[i].base, .len = iov[i].len };
+    }
+    return disk_readv(session->disk_fd, vec, count, disk_offset);
+}
+
+
+static ssize_t session_read_dir(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    if (zealfs_cache_read(&session->cache, buffer, addr, len)) {
+        return len;
+    }
+    const ssize_t bytes_read = session_read(arg, buffer, addr, len);
+    if (bytes_read == (ssize_t) len) {
+        zealfs_cache_add(&session->cache, buffer, addr, len);
+    }
+    return bytes_read;
+}
+
+
+static ssize_t read_write_sector(zealfs_session_t* session, const void* buffer, off_t aligned_addr, off_t offset, size_t len)
+{
+    uint8_t temp_sector[DISK_SECTOR_SIZE];
+
+    /* Read the first unaligned sector and write it back */
+    if (disk_writer_flush(&session->writer) != 0) {
+        return -1;
+    }
+    ssize_t bytes_read = disk_read(session->disk_fd, temp_sector, aligned_addr, DISK_SECTOR_SIZE);
+    CHECK_RW(bytes_read);
+
+    /* Copy the relevant part of the sector to the buffer */
+    const size_t unaligned_len = DISK_SECTOR_SIZE - offset;
+    const size_t bytes_to_copy = MIN(len, unaligned_len);
+    memcpy(temp_sector + offset, buffer, bytes_to_copy);
+
+    /* Write it back */
+    ssize_t bytes_written = disk_writer_write(&session->writer, temp_sector, aligned_addr, DISK_SECTOR_SIZE);
+    CHECK_RW(bytes_written);
+
+    return bytes_to_copy;
+}
+
+
+static ssize_t session_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+{
+    const size_t total = len;
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    off_t disk_offset = (off_t) session->start_lba * DISK_SECTOR_SIZE + addr;
+
+    /* Keep the cached directories in sync with the partition */
+    zealfs_cache_update(&session->cache, buffer, addr, len);
+
+    /* Check if addr is aligned to DISK_SECTOR_SIZE */
+    size_t offset = addr % DISK_SECTOR_SIZE;
+    if (offset != 0) {
+        const off_t first_sector_addr = disk_offset - offset;
+        ssize_t written = read_write_sector(session, buffer, first_sector_addr, offset, len);
+        CHECK_RW(written);
+
+        /* Update the buffer, addr, and len */
+        len -= written;
+        buffer += written;
+        disk_offset += written;
+    }
+
+    /* The whole sectors don't need to be read first, write all of them at once */
+    const size_t aligned_len = len - (len % DISK_SECTOR_SIZE);
+    if (aligned_len > 0) {
+        ssize_t written = disk_writer_write(&session->writer, buffer, disk_offset, aligned_len);
+        CHECK_RW(written);
+        buffer += aligned_len;
+        disk_offset += aligned_len;
+    }
+
+    /* Handle any remaining unaligned bytes */
+    len = len % DISK_SECTOR_SIZE;
+    if (len > 0) {
+        ssize_t written = read_write_sector(session, buffer, disk_offset, 0, len);
+        CHECK_RW(written);
+    }
+
+    return total;
+}
+
+
+static int session_discard(void* arg, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    const off_t disk_offset = (off_t) session->start_lba * DISK_SECTOR_SIZE + addr;
+    /* Image files are always kept sparse, devices are only trimmed when enabled */
+    if (!session->is_image && !disk_trim_enabled()) {
+        return -1;
+    }
+    /* Don't let data still gathered land in the range after it was discarded */
+    disk_writer_flush(&session->writer);
+    return disk_discard(session->disk_fd, disk_offset, len);
+}
+
+
+/* The context may be used by several threads at once while the disk descriptor, its offset, the
+ * writer and the cache can't, so the callbacks given to the context are serialized */
+static ssize_t locked_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    pthread_mutex_lock(&session->lock);
+    const ssize_t ret = session_read(arg, buffer, addr, len);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+static ssize_t locked_readv(void* arg, const zealfs_iovec_t* iov, int count, uint32_t addr)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    pthread_mutex_lock(&session->lock);
+    const ssize_t ret = session_readv(arg, iov, count, addr);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+static ssize_t locked_read_dir(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    pthread_mutex_lock(&session->lock);
+    const ssize_t ret = session_read_dir(arg, buffer, addr, len);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+static ssize_t locked_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    pthread_mutex_lock(&session->lock);
+    const ssize_t ret = session_write(arg, buffer, addr, len);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+static int locked_discard(void* arg, uint32_t addr, size_t len)
+{
+    zealfs_session_t* session = (zealfs_session_t*) arg;
+    pthread_mutex_lock(&session->lock);
+    const int ret = session_discard(arg, addr, len);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+static void session_close(zealfs_session_t* session)
+{
+    if (!session->open) {
+        return;
+    }
+    printf("[SESSION] Closing %s @ %u\n", session->disk_path, session->start_lba);
+    /* Release the pages freed since the last operation before closing the disk */
+    zealfs_discard_flush(session->ctx);
+    disk_writer_free(&session->writer);
+    /* Save the metadata once all the writes reached the image */
+    zealfs_cache_close(&session->cache, session->ctx);
+    zealfs_context_destroy(session->ctx);
+    disk_close(session->disk_fd);
+    pthread_mutex_destroy(&session->lock);
+    memset(session, 0, sizeof(*session));
+}
+
+
+static const char* session_open(zealfs_session_t* session, disk_info_t* disk, const partition_t* part)
+{
+    snprintf(session->disk_path, sizeof(session->disk_path), "%s", disk->path);
+    session->start_lba = part->start_lba;
+    session->size_sectors = part->size_sectors;
+    session->is_image = disk->is_image;
+
+    session->ctx = zealfs_context_create(locked_read, locked_write, session);
+    if (session->ctx == NULL) {
+        return "Could not allocate the ZealFS context";
+    }
+    session->ctx->read_dir = locked_read_dir;
+    session->ctx->readv = locked_readv;
+    session->ctx->discard = locked_discard;
+
+    if (disk_open(disk, &session->disk_fd)) {
+        zealfs_context_destroy(session->ctx);
+        return "Could not open disk";
+    }
+    /* Writes are coalesced up to the allocation unit of the media */
+    if (disk_writer_init(&session->writer, session->disk_fd, disk_au_size(disk))) {
+        disk_close(session->disk_fd);
+        zealfs_context_destroy(session->ctx);
+        return "Could not allocate the write buffer";
+    }
+    pthread_mutex_init(&session->lock, NULL);
+    /* Images can be reopened without reading their FAT and directories again */
+    if (disk->is_image) {
+        zealfs_cache_open(&session->cache, session->ctx, disk->path, part->start_lba);
+    }
+    session->open = true;
+    return NULL;
+}
+
+
+zealfs_session_t* zealfs_session_get(disk_info_t* disk, const partition_t* part, const char** error)
+{
+    zealfs_session_t* victim = NULL;
+
+    for (int i = 0; i < ZEALFS_SESSIONS_MAX; i++) {
+        zealfs_session_t* session = &s_sessions[i];
+        if (session->open &&
+            session->start_lba == part->start_lba &&
+            session->size_sectors == part->size_sectors &&
+            strcmp(session->disk_path, disk->path) == 0)
+        {
+            session->last_use = ++s_use_counter;
+            return session;
+        }
+        /* Prefer a free slot, else the least recently used session, never a pinned one */
+        if (session->pins > 0) {
+            continue;
+        }
+        if (victim == NULL || (victim->open && (!session->open || session->last_use < victim->last_use))) {
+            victim = session;
+        }
+    }
+
+    if (victim == NULL) {
+        printf("[SESSION] All the sessions are in use\n");
+        if (error) {
+            *error = "Too many partitions in use";
+        }
+        return NULL;
+    }
+
+    session_close(victim);
+    const char* err = session_open(victim, disk, part);
+    if (err) {
+        printf("[SESSION] %s\n", err);
+        memset(victim, 0, sizeof(*victim));
+        if (error) {
+            *error = err;
+        }
+        return NULL;
+    }
+    victim->last_use = ++s_use_counter;
+    return victim;
+}
+
+
+void zealfs_session_pin(zealfs_session_t* session)
+{
+    if (session != NULL && session->open) {
+        session->pins++;
+    }
+}
+
+
+void zealfs_session_unpin(zealfs_session_t* session)
+{
+    /* Closing the session already released all its pins */
+    if (session != NULL && session->open && session->pins > 0) {
+        session->pins--;
+    }
+}
+
+
+int zealfs_session_flush(zealfs_session_t* session)
+{
+    if (session == NULL || !session->open) {
+        return 0;
+    }
+    zealfs_discard_flush(session->ctx);
+    pthread_mutex_lock(&session->lock);
+    const int ret = disk_writer_flush(&session->writer);
+    pthread_mutex_unlock(&session->lock);
+    return ret;
+}
+
+
+void zealfs_session_close_disk(const char* disk_path)
+{
+    for (int i = 0; i < ZEALFS_SESSIONS_MAX; i++) {
+        if (s_sessions[i].open && strcmp(s_sessions[i].disk_path, disk_path) == 0) {
+            session_close(&s_sessions[i]);
+        }
+    }
+}
+
+
+void zealfs_session_close_all(void)
+{
+    for (int i = 0; i < ZEALFS_SESSIONS_MAX; i++) {
+        session_close(&s_sessions[i]);
+    }
+}
@@ -0,0 +1,399 @@
+/* SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "zealfs_v2.h"
+#include "zealfs_sync.h"
+
+#ifdef _WIN32
+/* There are no symbolic links to skip on Windows */
+#define lstat(path, st)     stat(path, st)
+#define S_ISLNK(mode)       0
+#endif
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+#define SYNC_PATH_LEN       512
+/* Size of the chunks copied from the host files */
+#define SYNC_COPY_SIZE      (64*KB)
+/* Number of entries retrieved from a ZealFS directory at once */
+#define SYNC_DIR_BATCH      64
+
+typedef struct {
+    zealfs_entry_t entry;
+    /* Set when the entry also exists on the host */
+    bool           seen;
+} sync_fs_entry_t;
+
+
+typedef struct {
+    zealfs_context_t*    ctx;
+    int                  flags;
+    zealfs_sync_stats_t* stats;
+    uint8_t*             host_buffer;
+    uint8_t*             fs_buffer;
+} sync_job_t;
+
+
+static int sync_compare_entries(const void* a, const void* b)
+{
+    return strncmp(((const sync_fs_entry_t*) a)->entry.name, ((const sync_fs_entry_t*) b)->entry.name, NAME_MAX_LEN);
+}
+
+
+/**
+ * @brief Get all the entries of a ZealFS directory, sorted by name.
+ *
+ * @return Number of entries on success, negative error code on failure.
+ */
+static int sync_list_fs(zealfs_context_t* ctx, const char* fs_dir, sync_fs_entry_t** ret_entries)
+{
+    zealfs_entry_t batch[SYNC_DIR_BATCH];
+    sync_fs_entry_t* entries = NULL;
+    int capacity = 0;
+    int total = 0;
+    zealfs_dir_iter_t iter;
+    zealfs_fd_t fd;
+    int count;
+
+    count = zealfs_opendir(fs_dir, ctx, &fd);
+    if (count < 0 || (count = zealfs_dir_iter_init(ctx, &fd, &iter)) < 0) {
+        return count;
+    }
+
+    while ((count = zealfs_dir_iter_next(ctx, &iter, batch, SYNC_DIR_BATCH)) > 0) {
+        if (total + count > capacity) {
+            capacity = (capacity + count) * 2;
+            sync_fs_entry_t* bigger = realloc(entries, capacity * sizeof(sync_fs_entry_t));
+            if (bigger == NULL) {
+                free(entries);
+                return -ENOMEM;
+            }
+            entries = bigger;
+        }
+        for (int i = 0; i < count; i++) {
+            entries[total++] = (sync_fs_entry_t) { .entry = batch[i] };
+        }
+    }
+    if (count < 0) {
+        free(entries);
+        return count;
+    }
+
+    if (total > 0) {
+        qsort(entries, total, sizeof(sync_fs_entry_t), sync_compare_entries);
+    }
+    *ret_entries = entries;
+    return total;
+}
+
+
+static sync_fs_entry_t* sync_find(sync_fs_entry_t* entries, int count, const char* name)
+{
+    sync_fs_entry_t key = { 0 };
+    memcpy(key.entry.name, name, MIN(strlen(name), NAME_MAX_LEN));
+    return count > 0 ? bsearch(&key, entries, count, sizeof(sync_fs_entry_t), sync_compare_entries) : NULL;
+}
+
+
+/**
+ * @brief Build the path of an entry of a ZealFS directory.
+ *
+ * @return 0 on success, -ENAMETOOLONG if the path doesn't fit in SYNC_PATH_LEN.
+ */
+static int sync_fs_path(char* path, const char* fs_dir, const char* name, int name_len)
+{
+    const bool is_root = strcmp(fs_dir, "/") == 0;
+    const int len = snprintf(path, SYNC_PATH_LEN, "%s/%.*s", is_root ? "" : fs_dir, name_len, name);
+    return (len >= SYNC_PATH_LEN) ? -ENAMETOOLONG : 0;
+}
+
+
+/**
+ * @brief Remove an entry from ZealFS, the content of a directory is removed first.
+ */
+static int sync_remove(sync_job_t* job, const char* fs_path, const zealfs_entry_t* entry)
+{
+    int ret;
+
+    if (entry->flags & IS_DIR) {
+        sync_fs_entry_t* entries = NULL;
+        char path[SYNC_PATH_LEN];
+        const int count = sync_list_fs(job->ctx, fs_path, &entries);
+        if (count < 0) {
+            return count;
+        }
+        for (int i = 0; i < count; i++) {
+            ret = sync_fs_path(path, fs_path, entries[i].entry.name, strnlen(entries[i].entry.name, NAME_MAX_LEN));
+            if (ret == 0) {
+                ret = sync_remove(job, path, &entries[i].entry);
+            }
+            if (ret < 0) {
+                free(entries);
+                return ret;
+            }
+        }
+        free(entries);
+        ret = zealfs_rmdir(fs_path, job->ctx);
+    } else {
+        ret = zealfs_unlink(fs_path, job->ctx);
+    }
+
+    if (ret < 0) {
+        printf("[SYNC] Could not remove %s: %s\n", fs_path, strerror(-ret));
+        return ret;
+    }
+    job->stats->deleted++;
+    return 0;
+}
+
+
+/**
+ * @brief Check whether the date of a ZealFS entry matches the modification date of a host file.
+ * ZealFS dates have a one second resolution.
+ */
+static bool sync_same_date(const zealfs_entry_t* entry, time_t date)
+{
+    zealfs_entry_t host = { 0 };
+    zealfs_entry_set_date(&host, date);
+    /* Compare all the date fields at once, from the year to the seconds */
+    const size_t date_size = offsetof(zealfs_entry_t, seconds) + 1 - offsetof(zealfs_entry_t, year);
+    return memcmp(entry->year, host.year, date_size) == 0;
+}
+
+
+/**
+ * @brief Compare the content of a host file and of a ZealFS file of the same size.
+ */
+static bool sync_same_content(sync_job_t* job, const char* host_path, const zealfs_entry_t* entry)
+{
+    zealfs_fd_t fd = { .entry = *entry };
+    bool same = true;
+
+    FILE* file = fopen(host_path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    for (uint32_t offset = 0; same && offset < entry->size; ) {
+        const size_t len = MIN(entry->size - offset, SYNC_COPY_SIZE);
+        same = fread(job->host_buffer, 1, len, file) == len &&
+               zealfs_read(job->ctx, &fd, job->fs_buffer, len, offset) == (int) len &&
+               memcmp(job->host_buffer, job->fs_buffer, len) == 0;
+        offset += len;
+    }
+
+    fclose(file);
+    return same;
+}
+
+
+/**
+ * @brief Copy a host file to ZealFS, the file must not exist on ZealFS yet.
+ */
+static int sync_write_file(sync_job_t* job, const char* host_path, const char* fs_path, const struct stat* st)
+{
+    zealfs_fd_t fd;
+    uint32_t offset = 0;
+    int ret;
+
+    if ((uint64_t) st->st_size > zealfs_free_space(job->ctx)) {
+        return -ENOSPC;
+    }
+
+    FILE* file = fopen(host_path, "rb");
+    if (file == NULL) {
+        return -errno;
+    }
+
+    ret = zealfs_create(fs_path, job->ctx, &fd);
+    const bool created = ret >= 0;
+    while (ret >= 0) {
+        const size_t len = fread(job->host_buffer, 1, SYNC_COPY_SIZE, file);
+        if (len == 0) {
+            break;
+        }
+        ret = zealfs_write(job->ctx, &fd, job->host_buffer, len, offset);
+        offset += len;
+    }
+    fclose(file);
+
+    if (ret >= 0) {
+        /* Keep the date of the host file so that the next sync can tell it didn't change */
+        zealfs_entry_set_date(&fd.entry, st->st_mtime);
+        ret = zealfs_flush(job->ctx, &fd);
+    } else if (created) {
+        /* Don't leave a truncated file behind, its pages are released with it */
+        zealfs_flush(job->ctx, &fd);
+        zealfs_unlink(fs_path, job->ctx);
+    }
+    if (ret < 0) {
+        printf("[SYNC] Could not write %s: %s\n", fs_path, strerror(-ret));
+        return ret;
+    }
+
+    job->stats->bytes_written += offset;
+    return 0;
+}
+
+
+static int sync_file(sync_job_t* job, const char* host_path, const char* fs_path,
+                     const struct stat* st, sync_fs_entry_t* existing)
+{
+    int ret;
+
+    if (existing != NULL) {
+        const zealfs_entry_t* entry = &existing->entry;
+        if (entry->size == (uint64_t) st->st_size && sync_same_date(entry, st->st_mtime) &&
+            ((job->flags & ZEALFS_SYNC_CONTENT) == 0 || sync_same_content(job, host_path, entry)))
+        {
+            job->stats->unchanged++;
+            return 0;
+        }
+        /* Keep the former version if the new one can't fit, even once the former one is removed */
+        if ((uint64_t) st->st_size > zealfs_free_space(job->ctx) + (uint64_t) entry->size) {
+            return -ENOSPC;
+        }
+        /* Files can only be appended to, write the new version from scratch */
+        ret = zealfs_unlink(fs_path, job->ctx);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ret = sync_write_file(job, host_path, fs_path, st);
+    if (ret == 0) {
+        if (existing != NULL) {
+            job->stats->updated++;
+        } else {
+            job->stats->created++;
+        }
+    }
+    return ret;
+}
+
+
+static int sync_dir(sync_job_t* job, const char* host_dir, const char* fs_dir)
+{
+    char host_path[SYNC_PATH_LEN];
+    char fs_path[SYNC_PATH_LEN];
+    sync_fs_entry_t* entries = NULL;
+    struct dirent* dirent;
+    struct stat st;
+    int ret = 0;
+
+    const int count = sync_list_fs(job->ctx, fs_dir, &entries);
+    if (count < 0) {
+        return count;
+    }
+
+    DIR* dir = opendir(host_dir);
+    if (dir == NULL) {
+        free(entries);
+        return -errno;
+    }
+
+    while (ret == 0 && (dirent = readdir(dir)) != NULL) {
+        const char* name = dirent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        /* Symbolic links are not followed, they could make the walk loop forever */
+        const size_t name_len = strlen(name);
+        const int host_len = snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, name);
+        if (name_len > NAME_MAX_LEN || host_len >= (int) sizeof(host_path) ||
+            sync_fs_path(fs_path, fs_dir, name, name_len) != 0 ||
+            lstat(host_path, &st) != 0 || S_ISLNK(st.st_mode) ||
+            (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) ||
+            (S_ISREG(st.st_mode) && (uint64_t) st.st_size > UINT32_MAX))
+        {
+            printf("[SYNC] Skipping %s/%s\n", host_dir, name);
+            job->stats->skipped++;
+            continue;
+        }
+
+        sync_fs_entry_t* existing = sync_find(entries, count, name);
+        if (existing != NULL) {
+            existing->seen = true;
+            /* A file replaced by a directory, or the opposite */
+            if (((existing->entry.flags & IS_DIR) != 0) != S_ISDIR(st.st_mode)) {
+                ret = sync_remove(job, fs_path, &existing->entry);
+                existing = NULL;
+            }
+        }
+        if (ret < 0) {
+            break;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (existing == NULL) {
+                zealfs_fd_t fd;
+                ret = zealfs_mkdir(fs_path, job->ctx, &fd);
+                if (ret == 0) {
+                    job->stats->created++;
+                }
+            }
+            if (ret == 0) {
+                ret = sync_dir(job, host_path, fs_path);
+            }
+        } else {
+            ret = sync_file(job, host_path, fs_path, &st, existing);
+        }
+
+        /* An entry that doesn't fit doesn't prevent the smaller ones from being synchronized */
+        if (ret == -ENOSPC) {
+            printf("[SYNC] Not enough space for %s\n", host_path);
+            job->stats->failed++;
+            ret = 0;
+        }
+    }
+    closedir(dir);
+
+    /* Entries that don't exist on the host anymore */
+    for (int i = 0; ret == 0 && (job->flags & ZEALFS_SYNC_DELETE) && i < count; i++) {
+        if (!entries[i].seen) {
+            ret = sync_fs_path(fs_path, fs_dir, entries[i].entry.name, strnlen(entries[i].entry.name, NAME_MAX_LEN));
+            if (ret == 0) {
+                ret = sync_remove(job, fs_path, &entries[i].entry);
+            }
+        }
+    }
+
+    free(entries);
+    return ret;
+}
+
+
+int zealfs_sync(zealfs_context_t* ctx, const char* host_dir, const char* fs_dir, int flags, zealfs_sync_stats_t* stats)
+{
+    sync_job_t job = {
+        .ctx         = ctx,
+        .flags       = flags,
+        .stats       = stats,
+        .host_buffer = malloc(SYNC_COPY_SIZE),
+        .fs_buffer   = malloc(SYNC_COPY_SIZE),
+    };
+    int ret = -ENOMEM;
+
+    memset(stats, 0, sizeof(*stats));
+    if (job.host_buffer != NULL && job.fs_buffer != NULL) {
+        ret = sync_dir(&job, host_dir, fs_dir);
+    }
+    if (ret == 0 && stats->failed > 0) {
+        ret = -ENOSPC;
+    }
+
+    free(job.host_buffer);
+    free(job.fs_buffer);
+    return ret;
+}
@@ -16,9 +16,11 @@
 #include <stdint.h>
 #include <time.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "zealfs_v2.h"
 
 #define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+#define MAX(a,b)    (((a) > (b)) ? (a) : (b))
 /**
  * Macro to help converting a page number into an address in the cache.
  */
@@ -26,6 +28,14 @@
 
 #define ALIGN_UP(size,bound) (((size) + (bound) - 1) & ~((bound) - 1))
 
+#define DIM(arr)    (sizeof(arr) / sizeof(*(arr)))
+
+/* Size of the first read when loading the header, a sector holds the bitmap of up to 3840 pages */
+#define ZFS_HEADER_FIRST_READ   512
+/* Largest part of the root directory that is read along the bitmap and the FAT to save an operation,
+ * slow readers transfer about that much in the time of one operation */
+#define ZFS_HEADER_MAX_GAP      (16*KB)
+
 
 typedef struct {
     uint16_t       last_dir_page;        /* Last page of the last directory reached */
@@ -58,34 +68,177 @@ static inline int get_page_size(const zealfs_header_t* header)
 }
 
 
-static inline int check_header(zealfs_context_t* ctx) {
-    /* Initialize the header if it is not initialized yet */
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    if (header->magic == 0) {
-        /* In theory, we should read the header in two times:
-         * - First time to get the bitmap size
-         * - Second time to read the bitmap
-         * Keep it simple and read the potential maximum */
-        int err = ctx->read(ctx->arg, ctx->header, 0, sizeof(ctx->header));
-        if (err < 0) {
-            printf("[ZEALFS] Could not read header: %s\n", strerror(errno));
-            return err;
+/**
+ * @brief Get the size of the metadata described by a header.
+ *
+ * @return 0 on success, -EINVAL if the header can't be the one of a ZealFS partition.
+ */
+static int get_metadata_sizes(const zealfs_header_t* header, size_t* header_size, size_t* fat_size)
+{
+    if (header->page_size > 8 || header->bitmap_size == 0 || header->bitmap_size > 8192) {
+        return -EINVAL;
+    }
+    const uint32_t page_size = get_page_size(header);
+    *header_size = get_fs_header_size(header);
+    /* The FAT starts at the first page of the disk, its size is one page (when 256 bytes) else, two pages */
+    *fat_size = (page_size == 256) ? page_size : 2 * page_size;
+    /* The FAT must have an entry for each page of the bitmap */
+    const uint32_t fat_entries = (page_size == 256) ? *fat_size : *fat_size / 2;
+    if ((uint32_t) header->bitmap_size * 8 > fat_entries) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+
+static void zealfs_destroy_locked(zealfs_context_t* ctx);
+static void zealfs_dir_iter_rewind_locked(zealfs_context_t* ctx, zealfs_dir_iter_t* iter);
+
+
+/**
+ * @brief Allocate the metadata of the context as a single block: the header, the FAT and, when the
+ * context can discard pages, the bitmap of the pages to discard. Previous metadata are released.
+ */
+static int alloc_metadata(zealfs_context_t* ctx, size_t header_size, size_t fat_size, uint16_t bitmap_size)
+{
+    const size_t discard_size = (ctx->discard != NULL) ? bitmap_size : 0;
+    /* The header size is a multiple of 32 bytes, so the FAT that follows it is aligned */
+    uint8_t* block = calloc(1, header_size + fat_size + discard_size);
+    if (block == NULL) {
+        return -ENOMEM;
+    }
+    zealfs_destroy_locked(ctx);
+    ctx->header = block;
+    ctx->header_size = header_size;
+    ctx->fat = (uint16_t*) (block + header_size);
+    ctx->fat_size = fat_size;
+    ctx->discard_pending = discard_size ? block + header_size + fat_size : NULL;
+    return 0;
+}
+
+
+/**
+ * @brief Load the header, its bitmap and the FAT in two steps: the first sector holds the fixed
+ * header and the whole bitmap of small partitions, bigger bitmaps are read with the FAT afterwards.
+ */
+static int load_header(zealfs_context_t* ctx)
+{
+    uint8_t first[ZFS_HEADER_FIRST_READ];
+    const zealfs_header_t* header = (const zealfs_header_t*) first;
+    size_t header_size;
+    size_t fat_size;
+
+    int err = ctx->read(ctx->arg, first, 0, sizeof(first));
+    if (err < 0) {
+        printf("[ZEALFS] Could not read header: %s\n", strerror(errno));
+        return err;
+    }
+    err = get_metadata_sizes(header, &header_size, &fat_size);
+    if (err == 0) {
+        err = alloc_metadata(ctx, header_size, fat_size, header->bitmap_size);
+    }
+    if (err) {
+        printf("[ZEALFS] Could not load header: %s\n", strerror(-err));
+        return err;
+    }
+
+    const uint32_t page_size = get_page_size(header);
+    memcpy(ctx->header, first, MIN(header_size, sizeof(first)));
+    if (header_size <= sizeof(first)) {
+        if (page_size + fat_size <= sizeof(first)) {
+            /* Partitions of 256-byte pages are small enough to have their FAT in the first read */
+            memcpy(ctx->fat, first + page_size, fat_size);
+            return 0;
         }
-        ctx->header_size = get_fs_header_size(header);
-        /* Read the FAT table, that starts at the first page of the disk, its size is one page (when 256 bytes)
-         * else, two pages */
-        const off_t page_size = get_page_size(header);
-        ctx->fat_size = (page_size == 256) ? page_size : 2 * page_size;
-        err = ctx->read(ctx->arg, ctx->fat, page_size, ctx->fat_size);
-        if (err < 0) {
-            printf("[ZEALFS] Could not read FAT: %s\n", strerror(errno));
+        err = ctx->read(ctx->arg, ctx->fat, page_size, fat_size);
+    } else {
+        const uint32_t rest = header_size - sizeof(first);
+        const uint32_t gap = page_size - header_size;
+        if (ctx->readv != NULL && gap <= ZFS_HEADER_MAX_GAP) {
+            /* The root entries between the bitmap and the FAT are cheaper to read than another operation */
+            uint8_t root_entries[ZFS_HEADER_MAX_GAP];
+            const zealfs_iovec_t iov[] = {
+                { .base = ctx->header + sizeof(first), .len = rest },
+                { .base = root_entries, .len = gap },
+                { .base = ctx->fat, .len = fat_size },
+            };
+            err = ctx->readv(ctx->arg, iov, DIM(iov), sizeof(first));
+        } else {
+            err = ctx->read(ctx->arg, ctx->header + sizeof(first), sizeof(first), rest);
+            if (err >= 0) {
+                err = ctx->read(ctx->arg, ctx->fat, page_size, fat_size);
+            }
+        }
+    }
+    if (err < 0) {
+        printf("[ZEALFS] Could not read bitmap and FAT: %s\n", strerror(errno));
+        zealfs_destroy_locked(ctx);
+        return err;
+    }
+    return 0;
+}
+
+
+static inline int check_header(zealfs_context_t* ctx) {
+    /* Load the metadata if they are not loaded yet */
+    if (ctx->header == NULL) {
+        return load_header(ctx);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Lock the context for an operation that only reads the metadata, several of them can hold
+ * the lock at once. The metadata are loaded first if needed, which requires the exclusive lock.
+ *
+ * @return 0 when the lock is held, negative error code if the metadata couldn't be loaded.
+ */
+static int lock_shared(zealfs_context_t* ctx)
+{
+    pthread_rwlock_rdlock(&ctx->lock);
+    /* Metadata may be released by another thread between the two locks, check them again */
+    while (ctx->header == NULL) {
+        pthread_rwlock_unlock(&ctx->lock);
+        pthread_rwlock_wrlock(&ctx->lock);
+        const int err = check_header(ctx);
+        pthread_rwlock_unlock(&ctx->lock);
+        if (err) {
             return err;
         }
+        pthread_rwlock_rdlock(&ctx->lock);
     }
     return 0;
 }
 
 
+/**
+ * @brief Lock the context for an operation that modifies the metadata, or that may load them.
+ */
+static inline void lock_exclusive(zealfs_context_t* ctx)
+{
+    pthread_rwlock_wrlock(&ctx->lock);
+}
+
+
+static inline void unlock(zealfs_context_t* ctx)
+{
+    pthread_rwlock_unlock(&ctx->lock);
+}
+
+
+/**
+ * @brief Read directory entries, through the dedicated callback when the context has one.
+ */
+static inline int read_entries(zealfs_context_t* ctx, void* entries, uint32_t addr, size_t len)
+{
+    if (ctx->read_dir != NULL) {
+        return ctx->read_dir(ctx->arg, entries, addr, len);
+    }
+    return ctx->read(ctx->arg, entries, addr, len);
+}
+
+
 /**
  * Helper to get a pointer to the root directory entries
  */
@@ -130,6 +283,9 @@ static inline uint8_t to_bcd(int value) {
  */
 static inline void free_page(zealfs_header_t* header, uint16_t page) {
     assert(page != 0);
+    if (page >= header->bitmap_size * 8U) {
+        return;
+    }
     header->pages_bitmap[page / 8] &= ~(1 << (page % 8));
     header->free_pages++;
 }
@@ -141,7 +297,11 @@ static inline void free_page(zealfs_header_t* header, uint16_t page) {
 static uint16_t get_next_from_fat(zealfs_context_t* ctx, uint16_t current_page)
 {
     const zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    assert(header->magic != 0);
+    assert(header != NULL);
+    if (current_page >= header->bitmap_size * 8U) {
+        /* Corrupted chain, the FAT only has an entry for each page of the bitmap */
+        return 0;
+    }
     if (header->page_size == 0) {
         /* 256-byte pages */
         return ((uint8_t*) ctx->fat)[current_page];
@@ -157,7 +317,10 @@ static uint16_t get_next_from_fat(zealfs_context_t* ctx, uint16_t current_page)
 static void set_next_in_fat(zealfs_context_t* ctx, uint16_t current_page, uint16_t next_page)
 {
     const zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    assert(header->magic != 0);
+    assert(header != NULL);
+    if (current_page >= header->bitmap_size * 8U) {
+        return;
+    }
     if (header->page_size == 0) {
         /* 256-byte pages */
         ((uint8_t*) ctx->fat)[current_page] = next_page;
@@ -167,6 +330,22 @@ static void set_next_in_fat(zealfs_context_t* ctx, uint16_t current_page, uint16
 }
 
 
+/**
+ * @brief Remember a freed page so that it is discarded on the next `zealfs_discard_flush`, if the
+ * context supports discarding.
+ */
+static inline void discard_mark(zealfs_context_t* ctx, uint16_t page)
+{
+    const zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    if (ctx->discard_pending != NULL && page < header->bitmap_size * 8U &&
+        (ctx->discard_pending[page / 8] & (1 << (page % 8))) == 0)
+    {
+        ctx->discard_pending[page / 8] |= 1 << (page % 8);
+        ctx->discard_count++;
+    }
+}
+
+
 /**
  * @brief Allocate one page in the given header's bitmap.
  *
@@ -203,23 +382,49 @@ static uint_fast16_t allocate_page(zealfs_header_t* header) {
     return i * 8 + index_0;
 }
 
-uint32_t zealfs_free_space(zealfs_context_t* ctx)
+static uint32_t zealfs_free_space_locked(zealfs_context_t* ctx)
 {
+    if (check_header(ctx)) {
+        return 0;
+    }
     zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    assert (check_header(ctx) == 0);
     return header->free_pages * get_page_size(header);
 }
 
 
-uint32_t zealfs_total_space(zealfs_context_t* ctx)
+uint32_t zealfs_free_space(zealfs_context_t* ctx)
+{
+    if (lock_shared(ctx)) {
+        return 0;
+    }
+    const uint32_t space = zealfs_free_space_locked(ctx);
+    unlock(ctx);
+    return space;
+}
+
+
+static uint32_t zealfs_total_space_locked(zealfs_context_t* ctx)
 {
+    if (check_header(ctx)) {
+        return 0;
+    }
     zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    assert (check_header(ctx) == 0);
     const uint32_t pages_count = (uint32_t) header->bitmap_size * 8U;
     return pages_count * get_page_size(header);
 }
 
 
+uint32_t zealfs_total_space(zealfs_context_t* ctx)
+{
+    if (lock_shared(ctx)) {
+        return 0;
+    }
+    const uint32_t space = zealfs_total_space_locked(ctx);
+    unlock(ctx);
+    return space;
+}
+
+
 /**
  * @brief Function that goes through the absolute path given as a parameter and verifies
  *        that each sub-directory does exist in the disk image.
@@ -271,7 +476,7 @@ static int browse_path(zealfs_context_t* ctx, const char * path,
 
     while (1) {
         /* Read all the entries from disk */
-        int rd = ctx->read(ctx->arg, (void*) entries, entries_addr, max_entries * sizeof(zealfs_entry_t));
+        int rd = read_entries(ctx, (void*) entries, entries_addr, max_entries * sizeof(zealfs_entry_t));
         if (rd < 0) {
             printf("[ZEALFS] Could not read data from partition: %s\n", strerror(errno));
             return rd;
@@ -323,14 +528,14 @@ static int browse_path(zealfs_context_t* ctx, const char * path,
 /**
  * @brief Open the file or directory given as a parameter.
  */
-int zealfs_open(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
+static int zealfs_open_locked(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
     browse_out_t info;
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (check_header(ctx)) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (strcmp(path, "/") == 0) {
         return -EISDIR;
@@ -352,16 +557,27 @@ int zealfs_open(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 }
 
 
+int zealfs_open(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
+{
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_open_locked(path, ctx, fd);
+        unlock(ctx);
+    }
+    return ret;
+}
+
+
 /**
  * @brief Remove a file (and only a file!) from the disk image.
  */
-int zealfs_unlink(const char* path, zealfs_context_t* ctx)
+static int zealfs_unlink_locked(const char* path, zealfs_context_t* ctx)
 {
     browse_out_t info;
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (check_header(ctx)) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     int index = browse_path(ctx, path + 1, get_root_dir_addr(header), 1, &info);
     if (index == 0) {
@@ -373,12 +589,12 @@ int zealfs_unlink(const char* path, zealfs_context_t* ctx)
 
     assert(info.entry_addr != 0);
 
-    uint16_t page = info.entry.start_page;
+    /* Keep the chain in the FAT for now, it is needed to discard the pages */
+    const uint16_t start_page = info.entry.start_page;
+    uint16_t page = start_page;
     while (page != 0) {
         free_page(header, page);
-        const uint16_t next = get_next_from_fat(ctx, page);
-        set_next_in_fat(ctx, page, 0);
-        page = next;
+        page = get_next_from_fat(ctx, page);
     }
     /* Clear the flags of the file entry */
     memset(&info.entry, 0, sizeof(zealfs_entry_t));
@@ -398,6 +614,15 @@ int zealfs_unlink(const char* path, zealfs_context_t* ctx)
         return wr;
     }
 
+    /* The entry and the bitmap are on the disk, the pages content can be discarded on the next flush */
+    page = start_page;
+    while (page != 0) {
+        discard_mark(ctx, page);
+        const uint16_t next = get_next_from_fat(ctx, page);
+        set_next_in_fat(ctx, page, 0);
+        page = next;
+    }
+
     /* Update the FAT table and write it back to the disk */
     wr = ctx->write(ctx->arg, ctx->fat, page_size, ctx->fat_size);
     if (wr < 0) {
@@ -409,6 +634,15 @@ int zealfs_unlink(const char* path, zealfs_context_t* ctx)
 }
 
 
+int zealfs_unlink(const char* path, zealfs_context_t* ctx)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_unlink_locked(path, ctx);
+    unlock(ctx);
+    return ret;
+}
+
+
 #if 0
 /**
  * @brief Rename an entry, file or directory, in the disk image.
@@ -483,15 +717,15 @@ static int zealfs_rename(const char* from, const char* to, unsigned int flags)
 /**
  * @brief Remove an empty directory from the disk image.
  */
-int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
+static int zealfs_rmdir_locked(const char* path, zealfs_context_t* ctx)
 {
     browse_out_t info;
     zealfs_entry_t entries[2048];
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (check_header(ctx)) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (strcmp(path, "/") == 0) {
         return -EACCES;
@@ -505,12 +739,13 @@ int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
         return -ENOTDIR;
     }
 
-    uint16_t current_page = info.entry.start_page;
+    const uint16_t start_page = info.entry.start_page;
+    uint16_t current_page = start_page;
     const int max_entries = get_dir_max_entries(header);
 
     while (current_page != 0) {
         const uint32_t page_addr = ADDR_FROM_PAGE(header, current_page);
-        int rd = ctx->read(ctx->arg, (void*) entries, page_addr, max_entries * sizeof(zealfs_entry_t));
+        int rd = read_entries(ctx, (void*) entries, page_addr, max_entries * sizeof(zealfs_entry_t));
         if (rd < 0) {
             printf("[ZEALFS] Could not read directory entries: %s\n", strerror(errno));
             return rd;
@@ -522,10 +757,9 @@ int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
             }
         }
 
-        uint16_t next_page = get_next_from_fat(ctx, current_page);
+        /* Keep the chain in the FAT for now, it is needed to discard the pages */
         free_page(header, current_page);
-        set_next_in_fat(ctx, current_page, 0);
-        current_page = next_page;
+        current_page = get_next_from_fat(ctx, current_page);
     }
 
     /* Clear the directory entry */
@@ -544,6 +778,15 @@ int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
         return wr;
     }
 
+    /* The entry and the bitmap are on the disk, the pages content can be discarded on the next flush */
+    current_page = start_page;
+    while (current_page != 0) {
+        discard_mark(ctx, current_page);
+        const uint16_t next_page = get_next_from_fat(ctx, current_page);
+        set_next_in_fat(ctx, current_page, 0);
+        current_page = next_page;
+    }
+
     /* Update the FAT table and write it back to the disk */
     wr = ctx->write(ctx->arg, ctx->fat, page_size, ctx->fat_size);
     if (wr < 0) {
@@ -555,6 +798,15 @@ int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
 }
 
 
+int zealfs_rmdir(const char* path, zealfs_context_t* ctx)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_rmdir_locked(path, ctx);
+    unlock(ctx);
+    return ret;
+}
+
+
 /**
  * @brief Private function used to create either a directory of a file in the disk image.
  *
@@ -573,10 +825,10 @@ static int zealfs_create_both(zealfs_context_t* ctx, int isdir, const char * pat
     uint_fast16_t new_page_dir = 0;
     int err;
 
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (check_header(ctx)) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     /* Make a backup of the header in case we fail to write to disk */
     zealfs_header_t header_backup = *header;
@@ -625,18 +877,7 @@ static int zealfs_create_both(zealfs_context_t* ctx, int isdir, const char * pat
     memcpy(&entry.name, filename, len);
     entry.size = isdir ? get_page_size(header) : 0;
     /* Set the date in the structure */
-    time_t rawtime;
-    time(&rawtime);
-    struct tm* timest = localtime(&rawtime);
-    /* Got the time, populate it in the structure */
-    entry.year[0] = to_bcd((1900 + timest->tm_year) / 100);   /* 20 first */
-    entry.year[1] = to_bcd(timest->tm_year);         /* 22 then */
-    entry.month = to_bcd(timest->tm_mon + 1);
-    entry.day = to_bcd(timest->tm_mday);
-    entry.date = to_bcd(timest->tm_wday);
-    entry.hours = to_bcd(timest->tm_hour);
-    entry.minutes = to_bcd(timest->tm_min);
-    entry.seconds = to_bcd(timest->tm_sec);
+    zealfs_entry_set_date(&entry, time(NULL));
 
     if (fd) {
         fd->entry = entry;
@@ -688,6 +929,21 @@ write_error :
 }
 
 
+void zealfs_entry_set_date(zealfs_entry_t* entry, time_t date)
+{
+    struct tm* timest = localtime(&date);
+    /* Got the time, populate it in the structure */
+    entry->year[0] = to_bcd((1900 + timest->tm_year) / 100);   /* 20 first */
+    entry->year[1] = to_bcd(timest->tm_year);         /* 22 then */
+    entry->month = to_bcd(timest->tm_mon + 1);
+    entry->day = to_bcd(timest->tm_mday);
+    entry->date = to_bcd(timest->tm_wday);
+    entry->hours = to_bcd(timest->tm_hour);
+    entry->minutes = to_bcd(timest->tm_min);
+    entry->seconds = to_bcd(timest->tm_sec);
+}
+
+
 /**
  * @brief Create an empty file in the disk image.
  *
@@ -695,7 +951,10 @@ write_error :
  */
 int zealfs_create(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
-    return zealfs_create_both(ctx, 0, path, fd);
+    lock_exclusive(ctx);
+    const int ret = zealfs_create_both(ctx, 0, path, fd);
+    unlock(ctx);
+    return ret;
 }
 
 
@@ -706,7 +965,10 @@ int zealfs_create(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
  */
 int zealfs_mkdir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
-    return zealfs_create_both(ctx, 1, path, fd);
+    lock_exclusive(ctx);
+    const int ret = zealfs_create_both(ctx, 1, path, fd);
+    unlock(ctx);
+    return ret;
 }
 
 
@@ -721,13 +983,13 @@ int zealfs_mkdir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
  *
  * @return number of bytes read from the file.
  */
-int zealfs_read(zealfs_context_t* ctx, zealfs_fd_t* fd,
-                void *buf, size_t size, off_t offset)
+static int zealfs_read_locked(zealfs_context_t* ctx, zealfs_fd_t* fd,
+                              void *buf, size_t size, off_t offset)
 {
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (check_header(ctx) || fd == NULL) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (size == 0) {
         return 0;
     }
@@ -753,9 +1015,21 @@ int zealfs_read(zealfs_context_t* ctx, zealfs_fd_t* fd,
     uint32_t page_addr = ADDR_FROM_PAGE(header, current_page);
 
     while (size) {
-        int count = MIN(data_bytes_per_page - offset_in_page, size);
+        size_t count = MIN(data_bytes_per_page - offset_in_page, size);
+        /* Extend the read with the pages that follow the current one on the disk, so that
+         * contiguous parts of the file are read in a single request */
+        while (count < size) {
+            const uint_fast16_t next_page = get_next_from_fat(ctx, current_page);
+            if (next_page != current_page + 1) {
+                break;
+            }
+            current_page = next_page;
+            count += MIN(data_bytes_per_page, size - count);
+        }
         /* Read data from disk */
-        ctx->read(ctx->arg, buf, page_addr + offset_in_page, count);
+        if (ctx->read(ctx->arg, buf, page_addr + offset_in_page, count) < 0) {
+            return -EIO;
+        }
         buf += count;
         if (size != count) {
             current_page = get_next_from_fat(ctx, current_page);
@@ -769,6 +1043,18 @@ int zealfs_read(zealfs_context_t* ctx, zealfs_fd_t* fd,
 }
 
 
+int zealfs_read(zealfs_context_t* ctx, zealfs_fd_t* fd,
+                void *buf, size_t size, off_t offset)
+{
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_read_locked(ctx, fd, buf, size, offset);
+        unlock(ctx);
+    }
+    return ret;
+}
+
+
 static int allocate_next(zealfs_context_t* ctx, zealfs_header_t* header, uint_fast16_t current_page)
 {
     /* Only allocate a new page if we still need to write some bytes */
@@ -784,13 +1070,13 @@ static int allocate_next(zealfs_context_t* ctx, zealfs_header_t* header, uint_fa
 }
 
 
-int zealfs_write(zealfs_context_t* ctx, zealfs_fd_t* fd,
-                 void *buf, size_t size, off_t offset)
+static int zealfs_write_locked(zealfs_context_t* ctx, zealfs_fd_t* fd,
+                               void *buf, size_t size, off_t offset)
 {
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (check_header(ctx) || fd == NULL) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (size == 0) {
         return 0;
@@ -804,7 +1090,7 @@ int zealfs_write(zealfs_context_t* ctx, zealfs_fd_t* fd,
     const int total = size;
 
     /* Check if we have enough pages. */
-    if (zealfs_free_space(ctx) + remaining_in_page < size) {
+    if (zealfs_free_space_locked(ctx) + remaining_in_page < size) {
         return -ENOSPC;
     }
 
@@ -863,12 +1149,22 @@ int zealfs_write(zealfs_context_t* ctx, zealfs_fd_t* fd,
 }
 
 
-int zealfs_flush(zealfs_context_t* ctx, zealfs_fd_t* fd)
+int zealfs_write(zealfs_context_t* ctx, zealfs_fd_t* fd,
+                 void *buf, size_t size, off_t offset)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_write_locked(ctx, fd, buf, size, offset);
+    unlock(ctx);
+    return ret;
+}
+
+
+static int zealfs_flush_locked(zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     if (check_header(ctx) || fd == NULL) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     /* Write the updated entry back to the disk */
     int wr = ctx->write(ctx->arg, &fd->entry, fd->entry_addr, sizeof(zealfs_entry_t));
@@ -895,6 +1191,15 @@ int zealfs_flush(zealfs_context_t* ctx, zealfs_fd_t* fd)
 }
 
 
+int zealfs_flush(zealfs_context_t* ctx, zealfs_fd_t* fd)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_flush_locked(ctx, fd);
+    unlock(ctx);
+    return ret;
+}
+
+
 /**
  * @brief Open a directory from the disk image.
  *
@@ -903,13 +1208,13 @@ int zealfs_flush(zealfs_context_t* ctx, zealfs_fd_t* fd)
  *
  * @return 0 on success, error code else.
  */
-int zealfs_opendir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
+static int zealfs_opendir_locked(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
     browse_out_t info = { 0 };
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
-    if (check_header(ctx) == -1 || fd == NULL) {
+    if (check_header(ctx) || fd == NULL) {
         return -1;
     }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
 
     if (strcmp(path, "/") == 0) {
         fd->entry = info.entry;
@@ -931,63 +1236,935 @@ int zealfs_opendir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 }
 
 
-/**
- * @brief Read all entries from an opened directory.
- */
-int zealfs_readdir(zealfs_context_t* ctx, zealfs_fd_t* fd, zealfs_entry_t* ret_entries, int count)
+int zealfs_opendir(const char * path, zealfs_context_t* ctx, zealfs_fd_t* fd)
 {
-    zealfs_entry_t entries[2048];
-    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_opendir_locked(path, ctx, fd);
+        unlock(ctx);
+    }
+    return ret;
+}
 
-    if (check_header(ctx) || fd == NULL) {
-        return -1;
+
+/* Number of entries read from the disk at once when iterating over a directory */
+#define DIR_ITER_CHUNK_ENTRIES  64
+
+
+static int zealfs_dir_iter_init_locked(zealfs_context_t* ctx, const zealfs_fd_t* fd, zealfs_dir_iter_t* iter)
+{
+    if (check_header(ctx) || fd == NULL || iter == NULL) {
+        return -EINVAL;
+    }
+
+    iter->dir_addr = fd->entry_addr;
+    zealfs_dir_iter_rewind_locked(ctx, iter);
+    return 0;
+}
+
+
+int zealfs_dir_iter_init(zealfs_context_t* ctx, const zealfs_fd_t* fd, zealfs_dir_iter_t* iter)
+{
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_dir_iter_init_locked(ctx, fd, iter);
+        unlock(ctx);
     }
+    return ret;
+}
+
 
-    const int is_root = fd->entry_addr == get_root_dir_addr(header);
+static void zealfs_dir_iter_rewind_locked(zealfs_context_t* ctx, zealfs_dir_iter_t* iter)
+{
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    const int is_root = iter->dir_addr == get_root_dir_addr(header);
+
+    iter->page = iter->dir_addr / get_page_size(header);
+    iter->page_addr = iter->dir_addr;
+    iter->slot = 0;
     /* If the directory we are browsing is the root directory, we have less entries */
-    int max_entries = is_root ? get_root_dir_max_entries(header) :
-                                get_dir_max_entries(header);
+    iter->slots = is_root ? get_root_dir_max_entries(header) : get_dir_max_entries(header);
+    iter->done = 0;
+}
+
+
+void zealfs_dir_iter_rewind(zealfs_context_t* ctx, zealfs_dir_iter_t* iter)
+{
+    if (lock_shared(ctx) == 0) {
+        zealfs_dir_iter_rewind_locked(ctx, iter);
+        unlock(ctx);
+    }
+}
+
+
+static int zealfs_dir_iter_next_locked(zealfs_context_t* ctx, zealfs_dir_iter_t* iter, zealfs_entry_t* ret_entries, int count)
+{
+    zealfs_entry_t entries[DIR_ITER_CHUNK_ENTRIES];
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
     int filled_count = 0;
-    uint16_t current_page = fd->entry_addr / get_page_size(header);
-    uint32_t current_addr = fd->entry_addr;
 
-    while (1) {
-        /* Read all the entries from disk */
-        int rd = ctx->read(ctx->arg, (void*) entries, current_addr, max_entries * sizeof(zealfs_entry_t));
+    while (!iter->done && filled_count < count) {
+        /* Only read the remaining slots of the current page, chunk by chunk */
+        const int chunk = MIN(iter->slots - iter->slot, DIR_ITER_CHUNK_ENTRIES);
+        const uint32_t chunk_addr = iter->page_addr + iter->slot * sizeof(zealfs_entry_t);
+        int rd = read_entries(ctx, (void*) entries, chunk_addr, chunk * sizeof(zealfs_entry_t));
         if (rd < 0) {
             printf("[ZEALFS] Could not readdir data from partition: %s\n", strerror(errno));
-            return 0;
+            return -EIO;
         }
 
-        /* Browse each entry, looking for a non-empty one thanks to the flags */
-        for (int i = 0; i < max_entries && filled_count < count; i++) {
-            const uint8_t flags = entries[i].flags;
-            if (flags & IS_OCCUPIED) {
-                ret_entries[filled_count] = entries[i];
-                filled_count++;
+        /* Browse each entry, looking for a non-empty one thanks to the flags. If the caller's
+         * array gets full, the next call resumes right after the last returned entry. */
+        int i;
+        for (i = 0; i < chunk && filled_count < count; i++) {
+            if (entries[i].flags & IS_OCCUPIED) {
+                ret_entries[filled_count++] = entries[i];
             }
         }
-
-        /* Check if we have filled the requested count */
-        if (filled_count >= count) {
-            break;
-        }
-
-        max_entries = get_dir_max_entries(header);
-        /* Get the next page of the directory */
-        current_page = get_next_from_fat(ctx, current_page);
-        if (current_page == 0) {
-            break;
+        iter->slot += i;
+
+        if (iter->slot == iter->slots) {
+            /* Get the next page of the directory */
+            iter->page = get_next_from_fat(ctx, iter->page);
+            if (iter->page == 0) {
+                iter->done = 1;
+                break;
+            }
+            iter->page_addr = ADDR_FROM_PAGE(header, iter->page);
+            iter->slot = 0;
+            iter->slots = get_dir_max_entries(header);
         }
-        current_addr = ADDR_FROM_PAGE(header, current_page);
     }
 
     return filled_count;
 }
 
 
-void zealfs_destroy(zealfs_context_t* ctx)
+int zealfs_dir_iter_next(zealfs_context_t* ctx, zealfs_dir_iter_t* iter, zealfs_entry_t* ret_entries, int count)
+{
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_dir_iter_next_locked(ctx, iter, ret_entries, count);
+        unlock(ctx);
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Read the first entries from an opened directory.
+ */
+static int zealfs_readdir_locked(zealfs_context_t* ctx, zealfs_fd_t* fd, zealfs_entry_t* ret_entries, int count)
+{
+    zealfs_dir_iter_t iter;
+
+    int ret = zealfs_dir_iter_init_locked(ctx, fd, &iter);
+    if (ret) {
+        return ret;
+    }
+    return zealfs_dir_iter_next_locked(ctx, &iter, ret_entries, count);
+}
+
+
+int zealfs_readdir(zealfs_context_t* ctx, zealfs_fd_t* fd, zealfs_entry_t* ret_entries, int count)
+{
+    int ret = lock_shared(ctx);
+    if (ret == 0) {
+        ret = zealfs_readdir_locked(ctx, fd, ret_entries, count);
+        unlock(ctx);
+    }
+    return ret;
+}
+
+
+zealfs_context_t* zealfs_context_create(ssize_t (*read) (void* arg, void* buffer, uint32_t addr, size_t len),
+                                        ssize_t (*write)(void* arg, const void* buffer, uint32_t addr, size_t len),
+                                        void* arg)
+{
+    zealfs_context_t* ctx = calloc(1, sizeof(zealfs_context_t));
+    if (ctx != NULL) {
+        ctx->read = read;
+        ctx->write = write;
+        ctx->arg = arg;
+        pthread_rwlock_init(&ctx->lock, NULL);
+    }
+    return ctx;
+}
+
+
+void zealfs_context_destroy(zealfs_context_t* ctx)
+{
+    if (ctx != NULL) {
+        zealfs_destroy_locked(ctx);
+        pthread_rwlock_destroy(&ctx->lock);
+        free(ctx);
+    }
+}
+
+
+static void zealfs_destroy_locked(zealfs_context_t* ctx)
+{
+    /* Release the metadata previously loaded, they are all part of the same block */
+    free(ctx->header);
+    ctx->header = NULL;
+    ctx->header_size = 0;
+    ctx->fat = NULL;
+    ctx->fat_size = 0;
+    ctx->discard_pending = NULL;
+    ctx->discard_count = 0;
+}
+
+
+void zealfs_destroy(zealfs_context_t* ctx)
+{
+    lock_exclusive(ctx);
+    zealfs_destroy_locked(ctx);
+    unlock(ctx);
+}
+
+
+static int zealfs_set_metadata_locked(zealfs_context_t* ctx, const void* header, size_t header_size,
+                                      const void* fat, size_t fat_size)
+{
+    const zealfs_header_t* copy = (const zealfs_header_t*) header;
+    size_t expected_header_size;
+    size_t expected_fat_size;
+
+    if (header_size < sizeof(zealfs_header_t) ||
+        get_metadata_sizes(copy, &expected_header_size, &expected_fat_size) != 0 ||
+        header_size != expected_header_size || fat_size != expected_fat_size)
+    {
+        return -EINVAL;
+    }
+    const int err = alloc_metadata(ctx, header_size, fat_size, copy->bitmap_size);
+    if (err) {
+        return err;
+    }
+    memcpy(ctx->header, header, header_size);
+    memcpy(ctx->fat, fat, fat_size);
+    return 0;
+}
+
+
+int zealfs_set_metadata(zealfs_context_t* ctx, const void* header, size_t header_size,
+                        const void* fat, size_t fat_size)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_set_metadata_locked(ctx, header, header_size, fat, fat_size);
+    unlock(ctx);
+    return ret;
+}
+
+
+static int zealfs_discard_flush_locked(zealfs_context_t* ctx)
+{
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    int runs = 0;
+
+    if (ctx->discard == NULL || ctx->discard_pending == NULL || ctx->discard_count == 0) {
+        return 0;
+    }
+
+    /* Browse the pending pages in order so that pages freed by different operations are merged.
+     * Pages that were allocated again since they were freed are skipped. */
+    const uint32_t bits = header->bitmap_size * 8;
+    const uint32_t page_size = get_page_size(header);
+    uint32_t page = 1;
+    while (page < bits) {
+        if ((ctx->discard_pending[page / 8] & (1 << (page % 8))) == 0 ||
+            (header->pages_bitmap[page / 8] & (1 << (page % 8))) != 0)
+        {
+            page++;
+            continue;
+        }
+        const uint32_t first = page;
+        while (page < bits && (ctx->discard_pending[page / 8] & (1 << (page % 8))) != 0 &&
+               (header->pages_bitmap[page / 8] & (1 << (page % 8))) == 0)
+        {
+            page++;
+        }
+        /* Discarding is only a hint, errors are ignored */
+        ctx->discard(ctx->arg, ADDR_FROM_PAGE(header, first), (size_t) (page - first) * page_size);
+        runs++;
+    }
+
+    memset(ctx->discard_pending, 0, header->bitmap_size);
+    ctx->discard_count = 0;
+    return runs;
+}
+
+
+int zealfs_discard_flush(zealfs_context_t* ctx)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_discard_flush_locked(ctx);
+    unlock(ctx);
+    return ret;
+}
+
+
+/**
+ * @brief State of a file system check. Each chain gets its own owner identifier, the pages it
+ * goes through are tagged with it, so a page reached twice reveals a cycle (same owner) or a
+ * cross-link (other owner).
+ */
+typedef struct {
+    zealfs_context_t*     ctx;
+    zealfs_fsck_report_t* report;
+    bool                  repair;
+    uint32_t              pages_count;
+    uint32_t              first_data_page;
+    uint32_t*             owner;
+    uint32_t              last_owner;
+    /* Directories left to browse: first page and number of valid pages of each */
+    uint32_t*             dirs;
+    int                   dirs_count;
+    int                   dirs_capacity;
+    uint8_t*              page_buffer;
+} fsck_t;
+
+
+#define FSCK_OWNER_METADATA 1
+
+
+/**
+ * @brief Claim the pages of a chain, starting at `page`. The chain is cut before the first page that
+ * is invalid, already claimed, or beyond `max_pages`.
+ *
+ * @param prev Page pointing to `page` in the FAT, -1 if `page` is the first page of an entry.
+ *
+ * @return Number of pages claimed, 0 if `page` itself could not be claimed.
+ */
+static uint32_t fsck_claim_chain(fsck_t* fsck, int prev, uint_fast16_t page, uint32_t max_pages, bool* size_error)
+{
+    zealfs_fsck_report_t* report = fsck->report;
+    const uint32_t id = ++fsck->last_owner;
+    uint32_t count = 0;
+
+    *size_error = false;
+    while (1) {
+        bool cut = true;
+        if (page < fsck->first_data_page || page >= fsck->pages_count) {
+            report->bad_pointers++;
+        } else if (fsck->owner[page] == id) {
+            report->cycles++;
+        } else if (fsck->owner[page] != 0) {
+            report->cross_links++;
+        } else if (count == max_pages) {
+            *size_error = true;
+        } else {
+            cut = false;
+        }
+
+        if (cut) {
+            if (fsck->repair && prev >= 0) {
+                set_next_in_fat(fsck->ctx, prev, 0);
+            }
+            break;
+        }
+
+        fsck->owner[page] = id;
+        count++;
+        const uint_fast16_t next = get_next_from_fat(fsck->ctx, page);
+        if (next == 0) {
+            break;
+        }
+        prev = page;
+        page = next;
+    }
+
+    return count;
+}
+
+
+static int fsck_push_dir(fsck_t* fsck, uint32_t first_page, uint32_t pages)
+{
+    if (fsck->dirs_count + 2 > fsck->dirs_capacity) {
+        const int capacity = fsck->dirs_capacity ? fsck->dirs_capacity * 2 : 64;
+        uint32_t* dirs = realloc(fsck->dirs, capacity * sizeof(uint32_t));
+        if (dirs == NULL) {
+            return -ENOMEM;
+        }
+        fsck->dirs = dirs;
+        fsck->dirs_capacity = capacity;
+    }
+    fsck->dirs[fsck->dirs_count++] = first_page;
+    fsck->dirs[fsck->dirs_count++] = pages;
+    return 0;
+}
+
+
+/**
+ * @brief Check the entries of one page of a directory, the chains of the entries are claimed and
+ * the sub-directories are pushed to the directories to browse.
+ */
+static int fsck_check_entries(fsck_t* fsck, uint32_t entries_addr, int entries_count)
+{
+    zealfs_context_t* ctx = fsck->ctx;
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    zealfs_fsck_report_t* report = fsck->report;
+    zealfs_entry_t* entries = (zealfs_entry_t*) fsck->page_buffer;
+    const uint32_t page_size = get_page_size(header);
+    bool size_error;
+
+    int rd = read_entries(ctx, entries, entries_addr, entries_count * sizeof(zealfs_entry_t));
+    if (rd < 0) {
+        return rd;
+    }
+
+    for (int i = 0; i < entries_count; i++) {
+        zealfs_entry_t* entry = &entries[i];
+        if ((entry->flags & IS_OCCUPIED) == 0) {
+            continue;
+        }
+        const bool is_dir = entry->flags & IS_DIR;
+        /* An empty file still owns one page */
+        const uint32_t needed = is_dir ? UINT32_MAX : MAX(1, (entry->size + page_size - 1) / page_size);
+        const uint32_t count = fsck_claim_chain(fsck, -1, entry->start_page, needed, &size_error);
+        bool modified = false;
+
+        if (count == 0) {
+            /* Not even the first page is valid, the entry is lost */
+            report->bad_entries++;
+            memset(entry, 0, sizeof(zealfs_entry_t));
+            modified = true;
+        } else if (is_dir) {
+            report->directories++;
+            int err = fsck_push_dir(fsck, entry->start_page, count);
+            if (err) {
+                return err;
+            }
+        } else {
+            report->files++;
+            if (size_error || count < needed) {
+                report->size_errors++;
+            }
+            /* Keep the data of the pages that are still in the chain */
+            if (count < needed) {
+                entry->size = count * page_size;
+                modified = true;
+            }
+        }
+
+        if (modified && fsck->repair) {
+            int wr = ctx->write(ctx->arg, entry, entries_addr + i * sizeof(zealfs_entry_t), sizeof(zealfs_entry_t));
+            if (wr < 0) {
+                return wr;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Compare the bitmap rebuilt from the chains with the one of the header, 64 pages at a time.
+ */
+static void fsck_compare_bitmaps(fsck_t* fsck, uint8_t* expected)
+{
+    zealfs_header_t* header = (zealfs_header_t*) fsck->ctx->header;
+    zealfs_fsck_report_t* report = fsck->report;
+    const uint32_t bits = header->bitmap_size * 8U;
+    uint32_t used = 0;
+
+    for (uint32_t page = 0; page < bits; page++) {
+        /* Pages after the end of the partition are always marked as used */
+        if (page >= fsck->pages_count || fsck->owner[page] != 0) {
+            expected[page / 8] |= 1 << (page % 8);
+        }
+    }
+
+    for (uint32_t i = 0; i < header->bitmap_size; i += 8) {
+        uint64_t exp = 0;
+        uint64_t cur = 0;
+        const uint32_t len = MIN(8U, header->bitmap_size - i);
+        memcpy(&exp, expected + i, len);
+        memcpy(&cur, header->pages_bitmap + i, len);
+        report->lost_pages += __builtin_popcountll(cur & ~exp);
+        report->unmarked_pages += __builtin_popcountll(exp & ~cur);
+        used += __builtin_popcountll(exp);
+    }
+
+    report->expected_free_pages = bits - used;
+    report->free_pages_error = header->free_pages != report->expected_free_pages;
+}
+
+
+static int zealfs_fsck_locked(zealfs_context_t* ctx, uint64_t partition_size, bool repair, zealfs_fsck_report_t* report)
+{
+    uint8_t* expected = NULL;
+    bool size_error;
+    int err;
+
+    memset(report, 0, sizeof(*report));
+    /* Work on the metadata stored on the disk, not on the cached ones */
+    zealfs_discard_flush_locked(ctx);
+    zealfs_destroy_locked(ctx);
+    err = check_header(ctx);
+    if (err) {
+        return (err == -EINVAL) ? err : -EIO;
+    }
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    if (header->magic != 'Z' || header->version != 2 || header->page_size > 8) {
+        return -EINVAL;
+    }
+
+    const uint32_t page_size = get_page_size(header);
+    fsck_t fsck = {
+        .ctx             = ctx,
+        .report          = report,
+        .repair          = repair,
+        .pages_count     = MIN((uint64_t) header->bitmap_size * 8, partition_size / page_size),
+        .first_data_page = 1 + ctx->fat_size / page_size,
+        .last_owner      = FSCK_OWNER_METADATA,
+    };
+    fsck.owner = calloc(header->bitmap_size * 8U, sizeof(uint32_t));
+    fsck.page_buffer = malloc(page_size);
+    expected = calloc(header->bitmap_size, 1);
+    if (fsck.owner == NULL || fsck.page_buffer == NULL || expected == NULL) {
+        err = -ENOMEM;
+        goto end;
+    }
+
+    /* The header and the FAT are always in use */
+    for (uint32_t page = 0; page < fsck.first_data_page; page++) {
+        fsck.owner[page] = FSCK_OWNER_METADATA;
+    }
+
+    /* The root directory starts in the header page, its next pages are chained to page 0 */
+    uint32_t root_pages = 1;
+    const uint_fast16_t root_next = get_next_from_fat(ctx, 0);
+    if (root_next != 0) {
+        root_pages += fsck_claim_chain(&fsck, 0, root_next, UINT32_MAX, &size_error);
+    }
+    err = fsck_check_entries(&fsck, get_root_dir_addr(header), get_root_dir_max_entries(header));
+    for (uint32_t i = 1, page = 0; err == 0 && i < root_pages; i++) {
+        page = get_next_from_fat(ctx, page);
+        err = fsck_check_entries(&fsck, ADDR_FROM_PAGE(header, page), get_dir_max_entries(header));
+    }
+
+    /* Browse the directories depth first, only through the pages that were claimed */
+    while (err == 0 && fsck.dirs_count > 0) {
+        const uint32_t pages = fsck.dirs[--fsck.dirs_count];
+        uint32_t page = fsck.dirs[--fsck.dirs_count];
+        for (uint32_t i = 0; err == 0 && i < pages; i++) {
+            err = fsck_check_entries(&fsck, ADDR_FROM_PAGE(header, page), get_dir_max_entries(header));
+            page = get_next_from_fat(ctx, page);
+        }
+    }
+    if (err) {
+        goto end;
+    }
+
+    fsck_compare_bitmaps(&fsck, expected);
+    report->errors = report->bad_pointers + report->cycles + report->cross_links + report->bad_entries +
+                     report->size_errors + report->lost_pages + report->unmarked_pages + report->free_pages_error;
+
+    if (repair && report->errors != 0) {
+        /* Release the pages that are not owned anymore, allocations expect their FAT entry to be cleared */
+        for (uint32_t page = fsck.first_data_page; page < fsck.pages_count; page++) {
+            if (fsck.owner[page] == 0) {
+                set_next_in_fat(ctx, page, 0);
+            }
+        }
+        memcpy(header->pages_bitmap, expected, header->bitmap_size);
+        header->free_pages = report->expected_free_pages;
+
+        err = ctx->write(ctx->arg, header, 0, ctx->header_size);
+        if (err >= 0) {
+            err = ctx->write(ctx->arg, ctx->fat, page_size, ctx->fat_size);
+        }
+        if (err < 0) {
+            printf("[ZEALFS] Error writing the repaired metadata to the disk: %s\n", strerror(errno));
+            goto end;
+        }
+        err = 0;
+    }
+
+    printf("[ZEALFS] Checked %u files and %u directories, %u errors\n",
+           report->files, report->directories, report->errors);
+end:
+    free(fsck.owner);
+    free(fsck.page_buffer);
+    free(fsck.dirs);
+    free(expected);
+    return err;
+}
+
+
+int zealfs_fsck(zealfs_context_t* ctx, uint64_t partition_size, bool repair, zealfs_fsck_report_t* report)
+{
+    lock_exclusive(ctx);
+    const int ret = zealfs_fsck_locked(ctx, partition_size, repair, report);
+    unlock(ctx);
+    return ret;
+}
+
+
+/**
+ * @brief File to defragment, its entry is rewritten in place once its pages are moved.
+ */
+typedef struct {
+    uint32_t       entry_addr;
+    zealfs_entry_t entry;
+    uint32_t       pages;
+    uint32_t       extents;
+} defrag_file_t;
+
+
+typedef struct {
+    zealfs_context_t* ctx;
+    defrag_file_t*    files;
+    int               files_count;
+    int               files_capacity;
+    uint16_t*         dirs;
+    int               dirs_count;
+    int               dirs_capacity;
+    uint8_t*          buffer;
+} defrag_t;
+
+
+static uint32_t zealfs_chain_extents_locked(zealfs_context_t* ctx, uint16_t start_page, uint32_t* pages)
+{
+    uint_fast16_t page = start_page;
+    uint32_t extents = 1;
+    uint32_t count = 1;
+    uint_fast16_t next;
+
+    while ((next = get_next_from_fat(ctx, page)) != 0) {
+        if (next != page + 1) {
+            extents++;
+        }
+        page = next;
+        /* Don't loop forever on a corrupted FAT */
+        if (++count > 65536) {
+            break;
+        }
+    }
+    if (pages) {
+        *pages = count;
+    }
+    return extents;
+}
+
+
+uint32_t zealfs_chain_extents(zealfs_context_t* ctx, uint16_t start_page, uint32_t* pages)
+{
+    if (lock_shared(ctx)) {
+        return 0;
+    }
+    const uint32_t extents = zealfs_chain_extents_locked(ctx, start_page, pages);
+    unlock(ctx);
+    return extents;
+}
+
+
+static int defrag_collect_entries(defrag_t* defrag, uint32_t entries_addr, int entries_count)
+{
+    zealfs_context_t* ctx = defrag->ctx;
+    zealfs_entry_t* entries = (zealfs_entry_t*) defrag->buffer;
+
+    int rd = read_entries(ctx, entries, entries_addr, entries_count * sizeof(zealfs_entry_t));
+    if (rd < 0) {
+        return rd;
+    }
+
+    for (int i = 0; i < entries_count; i++) {
+        zealfs_entry_t* entry = &entries[i];
+        if ((entry->flags & IS_OCCUPIED) == 0) {
+            continue;
+        }
+
+        if (entry->flags & IS_DIR) {
+            if (defrag->dirs_count == defrag->dirs_capacity) {
+                const int capacity = defrag->dirs_capacity ? defrag->dirs_capacity * 2 : 64;
+                uint16_t* dirs = realloc(defrag->dirs, capacity * sizeof(uint16_t));
+                if (dirs == NULL) {
+                    return -ENOMEM;
+                }
+                defrag->dirs = dirs;
+                defrag->dirs_capacity = capacity;
+            }
+            defrag->dirs[defrag->dirs_count++] = entry->start_page;
+            continue;
+        }
+
+        if (defrag->files_count == defrag->files_capacity) {
+            const int capacity = defrag->files_capacity ? defrag->files_capacity * 2 : 64;
+            defrag_file_t* files = realloc(defrag->files, capacity * sizeof(defrag_file_t));
+            if (files == NULL) {
+                return -ENOMEM;
+            }
+            defrag->files = files;
+            defrag->files_capacity = capacity;
+        }
+        defrag_file_t* file = &defrag->files[defrag->files_count++];
+        file->entry_addr = entries_addr + i * sizeof(zealfs_entry_t);
+        file->entry = *entry;
+        file->extents = zealfs_chain_extents_locked(ctx, entry->start_page, &file->pages);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Gather all the files of the file system, from all the directories.
+ */
+static int defrag_collect_files(defrag_t* defrag)
+{
+    zealfs_context_t* ctx = defrag->ctx;
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+
+    int err = defrag_collect_entries(defrag, get_root_dir_addr(header), get_root_dir_max_entries(header));
+    for (uint_fast16_t page = get_next_from_fat(ctx, 0); err == 0 && page != 0; page = get_next_from_fat(ctx, page)) {
+        err = defrag_collect_entries(defrag, ADDR_FROM_PAGE(header, page), get_dir_max_entries(header));
+    }
+
+    while (err == 0 && defrag->dirs_count > 0) {
+        uint_fast16_t page = defrag->dirs[--defrag->dirs_count];
+        for (; err == 0 && page != 0; page = get_next_from_fat(ctx, page)) {
+            err = defrag_collect_entries(defrag, ADDR_FROM_PAGE(header, page), get_dir_max_entries(header));
+        }
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief Fill the fragmentation score of the given files, in percent: 0 when all the files are
+ * contiguous, 100 when none of their pages follow each other.
+ */
+static void defrag_score(defrag_t* defrag, uint32_t* fragmented, uint32_t* extents, uint32_t* score)
+{
+    uint64_t links = 0;
+    uint64_t breaks = 0;
+
+    *fragmented = 0;
+    *extents = 0;
+    for (int i = 0; i < defrag->files_count; i++) {
+        const defrag_file_t* file = &defrag->files[i];
+        links += file->pages - 1;
+        breaks += file->extents - 1;
+        *extents += file->extents;
+        *fragmented += file->extents > 1;
+    }
+    *score = links ? (uint32_t) (breaks * 100 / links) : 0;
+}
+
+
+/**
+ * @brief Find the smallest run of free pages that can hold `count` pages.
+ *
+ * @return First page of the run, 0 if there is none.
+ */
+static uint_fast16_t defrag_find_run(zealfs_header_t* header, uint32_t count)
+{
+    const uint32_t bits = header->bitmap_size * 8U;
+    uint32_t best = 0;
+    uint32_t best_len = UINT32_MAX;
+    uint32_t page = 0;
+
+    while (page < bits) {
+        if (header->pages_bitmap[page / 8] & (1 << (page % 8))) {
+            page++;
+            continue;
+        }
+        const uint32_t start = page;
+        while (page < bits && (header->pages_bitmap[page / 8] & (1 << (page % 8))) == 0) {
+            page++;
+        }
+        const uint32_t len = page - start;
+        if (len >= count && len < best_len) {
+            best = start;
+            best_len = len;
+            if (len == count) {
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+
+static int defrag_write_metadata(zealfs_context_t* ctx)
+{
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+
+    int wr = ctx->write(ctx->arg, header, 0, ctx->header_size);
+    if (wr < 0) {
+        printf("[ZEALFS] Error writing the header to the disk: %s\n", strerror(errno));
+        return wr;
+    }
+    wr = ctx->write(ctx->arg, ctx->fat, get_page_size(header), ctx->fat_size);
+    if (wr < 0) {
+        printf("[ZEALFS] Error writing the FAT to the disk: %s\n", strerror(errno));
+        return wr;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Move the pages of a file to `dst` and the following pages, which must be free.
+ * The data and the new chain are written first, the entry is then updated to point to the new chain,
+ * the old pages are freed last. If the operation is interrupted, the file stays intact, at worst the
+ * pages of one of the chains are lost until the next check.
+ */
+static int defrag_move_file(defrag_t* defrag, defrag_file_t* file, uint_fast16_t dst)
+{
+    zealfs_context_t* ctx = defrag->ctx;
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    const uint32_t page_size = get_page_size(header);
+    const uint32_t batch_pages = MAX(1, ZEALFS_DEFRAG_BATCH_SIZE / page_size);
+    uint_fast16_t src = file->entry.start_page;
+    int err;
+
+    for (uint32_t i = 0; i < file->pages; i++) {
+        header->pages_bitmap[(dst + i) / 8] |= 1 << ((dst + i) % 8);
+    }
+    header->free_pages -= file->pages;
+
+    /* Copy the data, the source runs are read at once, the destination is written by batches */
+    for (uint32_t done = 0; done < file->pages; ) {
+        const uint32_t count = MIN(batch_pages, file->pages - done);
+        uint32_t filled = 0;
+        while (filled < count) {
+            uint32_t run = 1;
+            uint_fast16_t next = get_next_from_fat(ctx, src);
+            while (filled + run < count && next == src + run) {
+                run++;
+                next = get_next_from_fat(ctx, next);
+            }
+            err = ctx->read(ctx->arg, defrag->buffer + filled * page_size, ADDR_FROM_PAGE(header, src), run * page_size);
+            if (err < 0) {
+                return err;
+            }
+            filled += run;
+            src = next;
+        }
+        err = ctx->write(ctx->arg, defrag->buffer, ADDR_FROM_PAGE(header, dst + done), count * page_size);
+        if (err < 0) {
+            return err;
+        }
+        done += count;
+    }
+
+    for (uint32_t i = 0; i < file->pages; i++) {
+        set_next_in_fat(ctx, dst + i, (i + 1 < file->pages) ? dst + i + 1 : 0);
+    }
+    err = defrag_write_metadata(ctx);
+    if (err) {
+        return err;
+    }
+
+    /* Switch the entry to the new chain */
+    const uint_fast16_t old = file->entry.start_page;
+    file->entry.start_page = dst;
+    err = ctx->write(ctx->arg, &file->entry, file->entry_addr, sizeof(zealfs_entry_t));
+    if (err < 0) {
+        printf("[ZEALFS] Error writing the entry to the disk: %s\n", strerror(errno));
+        return err;
+    }
+
+    for (uint_fast16_t page = old; page != 0; ) {
+        const uint_fast16_t next = get_next_from_fat(ctx, page);
+        set_next_in_fat(ctx, page, 0);
+        free_page(header, page);
+        discard_mark(ctx, page);
+        page = next;
+    }
+    err = defrag_write_metadata(ctx);
+    if (err) {
+        return err;
+    }
+
+    file->extents = 1;
+    return 0;
+}
+
+
+static int defrag_compare_size(const void* a, const void* b)
+{
+    const defrag_file_t* fa = (const defrag_file_t*) a;
+    const defrag_file_t* fb = (const defrag_file_t*) b;
+    return (fa->pages < fb->pages) - (fa->pages > fb->pages);
+}
+
+
+static int zealfs_defrag_locked(zealfs_context_t* ctx, zealfs_defrag_report_t* report)
+{
+    defrag_t defrag = { .ctx = ctx };
+    int err;
+
+    memset(report, 0, sizeof(*report));
+    if (check_header(ctx)) {
+        return -EIO;
+    }
+
+    zealfs_header_t* header = (zealfs_header_t*) ctx->header;
+    const uint32_t page_size = get_page_size(header);
+    defrag.buffer = malloc(MAX(ZEALFS_DEFRAG_BATCH_SIZE, page_size));
+    if (defrag.buffer == NULL) {
+        return -ENOMEM;
+    }
+
+    err = defrag_collect_files(&defrag);
+    if (err) {
+        goto end;
+    }
+    report->files = defrag.files_count;
+    defrag_score(&defrag, &report->fragmented_before, &report->extents_before, &report->score_before);
+
+    /* Place the biggest files first, while the free space is the least fragmented. Moving files
+     * frees their former pages, which can make room for the files that were skipped, so keep
+     * going until a pass doesn't move anything. */
+    qsort(defrag.files, defrag.files_count, sizeof(defrag_file_t), defrag_compare_size);
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (int i = 0; i < defrag.files_count; i++) {
+            defrag_file_t* file = &defrag.files[i];
+            if (file->extents == 1) {
+                continue;
+            }
+            const uint_fast16_t dst = defrag_find_run(header, file->pages);
+            if (dst == 0) {
+                continue;
+            }
+            err = defrag_move_file(&defrag, file, dst);
+            if (err) {
+                goto end;
+            }
+            report->moved_files++;
+            report->moved_pages += file->pages;
+            moved = true;
+        }
+    }
+
+    defrag_score(&defrag, &report->fragmented_after, &report->extents_after, &report->score_after);
+    printf("[ZEALFS] Defragmented %u files (%u pages), fragmentation %u%% -> %u%%\n",
+           report->moved_files, report->moved_pages, report->score_before, report->score_after);
+    zealfs_discard_flush_locked(ctx);
+end:
+    if (err) {
+        /* Reload the metadata from the disk, the cached ones may not have been written */
+        zealfs_destroy_locked(ctx);
+    }
+    free(defrag.files);
+    free(defrag.dirs);
+    free(defrag.buffer);
+    return err;
+}
+
+
+int zealfs_defrag(zealfs_context_t* ctx, zealfs_defrag_report_t* report)
 {
-    /* Remove the header that was previously loaded */
-    memset(ctx->header, 0, sizeof(ctx->header));
+    lock_exclusive(ctx);
+    const int ret = zealfs_defrag_locked(ctx, report);
+    unlock(ctx);
+    return ret;
 }
@@ -0,0 +1,631 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Benchmark of the I/O features on the simulated media profiles. A ZealFS partition is created on
+ * an image file, or on a loop device given as parameter, then each feature is run on it and timed:
+ * the import with direct writes and with the allocation unit writer, the read back, the deletion,
+ * the synchronization, the manifest, the extraction to the host, the analyzer, the check and the
+ * defragmentation.
+ *
+ * Usage: bench.elf [/dev/loopN]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "disk.h"
+#include "disk_sim.h"
+#include "disk_writer.h"
+#include "disk_manifest.h"
+#include "disk_export.h"
+#include "disk_analyzer.h"
+#include "crc32c.h"
+#include "zealfs_v2.h"
+#include "zealfs_sync.h"
+
+#define BENCH_IMAGE         "build/bench.img"
+#define BENCH_HOST_DIR      "build/bench-host"
+#define BENCH_MANIFEST      "build/bench-manifest.txt"
+#define BENCH_EXPORT_DIR    "build/bench-export"
+/* The partition starts on an allocation unit, as the new partitions do */
+#define BENCH_PART_OFFSET   (4*MB)
+#define BENCH_PART_SIZE     (32*MB)
+/* Data imported and synchronized in each run */
+#define BENCH_IMPORT_SIZE   (2*MB)
+#define BENCH_SYNC_SIZE     (1*MB)
+#define BENCH_MAX_FILES     256
+#define BENCH_MAX_ROWS      64
+
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+typedef struct {
+    char     name[NAME_MAX_LEN + 1];
+    uint32_t size;
+    uint32_t seed;
+    uint32_t crc;
+    bool     deleted;
+} bench_file_t;
+
+
+typedef struct {
+    const char*      profile;
+    const char*      step;
+    double           seconds;
+    disk_sim_stats_t stats;
+} bench_row_t;
+
+
+typedef struct {
+    disk_info_t   disk;
+    void*         disk_fd;
+    uint64_t      offset;
+    disk_writer_t writer;
+    bool          use_writer;
+} bench_disk_t;
+
+
+static bench_disk_t s_bench;
+static bench_file_t s_files[BENCH_MAX_FILES];
+static int s_files_count;
+static bench_row_t s_rows[BENCH_MAX_ROWS];
+static int s_rows_count;
+static uint8_t s_buffer[64*KB];
+
+
+/**
+ * @brief Content of the generated files, it only depends on the seed of the file and on the offset.
+ */
+static void bench_fill(uint8_t* data, uint32_t seed, uint32_t offset, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        const uint32_t pos = offset + i;
+        data[i] = (uint8_t) ((pos * 2654435761U + seed) >> 13);
+    }
+}
+
+
+static uint32_t bench_random(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+/**
+ * @brief Disk accesses of the ZealFS context, the disk is accessed by whole sectors.
+ */
+static ssize_t bench_write_sectors(const void* data, uint64_t offset, uint32_t len)
+{
+    if (s_bench.use_writer) {
+        return disk_writer_write(&s_bench.writer, data, offset, len);
+    }
+    return disk_write(s_bench.disk_fd, data, offset, len);
+}
+
+
+static ssize_t bench_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    uint8_t sector[DISK_SECTOR_SIZE];
+    uint8_t* out = (uint8_t*) buffer;
+    uint64_t offset = s_bench.offset + addr;
+    const size_t total = len;
+
+    /* The data to read may still be in the writer */
+    if (disk_writer_flush(&s_bench.writer) != 0) {
+        return -1;
+    }
+    while (len > 0) {
+        const size_t head = offset % DISK_SECTOR_SIZE;
+        if (head == 0 && len >= DISK_SECTOR_SIZE) {
+            const uint32_t aligned = MIN(len, 1*MB) & ~(DISK_SECTOR_SIZE - 1);
+            if (disk_read(s_bench.disk_fd, out, offset, aligned) != aligned) {
+                return -1;
+            }
+            out += aligned;
+            offset += aligned;
+            len -= aligned;
+            continue;
+        }
+        const size_t count = MIN(DISK_SECTOR_SIZE - head, len);
+        if (disk_read(s_bench.disk_fd, sector, offset - head, DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE) {
+            return -1;
+        }
+        memcpy(out, sector + head, count);
+        out += count;
+        offset += count;
+        len -= count;
+    }
+    return total;
+}
+
+
+static ssize_t bench_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+{
+    uint8_t sector[DISK_SECTOR_SIZE];
+    const uint8_t* in = (const uint8_t*) buffer;
+    uint64_t offset = s_bench.offset + addr;
+    const size_t total = len;
+
+    while (len > 0) {
+        const size_t head = offset % DISK_SECTOR_SIZE;
+        if (head == 0 && len >= DISK_SECTOR_SIZE) {
+            const uint32_t aligned = MIN(len, 1*MB) & ~(DISK_SECTOR_SIZE - 1);
+            if (bench_write_sectors(in, offset, aligned) != aligned) {
+                return -1;
+            }
+            in += aligned;
+            offset += aligned;
+            len -= aligned;
+            continue;
+        }
+        /* Partial sector: read it, patch it and write it back */
+        const size_t count = MIN(DISK_SECTOR_SIZE - head, len);
+        if (disk_writer_flush(&s_bench.writer) != 0 ||
+            disk_read(s_bench.disk_fd, sector, offset - head, DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+        {
+            return -1;
+        }
+        memcpy(sector + head, in, count);
+        if (bench_write_sectors(sector, offset - head, DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE) {
+            return -1;
+        }
+        in += count;
+        offset += count;
+        len -= count;
+    }
+    return total;
+}
+
+
+static int bench_discard(void* arg, uint32_t addr, size_t len)
+{
+    /* Don't let data still gathered land in the range after it was discarded */
+    disk_writer_flush(&s_bench.writer);
+    return disk_discard(s_bench.disk_fd, s_bench.offset + addr, len);
+}
+
+
+static zealfs_context_t* s_zealfs;
+
+
+/**
+ * @brief Statistics of the simulated media, including the ones of the descriptor still opened.
+ */
+static void bench_stats(disk_sim_stats_t* stats)
+{
+    disk_sim_stats_t current;
+
+    disk_sim_total_stats(stats);
+    if (s_bench.disk_fd != NULL && disk_sim_stats(s_bench.disk_fd, &current)) {
+        stats->reads += current.reads;
+        stats->writes += current.writes;
+        stats->read_bytes += current.read_bytes;
+        stats->written_bytes += current.written_bytes;
+        stats->au_penalties += current.au_penalties;
+        stats->failures += current.failures;
+        stats->delay_us += current.delay_us;
+    }
+}
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static const char* bench_format(void)
+{
+    const uint32_t page_size = zealfsv2_page_size(BENCH_PART_SIZE);
+    /* Header page and FAT pages, the root directory is in the header page */
+    const uint32_t len = page_size * 3;
+    uint8_t* data = calloc(1, len);
+    if (data == NULL) {
+        return "Out of memory";
+    }
+    zealfsv2_format(data, BENCH_PART_SIZE);
+    const bool error = disk_write(s_bench.disk_fd, data, s_bench.offset, len) != len;
+    free(data);
+    zealfs_destroy(s_zealfs);
+    return error ? "Could not format the partition" : NULL;
+}
+
+
+static const char* bench_import(void)
+{
+    char path[NAME_MAX_LEN + 2];
+    zealfs_fd_t fd;
+
+    for (int i = 0; i < s_files_count; i++) {
+        bench_file_t* file = &s_files[i];
+        snprintf(path, sizeof(path), "/%.*s", NAME_MAX_LEN, file->name);
+        if (zealfs_create(path, s_zealfs, &fd) != 0) {
+            return "Could not create a file";
+        }
+        for (uint32_t offset = 0; offset < file->size; offset += sizeof(s_buffer)) {
+            const uint32_t len = MIN(sizeof(s_buffer), file->size - offset);
+            bench_fill(s_buffer, file->seed, offset, len);
+            if (zealfs_write(s_zealfs, &fd, s_buffer, len, offset) != (int) len) {
+                return "Could not write a file";
+            }
+        }
+        if (zealfs_flush(s_zealfs, &fd) != 0) {
+            return "Could not flush a file";
+        }
+        file->deleted = false;
+    }
+    return disk_writer_flush(&s_bench.writer) ? "Could not flush the writer" : NULL;
+}
+
+
+static const char* bench_import_direct(void)
+{
+    s_bench.use_writer = false;
+    const char* error = bench_import();
+    s_bench.use_writer = true;
+    return error;
+}
+
+
+/**
+ * @brief Read back all the files that were imported and compare their CRC32C, as the import
+ * verification does.
+ */
+static const char* bench_verify(void)
+{
+    char path[NAME_MAX_LEN + 2];
+    zealfs_fd_t fd;
+
+    for (int i = 0; i < s_files_count; i++) {
+        const bench_file_t* file = &s_files[i];
+        uint32_t crc = 0;
+        if (file->deleted) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/%.*s", NAME_MAX_LEN, file->name);
+        if (zealfs_open(path, s_zealfs, &fd) != 0 || fd.entry.size != file->size) {
+            return "Could not open a file";
+        }
+        for (uint32_t offset = 0; offset < file->size; offset += sizeof(s_buffer)) {
+            const uint32_t len = MIN(sizeof(s_buffer), file->size - offset);
+            if (zealfs_read(s_zealfs, &fd, s_buffer, len, offset) != (int) len) {
+                return "Could not read a file";
+            }
+            crc = crc32c(crc, s_buffer, len);
+        }
+        if (crc != file->crc) {
+            return "The data read back differs from the data imported";
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Delete every other file, their pages are discarded and leave holes to fill.
+ */
+static const char* bench_delete(void)
+{
+    char path[NAME_MAX_LEN + 2];
+
+    for (int i = 0; i < s_files_count; i += 2) {
+        snprintf(path, sizeof(path), "/%.*s", NAME_MAX_LEN, s_files[i].name);
+        if (zealfs_unlink(path, s_zealfs) != 0) {
+            return "Could not delete a file";
+        }
+        s_files[i].deleted = true;
+    }
+    zealfs_discard_flush(s_zealfs);
+    return disk_writer_flush(&s_bench.writer) ? "Could not flush the writer" : NULL;
+}
+
+
+static const char* bench_sync(void)
+{
+    zealfs_sync_stats_t stats;
+
+    if (zealfs_mkdir("/sync", s_zealfs, NULL) != 0) {
+        return "Could not create the directory to synchronize";
+    }
+    if (zealfs_sync(s_zealfs, BENCH_HOST_DIR, "/sync", 0, &stats) != 0 || stats.failed != 0) {
+        return "Could not synchronize the host directory";
+    }
+    return disk_writer_flush(&s_bench.writer) ? "Could not flush the writer" : NULL;
+}
+
+
+static const char* bench_manifest(void)
+{
+    return disk_manifest_export(&s_bench.disk, 0, BENCH_MANIFEST);
+}
+
+
+static const char* bench_export(void)
+{
+    disk_export_stats_t stats;
+
+    const char* error = disk_export_dir(&s_bench.disk, &s_bench.disk.partitions[0], "/", BENCH_EXPORT_DIR, &stats);
+    if (error == NULL) {
+        printf("[BENCH] Extracted %d files with %d threads\n", stats.files, stats.threads);
+    }
+    return error;
+}
+
+
+static const char* bench_analyzer(void)
+{
+    static disk_analyzer_t analyzer;
+
+    const char* error = disk_analyzer_start(&analyzer, &s_bench.disk, &s_bench.disk.partitions[0]);
+    if (error != NULL) {
+        return error;
+    }
+    while (analyzer.started && !disk_analyzer_poll(&analyzer)) {
+        usleep(1000);
+    }
+    const bool valid = analyzer.valid;
+    disk_analyzer_stop(&analyzer);
+    return valid ? NULL : "Could not analyze the partition";
+}
+
+
+static const char* bench_fsck(void)
+{
+    zealfs_fsck_report_t report;
+
+    if (zealfs_fsck(s_zealfs, BENCH_PART_SIZE, false, &report) != 0) {
+        return "Could not check the partition";
+    }
+    return report.errors == 0 ? NULL : "The file system check found errors";
+}
+
+
+static const char* bench_defrag(void)
+{
+    zealfs_defrag_report_t report;
+
+    if (zealfs_defrag(s_zealfs, &report) != 0) {
+        return "Could not defragment the partition";
+    }
+    printf("[BENCH] Defragmented %u files, %u pages moved, fragmentation %u%% -> %u%%\n",
+           report.moved_files, report.moved_pages, report.score_before, report.score_after);
+    return disk_writer_flush(&s_bench.writer) ? "Could not flush the writer" : NULL;
+}
+
+
+/**
+ * @brief Run a step and record its duration and the accesses it made to the simulated media.
+ */
+static const char* bench_step(const char* profile, const char* step, const char* (*run)(void))
+{
+    disk_sim_stats_t before;
+    disk_sim_stats_t after;
+
+    printf("[BENCH] %s: %s\n", profile, step);
+    bench_stats(&before);
+    const double start = bench_now();
+    const char* error = run();
+    const double seconds = bench_now() - start;
+    bench_stats(&after);
+    if (error != NULL) {
+        return error;
+    }
+
+    bench_row_t* row = &s_rows[s_rows_count++];
+    row->profile = profile;
+    row->step = step;
+    row->seconds = seconds;
+    row->stats.reads = after.reads - before.reads;
+    row->stats.writes = after.writes - before.writes;
+    row->stats.read_bytes = after.read_bytes - before.read_bytes;
+    row->stats.written_bytes = after.written_bytes - before.written_bytes;
+    row->stats.au_penalties = after.au_penalties - before.au_penalties;
+    row->stats.delay_us = after.delay_us - before.delay_us;
+    return NULL;
+}
+
+
+static const char* bench_profile(const char* profile)
+{
+    static const struct {
+        const char* name;
+        const char* (*run)(void);
+    } steps[] = {
+        { "format",         bench_format        },
+        { "import direct",  bench_import_direct },
+        { "format",         bench_format        },
+        { "import AU",      bench_import        },
+        { "verify",         bench_verify        },
+        { "delete",         bench_delete        },
+        { "sync",           bench_sync          },
+        { "manifest",       bench_manifest      },
+        { "export",         bench_export        },
+        { "analyzer",       bench_analyzer      },
+        { "fsck",           bench_fsck          },
+        { "defrag",         bench_defrag        },
+        { "verify",         bench_verify        },
+    };
+    const char* error = disk_sim_configure(strcmp(profile, "none") == 0 ? NULL : profile);
+    if (error != NULL) {
+        return error;
+    }
+    if (disk_open(&s_bench.disk, &s_bench.disk_fd)) {
+        return "Could not open the disk";
+    }
+    /* The simulated media reports its allocation unit, else same one as `disk_au_size` gives */
+    const disk_sim_profile_t* media = disk_sim_profile();
+    uint32_t au_size = s_bench.disk.au_size ? s_bench.disk.au_size : DISK_DEFAULT_AU_SIZE;
+    if (media != NULL && media->au_size != 0) {
+        au_size = media->au_size;
+    }
+    if (disk_writer_init(&s_bench.writer, s_bench.disk_fd, au_size) != 0) {
+        disk_close(s_bench.disk_fd);
+        return "Could not allocate the writer";
+    }
+    s_bench.use_writer = true;
+
+    for (size_t i = 0; error == NULL && i < DIM(steps); i++) {
+        error = bench_step(profile, steps[i].name, steps[i].run);
+    }
+
+    disk_writer_free(&s_bench.writer);
+    disk_close(s_bench.disk_fd);
+    s_bench.disk_fd = NULL;
+    return error;
+}
+
+
+/**
+ * @brief Generate the description of a file, from a few bytes to 256KB, most files are small.
+ */
+static void bench_new_file(bench_file_t* file, int index, uint32_t* random)
+{
+    const uint32_t shift = 8 + bench_random(random) % 11;
+    file->size = bench_random(random) % (1U << shift) + 1;
+    file->seed = bench_random(random);
+    file->crc = 0;
+    file->deleted = false;
+    snprintf(file->name, sizeof(file->name), "file%03d.bin", index);
+    for (uint32_t offset = 0; offset < file->size; offset += sizeof(s_buffer)) {
+        const uint32_t len = MIN(sizeof(s_buffer), file->size - offset);
+        bench_fill(s_buffer, file->seed, offset, len);
+        file->crc = crc32c(file->crc, s_buffer, len);
+    }
+}
+
+
+/**
+ * @brief Generate the files to import, and the host directory to synchronize.
+ */
+static const char* bench_generate(void)
+{
+    char path[512];
+    uint32_t random = 0x2545f491;
+    uint64_t total = 0;
+
+    while (total < BENCH_IMPORT_SIZE && s_files_count < BENCH_MAX_FILES) {
+        bench_new_file(&s_files[s_files_count], s_files_count, &random);
+        total += s_files[s_files_count++].size;
+    }
+
+    mkdir(BENCH_HOST_DIR, 0755);
+    for (int i = 0; total < BENCH_IMPORT_SIZE + BENCH_SYNC_SIZE; i++) {
+        bench_file_t file;
+        bench_new_file(&file, s_files_count + i, &random);
+        snprintf(path, sizeof(path), "%s/%s", BENCH_HOST_DIR, file.name);
+        FILE* host = fopen(path, "wb");
+        if (host == NULL) {
+            return "Could not create the host directory";
+        }
+        for (uint32_t offset = 0; offset < file.size; offset += sizeof(s_buffer)) {
+            const uint32_t len = MIN(sizeof(s_buffer), file.size - offset);
+            bench_fill(s_buffer, file.seed, offset, len);
+            fwrite(s_buffer, 1, len, host);
+        }
+        fclose(host);
+        total += file.size;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Prepare the disk: a sparse image file, or the loop device given by the user.
+ */
+static const char* bench_disk(const char* loop)
+{
+    disk_info_t* disk = &s_bench.disk;
+    static disk_info_t disks[MAX_DISKS];
+    int count = 0;
+
+    if (loop == NULL) {
+        FILE* file = fopen(BENCH_IMAGE, "wb");
+        if (file == NULL || disk_set_image_size(file, BENCH_PART_OFFSET + BENCH_PART_SIZE, true) != 0) {
+            if (file) {
+                fclose(file);
+            }
+            return "Could not create the image";
+        }
+        fclose(file);
+        snprintf(disk->path, sizeof(disk->path), "%s", BENCH_IMAGE);
+        snprintf(disk->name, sizeof(disk->name), "%s", BENCH_IMAGE);
+        disk->size_bytes = BENCH_PART_OFFSET + BENCH_PART_SIZE;
+        disk->valid = true;
+        disk->is_image = true;
+    } else {
+        /* Only loop devices are accepted, the benchmark overwrites the content of the disk */
+        if (strncmp(loop, "/dev/loop", 9) != 0) {
+            return "Only loop devices can be used, for example /dev/loop0";
+        }
+        disk_list(disks, MAX_DISKS, &count);
+        for (int i = 0; i < count && disk->path[0] == 0; i++) {
+            if (strcmp(disks[i].path, loop) == 0) {
+                *disk = disks[i];
+            }
+        }
+        if (disk->path[0] == 0 || !disk->valid) {
+            return "The loop device was not found, attach it first with losetup";
+        }
+        if (disk->size_bytes < BENCH_PART_OFFSET + BENCH_PART_SIZE) {
+            return "The loop device is too small, it must be at least 36MB big";
+        }
+    }
+
+    disk->partitions[0] = (partition_t) {
+        .active       = true,
+        .type         = ZEALFS_TYPE,
+        .start_lba    = BENCH_PART_OFFSET / DISK_SECTOR_SIZE,
+        .size_sectors = BENCH_PART_SIZE / DISK_SECTOR_SIZE,
+    };
+    s_bench.offset = BENCH_PART_OFFSET;
+    return NULL;
+}
+
+
+int main(int argc, char* argv[])
+{
+    /* Allocation units smaller than the data imported, so that the writes cross them */
+    const char* profiles[] = { "none", "good-card,au=512", "usb-reader,au=512" };
+    const char* error = bench_disk(argc > 1 ? argv[1] : NULL);
+
+    s_zealfs = zealfs_context_create(bench_read, bench_write, NULL);
+    if (s_zealfs == NULL) {
+        return 1;
+    }
+    s_zealfs->discard = bench_discard;
+
+    if (error == NULL) {
+        error = bench_generate();
+    }
+    for (size_t i = 0; error == NULL && i < DIM(profiles); i++) {
+        error = bench_profile(profiles[i]);
+    }
+    zealfs_context_destroy(s_zealfs);
+    if (error != NULL) {
+        printf("[BENCH] %s\n", error);
+        return 1;
+    }
+
+    printf("\n[BENCH] %s, %d files imported\n", s_bench.disk.path, s_files_count);
+    printf("%-18s %-14s %8s %9s %8s %8s %10s %10s %6s\n", "profile", "step", "time (s)", "media (s)",
+           "reads", "writes", "read (KB)", "write (KB)", "AU");
+    for (int i = 0; i < s_rows_count; i++) {
+        const bench_row_t* row = &s_rows[i];
+        printf("%-18s %-14s %8.2f %9.2f %8llu %8llu %10llu %10llu %6llu\n", row->profile, row->step, row->seconds,
+               row->stats.delay_us / 1e6, (unsigned long long) row->stats.reads,
+               (unsigned long long) row->stats.writes, (unsigned long long) (row->stats.read_bytes / KB),
+               (unsigned long long) (row->stats.written_bytes / KB), (unsigned long long) row->stats.au_penalties);
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+/* Number of checks that failed in the test program */
+static int s_test_failures;
+
+/**
+ * @brief Check a condition, print the message and count a failure if it doesn't hold.
+ */
+#define TEST_CHECK(cond, ...)   do { \
+        if (!(cond)) { \
+            printf("[TEST] %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            s_test_failures++; \
+        } \
+    } while (0)
+
+/**
+ * @brief Print the result of the test program, to be returned by `main`.
+ */
+#define TEST_RESULT(name)   (printf("[TEST] %s: %s\n", (name), s_test_failures ? "FAILED" : "passed"), \
+                             s_test_failures != 0)
+
+#endif // TEST_H
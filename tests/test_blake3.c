@@ -0,0 +1,81 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Check the BLAKE3 implementation against the official test vectors: the input is the sequence
+ * 0, 1, ..., 250, 0, 1, ... of the given length. The data is hashed at once, then fed in pieces of
+ * odd sizes, so that chunk and block boundaries fall in the middle of the updates.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "blake3.h"
+#include "test.h"
+
+typedef struct {
+    size_t      len;
+    const char* hash;
+} blake3_vector_t;
+
+static const blake3_vector_t s_vectors[] = {
+    {     0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+    {     1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+    {    63, "e9bc37a594daad83be9470df7f7b3798297c3d834ce80ba85d6e207627b7db7b" },
+    {    64, "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98" },
+    {    65, "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee" },
+    {  1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+    {  1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+    {  1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+    {  2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+    {  3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+    {  4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+    { 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+};
+
+
+static void hash_to_hex(const uint8_t hash[BLAKE3_OUT_LEN], char hex[BLAKE3_OUT_LEN * 2 + 1])
+{
+    for (int i = 0; i < BLAKE3_OUT_LEN; i++) {
+        snprintf(hex + i * 2, 3, "%02x", hash[i]);
+    }
+}
+
+
+int main(void)
+{
+    static uint8_t input[32*1024];
+    uint8_t hash[BLAKE3_OUT_LEN];
+    char hex[BLAKE3_OUT_LEN * 2 + 1];
+    blake3_hasher_t hasher;
+
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = i % 251;
+    }
+
+    for (size_t i = 0; i < sizeof(s_vectors) / sizeof(s_vectors[0]); i++) {
+        const blake3_vector_t* vector = &s_vectors[i];
+
+        blake3_hasher_init(&hasher);
+        blake3_hasher_update(&hasher, input, vector->len);
+        blake3_hasher_finalize(&hasher, hash);
+        hash_to_hex(hash, hex);
+        TEST_CHECK(strcmp(hex, vector->hash) == 0, "%zu bytes at once: %s", vector->len, hex);
+
+        blake3_hasher_init(&hasher);
+        for (size_t offset = 0; offset < vector->len; ) {
+            size_t piece = (offset * 7 + 13) % 4099 + 1;
+            if (piece > vector->len - offset) {
+                piece = vector->len - offset;
+            }
+            blake3_hasher_update(&hasher, input + offset, piece);
+            offset += piece;
+        }
+        blake3_hasher_finalize(&hasher, hash);
+        hash_to_hex(hash, hex);
+        TEST_CHECK(strcmp(hex, vector->hash) == 0, "%zu bytes in pieces: %s", vector->len, hex);
+    }
+
+    return TEST_RESULT("blake3");
+}
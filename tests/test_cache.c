@@ -0,0 +1,205 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Check the metadata cache of the images: a saved cache must serve the directories without reading
+ * them from the image, follow the changes made to the partition, and be ignored as soon as the image
+ * or the cache file doesn't match anymore.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "zealfs_v2.h"
+#include "zealfs_cache.h"
+#include "test.h"
+
+#define IMAGE_PATH      "build/test_cache.img"
+#define CACHE_PATH      IMAGE_PATH "-0.zdtcache"
+#define IMAGE_SIZE      (1*MB)
+#define ROOT_FILES      40
+#define DIR_FILES       20
+
+static int s_image_fd;
+static int s_dir_reads;
+static zealfs_cache_t s_cache;
+
+
+static ssize_t image_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    return pread(s_image_fd, buffer, len, addr);
+}
+
+
+static ssize_t image_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+{
+    zealfs_cache_update(&s_cache, buffer, addr, len);
+    return pwrite(s_image_fd, buffer, len, addr);
+}
+
+
+static ssize_t image_read_dir(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    if (zealfs_cache_read(&s_cache, buffer, addr, len)) {
+        return len;
+    }
+    s_dir_reads++;
+    const ssize_t ret = image_read(arg, buffer, addr, len);
+    if (ret == (ssize_t) len) {
+        zealfs_cache_add(&s_cache, buffer, addr, len);
+    }
+    return ret;
+}
+
+
+static zealfs_context_t* ctx;
+
+
+static int count_entries(const char* path)
+{
+    zealfs_entry_t entries[64];
+    zealfs_fd_t fd;
+
+    if (zealfs_opendir(path, ctx, &fd) != 0) {
+        return -1;
+    }
+    return zealfs_readdir(ctx, &fd, entries, 64);
+}
+
+
+static void create_file(const char* path)
+{
+    zealfs_fd_t fd;
+    TEST_CHECK(zealfs_create(path, ctx, &fd) == 0 && zealfs_flush(ctx, &fd) == 0, "create %s", path);
+}
+
+
+/**
+ * @brief Open the image with its cache, as the partition viewer does.
+ *
+ * @return true if the cache was loaded.
+ */
+static bool session_open(void)
+{
+    zealfs_destroy(ctx);
+    s_dir_reads = 0;
+    s_image_fd = open(IMAGE_PATH, O_RDWR);
+    TEST_CHECK(s_image_fd >= 0, "open " IMAGE_PATH);
+    return zealfs_cache_open(&s_cache, ctx, IMAGE_PATH, 0);
+}
+
+
+static void session_close(void)
+{
+    zealfs_cache_close(&s_cache, ctx);
+    close(s_image_fd);
+}
+
+
+/**
+ * @brief Give the image back the modification time it had, as if it was never touched.
+ */
+static void restore_mtime(const struct stat* st)
+{
+    struct utimbuf times = { .actime = st->st_atime, .modtime = st->st_mtime };
+    utime(IMAGE_PATH, &times);
+}
+
+
+int main(void)
+{
+    char path[32];
+    struct stat st;
+    bool hit;
+
+    ctx = zealfs_context_create(image_read, image_write, NULL);
+    TEST_CHECK(ctx != NULL, "create the context");
+    ctx->read_dir = image_read_dir;
+
+    uint8_t* image = calloc(1, IMAGE_SIZE);
+    zealfsv2_format(image, IMAGE_SIZE);
+    FILE* file = fopen(IMAGE_PATH, "wb");
+    TEST_CHECK(file != NULL && fwrite(image, 1, IMAGE_SIZE, file) == IMAGE_SIZE, "write " IMAGE_PATH);
+    fclose(file);
+    free(image);
+    remove(CACHE_PATH);
+
+    zealfs_cache_set_enabled(true);
+    session_open();
+    for (int i = 0; i < ROOT_FILES; i++) {
+        snprintf(path, sizeof(path), "/file%d", i);
+        create_file(path);
+    }
+    TEST_CHECK(zealfs_mkdir("/dir", ctx, NULL) == 0, "mkdir /dir");
+    for (int i = 0; i < DIR_FILES; i++) {
+        snprintf(path, sizeof(path), "/dir/file%d", i);
+        create_file(path);
+    }
+    session_close();
+
+    /* The cache saved by the former session serves all the directories */
+    hit = session_open();
+    TEST_CHECK(hit, "warm: cache not loaded");
+    TEST_CHECK(count_entries("/") == ROOT_FILES + 1 && count_entries("/dir") == DIR_FILES, "warm: wrong entries");
+    TEST_CHECK(s_dir_reads == 0, "warm: %d directory reads from the image", s_dir_reads);
+
+    /* Entries written are updated in the cache, it stays valid for the next session */
+    create_file("/dir/new");
+    TEST_CHECK(count_entries("/dir") == DIR_FILES + 1, "write: new entry not listed");
+    session_close();
+    hit = session_open();
+    TEST_CHECK(hit, "after write: cache not loaded");
+    TEST_CHECK(count_entries("/dir") == DIR_FILES + 1, "after write: new entry not in the cache");
+    TEST_CHECK(s_dir_reads == 0, "after write: %d directory reads from the image", s_dir_reads);
+    session_close();
+
+    /* A corrupted cache is ignored, the metadata are read from the image */
+    TEST_CHECK(stat(CACHE_PATH, &st) == 0, "stat " CACHE_PATH);
+    int fd = open(CACHE_PATH, O_RDWR);
+    uint8_t byte;
+    TEST_CHECK(pread(fd, &byte, 1, st.st_size - 1) == 1, "read " CACHE_PATH);
+    byte ^= 0xff;
+    TEST_CHECK(pwrite(fd, &byte, 1, st.st_size - 1) == 1, "write " CACHE_PATH);
+    close(fd);
+    hit = session_open();
+    TEST_CHECK(!hit, "corrupted: cache loaded");
+    TEST_CHECK(count_entries("/") == ROOT_FILES + 1 && count_entries("/dir") == DIR_FILES + 1,
+               "corrupted: wrong entries");
+    TEST_CHECK(s_dir_reads > 0, "corrupted: directories not read from the image");
+    session_close();
+
+    /* The image changed on disk, without the cache being updated */
+    TEST_CHECK(stat(IMAGE_PATH, &st) == 0, "stat " IMAGE_PATH);
+    s_image_fd = open(IMAGE_PATH, O_RDWR);
+    zealfs_destroy(ctx);
+    create_file("/outside");
+    close(s_image_fd);
+    restore_mtime(&st);
+    TEST_CHECK(!session_open(), "header changed: cache loaded");
+    TEST_CHECK(count_entries("/") == ROOT_FILES + 2, "header changed: wrong entries");
+    session_close();
+
+    TEST_CHECK(stat(IMAGE_PATH, &st) == 0, "stat " IMAGE_PATH);
+    st.st_mtime -= 10;
+    restore_mtime(&st);
+    TEST_CHECK(!session_open(), "date changed: cache loaded");
+    session_close();
+
+    /* Nothing is cached when the cache is disabled */
+    zealfs_cache_set_enabled(false);
+    TEST_CHECK(!session_open(), "disabled: cache loaded");
+    TEST_CHECK(count_entries("/") == ROOT_FILES + 2, "disabled: wrong entries");
+    session_close();
+
+    zealfs_context_destroy(ctx);
+    remove(CACHE_PATH);
+    remove(IMAGE_PATH);
+    return TEST_RESULT("cache");
+}
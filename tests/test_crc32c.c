@@ -0,0 +1,59 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Check the CRC32C implementation against the reference vectors of RFC 3720, and check that
+ * a checksum computed in several steps, from any alignment, matches the one-step checksum.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "crc32c.h"
+#include "test.h"
+
+
+int main(void)
+{
+    uint8_t buffer[32];
+
+    TEST_CHECK(crc32c(0, "123456789", 9) == 0xe3069283, "check value");
+    TEST_CHECK(crc32c(0, "", 0) == 0, "empty data");
+
+    /* RFC 3720, B.4 */
+    memset(buffer, 0, sizeof(buffer));
+    TEST_CHECK(crc32c(0, buffer, sizeof(buffer)) == 0x8a9136aa, "32 bytes of zeros");
+    memset(buffer, 0xff, sizeof(buffer));
+    TEST_CHECK(crc32c(0, buffer, sizeof(buffer)) == 0x62a8ab43, "32 bytes of ones");
+    for (int i = 0; i < 32; i++) {
+        buffer[i] = i;
+    }
+    TEST_CHECK(crc32c(0, buffer, sizeof(buffer)) == 0x46dd794e, "32 incrementing bytes");
+    for (int i = 0; i < 32; i++) {
+        buffer[i] = 31 - i;
+    }
+    TEST_CHECK(crc32c(0, buffer, sizeof(buffer)) == 0x113fdb5c, "32 decrementing bytes");
+
+    /* The accelerated paths process 8 bytes at a time, check every alignment and split */
+    static uint8_t data[4096 + 8];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t) (i * 31 + 7);
+    }
+    for (int align = 0; align < 8; align++) {
+        const uint8_t* start = data + align;
+        const size_t len = 4096 - align;
+        const uint32_t expected = crc32c(0, start, len);
+        for (size_t split = 0; split <= len; split += 509) {
+            const uint32_t crc = crc32c(crc32c(0, start, split), start + split, len - split);
+            TEST_CHECK(crc == expected, "alignment %d, split at %zu: %08x != %08x", align, split, crc, expected);
+        }
+    }
+    /* The same data at another alignment gives the same checksum */
+    memmove(data + 3, data, 1024);
+    const uint32_t moved = crc32c(0, data + 3, 1024);
+    memmove(data, data + 3, 1024);
+    TEST_CHECK(crc32c(0, data, 1024) == moved, "checksum depends on the alignment");
+
+    return TEST_RESULT("crc32c");
+}
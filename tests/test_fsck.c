@@ -0,0 +1,209 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Check the file system check on images damaged on purpose. Each kind of damage is applied to
+ * a copy of a clean image, the check must report it, then the repair must leave a partition that
+ * checks clean and whose intact files are unchanged.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs_v2.h"
+#include "test.h"
+
+#define IMAGE_SIZE      (1*MB)
+
+static uint8_t s_clean[IMAGE_SIZE];
+static uint8_t s_image[IMAGE_SIZE];
+
+
+static ssize_t image_read(void* arg, void* buffer, uint32_t addr, size_t len)
+{
+    memcpy(buffer, s_image + addr, len);
+    return len;
+}
+
+
+static ssize_t image_write(void* arg, const void* buffer, uint32_t addr, size_t len)
+{
+    memcpy(s_image + addr, buffer, len);
+    return len;
+}
+
+
+static zealfs_context_t* ctx;
+
+
+static uint8_t file_byte(int file, size_t offset)
+{
+    return (uint8_t) (offset * 3 + file * 101);
+}
+
+
+static void create_file(const char* path, int file, size_t size)
+{
+    uint8_t* data = malloc(size);
+    zealfs_fd_t fd;
+
+    for (size_t i = 0; i < size; i++) {
+        data[i] = file_byte(file, i);
+    }
+    TEST_CHECK(zealfs_create(path, ctx, &fd) == 0, "create %s", path);
+    TEST_CHECK(zealfs_write(ctx, &fd, data, size, 0) == (int) size, "write %s", path);
+    TEST_CHECK(zealfs_flush(ctx, &fd) == 0, "flush %s", path);
+    free(data);
+}
+
+
+static bool file_intact(const char* path, int file, size_t size)
+{
+    uint8_t* data = malloc(size);
+    zealfs_fd_t fd;
+    bool intact = zealfs_open(path, ctx, &fd) == 0 && fd.entry.size == size &&
+                  zealfs_read(ctx, &fd, data, size, 0) == (int) size;
+
+    for (size_t i = 0; intact && i < size; i++) {
+        intact = data[i] == file_byte(file, i);
+    }
+    free(data);
+    return intact;
+}
+
+
+static zealfs_header_t* image_header(void)
+{
+    return (zealfs_header_t*) s_image;
+}
+
+
+static uint16_t* image_fat(void)
+{
+    return (uint16_t*) (s_image + (256 << image_header()->page_size));
+}
+
+
+static zealfs_fd_t open_file(const char* path)
+{
+    zealfs_fd_t fd = { 0 };
+    TEST_CHECK(zealfs_open(path, ctx, &fd) == 0, "open %s", path);
+    return fd;
+}
+
+
+/**
+ * @brief Restore the clean image and give the first page of a file and the page that follows it.
+ */
+static void restore_image(const char* path, uint16_t* first, uint16_t* second)
+{
+    memcpy(s_image, s_clean, IMAGE_SIZE);
+    zealfs_destroy(ctx);
+    const zealfs_fd_t fd = open_file(path);
+    *first = fd.entry.start_page;
+    *second = image_fat()[*first];
+}
+
+
+/**
+ * @brief Check the damaged image, repair it and check it again.
+ */
+static zealfs_fsck_report_t check_and_repair(const char* damage)
+{
+    zealfs_fsck_report_t report;
+    zealfs_fsck_report_t after;
+
+    zealfs_destroy(ctx);
+    TEST_CHECK(zealfs_fsck(ctx, IMAGE_SIZE, false, &report) == 0, "%s: check failed", damage);
+    TEST_CHECK(report.errors > 0, "%s: not detected", damage);
+    TEST_CHECK(zealfs_fsck(ctx, IMAGE_SIZE, true, &after) == 0, "%s: repair failed", damage);
+    TEST_CHECK(zealfs_fsck(ctx, IMAGE_SIZE, false, &after) == 0 && after.errors == 0,
+               "%s: %u errors left after the repair", damage, after.errors);
+    /* The file that was not damaged must not be affected by the repair */
+    TEST_CHECK(file_intact("/dir/c.bin", 2, 700), "%s: intact file changed", damage);
+    return report;
+}
+
+
+int main(void)
+{
+    zealfs_fsck_report_t report;
+    zealfs_fd_t fd;
+    uint16_t first;
+    uint16_t second;
+
+    ctx = zealfs_context_create(image_read, image_write, NULL);
+    TEST_CHECK(ctx != NULL, "create the context");
+    /* 1KB pages: a.bin takes 3 pages, b.bin 2 pages and c.bin a single one */
+    zealfsv2_format(s_image, IMAGE_SIZE);
+    create_file("/a.bin", 0, 3000);
+    create_file("/b.bin", 1, 2000);
+    TEST_CHECK(zealfs_mkdir("/dir", ctx, &fd) == 0, "mkdir /dir");
+    create_file("/dir/c.bin", 2, 700);
+    memcpy(s_clean, s_image, IMAGE_SIZE);
+
+    TEST_CHECK(zealfs_fsck(ctx, IMAGE_SIZE, false, &report) == 0, "clean image: check failed");
+    TEST_CHECK(report.errors == 0 && report.files == 3 && report.directories == 1,
+               "clean image: %u errors, %u files, %u directories", report.errors, report.files, report.directories);
+
+    /* A page marked as used that no entry owns */
+    restore_image("/a.bin", &first, &second);
+    const uint16_t free_page = image_header()->bitmap_size * 8 - 1;
+    image_header()->pages_bitmap[free_page / 8] |= 1 << (free_page % 8);
+    image_header()->free_pages--;
+    report = check_and_repair("lost page");
+    TEST_CHECK(report.lost_pages == 1, "lost page: %u lost pages", report.lost_pages);
+    TEST_CHECK(file_intact("/a.bin", 0, 3000) && file_intact("/b.bin", 1, 2000), "lost page: files changed");
+
+    /* A page owned by a file but marked as free */
+    restore_image("/b.bin", &first, &second);
+    image_header()->pages_bitmap[second / 8] &= ~(1 << (second % 8));
+    image_header()->free_pages++;
+    report = check_and_repair("unmarked page");
+    TEST_CHECK(report.unmarked_pages == 1, "unmarked page: %u unmarked pages", report.unmarked_pages);
+    TEST_CHECK(file_intact("/b.bin", 1, 2000), "unmarked page: file changed");
+
+    /* The second page of a.bin leads to the first page of b.bin */
+    restore_image("/b.bin", &first, &second);
+    const uint16_t b_first = first;
+    restore_image("/a.bin", &first, &second);
+    image_fat()[second] = b_first;
+    report = check_and_repair("cross-link");
+    TEST_CHECK(report.cross_links >= 1, "cross-link: %u cross-links", report.cross_links);
+
+    /* The second page of a.bin leads back to its first page */
+    restore_image("/a.bin", &first, &second);
+    image_fat()[second] = first;
+    report = check_and_repair("cycle");
+    TEST_CHECK(report.cycles == 1, "cycle: %u cycles", report.cycles);
+
+    /* A chain going past the end of the partition */
+    restore_image("/a.bin", &first, &second);
+    image_fat()[second] = 0xfff0;
+    report = check_and_repair("bad pointer");
+    TEST_CHECK(report.bad_pointers == 1, "bad pointer: %u bad pointers", report.bad_pointers);
+
+    /* A file bigger than its chain */
+    restore_image("/b.bin", &first, &second);
+    fd = open_file("/b.bin");
+    zealfs_entry_t* entry = (zealfs_entry_t*) (s_image + fd.entry_addr);
+    entry->size = 5000;
+    report = check_and_repair("size");
+    TEST_CHECK(report.size_errors == 1, "size: %u size errors", report.size_errors);
+    /* The repair keeps all the pages of the chain */
+    fd = open_file("/b.bin");
+    TEST_CHECK(fd.entry.size == 2048, "size: file not truncated to its chain, %u bytes", fd.entry.size);
+    uint8_t data[2000];
+    TEST_CHECK(zealfs_read(ctx, &fd, data, sizeof(data), 0) == sizeof(data), "size: read failed");
+    for (size_t i = 0; i < sizeof(data); i++) {
+        if (data[i] != file_byte(1, i)) {
+            TEST_CHECK(false, "size: data changed at offset %zu", i);
+            break;
+        }
+    }
+
+    zealfs_context_destroy(ctx);
+    return TEST_RESULT("fsck");
+}
@@ -0,0 +1,227 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Stress test of the ZealFS context locking: several threads read fixed files and list the root
+ * directory while others create, write and remove files, all through the same session. The content
+ * read is checked and the partition is checked with fsck once all the threads are done.
+ *
+ * Usage: zealfs_stress.elf [image_path]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "disk.h"
+#include "zealfs_session.h"
+
+#define STRESS_IMAGE_SIZE       (8*MB)
+#define STRESS_FIXED_FILES      8
+#define STRESS_FIXED_SIZE       20000
+#define STRESS_READERS          4
+#define STRESS_WRITERS          2
+#define STRESS_WRITER_LOOPS     150
+#define STRESS_WRITER_FILES     5
+
+/* Settings of the disk module, which needs the UI: the image is never trimmed, writes use the default AU */
+bool disk_trim_enabled(void)
+{
+    return false;
+}
+
+uint32_t disk_au_size(const disk_info_t* disk)
+{
+    return DISK_DEFAULT_AU_SIZE;
+}
+
+static zealfs_context_t* s_ctx;
+static atomic_bool s_stop;
+static atomic_int s_errors;
+
+
+static uint8_t fixed_byte(int file, size_t offset)
+{
+    return (uint8_t) (offset * 7 + file * 13);
+}
+
+
+static void stress_error(const char* what, const char* path)
+{
+    printf("[STRESS] %s failed: %s\n", what, path);
+    atomic_fetch_add(&s_errors, 1);
+}
+
+
+static void* reader_thread(void* arg)
+{
+    const long id = (long) arg;
+    uint8_t* buffer = malloc(STRESS_FIXED_SIZE * STRESS_FIXED_FILES);
+    zealfs_entry_t entries[64];
+    zealfs_fd_t fd;
+    char path[32];
+    long loops = 0;
+
+    while (!atomic_load(&s_stop)) {
+        for (int i = 0; i < STRESS_FIXED_FILES; i++) {
+            snprintf(path, sizeof(path), "/fixed%d", i);
+            if (zealfs_open(path, s_ctx, &fd) != 0) {
+                stress_error("open", path);
+                continue;
+            }
+            const size_t size = fd.entry.size;
+            if (zealfs_read(s_ctx, &fd, buffer, size, 0) != (int) size) {
+                stress_error("read", path);
+                continue;
+            }
+            for (size_t j = 0; j < size; j++) {
+                if (buffer[j] != fixed_byte(i, j)) {
+                    stress_error("content", path);
+                    break;
+                }
+            }
+            if (zealfs_opendir("/", s_ctx, &fd) != 0 ||
+                zealfs_readdir(s_ctx, &fd, entries, 64) < STRESS_FIXED_FILES) {
+                stress_error("readdir", "/");
+            }
+            zealfs_free_space(s_ctx);
+            loops++;
+        }
+    }
+
+    printf("[STRESS] Reader %ld: %ld files read\n", id, loops);
+    free(buffer);
+    return NULL;
+}
+
+
+static void* writer_thread(void* arg)
+{
+    const long id = (long) arg;
+    const size_t max_size = 1000 * 100;
+    uint8_t* buffer = malloc(max_size);
+    zealfs_fd_t fd;
+    char path[32];
+
+    memset(buffer, (int) id, max_size);
+    for (int i = 0; i < STRESS_WRITER_LOOPS; i++) {
+        snprintf(path, sizeof(path), "/w%ld_%d", id, i % STRESS_WRITER_FILES);
+        zealfs_unlink(path, s_ctx);
+        if (zealfs_create(path, s_ctx, &fd) != 0) {
+            stress_error("create", path);
+            continue;
+        }
+        if (zealfs_write(s_ctx, &fd, buffer, 1000 * (i % 100 + 1), 0) < 0) {
+            stress_error("write", path);
+        }
+        zealfs_flush(s_ctx, &fd);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+
+static int create_image(disk_info_t* disk, const char* path)
+{
+    uint8_t* image = calloc(1, STRESS_IMAGE_SIZE);
+    if (image == NULL || zealfsv2_format(image, STRESS_IMAGE_SIZE) != 0) {
+        free(image);
+        return -1;
+    }
+
+    FILE* file = fopen(path, "wb");
+    const bool written = file != NULL && fwrite(image, 1, STRESS_IMAGE_SIZE, file) == STRESS_IMAGE_SIZE;
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(image);
+
+    snprintf(disk->path, sizeof(disk->path), "%s", path);
+    disk->valid = true;
+    disk->is_image = true;
+    disk->size_bytes = STRESS_IMAGE_SIZE;
+    return written ? 0 : -1;
+}
+
+
+static int create_fixed_files(void)
+{
+    uint8_t* buffer = malloc(STRESS_FIXED_SIZE * STRESS_FIXED_FILES);
+    zealfs_fd_t fd;
+    char path[32];
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < STRESS_FIXED_FILES; i++) {
+        const size_t size = STRESS_FIXED_SIZE * (i + 1);
+        for (size_t j = 0; j < size; j++) {
+            buffer[j] = fixed_byte(i, j);
+        }
+        snprintf(path, sizeof(path), "/fixed%d", i);
+        if (zealfs_create(path, s_ctx, &fd) != 0 || zealfs_write(s_ctx, &fd, buffer, size, 0) != (int) size) {
+            ret = -1;
+        }
+        zealfs_flush(s_ctx, &fd);
+    }
+
+    free(buffer);
+    return ret;
+}
+
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "zealfs_stress.img";
+    static disk_info_t disk;
+    partition_t part = {
+        .active       = true,
+        .start_lba    = 0,
+        .size_sectors = STRESS_IMAGE_SIZE / DISK_SECTOR_SIZE,
+    };
+    pthread_t readers[STRESS_READERS];
+    pthread_t writers[STRESS_WRITERS];
+    const char* error = NULL;
+
+    if (create_image(&disk, path) != 0) {
+        printf("[STRESS] Could not create image %s\n", path);
+        return 1;
+    }
+    zealfs_session_t* session = zealfs_session_get(&disk, &part, &error);
+    if (session == NULL) {
+        printf("[STRESS] Could not open the session: %s\n", error ? error : "unknown error");
+        return 1;
+    }
+    s_ctx = session->ctx;
+    if (create_fixed_files() != 0) {
+        printf("[STRESS] Could not create the fixed files\n");
+        return 1;
+    }
+
+    /* Drop the header so that the readers race to load it again */
+    zealfs_destroy(s_ctx);
+    for (long i = 0; i < STRESS_READERS; i++) {
+        pthread_create(&readers[i], NULL, reader_thread, (void*) i);
+    }
+    for (long i = 0; i < STRESS_WRITERS; i++) {
+        pthread_create(&writers[i], NULL, writer_thread, (void*) i);
+    }
+    for (int i = 0; i < STRESS_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    atomic_store(&s_stop, true);
+    for (int i = 0; i < STRESS_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    zealfs_session_flush(session);
+    zealfs_fsck_report_t report = { 0 };
+    const int fsck = zealfs_fsck(s_ctx, STRESS_IMAGE_SIZE, false, &report);
+    const int errors = atomic_load(&s_errors);
+    printf("[STRESS] %d errors, fsck returned %d with %u problems\n", errors, fsck, report.errors);
+    zealfs_session_close_all();
+
+    return (errors == 0 && fsck == 0 && report.errors == 0) ? 0 : 1;
+}